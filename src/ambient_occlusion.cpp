@@ -0,0 +1,197 @@
+#include "ambient_occlusion.h"
+
+void GTR::SSAO_Component::init() {
+	// Create random samples
+	srand(time(NULL));
+
+	float rand_max_f = (float)RAND_MAX;
+	for (uint32_t i = 0; i < AO_SAMPLE_SIZE; i++) {
+		float x = ((float)rand()) / rand_max_f, z = ((float)rand()) / rand_max_f;
+		x *= 2.0f, z *= 2.0f;
+		x -= 1.0f, z -= 1.0f;
+		//float y = sqrt((1.0f - (x * x) - (z * z)));
+		float y = ((float)rand()) / rand_max_f;
+
+		vec3 point = vec3(x, y, z);
+		float scale = (float)i / 64.0;
+		scale = lerp(0.1f, 1.0f, scale * scale);
+
+		_samples[i] = point;
+	}
+
+	for (int i = 0; i < AO_SAMPLE_SIZE; i += 1) {
+		Vector3& p = _samples[i];
+		float u = random();
+		float v = random();
+		float theta = u * 2.0 * PI;
+		float phi = acos(2.0 * v - 1.0);
+		float r = cbrt(random() * 0.9 + 0.1) * 1.0;
+		float sinTheta = sin(theta);
+		float cosTheta = cos(theta);
+		float sinPhi = sin(phi);
+		float cosPhi = cos(phi);
+		p.x = r * sinPhi * cosTheta;
+		p.y = r * sinPhi * sinTheta;
+		p.z = r * cosPhi;
+		if (p.z < 0)
+			p.z *= -1.0;
+
+		p = p.normalize();
+	}
+
+	// The kernel never changes, so it goes to the GPU once
+	sAOKernelBlock block;
+	for (int i = 0; i < AO_SAMPLE_SIZE; i++) {
+		block.kernel[i] = Vector4(_samples[i].x, _samples[i].y, _samples[i].z, 0.0f);
+	}
+	static_assert(sizeof(sAOKernelBlock) % 16 == 0, "std140 blocks are padded to 16 bytes");
+	kernel_block.create("AOKernelBlock", AO_KERNEL_BLOCK_BINDING, sizeof(sAOKernelBlock));
+	kernel_block.upload(&block);
+
+	vec3 noise_vecs[16];
+	for (uint32_t i = 0; i < 16; i++) {
+		noise_vecs[i].x = (((float)rand()) / rand_max_f) * 2.0f - 1.0f;
+		noise_vecs[i].x = (((float)rand()) / rand_max_f) * 2.0f - 1.0f;
+		noise_vecs[i].z = 0.0;
+
+		noise_vecs[i] = noise_vecs[i].normalize();
+	}
+
+	custom_noise_tex = upload_raw_texture_square((float*) noise_vecs, 16);
+
+	quad_mesh = Mesh::getQuad();
+}
+
+Texture* GTR::SSAO_Component::compute_AO(Texture* depth_tex, Texture* normal_tex, const Camera* camera, const bool packed_normals) {
+	// Each temporal frame uses the next part of the kernel, so the history sees all of it
+	int sample_count = use_temporal ? temporal_samples : AO_SAMPLE_SIZE;
+	ao_pass(depth_tex, normal_tex, camera, packed_normals, sample_count);
+
+	Texture* ao_tex = ao_fbo->color_textures[0];
+	if (use_temporal) {
+		ao_tex = temporal_pass(depth_tex, camera);
+	} else {
+		history_valid = false;
+	}
+
+	upsample_pass(ao_tex, depth_tex, normal_tex, camera, packed_normals);
+
+	prev_viewprojection = camera->viewprojection_matrix;
+	frame++;
+
+	return upsample_fbo->color_textures[0];
+}
+
+void GTR::SSAO_Component::ao_pass(Texture* depth_tex, Texture* normal_tex, const Camera* camera, const bool packed_normals, const int sample_count) {
+	ao_fbo->bind();
+
+	Shader* shader = ShaderVariants::Get(VARIANT_AO_PASS, packed_normals ? FEATURE_PACKED_GBUFFER : 0);
+
+	shader->enable();
+
+	Matrix44 inv_proj_mat = camera->projection_matrix;
+	inv_proj_mat.inverse();
+
+	shader->setUniform("u_view", camera->view_matrix);
+	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
+	shader->setUniform("u_inv_projection", inv_proj_mat);
+	shader->setUniform("u_projection", camera->projection_matrix);
+	shader->setUniform("u_near_far", vec2(camera->near_plane, camera->far_plane));
+	shader->setUniform("u_ao_radius", ao_radius);
+	shader->setUniform("u_sample_count", sample_count);
+	shader->setUniform("u_kernel_offset", (int)((frame * sample_count) % AO_SAMPLE_SIZE));
+	// Golden angle, so the rotations of consecutive frames do not repeat
+	shader->setUniform("u_noise_rotation", use_temporal ? (float)(frame % 64) * 2.39996f : 0.0f);
+	shader->setUniform("u_normal_occ_tex", normal_tex, 0);
+	shader->setUniform("u_depth_tex", depth_tex, 1);
+
+	glActiveTexture(GL_TEXTURE0 + 2);
+	glBindTexture(GL_TEXTURE_2D, custom_noise_tex);
+	shader->setUniform1("u_noise_tex", 2);
+	shader->setUniform("u_noise_scale", vec2(ao_fbo->width / 4.0f, ao_fbo->height / 4.0f));
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	quad_mesh->render(GL_TRIANGLES);
+
+	shader->disable();
+	ao_fbo->unbind();
+}
+
+// Blends the AO with the history of the same surface in the last frame
+Texture* GTR::SSAO_Component::temporal_pass(Texture* depth_tex, const Camera* camera) {
+	// The history follows the size of the AO target
+	for (int i = 0; i < 2; i++) {
+		if (history_fbo[i] && history_fbo[i]->width == ao_fbo->width && history_fbo[i]->height == ao_fbo->height) {
+			continue;
+		}
+		delete history_fbo[i];
+		const int formats[1] = { GL_RG16F };
+		history_fbo[i] = new FBO();
+		history_fbo[i]->create(ao_fbo->width, ao_fbo->height, 1, GL_RG, GL_HALF_FLOAT, false, formats);
+		history_valid = false;
+	}
+
+	FBO* prev_history = history_fbo[history_index];
+	history_index = (history_index + 1) % 2;
+	FBO* new_history = history_fbo[history_index];
+
+	Matrix44 inv_viewprojection = camera->viewprojection_matrix;
+	inv_viewprojection.inverse();
+
+	new_history->bind();
+
+	static const Handle<Shader> sh_ao_temporal("ao_temporal");
+	Shader* shader = sh_ao_temporal.get();
+	shader->enable();
+	shader->setUniform("u_ao_tex", ao_fbo->color_textures[0], 0);
+	shader->setUniform("u_history_tex", prev_history->color_textures[0], 1);
+	shader->setUniform("u_depth_tex", depth_tex, 2);
+	shader->setUniform("u_inv_viewprojection", inv_viewprojection);
+	shader->setUniform("u_prev_viewprojection", prev_viewprojection);
+	// Without history, the current frame is taken as is
+	shader->setUniform("u_blend", history_valid ? temporal_blend : 1.0f);
+
+	quad_mesh->render(GL_TRIANGLES);
+
+	shader->disable();
+	new_history->unbind();
+
+	history_valid = true;
+	return new_history->color_textures[0];
+}
+
+void GTR::SSAO_Component::upsample_pass(Texture* ao_tex, Texture* depth_tex, Texture* normal_tex, const Camera* camera, const bool packed_normals) {
+	upsample_fbo->bind();
+
+	Shader* shader = ShaderVariants::Get(VARIANT_AO_UPSAMPLE, packed_normals ? FEATURE_PACKED_GBUFFER : 0);
+	shader->enable();
+	shader->setUniform("u_ao_tex", ao_tex, 0);
+	shader->setUniform("u_depth_tex", depth_tex, 1);
+	shader->setUniform("u_normal_occ_tex", normal_tex, 2);
+	shader->setUniform("u_near_far", vec2(camera->near_plane, camera->far_plane));
+	shader->setUniform("u_depth_sharpness", depth_sharpness);
+
+	quad_mesh->render(GL_TRIANGLES);
+
+	shader->disable();
+	upsample_fbo->unbind();
+}
+
+void GTR::SSAO_Component::render_imgui() {
+#ifndef SKIP_IMGUI
+	const char* resolution_labels[3] = { "Full", "Half", "Quarter" };
+	int resolution_index = (resolution_divider == AO_FULL_RES) ? 0 : ((resolution_divider == AO_HALF_RES) ? 1 : 2);
+	if (ImGui::Combo("AO resolution", &resolution_index, resolution_labels, IM_ARRAYSIZE(resolution_labels))) {
+		const int dividers[3] = { AO_FULL_RES, AO_HALF_RES, AO_QUARTER_RES };
+		resolution_divider = dividers[resolution_index];
+	}
+	ImGui::SliderFloat("AO radius", &ao_radius, 0.0f, 40.0f);
+	ImGui::SliderFloat("AO upsample depth sharpness", &depth_sharpness, 1.0f, 100.0f);
+	ImGui::Checkbox("AO temporal accumulation", &use_temporal);
+	if (use_temporal) {
+		ImGui::SliderInt("AO samples per frame", &temporal_samples, 4, AO_SAMPLE_SIZE);
+		ImGui::SliderFloat("AO history blend", &temporal_blend, 0.02f, 1.0f);
+	}
+#endif
+}
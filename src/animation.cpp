@@ -1,4 +1,6 @@
 #include "animation.h"
+#include "animation_clip.h"
+#include "animation_batch.h"
 #include "framework.h"
 #include "utils.h"
 #include <cassert>
@@ -12,6 +14,18 @@
 Skeleton::Skeleton()
 {
 	num_bones = 0;
+	layout_hash = 0;
+}
+
+uint64_t Skeleton::getLayoutHash()
+{
+	if (layout_hash)
+		return layout_hash;
+	uint64_t hash = hashAssetNumber(num_bones, ASSET_HASH_SEED);
+	for (int i = 0; i < num_bones; ++i)
+		hash = hashAssetNumber(bones[i].parent, hashAssetName(bones[i].name, hash));
+	layout_hash = hash ? hash : 1;
+	return layout_hash;
 }
 
 Skeleton::Bone* Skeleton::getBone(const char* name)
@@ -39,12 +53,16 @@ void Skeleton::computeFinalBoneMatrices( std::vector<Matrix44>& bone_matrices, M
 
 	updateGlobalMatrices();
 
-	bone_matrices.resize(mesh->bones_info.size());
-	#pragma omp for  
-	for (int i = 0; i < mesh->bones_info.size(); ++i)
+	//the bone of every BoneInfo is found once per mesh and skeleton layout
+	const sBoneRemap* remap = ANIMATION_BATCH::getBoneRemap(mesh, this);
+	bone_matrices.resize(remap->bind_matrices.size());
+	for (int i = 0; i < (int)remap->bind_matrices.size(); ++i)
 	{
-		BoneInfo& bone_info = mesh->bones_info[i];
-		bone_matrices[i] = mesh->bind_matrix * bone_info.bind_pose * getBoneMatrix( bone_info.name, false ); //use globals
+		int bone_index = remap->skeleton_bones[i];
+		if (bone_index == -1)
+			bone_matrices[i] = remap->bind_matrices[i];
+		else
+			bone_matrices[i] = remap->bind_matrices[i] * global_bone_matrices[bone_index]; //use globals
 	}
 }
 
@@ -76,10 +94,10 @@ void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 la
 		memcpy(result->bones, a->bones, sizeof(result->bones)); //copy skeleton structure
 		result->bones_by_name = a->bones_by_name;
 		result->num_bones = a->num_bones;
+		result->layout_hash = a->layout_hash;
 	}
 
 	//blend bones locally
-	#pragma omp for  
 	for (int i = 0; i < result->num_bones; ++i)
 	{
 		Skeleton::Bone& bone = result->bones[i];
@@ -87,7 +105,6 @@ void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 la
 		Skeleton::Bone& boneB = b->bones[i];
 		if ( layer != 0xFF && !(bone.layer & layer) ) //not in the same layer
 			continue;
-		#pragma omp for  
 		for (int j = 0; j < 16; ++j)
 			bone.model.m[j] = lerp( boneA.model.m[j], boneB.model.m[j], w);
 	}
@@ -165,6 +182,7 @@ Animation::Animation()
 {
 	duration = 0.0f;
 	keyframes = NULL;
+	clip = NULL;
 	num_keyframes = 0;
 	num_animated_bones = 0;
 }
@@ -173,12 +191,28 @@ Animation::~Animation()
 {
 	if (keyframes)
 		delete[] keyframes;
+	if (clip)
+		delete clip;
 }
 
 void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
 {
-	assert(keyframes && skeleton.num_bones);
+	assert((keyframes || clip) && skeleton.num_bones);
+
+	int index, index2;
+	float f;
+	getSamplePosition(t, loop, index, index2, f);
+
+	if (clip)
+		clip->sample(index, index2, f, skeleton.bones, layers);
+	else
+		sampleKeyframes(index, index2, f, layers);
+
+	skeleton.updateGlobalMatrices();
+}
 
+void Animation::getSamplePosition(float t, bool loop, int& index, int& index2, float& f) const
+{
 	if (loop)
 	{
 		t = fmod(t, duration);
@@ -188,17 +222,41 @@ void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
 	else
 		t = clamp( t, 0.0f, duration - (1.0/samples_per_second) );
 	float v = samples_per_second * t;
-	int index = clamp(floor(v), 0, num_keyframes - 1);
-	int index2 = index + 1;
+	index = clamp(floor(v), 0, num_keyframes - 1);
+	index2 = index + 1;
 	if (index2 >= num_keyframes)
 		index2 = 0;
-	float f = v - floor(v);
+	f = v - floor(v);
+}
+
+void Animation::samplePose(float t, bool loop, Matrix44* local_matrices) const
+{
+	int index, index2;
+	float f;
+	getSamplePosition(t, loop, index, index2, f);
+
+	if (clip)
+	{
+		clip->samplePose(index, index2, f, local_matrices);
+		return;
+	}
 
+	const Matrix44* k = keyframes + index * num_animated_bones;
+	const Matrix44* k2 = keyframes + index2 * num_animated_bones;
+	for (int i = 0; i < num_animated_bones; ++i)
+	{
+		Matrix44& local = local_matrices[bones_map[i]];
+		for (int j = 0; j < 16; ++j)
+			local.m[j] = lerp(k[i].m[j], k2[i].m[j], f);
+	}
+}
+
+void Animation::sampleKeyframes(int index, int index2, float f, uint8 layers)
+{
 	Matrix44* k = keyframes + index * num_animated_bones;
 	Matrix44* k2 = keyframes + index2 * num_animated_bones;
 
 	//compute local bones
-	#pragma omp for  
 	for (int i = 0; i < num_animated_bones; ++i)
 	{
 		int bone_index = bones_map[i];
@@ -208,8 +266,26 @@ void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
 		for (int j = 0; j < 16; ++j)
 			bone.model.m[j] = lerp(k[i].m[j], k2[i].m[j], f);
 	}
+}
 
-	skeleton.updateGlobalMatrices();
+bool Animation::compress(bool keep_keyframes)
+{
+	AnimationClip* new_clip = new AnimationClip();
+	if (!new_clip->compress(this))
+	{
+		delete new_clip;
+		return false;
+	}
+
+	if (clip)
+		delete clip;
+	clip = new_clip;
+	if (!keep_keyframes)
+	{
+		delete[] keyframes;
+		keyframes = NULL;
+	}
+	return true;
 }
 
 
@@ -217,6 +293,7 @@ void Animation::operator = (Animation* anim)
 {
 	memcpy(this, anim, sizeof(Animation));
 	this->keyframes = NULL;
+	this->clip = NULL;
 }
 
 bool Animation::load(const char* filename)
@@ -229,25 +306,42 @@ bool Animation::load(const char* filename)
 	//char file_format = 0;
 	std::string name = filename;
 	std::string ext = name.substr(name.find_last_of(".") + 1);
-	if (ext == "abin" || ext == "ABIN")
+	if (ext == "cabin" || ext == "CABIN")
+	{
+		if (!loadCABIN(filename))
+			return false;
+	}
+	else if (ext == "abin" || ext == "ABIN")
 	{
 		if( !loadABIN(filename) )
 			return false;
+		if (ANIMATION_CLIP::compress_on_load)
+			compress(ANIMATION_CLIP::keep_keyframes);
 	}
 	else //not a bin
 	{
+		std::string cbinfilename = name + ".cabin";
 		std::string binfilename = name + ".abin";
-		if (!loadABIN(binfilename.c_str())) //not found
+		if (!ANIMATION_CLIP::compress_on_load || !loadCABIN(cbinfilename.c_str())) //not found
 		{
-			//try to load in ASCII
-			if (!loadSKANIM(filename))
+			if (!loadABIN(binfilename.c_str())) //not found
 			{
-				std::cout << " [ERROR]: File not found" << std::endl;
-				return false;
+				//try to load in ASCII
+				if (!loadSKANIM(filename))
+				{
+					std::cout << " [ERROR]: File not found" << std::endl;
+					return false;
+				}
+
+				std::cout << "[Writing .ABIN] ... ";
+				writeABIN( filename );
 			}
 
-			std::cout << "[Writing .ABIN] ... ";
-			writeABIN( filename );
+			if (ANIMATION_CLIP::compress_on_load && compress(ANIMATION_CLIP::keep_keyframes))
+			{
+				std::cout << "[Writing .CABIN] ... ";
+				writeCABIN( filename );
+			}
 		}
 	}
 
@@ -361,11 +455,150 @@ bool Animation::loadABIN(const char* filename)
 	//compute bone names map
 	for (int i = 0; i < skeleton.num_bones; ++i)
 		skeleton.bones_by_name[ skeleton.bones[i].name ] = i;
+	skeleton.layout_hash = 0;
+
+	delete[] data;
+	return true;
+}
+
+bool Animation::writeCABIN(const char* filename)
+{
+	assert(clip);
+	std::string s_filename = filename;
+	s_filename += ".cabin";
+
+	FILE* f = fopen(s_filename.c_str(), "wb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] cannot write CABIN: " << s_filename.c_str() << std::endl;
+		return false;
+	}
+
+	//watermark
+	fwrite("ACLP", sizeof(char), 4, f);
+
+	sAnimHeader header;
+	header.version = ANIM_BIN_VERSION;
+	header.header_bytes = sizeof(header);
+	header.duration = duration;
+	header.samples_per_second = samples_per_second;
+	header.num_animated_bones = num_animated_bones;
+	header.num_keyframes = num_keyframes;
+	header.num_bones = skeleton.num_bones;
+	memcpy( header.bones_map, bones_map, sizeof(bones_map)  );
+
+	//write header
+	fwrite((void*)&header, sizeof(sAnimHeader), 1, f);
+
+	//write skeleton
+	fwrite((void*)skeleton.bones, sizeof(skeleton.bones), 1, f);
+
+	//write the compressed tracks
+	clip->write(f);
+
+	fclose(f);
+	return true;
+}
+
+bool Animation::loadCABIN(const char* filename)
+{
+	FILE *f;
+	assert(filename);
+
+	struct stat stbuffer;
+
+	if (stat(filename, &stbuffer) != 0)
+		return false;
+	f = fopen(filename, "rb");
+	if (f == NULL)
+		return false;
+
+	unsigned int size = (unsigned int)stbuffer.st_size;
+	char* data = new char[size];
+	fread(data, size, 1, f);
+	fclose(f);
+
+	//watermark
+	if (size < 4 + sizeof(sAnimHeader) + sizeof(skeleton.bones) || memcmp(data, "ACLP", 4) != 0)
+	{
+		std::cout << "[ERROR] loading CABIN: invalid content: " << filename << std::endl;
+		delete[] data;
+		return false;
+	}
+
+	char* pos = data + 4;
+	sAnimHeader header;
+	memcpy(&header, pos, sizeof(sAnimHeader));
+	pos += sizeof(sAnimHeader);
+
+	if (header.version != ANIM_BIN_VERSION || header.header_bytes != sizeof(sAnimHeader))
+	{
+		std::cout << "[WARN] loading CABIN: old version: " << filename << std::endl;
+		delete[] data;
+		return false;
+	}
+
+	//extract the compressed tracks after the skeleton
+	AnimationClip* new_clip = new AnimationClip();
+	if (!new_clip->read(pos + sizeof(skeleton.bones), data + size) || new_clip->num_keyframes != header.num_keyframes)
+	{
+		std::cout << "[WARN] loading CABIN: old version: " << filename << std::endl;
+		delete new_clip;
+		delete[] data;
+		return false;
+	}
+
+	//extract header
+	duration = header.duration;
+	samples_per_second = header.samples_per_second;
+	num_animated_bones = header.num_animated_bones;
+	num_keyframes = header.num_keyframes;
+	skeleton.num_bones = header.num_bones;
+	memcpy(bones_map, header.bones_map, sizeof(bones_map));
+
+	//extract skeleton
+	memcpy( skeleton.bones, pos, sizeof(skeleton.bones) );
+	pos += sizeof(skeleton.bones);
+
+	if (clip)
+		delete clip;
+	clip = new_clip;
+
+	//compute bone names map
+	for (int i = 0; i < skeleton.num_bones; ++i)
+		skeleton.bones_by_name[ skeleton.bones[i].name ] = i;
+	skeleton.layout_hash = 0;
 
 	delete[] data;
 	return true;
 }
 
+bool Animation::ConvertABIN(const char* filename)
+{
+	Animation animation;
+	if (!animation.loadABIN(filename))
+	{
+		std::cout << "[ERROR] converting ABIN: cannot load " << filename << std::endl;
+		return false;
+	}
+
+	const size_t dense_bytes = sizeof(Matrix44) * animation.num_keyframes * animation.num_animated_bones;
+	if (!animation.compress())
+		return false;
+
+	//name.abin -> name.cabin
+	std::string name = filename;
+	name = name.substr(0, name.find_last_of("."));
+	if (!animation.writeCABIN(name.c_str()))
+		return false;
+
+	const AnimationClip* clip = animation.clip;
+	std::cout << " + Animation converted: " << name << ".cabin " << dense_bytes / 1024 << "KB -> " << clip->getBytes() / 1024 << "KB"
+		<< " Constant tracks: " << clip->constant_tracks << "/" << clip->tracks.size() * 3
+		<< " Max error: " << clip->error.max_position << " " << clip->error.max_rotation_degrees << "deg" << std::endl;
+	return true;
+}
+
 bool Animation::loadSKANIM(const char* filename)
 {
 	struct stat stbuffer;
@@ -454,6 +687,7 @@ bool Animation::loadSKANIM(const char* filename)
 		bone.layer = BODY;
 		skeleton.bones_by_name[bone.name] = i;
 	}
+	skeleton.layout_hash = 0;
 
 	//assign layers
 	Skeleton::Bone* hips = skeleton.getBone("mixamorig_Hips");
@@ -475,24 +709,24 @@ bool Animation::loadSKANIM(const char* filename)
 }
 
 
-std::map<std::string, Animation*> Animation::sAnimationsLoaded;
+AssetRegistry<Animation> Animation::sAnimationsLoaded("Animation", 1 << 10);
 Animation* Animation::Get(const char* filename)
 {
 	assert(filename);
 
 	//check if loaded
-	auto it = sAnimationsLoaded.find(filename);
-	if (it != sAnimationsLoaded.end())
-		return it->second;
+	Animation* anim = sAnimationsLoaded.find(filename);
+	if (anim)
+		return anim;
 
 	//load it
-	Animation* anim = new Animation();
+	anim = new Animation();
 	if (!anim->load(filename))
 	{
 		delete anim;
 		return NULL;
 	}
 
-	sAnimationsLoaded[filename] = anim;
+	sAnimationsLoaded.add(filename, anim);
 	return anim;
 }
@@ -8,6 +8,7 @@
 
 
 class Camera;
+class AnimationClip;
 
 #define ANIM_BIN_VERSION 3
 
@@ -44,16 +45,19 @@ public:
 
 	Matrix44 global_bone_matrices[128]; //transform of every bone in global coordinates (according to the 0,0,0 and not the parent)
 	std::map<const char*, int, cmp_str> bones_by_name;	//map to get the bone index from its name, required to extract the final bones array
+	uint64_t layout_hash; //of the bone names and parents, 0 until getLayoutHash (reset it if the bones change)
 
 	Skeleton();
 
+	uint64_t getLayoutHash(); //the skeletons with the same hash share the bone remaps
+
 	Bone* getBone(const char* name); //returns the bone pointer
 	Matrix44& getBoneMatrix(const char* name, bool local = true); //returns the local matrix of a bone
 	void applyTransformToBones(const char* root, Matrix44 transform); //given a bone name and matrix, it multiplies the matrix to the bone
 	void updateGlobalMatrices(); //updates the list of global matrices according to the local matrices
 
 	void renderSkeleton(Camera* camera, Matrix44 model, Vector4 color = Vector4(0.5, 0, 0.5, 1), bool render_points = false); //renders the skeleton with lines
-	void computeFinalBoneMatrices(std::vector<Matrix44>& bones, Mesh* mesh); //fills the std::vector with the bones ready for the shader
+	void computeFinalBoneMatrices(std::vector<Matrix44>& bones, Mesh* mesh); //fills the std::vector with the bones ready for the shader (uses the cached bone remap)
 	void assignLayer(Bone* bone, uint8 layer); //assigns a layer to a node and all its children
 };
 
@@ -73,23 +77,40 @@ public:
 	int8 bones_map[128]; //maps from keyframe data index to bone
 
 	Matrix44* keyframes;
+	AnimationClip* clip; //compressed keyframes, used instead of the dense ones if set
 
 	Animation();
 	~Animation();	//we need the dtor to remove the keyframes memory
 
 	//change the skeleton to the given pose according to time
 	void assignTime(float time, bool loop = true, bool interpolate = true, uint8 layers = 0xFF);
+	//lerps the dense keyframes into the local matrices of the bones
+	void sampleKeyframes(int index, int index2, float f, uint8 layers = 0xFF);
+	//the keyframes around time and the interpolation factor between them
+	void getSamplePosition(float time, bool loop, int& index, int& index2, float& f) const;
+	//writes the local matrices of the animated bones, indexed by bone, without changing the skeleton
+	void samplePose(float time, bool loop, Matrix44* local_matrices) const;
+
+	//builds the clip from the keyframes, the keyframes are freed unless asked
+	bool compress(bool keep_keyframes = false);
 
 	//storage
 	bool load(const char* filename);
 	bool loadSKANIM(const char* filename);
 	bool loadABIN(const char* filename);
 	bool writeABIN(const char* filename);
+	bool loadCABIN(const char* filename);
+	bool writeCABIN(const char* filename);
 
-	static std::map<std::string, Animation*> sAnimationsLoaded;
+	//converts an ABIN to a compressed .cabin next to the original (name.abin -> name.cabin)
+	static bool ConvertABIN(const char* filename);
+
+	static AssetRegistry<Animation> sAnimationsLoaded;
 	static Animation* Get(const char* filename);
 
 	//copy operator to copy the keyframes
 	void operator = (Animation* anim);
 };
 
+template<> inline AssetRegistry<Animation>& getAssetRegistry<Animation>() { return Animation::sAnimationsLoaded; }
+
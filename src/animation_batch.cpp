@@ -0,0 +1,265 @@
+#include "animation_batch.h"
+
+#include "animation.h"
+#include "animation_clip.h"
+#include "mesh.h"
+#include "task.h"
+#include "includes.h"
+#include "utils.h"
+
+#include <map>
+#include <mutex>
+#include <cmath>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+namespace ANIMATION_BATCH {
+
+	AnimationBatch scene_batch;
+
+	static std::mutex cache_mutex;
+	static std::map<std::pair<const Mesh*, uint64_t>, sBoneRemap*> bone_remaps;
+	static std::map<uint64_t, sRig*> rigs;
+
+	const sBoneRemap* getBoneRemap(const Mesh* mesh, Skeleton* skeleton) {
+		const uint64_t layout = skeleton->getLayoutHash();
+		const std::lock_guard<std::mutex> lock(cache_mutex);
+		sBoneRemap*& remap = bone_remaps[std::make_pair(mesh, layout)];
+		if (remap)
+			return remap;
+
+		remap = new sBoneRemap();
+		remap->mesh = mesh;
+		remap->skeleton_layout = layout;
+		const int count = (int)mesh->bones_info.size();
+		remap->skeleton_bones.resize(count);
+		remap->bind_matrices.resize(count);
+		for (int i = 0; i < count; ++i) {
+			const BoneInfo& bone_info = mesh->bones_info[i];
+			auto it = skeleton->bones_by_name.find(bone_info.name);
+			remap->skeleton_bones[i] = (it == skeleton->bones_by_name.end()) ? -1 : it->second;
+			remap->bind_matrices[i] = mesh->bind_matrix * bone_info.bind_pose;
+		}
+		return remap;
+	}
+
+	void removeBoneRemaps(const Mesh* mesh) {
+		const std::lock_guard<std::mutex> lock(cache_mutex);
+		auto it = bone_remaps.lower_bound(std::make_pair(mesh, (uint64_t)0));
+		while (it != bone_remaps.end() && it->first.first == mesh) {
+			delete it->second;
+			it = bone_remaps.erase(it);
+		}
+	}
+
+	const sRig* getRig(Skeleton* skeleton) {
+		const uint64_t layout = skeleton->getLayoutHash();
+		const std::lock_guard<std::mutex> lock(cache_mutex);
+		sRig*& rig = rigs[layout];
+		if (rig)
+			return rig;
+
+		rig = new sRig();
+		rig->layout = layout;
+		rig->num_bones = skeleton->num_bones;
+		rig->parents.resize(rig->num_bones);
+		std::vector<int> depths(rig->num_bones, 0);
+		for (int i = 0; i < rig->num_bones; ++i) {
+			rig->parents[i] = skeleton->bones[i].parent;
+			for (int parent = rig->parents[i]; parent != -1; parent = skeleton->bones[parent].parent)
+				depths[i]++;
+		}
+
+		// By depth, so it does not depend on the order of the bones in the file
+		rig->order.resize(rig->num_bones);
+		for (int i = 0; i < rig->num_bones; ++i)
+			rig->order[i] = i;
+		std::stable_sort(rig->order.begin(), rig->order.end(), [&depths](const int a, const int b) { return depths[a] < depths[b]; });
+		return rig;
+	}
+};
+
+int AnimationBatch::add(Animation* animation, Mesh* mesh, const float time, const float speed, const bool loop)
+{
+	assert(animation && (animation->keyframes || animation->clip));
+
+	sInstance instance;
+	instance.animation = animation;
+	instance.rig = ANIMATION_BATCH::getRig(&animation->skeleton);
+	instance.remap = (mesh && mesh->bones_info.size()) ? ANIMATION_BATCH::getBoneRemap(mesh, &animation->skeleton) : NULL;
+	instance.time = time;
+	instance.speed = speed;
+	instance.loop = loop;
+	instance.bone_offset = (int)local_matrices.size();
+	instance.palette_offset = (int)palettes.size();
+
+	// The bones that are not animated keep the rest pose
+	for (int i = 0; i < instance.rig->num_bones; ++i)
+		local_matrices.push_back(animation->skeleton.bones[i].model);
+	global_matrices.resize(local_matrices.size());
+	if (instance.remap)
+		palettes.resize(palettes.size() + instance.remap->bind_matrices.size());
+
+	// The palette is ready before the next update
+	instances.push_back(instance);
+	updateInstance((int)instances.size() - 1, 0.0f);
+	return (int)instances.size() - 1;
+}
+
+void AnimationBatch::clear()
+{
+	instances.clear();
+	local_matrices.clear();
+	global_matrices.clear();
+	palettes.clear();
+}
+
+void AnimationBatch::update(const float seconds_elapsed, const bool parallel)
+{
+	if (instances.empty()) {
+		update_ms = 0.0;
+		return;
+	}
+
+	const Uint64 start = SDL_GetPerformanceCounter();
+	const int count = (int)instances.size();
+	const int per_job = max(instances_per_job, 1);
+	const int jobs = (count + per_job - 1) / per_job;
+	auto job = [this, count, per_job, seconds_elapsed](const int j) {
+		const int end = min((j + 1) * per_job, count);
+		for (int i = j * per_job; i < end; ++i)
+			updateInstance(i, seconds_elapsed);
+	};
+
+	if (parallel) {
+		TaskManager::workers.parallelFor(jobs, job);
+	}
+	else {
+		for (int j = 0; j < jobs; ++j)
+			job(j);
+	}
+	update_ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+void AnimationBatch::updateInstance(const int index, const float seconds_elapsed)
+{
+	sInstance& instance = instances[index];
+	const Animation* animation = instance.animation;
+	instance.time += seconds_elapsed * instance.speed;
+	if (instance.loop && animation->duration > 0.0f)
+		instance.time = fmodf(instance.time, animation->duration);
+
+	Matrix44* locals = &local_matrices[instance.bone_offset];
+	Matrix44* globals = &global_matrices[instance.bone_offset];
+	animation->samplePose(instance.time, instance.loop, locals);
+
+	const sRig* rig = instance.rig;
+	for (const int bone : rig->order) {
+		const int parent = rig->parents[bone];
+		globals[bone] = (parent == -1) ? locals[bone] : locals[bone] * globals[parent];
+	}
+
+	const sBoneRemap* remap = instance.remap;
+	if (!remap)
+		return;
+	Matrix44* palette = &palettes[instance.palette_offset];
+	for (int i = 0; i < (int)remap->bind_matrices.size(); ++i) {
+		const int bone = remap->skeleton_bones[i];
+		palette[i] = (bone == -1) ? remap->bind_matrices[i] : remap->bind_matrices[i] * globals[bone];
+	}
+}
+
+namespace ANIMATION_BATCH {
+
+	inline double get_ms_since(const Uint64 start) {
+		return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+	}
+
+	void sBenchmark::run() {
+		Animation animation;
+		ANIMATION_CLIP::generate_animation(animation, num_bones, 10.0f);
+		animation.compress();
+		Skeleton& skeleton = animation.skeleton;
+
+		// Only the bones of the mesh are used
+		Mesh mesh;
+		mesh.bones_info.resize(skeleton.num_bones);
+		for (int i = 0; i < skeleton.num_bones; ++i) {
+			strcpy(mesh.bones_info[i].name, skeleton.bones[i].name);
+			mesh.bones_info[i].bind_pose.setTranslation(0.0f, -0.2f * i, 0.0f);
+		}
+
+		const int count = max(characters, 1);
+		const int frame_count = max(frames, 1);
+		const float frame_time = 1.0f / 30.0f;
+
+		// A skeleton per character, as with Animation::assignTime and computeFinalBoneMatrices
+		std::vector<Skeleton> skeletons(count, skeleton);
+		std::vector<std::vector<Matrix44>> skeleton_palettes(count);
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int f = 0; f < frame_count; ++f) {
+			for (int c = 0; c < count; ++c) {
+				int index, index2;
+				float factor;
+				animation.getSamplePosition(c * 0.1f + (f + 1) * frame_time, true, index, index2, factor);
+				animation.clip->sample(index, index2, factor, skeletons[c].bones);
+				skeletons[c].computeFinalBoneMatrices(skeleton_palettes[c], &mesh);
+			}
+		}
+		skeleton_ms = get_ms_since(start) / frame_count;
+
+		AnimationBatch batch;
+		for (int c = 0; c < count; ++c)
+			batch.add(&animation, &mesh, c * 0.1f);
+		start = SDL_GetPerformanceCounter();
+		for (int f = 0; f < frame_count; ++f)
+			batch.update(frame_time, false);
+		batch_single_thread_ms = get_ms_since(start) / frame_count;
+
+		batch.clear();
+		for (int c = 0; c < count; ++c)
+			batch.add(&animation, &mesh, c * 0.1f);
+		start = SDL_GetPerformanceCounter();
+		for (int f = 0; f < frame_count; ++f)
+			batch.update(frame_time, true);
+		batch_multi_thread_ms = get_ms_since(start) / frame_count;
+
+		// The times are accumulated differently, the difference is not exactly 0
+		max_difference = 0.0f;
+		for (int c = 0; c < count; ++c) {
+			const Matrix44* palette = batch.getPalette(c);
+			for (int i = 0; i < batch.getPaletteSize(c); ++i)
+				for (int j = 0; j < 16; ++j)
+					max_difference = max(max_difference, fabsf(palette[i].m[j] - skeleton_palettes[c][i].m[j]));
+		}
+
+		removeBoneRemaps(&mesh);
+		has_run = true;
+	}
+
+	void render_imgui() {
+#ifndef SKIP_IMGUI
+		static sBenchmark benchmark;
+		if (ImGui::TreeNode("Animation batch")) {
+			ImGui::Text("Scene: %d instances, %d bones, %d palette matrices", (int)scene_batch.instances.size(), (int)scene_batch.local_matrices.size(), (int)scene_batch.palettes.size());
+			ImGui::Text("Update: %.3f ms", scene_batch.update_ms);
+			ImGui::SliderInt("Instances per job", &scene_batch.instances_per_job, 1, 256);
+
+			ImGui::SliderInt("Benchmark characters", &benchmark.characters, 1, 5000);
+			ImGui::SliderInt("Benchmark bones", &benchmark.num_bones, 2, 128);
+			if (ImGui::Button("Run animation benchmark")) {
+				benchmark.run();
+			}
+
+			if (benchmark.has_run) {
+				ImGui::Text("Per skeleton: %.3f ms", benchmark.skeleton_ms);
+				ImGui::Text("Batch, 1 thread: %.3f ms (x%.1f)", benchmark.batch_single_thread_ms, benchmark.skeleton_ms / benchmark.batch_single_thread_ms);
+				ImGui::Text("Batch, %d threads: %.3f ms (x%.1f)", TaskManager::workers.getThreadCount() + 1, benchmark.batch_multi_thread_ms, benchmark.skeleton_ms / benchmark.batch_multi_thread_ms);
+				ImGui::Text("Max palette difference: %g", benchmark.max_difference);
+			}
+			ImGui::TreePop();
+		}
+#endif
+	}
+};
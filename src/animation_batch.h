@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "framework.h"
+
+class Mesh;
+class Skeleton;
+class Animation;
+
+// ================
+//  ANIMATION BATCH
+// ================
+// Updates many animated instances at once. The bone data of all the instances is kept
+// in separate streams (local matrices, global matrices, skinning palettes), each instance
+// owns a contiguous range of every stream. The instances are split in jobs that run in the
+// worker threads: sample the local pose, compute the globals with the parents before the
+// children, and multiply by the bind matrices of the mesh. The bone of every BoneInfo of
+// a mesh is found by name once per (mesh, skeleton layout) and cached.
+
+// The BoneInfos of a mesh mapped to the bones of a skeleton layout
+struct sBoneRemap {
+	const Mesh* mesh;
+	uint64_t skeleton_layout;
+	std::vector<int> skeleton_bones; // Per BoneInfo, -1 if the skeleton does not have the bone
+	std::vector<Matrix44> bind_matrices; // mesh->bind_matrix * bind_pose, per BoneInfo
+};
+
+// The hierarchy of a skeleton layout
+struct sRig {
+	uint64_t layout;
+	int num_bones;
+	std::vector<int> parents; // -1 for the roots
+	std::vector<int> order; // Topological, the parents before the children
+};
+
+class AnimationBatch {
+public:
+	struct sInstance {
+		Animation* animation;
+		const sRig* rig;
+		const sBoneRemap* remap; // NULL if there is no mesh, no palette then
+		float time;
+		float speed;
+		bool loop;
+		int bone_offset; // In local_matrices and global_matrices
+		int palette_offset; // In palettes
+	};
+
+	std::vector<sInstance> instances;
+	std::vector<Matrix44> local_matrices;
+	std::vector<Matrix44> global_matrices;
+	std::vector<Matrix44> palettes; // Ready for the shader, the ones of an instance are contiguous
+
+	int instances_per_job = 16;
+	double update_ms = 0.0; // Of the last update
+
+	// Returns the index of the instance, the indices are valid until clear
+	int add(Animation* animation, Mesh* mesh, const float time = 0.0f, const float speed = 1.0f, const bool loop = true);
+	void clear();
+
+	// Advances the time of all the instances and computes their palettes
+	void update(const float seconds_elapsed, const bool parallel = true);
+
+	inline const Matrix44* getPalette(const int instance) const { return &palettes[instances[instance].palette_offset]; }
+	inline int getPaletteSize(const int instance) const { return instances[instance].remap ? (int)instances[instance].remap->bind_matrices.size() : 0; }
+
+private:
+	void updateInstance(const int index, const float seconds_elapsed);
+};
+
+namespace ANIMATION_BATCH {
+
+	// Cached, safe to call from any thread. The skeleton layout hash is computed if needed
+	const sBoneRemap* getBoneRemap(const Mesh* mesh, Skeleton* skeleton);
+	const sRig* getRig(Skeleton* skeleton);
+	void removeBoneRemaps(const Mesh* mesh); // When the mesh is deleted, its address can be reused
+
+	// The animated instances of the scene, updated every frame
+	extern AnimationBatch scene_batch;
+
+	// Updates characters * bones with the per skeleton functions, and with the batch in one and in all the threads
+	struct sBenchmark {
+		int characters = 1000;
+		int num_bones = 64;
+		int frames = 10;
+
+		double skeleton_ms = 0.0; // Per frame
+		double batch_single_thread_ms = 0.0;
+		double batch_multi_thread_ms = 0.0;
+		float max_difference = 0.0f; // Between the palettes of both paths
+		bool has_run = false;
+
+		void run();
+	};
+
+	void render_imgui();
+};
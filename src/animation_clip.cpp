@@ -0,0 +1,514 @@
+#include "animation_clip.h"
+
+#include "includes.h"
+#include "utils.h"
+
+#include <cmath>
+#include <cstring>
+#include <cassert>
+#include <iostream>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ANIM_CLIP_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace ANIMATION_CLIP {
+
+	bool use_slerp = false;
+	bool compress_on_load = true;
+	bool keep_keyframes = false;
+
+	float rotation_tolerance = 1e-6f;
+	float translation_tolerance = 1e-4f;
+	float scale_tolerance = 1e-4f;
+
+	void decompose_matrix(const Matrix44& matrix, Quaternion& rotation, Vector3& translation, Vector3& scale) {
+		translation.set(matrix.m[12], matrix.m[13], matrix.m[14]);
+
+		// The rows are the scaled axes
+		float axes[9];
+		for (int row = 0; row < 3; ++row) {
+			const float* axis = matrix.m + row * 4;
+			scale.v[row] = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+			const float inv_scale = (scale.v[row] > 0.0f) ? 1.0f / scale.v[row] : 0.0f;
+			for (int c = 0; c < 3; ++c) {
+				axes[row * 3 + c] = axis[c] * inv_scale;
+			}
+		}
+
+		// A mirror goes to the scale, the rotation has to be proper
+		const float determinant = axes[0] * (axes[4] * axes[8] - axes[5] * axes[7])
+								- axes[1] * (axes[3] * axes[8] - axes[5] * axes[6])
+								+ axes[2] * (axes[3] * axes[7] - axes[4] * axes[6]);
+		if (determinant < 0.0f) {
+			scale.x = -scale.x;
+			axes[0] = -axes[0];
+			axes[1] = -axes[1];
+			axes[2] = -axes[2];
+		}
+
+		// The inverse of Quaternion::toMatrix
+		const float trace = axes[0] + axes[4] + axes[8];
+		if (trace > 0.0f) {
+			float root = sqrtf(trace + 1.0f);
+			rotation.w = 0.5f * root;
+			root = 0.5f / root;
+			rotation.x = (axes[5] - axes[7]) * root;
+			rotation.y = (axes[6] - axes[2]) * root;
+			rotation.z = (axes[1] - axes[3]) * root;
+		}
+		else {
+			int i = 0;
+			if (axes[4] > axes[0]) i = 1;
+			if (axes[8] > axes[i * 3 + i]) i = 2;
+			const int j = (i + 1) % 3;
+			const int k = (i + 2) % 3;
+			float root = sqrtf(axes[i * 3 + i] - axes[j * 3 + j] - axes[k * 3 + k] + 1.0f);
+			rotation.q[i] = 0.5f * root;
+			root = 0.5f / root;
+			rotation.w = (axes[j * 3 + k] - axes[k * 3 + j]) * root;
+			rotation.q[j] = (axes[j * 3 + i] + axes[i * 3 + j]) * root;
+			rotation.q[k] = (axes[k * 3 + i] + axes[i * 3 + k]) * root;
+		}
+		rotation.normalize();
+	}
+
+	void compose_matrix(const Quaternion& rotation, const Vector3& translation, const Vector3& scale, Matrix44& matrix) {
+		rotation.toMatrix(matrix);
+		for (int c = 0; c < 3; ++c) {
+			matrix.m[c] *= scale.x;
+			matrix.m[4 + c] *= scale.y;
+			matrix.m[8 + c] *= scale.z;
+		}
+		matrix.m[12] = translation.x;
+		matrix.m[13] = translation.y;
+		matrix.m[14] = translation.z;
+	}
+
+	// nlerp by the shortest path, or slerp
+	inline void interpolate_rotation(const float* a, const float* b, const float f, Quaternion& result) {
+		const Quaternion qa(a);
+		const Quaternion qb(b);
+		if (use_slerp) {
+			result = Qslerp(qa, qb, f);
+		}
+		else {
+			const float sign = (DotProduct(qa, qb) < 0.0f) ? -1.0f : 1.0f;
+			for (int c = 0; c < 4; ++c) {
+				result.q[c] = qa.q[c] + (qb.q[c] * sign - qa.q[c]) * f;
+			}
+		}
+		result.normalize();
+	}
+
+	inline void interpolate_vector(const float* a, const float* b, const float f, Vector3& result) {
+		result.set(a[0] + (b[0] - a[0]) * f, a[1] + (b[1] - a[1]) * f, a[2] + (b[2] - a[2]) * f);
+	}
+
+	// As Skeleton::updateGlobalMatrices, the parents are before the children
+	static void compute_globals(const Skeleton::Bone* bones, const int num_bones, Matrix44* globals) {
+		globals[0] = bones[0].model;
+		for (int i = 1; i < num_bones; ++i) {
+			globals[i] = bones[i].model * globals[(int)bones[i].parent];
+		}
+	}
+};
+
+bool AnimationClip::compress(const Animation* animation)
+{
+	const int num_bones = animation->num_animated_bones;
+	if (!animation->keyframes || !animation->num_keyframes || !num_bones)
+		return false;
+	num_keyframes = animation->num_keyframes;
+
+	// Split all the keys
+	std::vector<Quaternion> rotations(num_keyframes * num_bones);
+	std::vector<Vector3> translations(num_keyframes * num_bones);
+	std::vector<Vector3> scales(num_keyframes * num_bones);
+	for (int k = 0; k < num_keyframes; ++k) {
+		for (int i = 0; i < num_bones; ++i) {
+			const int key = k * num_bones + i;
+			ANIMATION_CLIP::decompose_matrix(animation->keyframes[key], rotations[key], translations[key], scales[key]);
+			// In the hemisphere of the previous key, so the interpolation takes the short path
+			if (k > 0 && DotProduct(rotations[key], rotations[key - num_bones]) < 0.0f)
+				rotations[key] = rotations[key] * -1.0f;
+		}
+	}
+
+	auto key_value = [&](const int k, const int i, const int channel, const int c) -> float {
+		const int key = k * num_bones + i;
+		if (channel == 0)
+			return rotations[key].q[c];
+		if (channel == 1)
+			return translations[key].v[c];
+		return scales[key].v[c];
+	};
+
+	auto is_constant = [&](const int i, const int channel) -> bool {
+		for (int k = 1; k < num_keyframes; ++k) {
+			const int key = k * num_bones + i;
+			if (channel == 0 && 1.0f - fabsf(DotProduct(rotations[key], rotations[i])) > ANIMATION_CLIP::rotation_tolerance)
+				return false;
+			if (channel == 1 && (translations[key] - translations[i]).length() > ANIMATION_CLIP::translation_tolerance)
+				return false;
+			if (channel == 2 && (scales[key] - scales[i]).length() > ANIMATION_CLIP::scale_tolerance)
+				return false;
+		}
+		return true;
+	};
+
+	// Constant or animated, channel by channel
+	struct sComponent { int bone; int channel; int c; };
+	std::vector<sComponent> components;
+	const int channel_size[3] = { 4, 3, 3 };
+	const uint8 channel_flag[3] = { ROTATION_ANIMATED, TRANSLATION_ANIMATED, SCALE_ANIMATED };
+
+	tracks.resize(num_bones);
+	constants.clear();
+	constant_tracks = 0;
+	for (int i = 0; i < num_bones; ++i) {
+		sTrack& track = tracks[i];
+		track.bone = (uint8)animation->bones_map[i];
+		track.flags = 0;
+		uint16* offsets[3] = { &track.rotation, &track.translation, &track.scale };
+		for (int channel = 0; channel < 3; ++channel) {
+			if (is_constant(i, channel)) {
+				*offsets[channel] = (uint16)constants.size();
+				for (int c = 0; c < channel_size[channel]; ++c)
+					constants.push_back(key_value(0, i, channel, c));
+				constant_tracks++;
+				continue;
+			}
+			track.flags |= channel_flag[channel];
+			*offsets[channel] = (uint16)components.size();
+			for (int c = 0; c < channel_size[channel]; ++c)
+				components.push_back({ i, channel, c });
+		}
+	}
+
+	// Quantize with the range of each component, the padding decodes to 0
+	stride = ((int)components.size() + 7) & ~7;
+	assert(stride <= ANIM_CLIP_MAX_COMPONENTS);
+	range_min.assign(stride, 0.0f);
+	range_scale.assign(stride, 0.0f);
+	keys.assign(num_keyframes * stride, 0);
+	for (int j = 0; j < (int)components.size(); ++j) {
+		const sComponent& component = components[j];
+		float minimum = key_value(0, component.bone, component.channel, component.c);
+		float maximum = minimum;
+		for (int k = 1; k < num_keyframes; ++k) {
+			const float value = key_value(k, component.bone, component.channel, component.c);
+			minimum = min(minimum, value);
+			maximum = max(maximum, value);
+		}
+		const float range = maximum - minimum;
+		range_min[j] = minimum;
+		range_scale[j] = range / 65535.0f;
+		if (range <= 0.0f)
+			continue;
+		for (int k = 0; k < num_keyframes; ++k) {
+			const float normalized = (key_value(k, component.bone, component.channel, component.c) - minimum) / range;
+			keys[k * stride + j] = (uint16)clamp(floorf(normalized * 65535.0f + 0.5f), 0.0f, 65535.0f);
+		}
+	}
+
+	// Error against the dense keys, in model space for the positions
+	const Skeleton& skeleton = animation->skeleton;
+	std::vector<Skeleton::Bone> dense_bones(skeleton.bones, skeleton.bones + skeleton.num_bones);
+	std::vector<Skeleton::Bone> clip_bones(skeleton.bones, skeleton.bones + skeleton.num_bones);
+	std::vector<Matrix44> dense_globals(skeleton.num_bones);
+	std::vector<Matrix44> clip_globals(skeleton.num_bones);
+	error = sError();
+	double position_sum = 0.0;
+	for (int k = 0; k < num_keyframes; ++k) {
+		for (int i = 0; i < num_bones; ++i)
+			dense_bones[animation->bones_map[i]].model = animation->keyframes[k * num_bones + i];
+		sample(k, k, 0.0f, clip_bones.data());
+
+		ANIMATION_CLIP::compute_globals(dense_bones.data(), skeleton.num_bones, dense_globals.data());
+		ANIMATION_CLIP::compute_globals(clip_bones.data(), skeleton.num_bones, clip_globals.data());
+		for (int b = 0; b < skeleton.num_bones; ++b) {
+			const float distance = (dense_globals[b].getTranslation() - clip_globals[b].getTranslation()).length();
+			error.max_position = max(error.max_position, distance);
+			position_sum += distance;
+		}
+
+		for (int i = 0; i < num_bones; ++i) {
+			Quaternion rotation;
+			Vector3 translation, scale;
+			ANIMATION_CLIP::decompose_matrix(clip_bones[tracks[i].bone].model, rotation, translation, scale);
+			const float cos_half_angle = min(fabsf(DotProduct(rotation, rotations[k * num_bones + i])), 1.0f);
+			error.max_rotation_degrees = max(error.max_rotation_degrees, (float)(2.0f * acosf(cos_half_angle) * RAD2DEG));
+		}
+	}
+	error.avg_position = (float)(position_sum / (num_keyframes * skeleton.num_bones));
+	return true;
+}
+
+void AnimationClip::decodeKeyframe(const int keyframe, float* output) const
+{
+	const uint16* key = keys.data() + keyframe * stride;
+	const float* minimum = range_min.data();
+	const float* scale = range_scale.data();
+#ifdef ANIM_CLIP_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (int i = 0; i < stride; i += 8) {
+		const __m128i packed = _mm_loadu_si128((const __m128i*)(key + i));
+		const __m128 low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, zero));
+		const __m128 high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(packed, zero));
+		_mm_store_ps(output + i, _mm_add_ps(_mm_loadu_ps(minimum + i), _mm_mul_ps(low, _mm_loadu_ps(scale + i))));
+		_mm_store_ps(output + i + 4, _mm_add_ps(_mm_loadu_ps(minimum + i + 4), _mm_mul_ps(high, _mm_loadu_ps(scale + i + 4))));
+	}
+#else
+	#pragma omp simd
+	for (int i = 0; i < stride; ++i)
+		output[i] = minimum[i] + key[i] * scale[i];
+#endif
+}
+
+void AnimationClip::sample(const int keyframe, const int next_keyframe, const float f, Skeleton::Bone* bones, const uint8 layers) const
+{
+	alignas(16) float current[ANIM_CLIP_MAX_COMPONENTS];
+	alignas(16) float next[ANIM_CLIP_MAX_COMPONENTS];
+	decodeKeyframe(keyframe, current);
+	const float* next_values = current;
+	if (next_keyframe != keyframe) {
+		decodeKeyframe(next_keyframe, next);
+		next_values = next;
+	}
+
+	for (const sTrack& track : tracks) {
+		Skeleton::Bone& bone = bones[track.bone];
+		if (layers != 0xFF && !(bone.layer & layers))
+			continue;
+		sampleTrack(track, current, next_values, f, bone.model);
+	}
+}
+
+void AnimationClip::samplePose(const int keyframe, const int next_keyframe, const float f, Matrix44* local_matrices) const
+{
+	alignas(16) float current[ANIM_CLIP_MAX_COMPONENTS];
+	alignas(16) float next[ANIM_CLIP_MAX_COMPONENTS];
+	decodeKeyframe(keyframe, current);
+	const float* next_values = current;
+	if (next_keyframe != keyframe) {
+		decodeKeyframe(next_keyframe, next);
+		next_values = next;
+	}
+
+	for (const sTrack& track : tracks) {
+		sampleTrack(track, current, next_values, f, local_matrices[track.bone]);
+	}
+}
+
+void AnimationClip::sampleTrack(const sTrack& track, const float* current, const float* next, const float f, Matrix44& local_matrix) const
+{
+	Quaternion rotation;
+	Vector3 translation, scale;
+	if (track.flags & ROTATION_ANIMATED)
+		ANIMATION_CLIP::interpolate_rotation(current + track.rotation, next + track.rotation, f, rotation);
+	else
+		rotation = Quaternion(&constants[track.rotation]);
+	if (track.flags & TRANSLATION_ANIMATED)
+		ANIMATION_CLIP::interpolate_vector(current + track.translation, next + track.translation, f, translation);
+	else
+		translation.set(constants[track.translation], constants[track.translation + 1], constants[track.translation + 2]);
+	if (track.flags & SCALE_ANIMATED)
+		ANIMATION_CLIP::interpolate_vector(current + track.scale, next + track.scale, f, scale);
+	else
+		scale.set(constants[track.scale], constants[track.scale + 1], constants[track.scale + 2]);
+	ANIMATION_CLIP::compose_matrix(rotation, translation, scale, local_matrix);
+}
+
+size_t AnimationClip::getBytes() const
+{
+	return sizeof(AnimationClip) + tracks.size() * sizeof(sTrack) + constants.size() * sizeof(float)
+		+ (range_min.size() + range_scale.size()) * sizeof(float) + keys.size() * sizeof(uint16);
+}
+
+struct sClipHeader {
+	int version;
+	int num_keyframes;
+	int stride;
+	int num_tracks;
+	int num_constants;
+	int constant_tracks;
+};
+
+void AnimationClip::write(FILE* f) const
+{
+	sClipHeader header;
+	header.version = ANIM_CLIP_VERSION;
+	header.num_keyframes = num_keyframes;
+	header.stride = stride;
+	header.num_tracks = (int)tracks.size();
+	header.num_constants = (int)constants.size();
+	header.constant_tracks = constant_tracks;
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(tracks.data(), sizeof(sTrack), tracks.size(), f);
+	fwrite(constants.data(), sizeof(float), constants.size(), f);
+	fwrite(range_min.data(), sizeof(float), stride, f);
+	fwrite(range_scale.data(), sizeof(float), stride, f);
+	fwrite(keys.data(), sizeof(uint16), keys.size(), f);
+	fwrite(&error, sizeof(error), 1, f);
+}
+
+const char* AnimationClip::read(const char* pos, const char* end)
+{
+	sClipHeader header;
+	if (pos + sizeof(header) > end)
+		return NULL;
+	memcpy(&header, pos, sizeof(header));
+	pos += sizeof(header);
+	if (header.version != ANIM_CLIP_VERSION || header.stride > ANIM_CLIP_MAX_COMPONENTS)
+		return NULL;
+
+	const size_t bytes = header.num_tracks * sizeof(sTrack) + header.num_constants * sizeof(float)
+		+ 2 * header.stride * sizeof(float) + header.num_keyframes * header.stride * sizeof(uint16) + sizeof(sError);
+	if (pos + bytes > end)
+		return NULL;
+
+	num_keyframes = header.num_keyframes;
+	stride = header.stride;
+	constant_tracks = header.constant_tracks;
+	tracks.resize(header.num_tracks);
+	constants.resize(header.num_constants);
+	range_min.resize(stride);
+	range_scale.resize(stride);
+	keys.resize(num_keyframes * stride);
+
+	memcpy(tracks.data(), pos, tracks.size() * sizeof(sTrack));
+	pos += tracks.size() * sizeof(sTrack);
+	memcpy(constants.data(), pos, constants.size() * sizeof(float));
+	pos += constants.size() * sizeof(float);
+	memcpy(range_min.data(), pos, stride * sizeof(float));
+	pos += stride * sizeof(float);
+	memcpy(range_scale.data(), pos, stride * sizeof(float));
+	pos += stride * sizeof(float);
+	memcpy(keys.data(), pos, keys.size() * sizeof(uint16));
+	pos += keys.size() * sizeof(uint16);
+	memcpy(&error, pos, sizeof(error));
+	pos += sizeof(error);
+	return pos;
+}
+
+namespace ANIMATION_CLIP {
+
+	inline double get_seconds_since(const Uint64 start) {
+		return (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	}
+
+	void generate_animation(Animation& animation, const int num_bones, const float seconds) {
+		const int bones = (int)clamp((float)num_bones, 2.0f, 128.0f);
+		const float samples_per_second = 30.0f;
+
+		// A binary tree of bones, the root moves, the rest rotate and a third of them stay still
+		animation.duration = seconds;
+		animation.samples_per_second = samples_per_second;
+		animation.num_keyframes = max((int)(seconds * samples_per_second), 2);
+		animation.num_animated_bones = bones;
+		Skeleton& skeleton = animation.skeleton;
+		skeleton.num_bones = bones;
+		for (int i = 0; i < bones; ++i) {
+			Skeleton::Bone& bone = skeleton.bones[i];
+			bone = Skeleton::Bone(); // Zeroed, with the identity as the model
+			bone.parent = (int8)(i ? (i - 1) / 2 : -1);
+			snprintf(bone.name, sizeof(bone.name), "bone_%d", i);
+			bone.layer = BODY;
+			bone.model.setTranslation(0.0f, i ? 0.2f : 1.0f, 0.0f);
+			animation.bones_map[i] = (int8)i;
+		}
+
+		animation.keyframes = new Matrix44[animation.num_keyframes * bones];
+		for (int k = 0; k < animation.num_keyframes; ++k) {
+			const float time = k / samples_per_second;
+			for (int i = 0; i < bones; ++i) {
+				Matrix44& key = animation.keyframes[k * bones + i];
+				const Matrix44& rest = skeleton.bones[i].model;
+				if (i % 3 == 2) {
+					key = rest;
+					continue;
+				}
+				key.setRotation(sinf(time * 2.0f + i) * 0.8f, Vector3((float)(i % 2), 1.0f, (float)(i % 5) * 0.25f));
+				key.m[12] = rest.m[12] + (i ? 0.0f : sinf(time));
+				key.m[13] = rest.m[13];
+				key.m[14] = rest.m[14] + (i ? 0.0f : time * 0.5f);
+			}
+		}
+		skeleton.layout_hash = 0;
+		for (int i = 0; i < bones; ++i)
+			skeleton.bones_by_name[skeleton.bones[i].name] = i;
+	}
+
+	void sBenchmark::run() {
+		Animation animation;
+		generate_animation(animation, num_bones, seconds);
+		const int bones = animation.num_animated_bones;
+		Skeleton& skeleton = animation.skeleton;
+
+		dense_bytes = sizeof(Animation) + sizeof(Matrix44) * animation.num_keyframes * bones;
+		animation.compress(true);
+		const AnimationClip* clip = animation.clip;
+		compressed_bytes = sizeof(Animation) + clip->getBytes();
+		constant_tracks = clip->constant_tracks;
+		total_tracks = (int)clip->tracks.size() * 3;
+		error = clip->error;
+
+		// The same times for both
+		const int count = max(samples, 1);
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int s = 0; s < count; ++s) {
+			const float v = fmodf(s * 0.37f, (float)(animation.num_keyframes - 1));
+			animation.sampleKeyframes((int)v, (int)v + 1, v - floorf(v));
+		}
+		dense_us = get_seconds_since(start) * 1e6 / count;
+
+		start = SDL_GetPerformanceCounter();
+		for (int s = 0; s < count; ++s) {
+			const float v = fmodf(s * 0.37f, (float)(animation.num_keyframes - 1));
+			clip->sample((int)v, (int)v + 1, v - floorf(v), skeleton.bones);
+		}
+		compressed_us = get_seconds_since(start) * 1e6 / count;
+
+		has_run = true;
+	}
+
+	void render_imgui() {
+#ifndef SKIP_IMGUI
+		static sBenchmark benchmark;
+		if (ImGui::TreeNode("Animation clips")) {
+			ImGui::Checkbox("Slerp (nlerp otherwise)", &use_slerp);
+			ImGui::Checkbox("Compress on load", &compress_on_load);
+			ImGui::Checkbox("Keep dense keyframes", &keep_keyframes);
+
+			Animation::sAnimationsLoaded.forEach([](const std::string& name, Animation* animation) {
+				const AnimationClip* clip = animation->clip;
+				if (!clip) {
+					ImGui::Text("%s: dense, %.1f KB", name.c_str(), sizeof(Matrix44) * animation->num_keyframes * animation->num_animated_bones / 1024.0f);
+					return;
+				}
+				ImGui::Text("%s: %.1f KB, %d/%d constant tracks, error %.4f max %.4f avg, %.3f deg", name.c_str(), clip->getBytes() / 1024.0f,
+					clip->constant_tracks, (int)clip->tracks.size() * 3, clip->error.max_position, clip->error.avg_position, clip->error.max_rotation_degrees);
+			});
+
+			ImGui::SliderInt("Benchmark bones", &benchmark.num_bones, 2, 128);
+			ImGui::SliderFloat("Benchmark seconds", &benchmark.seconds, 1.0f, 120.0f);
+			if (ImGui::Button("Run clip benchmark")) {
+				benchmark.run();
+			}
+
+			if (benchmark.has_run) {
+				ImGui::Text("Memory: dense %.1f KB, compressed %.1f KB (x%.1f)", benchmark.dense_bytes / 1024.0f, benchmark.compressed_bytes / 1024.0f,
+					(float)benchmark.dense_bytes / benchmark.compressed_bytes);
+				ImGui::Text("Constant tracks: %d/%d", benchmark.constant_tracks, benchmark.total_tracks);
+				ImGui::Text("Sample: dense %.2f us, compressed %.2f us", benchmark.dense_us, benchmark.compressed_us);
+				ImGui::Text("Position error: %.5f max, %.5f avg", benchmark.error.max_position, benchmark.error.avg_position);
+				ImGui::Text("Rotation error: %.4f deg", benchmark.error.max_rotation_degrees);
+			}
+			ImGui::TreePop();
+		}
+#endif
+	}
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <vector>
+#include <cstdio>
+#include "framework.h"
+#include "animation.h"
+
+// ================
+//  ANIMATION CLIP
+// ================
+// The compressed form of the keyframes of an Animation. The local matrix of every animated
+// bone is split in a rotation (quaternion), a translation and a scale track. The tracks that
+// do not change in the whole clip are stored once as floats, the others are quantized to
+// 16 bits per component with the range of each component. The animated components of a
+// keyframe are contiguous, so a keyframe is decoded for all the bones in one SIMD loop.
+
+#define ANIM_CLIP_VERSION 1
+#define ANIM_CLIP_MAX_COMPONENTS 1280 // 128 bones * (4 + 3 + 3), multiple of 8
+
+class AnimationClip {
+public:
+	enum eTrackFlags : uint8 {
+		ROTATION_ANIMATED = 1,
+		TRANSLATION_ANIMATED = 2,
+		SCALE_ANIMATED = 4,
+	};
+
+	// The offsets are in the constants, or in the decoded keyframe if the flag is set
+	struct sTrack {
+		uint8 bone;
+		uint8 flags;
+		uint16 rotation;
+		uint16 translation;
+		uint16 scale;
+	};
+
+	// Measured against the dense keyframes when compressing
+	struct sError {
+		float max_position = 0.0f; // Of the bones in model space
+		float avg_position = 0.0f;
+		float max_rotation_degrees = 0.0f; // Of the local rotations
+	};
+
+	int num_keyframes = 0;
+	int stride = 0; // Animated components per keyframe, padded to 8
+	std::vector<sTrack> tracks;
+	std::vector<float> constants;
+	std::vector<float> range_min; // Per animated component
+	std::vector<float> range_scale; // range / 65535
+	std::vector<uint16> keys; // num_keyframes * stride
+
+	int constant_tracks = 0; // Of the 3 * tracks.size()
+	sError error;
+
+	// Builds the clip from the dense keyframes of the animation
+	bool compress(const Animation* animation);
+
+	// Writes the local matrix of the animated bones in the layers, interpolated between two keyframes
+	void sample(const int keyframe, const int next_keyframe, const float f, Skeleton::Bone* bones, const uint8 layers = 0xFF) const;
+
+	// The same, for all the tracks, in local matrices indexed by bone
+	void samplePose(const int keyframe, const int next_keyframe, const float f, Matrix44* local_matrices) const;
+
+	// The animated components of a keyframe, output has to be 16 byte aligned with stride floats
+	void decodeKeyframe(const int keyframe, float* output) const;
+
+	size_t getBytes() const;
+
+	// After the ABIN header and skeleton
+	void write(FILE* f) const;
+	const char* read(const char* pos, const char* end);
+
+private:
+	void sampleTrack(const sTrack& track, const float* current, const float* next, const float f, Matrix44& local_matrix) const;
+};
+
+namespace ANIMATION_CLIP {
+
+	extern bool use_slerp; // nlerp otherwise
+	extern bool compress_on_load;
+	extern bool keep_keyframes; // The dense keyframes are freed after compressing
+
+	// A track is constant if no key is further than this from the first one
+	extern float rotation_tolerance; // 1 - |dot| of the quaternions
+	extern float translation_tolerance;
+	extern float scale_tolerance;
+
+	// Splits a local matrix, the scale is negative in x if the matrix mirrors
+	void decompose_matrix(const Matrix44& matrix, Quaternion& rotation, Vector3& translation, Vector3& scale);
+	void compose_matrix(const Quaternion& rotation, const Vector3& translation, const Vector3& scale, Matrix44& matrix);
+
+	// A binary tree of bones with keyframes, for the benchmarks
+	void generate_animation(Animation& animation, const int num_bones, const float seconds);
+
+	// Generates a clip in memory and times the dense and the compressed sampling
+	struct sBenchmark {
+		int num_bones = 64;
+		float seconds = 10.0f;
+		int samples = 10000;
+
+		size_t dense_bytes = 0;
+		size_t compressed_bytes = 0;
+		double dense_us = 0.0; // Per sample of all the bones
+		double compressed_us = 0.0;
+		int constant_tracks = 0;
+		int total_tracks = 0;
+		AnimationClip::sError error;
+		bool has_run = false;
+
+		void run();
+	};
+
+	void render_imgui();
+};
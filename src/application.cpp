@@ -10,6 +10,8 @@
 #include "prefab.h"
 #include "gltf_loader.h"
 #include "renderer.h"
+#include "asset_memory.h"
+#include "animation_batch.h"
 
 #include <cmath>
 #include <string>
@@ -105,6 +107,9 @@ void Application::render(void)
 
 	renderer->renderScene(scene, camera);
 
+	//frees the memory of the assets not used lately if it is over the budget
+	ASSET_MEMORY::update();
+
 	//Draw the floor grid, helpful to have a reference point
 	//if(render_debug)
 	//	drawGrid();
@@ -119,6 +124,9 @@ void Application::update(double seconds_elapsed)
 {
 	float speed = seconds_elapsed * cam_speed; //the speed is defined by the seconds_elapsed so it goes constant
 	float orbit_speed = seconds_elapsed * 0.5;
+
+	//all the animated instances, in the worker threads
+	ANIMATION_BATCH::scene_batch.update(seconds_elapsed);
 	
 	//async input to move the camera around
 	if (Input::isKeyPressed(SDL_SCANCODE_LSHIFT)) speed *= 10; //move faster with left shift
@@ -253,6 +261,9 @@ void Application::renderDebugGUI(void)
 		ImGui::TreePop();
 	}
 
+	scene->renderLoadingInMenu();
+	ASSET_MEMORY::render_imgui();
+
 	//add info to the debug panel about the camera
 	if (ImGui::TreeNode(camera, "Camera")) {
 		camera->renderInMenu();
@@ -368,5 +379,6 @@ void Application::onResize(int width, int height)
 	camera->aspect =  width / (float)height;
 	window_width = width;
 	window_height = height;
+	renderer->onResize();
 }
 
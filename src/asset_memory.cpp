@@ -0,0 +1,123 @@
+#include "asset_memory.h"
+#include "includes.h"
+#include "mesh.h"
+#include "texture.h"
+
+#include <vector>
+#include <algorithm>
+
+namespace ASSET_MEMORY {
+
+	uint32_t frame = 1;
+	int vram_budget_mb = 2048;
+	int ram_budget_mb = 1024;
+	int min_unused_frames = 120;
+
+	sStats stats;
+	int eviction_count = 0;
+	int reload_count = 0;
+
+	struct sCandidate {
+		Mesh* mesh;
+		Texture* texture;
+		bool is_referenced;
+		uint32_t last_used_frame;
+		size_t bytes;
+	};
+
+	// The unreferenced first, then the least recently used
+	inline bool is_evicted_before(const sCandidate& a, const sCandidate& b) {
+		if (a.is_referenced != b.is_referenced)
+			return !a.is_referenced;
+		return a.last_used_frame < b.last_used_frame;
+	}
+
+	inline bool is_unused(const uint32_t last_used_frame) {
+		return frame - last_used_frame > (uint32_t)min_unused_frames;
+	}
+
+	void evict_VRAM(size_t bytes_to_free) {
+		std::vector<sCandidate> candidates;
+		Mesh::sMeshesLoaded.forEach([&candidates](const std::string& name, Mesh* mesh) {
+			if (!mesh->evicted && mesh->vram_bytes && mesh->canEvict() && is_unused(mesh->last_used_frame))
+				candidates.push_back({ mesh, NULL, mesh->ref_count > 0, mesh->last_used_frame, mesh->vram_bytes });
+		});
+		Texture::sTexturesLoaded.forEach([&candidates](const std::string& name, Texture* texture) {
+			if (!texture->evicted && texture->reloadable && !texture->loading && is_unused(texture->last_used_frame))
+				candidates.push_back({ NULL, texture, texture->ref_count > 0, texture->last_used_frame, texture->getVRAMBytes() });
+		});
+		std::sort(candidates.begin(), candidates.end(), is_evicted_before);
+
+		size_t freed = 0;
+		for (int i = 0; i < candidates.size() && freed < bytes_to_free; i++) {
+			if (candidates[i].mesh)
+				candidates[i].mesh->evictFromVRAM();
+			else
+				candidates[i].texture->evictFromVRAM();
+			freed += candidates[i].bytes;
+			eviction_count++;
+		}
+	}
+
+	// The CPU copy is not needed to render, so the meshes in VRAM can free it at any time.
+	// Except the recent occluders, that are rasterized from it
+	void release_RAM(size_t bytes_to_free) {
+		std::vector<sCandidate> candidates;
+		Mesh::sMeshesLoaded.forEach([&candidates](const std::string& name, Mesh* mesh) {
+			const bool is_occluder = mesh->last_occluder_frame && !is_unused(mesh->last_occluder_frame);
+			if (!mesh->evicted && !is_occluder && mesh->vram_bytes && mesh->hasCPUData() && mesh->reload_callback)
+				candidates.push_back({ mesh, NULL, mesh->ref_count > 0, mesh->last_used_frame, mesh->getRAMBytes() });
+		});
+		std::sort(candidates.begin(), candidates.end(), is_evicted_before);
+
+		size_t freed = 0;
+		for (int i = 0; i < candidates.size() && freed < bytes_to_free; i++) {
+			candidates[i].mesh->releaseCPUData();
+			freed += candidates[i].bytes;
+		}
+	}
+
+	void update() {
+		stats = sStats();
+		Mesh::sMeshesLoaded.forEach([](const std::string& name, Mesh* mesh) {
+			stats.mesh_count++;
+			stats.mesh_vram += mesh->vram_bytes;
+			stats.mesh_ram += mesh->getRAMBytes();
+			stats.evicted_meshes += mesh->evicted ? 1 : 0;
+			stats.unreferenced_assets += (mesh->ref_count == 0) ? 1 : 0;
+		});
+		Texture::sTexturesLoaded.forEach([](const std::string& name, Texture* texture) {
+			stats.texture_count++;
+			stats.texture_vram += texture->getVRAMBytes();
+			stats.evicted_textures += texture->evicted ? 1 : 0;
+			stats.unreferenced_assets += (texture->ref_count == 0) ? 1 : 0;
+		});
+
+		const size_t MB = 1024 * 1024;
+		size_t vram = stats.mesh_vram + stats.texture_vram;
+		if (vram > (size_t)vram_budget_mb * MB)
+			evict_VRAM(vram - (size_t)vram_budget_mb * MB);
+		if (stats.mesh_ram > (size_t)ram_budget_mb * MB)
+			release_RAM(stats.mesh_ram - (size_t)ram_budget_mb * MB);
+
+		frame++;
+	}
+
+	void render_imgui() {
+#ifndef SKIP_IMGUI
+		if (ImGui::TreeNode("Asset memory")) {
+			const float to_MB = 1.0f / (1024.0f * 1024.0f);
+			ImGui::SliderInt("VRAM budget (MB)", &vram_budget_mb, 64, 8192);
+			ImGui::SliderInt("RAM budget (MB)", &ram_budget_mb, 64, 8192);
+			ImGui::SliderInt("Min unused frames", &min_unused_frames, 1, 1000);
+			ImGui::Text("VRAM: %.2f MB (meshes %.2f, textures %.2f)", (stats.mesh_vram + stats.texture_vram) * to_MB, stats.mesh_vram * to_MB, stats.texture_vram * to_MB);
+			ImGui::Text("RAM meshes: %.2f MB", stats.mesh_ram * to_MB);
+			ImGui::Text("Meshes: %d (%d evicted)", stats.mesh_count, stats.evicted_meshes);
+			ImGui::Text("Textures: %d (%d evicted)", stats.texture_count, stats.evicted_textures);
+			ImGui::Text("Unreferenced: %d", stats.unreferenced_assets);
+			ImGui::Text("Evictions: %d Reloads: %d", eviction_count, reload_count);
+			ImGui::TreePop();
+		}
+#endif
+	}
+};
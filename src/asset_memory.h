@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// ================
+//  ASSET MEMORY
+// ================
+// Accounting of the memory of the meshes and textures in the registries, and eviction
+// when it goes over the budget. The assets are referenced by the prefabs that entities
+// use and by the materials of those prefabs, and every draw stamps the frame in them.
+// Over the VRAM budget, the GPU copy of the assets that were not drawn recently is freed,
+// the unreferenced ones first and then the least recently used. Over the RAM budget, the
+// CPU copy of the meshes that are in VRAM is freed. An evicted asset is uploaded again
+// the next time it is drawn, or read again from its file in the loading threads.
+
+namespace ASSET_MEMORY {
+
+	extern uint32_t frame; // Increased in every update, the assets keep the last frame they were used
+	extern int vram_budget_mb;
+	extern int ram_budget_mb;
+	extern int min_unused_frames; // The assets used more recently are never evicted
+
+	struct sStats {
+		size_t mesh_vram = 0;
+		size_t mesh_ram = 0;
+		size_t texture_vram = 0;
+		int mesh_count = 0;
+		int texture_count = 0;
+		int evicted_meshes = 0;
+		int evicted_textures = 0;
+		int unreferenced_assets = 0;
+	};
+	extern sStats stats; // Of the last update
+
+	// Totals since the start
+	extern int eviction_count;
+	extern int reload_count;
+
+	// Once per frame, after rendering
+	void update();
+
+	void render_imgui();
+};
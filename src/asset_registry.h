@@ -0,0 +1,213 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+
+// ================
+//  ASSET REGISTRY
+// ================
+// The loaded assets (meshes, textures, materials, prefabs, shaders, animations) are
+// stored by the 64 bit hash of their name in an open addressing table. A slot never
+// moves once its key is claimed, so the lookups do not lock and a Handle can keep
+// the slot it found. Adding and removing are serialized between them with a mutex.
+
+// FNV-1a, constexpr so the names written as literals are hashed at compile time.
+// The hash can be continued, hashAssetName("b", hashAssetName("a")) == hashAssetName("ab")
+#define ASSET_HASH_SEED 14695981039346656037ULL
+constexpr uint64_t hashAssetName(const char* str, uint64_t hash = ASSET_HASH_SEED) {
+	while (*str) {
+		hash = (hash ^ (uint64_t)(unsigned char)*str) * 1099511628211ULL;
+		str++;
+	}
+	return hash;
+}
+
+inline uint64_t hashAssetName(const std::string& str, uint64_t hash = ASSET_HASH_SEED) {
+	return hashAssetName(str.c_str(), hash);
+}
+
+// Continues the hash with the decimal digits of the number, as if it was in the string
+inline uint64_t hashAssetNumber(int number, uint64_t hash) {
+	char digits[16];
+	snprintf(digits, sizeof(digits), "%d", number);
+	return hashAssetName(digits, hash);
+}
+
+template<typename T>
+class AssetRegistry {
+public:
+	struct sSlot {
+		std::atomic<uint64_t> key;
+		std::atomic<T*> asset; // NULL if removed, the key keeps the slot
+		std::string name; // Written before the asset is published, for the UI and the logs
+	};
+
+	const char* type_name;
+
+	// capacity is rounded to a power of two, the table does not grow because the slots can not move
+	AssetRegistry(const char* type_name, int capacity) : type_name(type_name) {
+		int size = 1;
+		while (size < capacity) size <<= 1;
+		slot_mask = size - 1;
+		slots = new sSlot[size];
+		for (int i = 0; i < size; ++i) {
+			slots[i].key.store(0, std::memory_order_relaxed);
+			slots[i].asset.store(NULL, std::memory_order_relaxed);
+		}
+	}
+	~AssetRegistry() { delete[] slots; }
+
+	inline int capacity() const { return slot_mask + 1; }
+	inline int size() const { return used_slots.load(std::memory_order_relaxed) - removed_count.load(std::memory_order_relaxed); }
+
+	// The key 0 marks the empty slots, the hashes that give 0 are moved to 1
+	static inline uint64_t validKey(uint64_t key) { return key ? key : 1; }
+
+	// -1 if the key was never added, lock free
+	int findSlot(uint64_t key) const {
+		key = validKey(key);
+		for (int i = 0; i <= slot_mask; ++i) {
+			int slot = (int)((key + i) & slot_mask);
+			uint64_t slot_key = slots[slot].key.load(std::memory_order_acquire);
+			if (slot_key == key)
+				return slot;
+			if (slot_key == 0)
+				return -1;
+		}
+		return -1;
+	}
+
+	inline uint64_t keyAt(int slot) const { return slots[slot].key.load(std::memory_order_acquire); }
+	inline T* at(int slot) const { return slots[slot].asset.load(std::memory_order_acquire); }
+	inline const std::string& nameAt(int slot) const { return slots[slot].name; }
+
+	inline T* find(uint64_t key) const {
+		int slot = findSlot(key);
+		return (slot == -1) ? NULL : at(slot);
+	}
+	inline T* find(const char* name) const { return find(hashAssetName(name)); }
+	inline T* find(const std::string& name) const { return find(hashAssetName(name.c_str())); }
+
+	// Replaces the asset if the key is already used, returns the slot.
+	// -1 if the table is full, then the asset still works but it can not be found by its name
+	int add(uint64_t key, const std::string& name, T* asset) {
+		key = validKey(key);
+		const std::lock_guard<std::mutex> lock(write_mutex);
+		for (int i = 0; i <= slot_mask; ++i) {
+			int slot = (int)((key + i) & slot_mask);
+			sSlot& entry = slots[slot];
+			uint64_t slot_key = entry.key.load(std::memory_order_relaxed);
+			if (slot_key == key) {
+				if (!entry.asset.load(std::memory_order_relaxed))
+					removed_count--;
+				else if (entry.name != name)
+					std::cout << "[WARN] " << type_name << " hash collision: " << entry.name << " and " << name << std::endl;
+				entry.asset.store(asset, std::memory_order_release);
+				return slot;
+			}
+			if (slot_key != 0)
+				continue;
+
+			// Keep a free part of the table, so the lookups of missing keys stay short
+			if (used_slots.load(std::memory_order_relaxed) >= capacity() * 3 / 4)
+				break;
+			entry.name = name;
+			entry.asset.store(asset, std::memory_order_relaxed);
+			entry.key.store(key, std::memory_order_release);
+			used_slots++;
+			return slot;
+		}
+		std::cout << "[ERROR] " << type_name << " registry full (" << capacity() << " slots), " << name << " is not registered. Increase the capacity" << std::endl;
+		assert(false && "Asset registry full, increase the capacity");
+		return -1;
+	}
+	inline int add(const std::string& name, T* asset) { return add(hashAssetName(name.c_str()), name, asset); }
+
+	// Only if the slot still has this asset, so a replaced asset does not remove the new one
+	void remove(uint64_t key, T* asset = NULL) {
+		const std::lock_guard<std::mutex> lock(write_mutex);
+		int slot = findSlot(key);
+		if (slot == -1)
+			return;
+		T* current = slots[slot].asset.load(std::memory_order_relaxed);
+		if (!current || (asset && current != asset))
+			return;
+		slots[slot].asset.store(NULL, std::memory_order_release);
+		removed_count++;
+	}
+	inline void remove(const std::string& name, T* asset = NULL) { remove(hashAssetName(name.c_str()), asset); }
+
+	// Calls func(name, asset) for every asset, the order is the one of the table
+	template<typename F>
+	void forEach(F func) const {
+		int used = used_slots.load(std::memory_order_acquire);
+		for (int i = 0; i <= slot_mask && used > 0; ++i) {
+			if (!slots[i].key.load(std::memory_order_acquire))
+				continue;
+			used--;
+			T* asset = at(i);
+			if (asset)
+				func(slots[i].name, asset);
+		}
+	}
+
+	// Removes all, the assets are not deleted
+	void clear() {
+		const std::lock_guard<std::mutex> lock(write_mutex);
+		for (int i = 0; i <= slot_mask; ++i) {
+			if (slots[i].key.load(std::memory_order_relaxed) && slots[i].asset.load(std::memory_order_relaxed)) {
+				slots[i].asset.store(NULL, std::memory_order_release);
+				removed_count++;
+			}
+		}
+	}
+
+private:
+	sSlot* slots;
+	int slot_mask;
+	std::atomic<int> used_slots{ 0 };
+	std::atomic<int> removed_count{ 0 };
+	std::mutex write_mutex;
+};
+
+// Where the registry of every asset type is, declared next to each class
+template<typename T> AssetRegistry<T>& getAssetRegistry();
+
+// A name hashed once, the slot is found in the first use and kept.
+// Declare them static in the hot paths: static const Handle<Shader> sh_skybox("skybox");
+template<typename T>
+struct Handle {
+	uint64_t key;
+	mutable std::atomic<int> slot; // The static handles can be used from several threads
+
+	constexpr Handle() : key(0), slot(-1) {}
+	constexpr explicit Handle(uint64_t key) : key(key), slot(-1) {}
+	constexpr explicit Handle(const char* name) : key(hashAssetName(name)), slot(-1) {}
+	Handle(const Handle& other) : key(other.key), slot(other.slot.load(std::memory_order_relaxed)) {}
+	Handle& operator = (const Handle& other) {
+		key = other.key;
+		slot.store(other.slot.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		return *this;
+	}
+
+	inline bool isValid() const { return key != 0; }
+
+	T* get() const {
+		AssetRegistry<T>& registry = getAssetRegistry<T>();
+		int index = slot.load(std::memory_order_relaxed);
+		if (index == -1) {
+			index = registry.findSlot(key);
+			if (index == -1)
+				return NULL;
+			slot.store(index, std::memory_order_relaxed);
+		}
+		return registry.at(index);
+	}
+	inline T* operator->() const { return get(); }
+	inline operator T*() const { return get(); }
+};
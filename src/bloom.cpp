@@ -1,88 +1,97 @@
 #include "bloom.h"
 
-void GTR::SBloom_Component::init(const vec2 size) {
-	bloom_FBO = new FBO();
-	bloom_FBO->create(size.x, size.y, 1, GL_RGBA, GL_FLOAT);
-	threshold_FBO = new FBO();
-	threshold_FBO->create(size.x, size.y, 1, GL_RGBA, GL_FLOAT);
+int GTR::SBloom_Component::get_level_count(const vec2& resolution) const {
+	int count = 0;
+	float size = min(resolution.x, resolution.y) * 0.5f;
+	while (count < levels && count < BLOOM_MAX_LEVELS && size >= 2.0f) {
+		count++;
+		size *= 0.5f;
+	}
+	return max(count, 1);
 }
 
 Texture* GTR::SBloom_Component::bloom_pass(Texture* text) {
 	if (!enabled_bloom)
 		return text;
 
-	Shader* shader = Shader::Get("threshold_bloom");
 	Mesh* quad = Mesh::getQuad();
-	
-	threshold_FBO->bind();
-	threshold_FBO->enableSingleBuffer(0);
-	glClearColor(0.1, 0.1, 0.1, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	const int level_count = get_level_count(vec2(text->width, text->height));
+	const float screen_pixels = text->width * text->height;
+	written_screens = 0.0f;
 
-	shader->enable();
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
 
-	shader->setUniform("u_color_tex", text, 0);
+	// Downsample, the first level also removes the dark pixels
+	static const Handle<Shader> sh_bloom_downsample("bloom_downsample");
+	Shader* shader = sh_bloom_downsample.get();
+	shader->enable();
 	shader->setUniform("u_threshold_min", threshold_min);
 	shader->setUniform("u_threshold_max", threshold_max);
-
-	quad->render(GL_TRIANGLES);
-
+	for (int i = 0; i < level_count; i++) {
+		Texture* source = (i == 0) ? text : mip_FBOs[i - 1]->color_textures[0];
+		mip_FBOs[i]->bind();
+		shader->setUniform("u_color_tex", source, 0);
+		shader->setUniform("u_texel_size", vec2(1.0f / source->width, 1.0f / source->height));
+		shader->setUniform("u_apply_threshold", (i == 0) ? 1 : 0);
+		quad->render(GL_TRIANGLES);
+		mip_FBOs[i]->unbind();
+		written_screens += mip_FBOs[i]->width * mip_FBOs[i]->height / screen_pixels;
+	}
 	shader->disable();
 
-	threshold_FBO->unbind();
-
-	threshold_FBO->color_textures[0]->generateMipmaps();
-	int numLevels = (log2(max(text->width, text->height)));
-
-	shader = Shader::Get("bloom");
-
-	bloom_FBO->bind();
-	bloom_FBO->enableSingleBuffer(0);
-	glClearColor(0.1, 0.1, 0.1, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	// Upsample, each level is added on top of the one above it
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	static const Handle<Shader> sh_bloom_upsample("bloom_upsample");
+	shader = sh_bloom_upsample.get();
 	shader->enable();
-
-	shader->setUniform("u_color_tex", threshold_FBO->color_textures[0], 1);
-	shader->setUniform("u_max_step_LOD", numLevels - (numLevels - max_LOD) );
-	shader->setUniform("u_bloom_steps_num", min(bloom_steps, numLevels));
-	shader->setUniform("u_min_step", min_step_size);
-
-	quad->render(GL_TRIANGLES);
-
+	for (int i = level_count - 2; i >= 0; i--) {
+		Texture* source = mip_FBOs[i + 1]->color_textures[0];
+		mip_FBOs[i]->bind();
+		shader->setUniform("u_color_tex", source, 0);
+		shader->setUniform("u_texel_size", vec2(1.0f / source->width, 1.0f / source->height));
+		quad->render(GL_TRIANGLES);
+		mip_FBOs[i]->unbind();
+		written_screens += mip_FBOs[i]->width * mip_FBOs[i]->height / screen_pixels;
+	}
 	shader->disable();
-	bloom_FBO->unbind();
-
-	threshold_FBO->bind();
-	// Blur AO PASS ======
-	threshold_FBO->enableSingleBuffer(0);
-	glClearColor(0.1, 0.1, 0.1, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	shader = Shader::Get("blur_and_sum");
+	glDisable(GL_BLEND);
 
+	// The last upsample goes with the original image
+	Texture* bloom_tex = mip_FBOs[0]->color_textures[0];
+	composite_FBO->bind();
+	static const Handle<Shader> sh_bloom_composite("bloom_composite");
+	shader = sh_bloom_composite.get();
 	shader->enable();
-	shader->setUniform("u_to_blur_tex", bloom_FBO->color_textures[0], 2);
 	shader->setUniform("u_color_tex", text, 0);
+	shader->setUniform("u_bloom_tex", bloom_tex, 1);
+	shader->setUniform("u_texel_size", vec2(1.0f / bloom_tex->width, 1.0f / bloom_tex->height));
+	shader->setUniform("u_intensity", intensity);
 	quad->render(GL_TRIANGLES);
 	shader->disable();
+	composite_FBO->unbind();
+	written_screens += 1.0f;
 
-	threshold_FBO->unbind();
-
-	return threshold_FBO->color_textures[0];
+	return composite_FBO->color_textures[0];
 }
 
 
 void GTR::SBloom_Component::render_imgui() {
+#ifndef SKIP_IMGUI
 	if (ImGui::TreeNode("Bloom")) {
 
 		ImGui::Checkbox("Enable bloom", &enabled_bloom);
 	
-		ImGui::SliderInt("# of steps", &bloom_steps, 2, 15);
-		ImGui::SliderInt("MIN steps", &min_step_size, 1, 15);
-		ImGui::SliderInt("Max LOD", &max_LOD, 1, 20);
+		ImGui::SliderInt("Levels", &levels, 1, BLOOM_MAX_LEVELS);
+		ImGui::SliderFloat("Intensity", &intensity, 0.0f, 2.0f);
 
 		ImGui::SliderFloat("Threshold", &threshold_min, 0.10f, 10.0f);
+		ImGui::SliderFloat("Max luminance", &threshold_max, 1.0f, 50.0f);
+
+		ImGui::Text("Pixels written: %.2fx a full screen pass", written_screens);
 
 		ImGui::TreePop();
 	}
+#endif
 }
@@ -6,27 +6,40 @@
 #include "fbo.h"
 #include "scene.h"
 
+// ================
+//  BLOOM
+// ================
+// Dual filter bloom: the bright pixels are downsampled through a chain of half
+// size targets, and upsampled back adding each level to the one above it.
+// Each level costs a quarter of the previous, so the whole chain is close to
+// the cost of one full screen pass.
+
+#define BLOOM_MAX_LEVELS 8
+
 namespace GTR {
 	
 	struct SBloom_Component {
 
-		FBO* bloom_FBO = NULL;
-		FBO* threshold_FBO = NULL;
+		// Transient, set by the frame graph. Level i is 1 / 2^(i+1) of the resolution, R11G11B10F
+		FBO* mip_FBOs[BLOOM_MAX_LEVELS] = {};
+		FBO* composite_FBO = NULL;
 
-		int bloom_steps = 5;
-		int max_LOD = 3;
-		int min_step_size = 1;
+		int levels = 6;
+		float intensity = 0.5f;
 
 		float threshold_min = 0.5f;
-		float threshold_max = 10.5f;
+		float threshold_max = 10.5f; // Clamps the luminance, so single very bright pixels do not flicker
 
 		bool enabled_bloom = false;
 
-		void init(const vec2 size);
+		// Stats: pixels written by the last bloom, relative to a full screen pass
+		float written_screens = 0.0f;
+
+		// Levels that fit in the resolution, the smallest one is at least 2 pixels
+		int get_level_count(const vec2 &resolution) const;
 
 		Texture* bloom_pass(Texture* base);
 
 		void render_imgui();
 	};
 };
-
@@ -2,17 +2,6 @@
 
 // Defintion of the Deferred rendering functions
 
-void GTR::Renderer::_init_deferred_renderer() {
-	deferred_gbuffer = new FBO();
-
-	deferred_gbuffer->create(Application::instance->window_width, Application::instance->window_height, 
-		4,
-		GL_RGBA, 
-		GL_FLOAT,  // Enought..? Now, yes
-		true);
-}
-
-
 inline void GTR::Renderer::forwardOpacyRenderDrawCall(const sDrawCall& draw_call, const Scene* scene) {
 	//in case there is nothing to do
 	if (!draw_call.mesh || !draw_call.mesh->getNumVertices() || !draw_call.material)
@@ -34,7 +23,7 @@ inline void GTR::Renderer::forwardOpacyRenderDrawCall(const sDrawCall& draw_call
 	assert(glGetError() == GL_NO_ERROR);
 
 	//chose a shader
-	shader = Shader::Get("forward_singlepass_pbr");
+	shader = ShaderVariants::Get(VARIANT_FORWARD_PBR, get_material_features(draw_call) | get_renderer_features());
 
 	assert(glGetError() == GL_NO_ERROR);
 
@@ -45,42 +34,39 @@ inline void GTR::Renderer::forwardOpacyRenderDrawCall(const sDrawCall& draw_call
 
 	// Upload light data
 	// Common data of the lights
-	shader->setUniform("u_ambient_light", scene->ambient_light);
-	shader->setUniform3Array("u_light_pos", (float*)draw_call.light_positions, draw_call.light_count);
-	shader->setUniform3Array("u_light_color", (float*)draw_call.light_color, draw_call.light_count);
-	shader->setUniform1Array("u_light_type", (int*)draw_call.light_type, draw_call.light_count);
-	shader->setUniform1Array("u_light_shadow_id", (int*)draw_call.light_shadow_id, draw_call.light_count);
-	shader->setUniform1Array("u_light_max_dist", (float*)draw_call.light_max_distance, draw_call.light_count);
-	shader->setUniform1Array("u_light_intensities", draw_call.light_intensities, draw_call.light_count);
-	shader->setUniform("u_num_lights", draw_call.light_count);
-	shader->setUniform("u_material_type", draw_call.pbr_structure);
+	shader->setUniform(UNIFORM::u_ambient_light, scene->ambient_light);
+	shader->setUniform3Array(UNIFORM::u_light_pos, (float*)draw_call.light_positions, draw_call.light_count);
+	shader->setUniform3Array(UNIFORM::u_light_color, (float*)draw_call.light_color, draw_call.light_count);
+	shader->setUniform1Array(UNIFORM::u_light_type, (int*)draw_call.light_type, draw_call.light_count);
+	shader->setUniform1Array(UNIFORM::u_light_shadow_id, (int*)draw_call.light_shadow_id, draw_call.light_count);
+	shader->setUniform1Array(UNIFORM::u_light_max_dist, (float*)draw_call.light_max_distance, draw_call.light_count);
+	shader->setUniform1Array(UNIFORM::u_light_intensities, draw_call.light_intensities, draw_call.light_count);
+	shader->setUniform(UNIFORM::u_num_lights, draw_call.light_count);
 
 	// Spotlight data of the lights
-	shader->setUniform3Array("u_light_direction", (float*)draw_call.light_direction, draw_call.light_count);
-	shader->setUniform1Array("u_light_cone_angle", (float*)draw_call.light_cone_angle, draw_call.light_count);
-	shader->setUniform1Array("u_light_cone_decay", (float*)draw_call.light_cone_decay, draw_call.light_count);
+	shader->setUniform3Array(UNIFORM::u_light_direction, (float*)draw_call.light_direction, draw_call.light_count);
+	shader->setUniform1Array(UNIFORM::u_light_cone_angle, (float*)draw_call.light_cone_angle, draw_call.light_count);
+	shader->setUniform1Array(UNIFORM::u_light_cone_decay, (float*)draw_call.light_cone_decay, draw_call.light_count);
 
 	//upload uniforms
-	shader->setUniform("u_viewprojection", draw_call.camera->viewprojection_matrix);
-	shader->setUniform("u_camera_position", draw_call.camera->eye);
-	shader->setUniform("u_model", draw_call.model);
+	shader->setUniform(UNIFORM::u_viewprojection, draw_call.camera->viewprojection_matrix);
+	shader->setUniform(UNIFORM::u_camera_position, draw_call.camera->eye);
+	shader->setUniform(UNIFORM::u_model, draw_call.model);
 	float t = getTime();
-	shader->setUniform("u_time", t);
+	shader->setUniform(UNIFORM::u_time, t);
 
 	// Material properties
-	shader->setUniform("u_color", draw_call.material->color);
-	int enabled_texteres = bind_textures(draw_call.material, shader);
-
-	shader->setUniform("u_enabled_texteres", enabled_texteres);
+	shader->setUniform(UNIFORM::u_color, draw_call.material->color);
+	bind_textures(draw_call.material, shader);
 
 	// Set the shadowmap
 	shadowmap_renderer.bind_shadows(shader);
 
 	//this is used to say which is the alpha threshold to what we should not paint a pixel on the screen (to cut polygons according to texture alpha)
-	shader->setUniform("u_alpha_cutoff", draw_call.material->alpha_mode == GTR::eAlphaMode::MASK ? draw_call.material->alpha_cutoff : 0);
+	shader->setUniform(UNIFORM::u_alpha_cutoff, draw_call.material->alpha_mode == GTR::eAlphaMode::MASK ? draw_call.material->alpha_cutoff : 0);
 
 	//do the draw call that renders the mesh into the screen
-	draw_call.mesh->render(GL_TRIANGLES);
+	SKINNING::render(shader, draw_call);
 
 	//disable shader
 	shader->disable();
@@ -89,27 +75,44 @@ inline void GTR::Renderer::forwardOpacyRenderDrawCall(const sDrawCall& draw_call
 	glDisable(GL_BLEND);
 }
 
-void GTR::Renderer::deferredRenderDecal(const DecalEntity* ent, Camera *cam, Texture* depth) {
-	Mesh cube;
-	cube.createCube();
+// The decals come sorted by texture, each run with the same texture is a single instanced draw
+void GTR::Renderer::deferredRenderDecals(const std::vector<DecalEntity*>& decals, Camera* cam) {
+	Shader* shader = ShaderVariants::Get(VARIANT_DEFERRED_DECALS, get_renderer_features());
 
-	Shader* shader = Shader::Get("deferred_decals");
+	Matrix44 inv_viewprojection = cam->viewprojection_matrix;
+	inv_viewprojection.inverse();
 
 	shader->enable();
-	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
-	shader->setUniform("u_model", ent->model);
-	shader->setUniform("u_color_tex", ent->color_tex, 1);
-	shader->setUniform("u_depth_tex", depth, 2);
-	shader->setUniform("u_iRes", vec2(Application::instance->window_width, Application::instance->window_height));
-	
-	cube.render(GL_TRIANGLES);
+	shader->setUniform("u_viewprojection", cam->viewprojection_matrix);
+	shader->setUniform("u_inv_viewprojection", inv_viewprojection);
+	shader->setUniform("u_depth_tex", depth_decal_fbo->depth_texture, 3);
+
+	std::vector<Matrix44> models;
+	for (int i = 0; i < decals.size(); i++) {
+		models.push_back(decals[i]->model);
+
+		bool batch_ends = (i + 1 == decals.size()) || (decals[i + 1]->color_tex != decals[i]->color_tex);
+		if (!batch_ends) {
+			continue;
+		}
+
+		shader->setUniform("u_color_tex", decals[i]->color_tex, 1);
+		decal_cube->renderInstanced(GL_TRIANGLES, &models[0], models.size());
+		models.clear();
+	}
 
 	shader->disable();
 }
 
-void GTR::Renderer::deferredRenderScene(const Scene* scene, Camera* camera, FBO* resulting_fbo, CULLING::sSceneCulling* scene_data) {
+// Fills the GBuffer and the decals, deferred_gbuffer and depth_decal_fbo are given by the frame graph
+void GTR::Renderer::deferredGeometryPass(const Scene* scene, Camera* camera, CULLING::sSceneCulling* scene_data) {
 	deferred_gbuffer->bind();
 
+	// The packed albedo is sRGB, the hardware encodes it on write
+	if (use_packed_gbuffer) {
+		glEnable(GL_FRAMEBUFFER_SRGB);
+	}
+
 	// Clean last frame
 	deferred_gbuffer->enableSingleBuffer(0);
 	glClearColor(0.1, 0.1, 0.1, 1.0);
@@ -131,68 +134,59 @@ void GTR::Renderer::deferredRenderScene(const Scene* scene, Camera* camera, FBO*
 
 	// Note, only render the opaque drawcalls
 
-	//std::cout << _opaque_objects.size() << std::endl;
+	// The skinned ones are drawn after, an instanced draw per mesh and material
+	std::vector<const sDrawCall*> skinned_draw_calls;
 	for (uint16_t i = 0; i < scene_data->_opaque_objects.size(); i++) {
+		if (SKINNING::use_instancing && scene_data->_opaque_objects[i].palette_offset != -1) {
+			skinned_draw_calls.push_back(&scene_data->_opaque_objects[i]);
+			continue;
+		}
 		renderDeferredPlainDrawCall(scene_data->_opaque_objects[i], scene);
 	}
 
-	if (scene->decals.size() > 0) {
-		// Copy depth bufffer
-		deferred_gbuffer->unbind();
-		if (depth_decal_fbo == NULL) {
-			depth_decal_fbo = new FBO();
-			depth_decal_fbo->create(deferred_gbuffer->width, deferred_gbuffer->height, 4, GL_RGBA, GL_FLOAT, true);
+	std::sort(skinned_draw_calls.begin(), skinned_draw_calls.end(), SKINNING::draw_call_batch_comp);
+	SKINNING::sInstances instances;
+	for (uint16_t i = 0; i < skinned_draw_calls.size(); i++) {
+		instances.add(skinned_draw_calls[i]->model, skinned_draw_calls[i]->palette_offset);
+
+		bool batch_ends = (i + 1 == skinned_draw_calls.size()) || !SKINNING::same_batch(skinned_draw_calls[i], skinned_draw_calls[i + 1]);
+		if (!batch_ends) {
+			continue;
 		}
 
-		//depth_decal_fbo->bind();
-		deferred_gbuffer->color_textures[0]->copyTo(depth_decal_fbo->color_textures[0]);
-		deferred_gbuffer->color_textures[1]->copyTo(depth_decal_fbo->color_textures[1]);
-		deferred_gbuffer->color_textures[2]->copyTo(depth_decal_fbo->color_textures[2]);
-		deferred_gbuffer->color_textures[3]->copyTo(depth_decal_fbo->color_textures[3]);
-		
-		
-		depth_decal_fbo->bind();
-		deferred_gbuffer->depth_texture->copyTo(NULL);
-		depth_decal_fbo->unbind();
+		renderDeferredPlainDrawCall(*skinned_draw_calls[i], scene, &instances);
+		instances.clear();
+	}
 
-		deferred_gbuffer->bind();
+	if (scene_data->_decals.size() > 0) {
+		// Copy only the depth: the decals read the copy, and the GBuffer depth is kept for the depth test
+		int width = deferred_gbuffer->width;
+		int height = deferred_gbuffer->height;
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, deferred_gbuffer->fbo_id);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depth_decal_fbo->fbo_id);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, deferred_gbuffer->fbo_id);
 
 		glEnable(GL_DEPTH_TEST);
 		glDepthMask(false);
-		glDepthFunc(GL_LEQUAL);
 
+		// Render the back faces that are behind the surfaces, so the decals
+		// still work when the camera is inside of them
+		glDepthFunc(GL_GEQUAL);
 		glEnable(GL_CULL_FACE);
-		//glFrontFace(GL_CW);
+		glCullFace(GL_FRONT);
 
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		glColorMask(true, true, true, false);
 
-		deferred_gbuffer->enableAllBuffers();
+		// The decals only write the albedo
+		deferred_gbuffer->enableSingleBuffer(0);
 
-		Mesh cube;
-		cube.createCube();
+		deferredRenderDecals(scene_data->_decals, camera);
 
-		Shader* shader = Shader::Get("deferred_decals");
-
-		shader->enable();
-
-		shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
-		shader->setUniform("u_iRes", vec2(1.0f / (float)Application::instance->window_width, 1.0f/ (float) Application::instance->window_height));
-		shader->setUniform("u_depth_tex", depth_decal_fbo->depth_texture, 3);
-
-
-		for (int i = 0; i < scene->decals.size(); i++) {
-			
-			shader->setUniform("u_model", scene->decals[i]->model);
-			shader->setUniform("u_color_tex", scene->decals[i]->color_tex, 1);
-			cube.render(GL_TRIANGLES);
-		}
-		
-		shader->disable();
-
-		
 		glColorMask(true, true, true, true);
+		glCullFace(GL_BACK);
 		glDepthFunc(GL_LEQUAL);
 		glFrontFace(GL_CCW);
 		glDisable(GL_DEPTH_TEST);
@@ -200,35 +194,37 @@ void GTR::Renderer::deferredRenderScene(const Scene* scene, Camera* camera, FBO*
 		glDepthMask(true);
 	}
 
+	glDisable(GL_FRAMEBUFFER_SRGB);
 	deferred_gbuffer->unbind();
+}
 
+void GTR::Renderer::deferredRenderScene(const Scene* scene, Camera* camera, FBO* resulting_fbo, CULLING::sSceneCulling* scene_data, Texture* ao_tex) {
 	switch (deferred_output) {
 	case WORLD_POS:
 	case RESULT:
-		renderDefferredPass(scene, scene_data);
+		renderDefferredPass(scene, scene_data, ao_tex);
 		break;
 	case COLOR:
-		deferred_gbuffer->color_textures[0]->toViewport();
+		renderGBufferDebug(0);
 		break;
 	case NORMAL:
-		deferred_gbuffer->color_textures[1]->toViewport();
+		renderGBufferDebug(1);
 		break;
 	case MATERIAL:
 		deferred_gbuffer->color_textures[2]->toViewport();
 		break;
 	case AMBIENT_OCCLUSION:
-		ao_component.compute_AO(deferred_gbuffer->depth_texture, deferred_gbuffer->color_textures[1], camera);
-		ao_component.ao_fbo->color_textures[0]->toViewport();
+		ao_component.get_raw_AO()->toViewport(Shader::Get("ao_debug"));
 		break;
 	case AMBIENT_OCCLUSION_BLUR:
-		ao_component.compute_AO(deferred_gbuffer->depth_texture, deferred_gbuffer->color_textures[1], camera);
-		ao_component.ao_fbo->color_textures[1]->toViewport();
+		ao_tex->toViewport();
 		break;
 	case EMMISIVE:
-		deferred_gbuffer->color_textures[3]->toViewport();
+		renderGBufferDebug(3);
 		break;
 	case DEPTH:
-		Shader* depth = Shader::Get("depth");
+		static const Handle<Shader> sh_depth("depth");
+		Shader* depth = sh_depth.get();
 		depth->enable();
 		depth->setUniform("u_camera_nearfar", vec2(0.1, scene->main_camera.far_plane));
 		deferred_gbuffer->depth_texture->toViewport(depth);
@@ -236,16 +232,29 @@ void GTR::Renderer::deferredRenderScene(const Scene* scene, Camera* camera, FBO*
 	};
 } 
 
-void GTR::Renderer::renderDefferredPass(const Scene* scene, CULLING::sSceneCulling * scene_data) {
-	// Compute AO
-	Texture* ao_tex = NULL;
-	if (use_ssao) {
-		ao_tex = ao_component.compute_AO(deferred_gbuffer->depth_texture, deferred_gbuffer->color_textures[1], camera);
-	} else {
-		ao_tex = Texture::getWhiteTexture();
+// The packed targets need to be decoded to be shown
+void GTR::Renderer::renderGBufferDebug(const int texture_index) {
+	Texture* texture = deferred_gbuffer->color_textures[texture_index];
+	if (!use_packed_gbuffer) {
+		texture->toViewport();
+		return;
 	}
 
-	Shader* shader_pass = (deferred_output == WORLD_POS) ? Shader::Get("deferred_world_pos") : Shader::Get("deferred_pass");
+	static const Handle<Shader> sh_gbuffer_debug_packed("gbuffer_debug_packed");
+	Shader* shader = sh_gbuffer_debug_packed.get();
+	shader->enable();
+	shader->setUniform("u_channel", texture_index);
+	texture->toViewport(shader);
+}
+
+void GTR::Renderer::renderDefferredPass(const Scene* scene, CULLING::sSceneCulling * scene_data, Texture* ao_tex) {
+	Shader* shader_pass = NULL;
+	if (deferred_output == WORLD_POS) {
+		static const Handle<Shader> sh_deferred_world_pos("deferred_world_pos");
+		shader_pass = sh_deferred_world_pos.get();
+	} else {
+		shader_pass = ShaderVariants::Get(VARIANT_DEFERRED_PASS, get_renderer_features());
+	}
 
 	final_illumination_fbo->bind();
 
@@ -301,11 +310,7 @@ void GTR::Renderer::renderDefferredPass(const Scene* scene, CULLING::sSceneCulli
 
 	irradiance_component.bind_GI(shader_pass);
 
-	if (reflections_component.enable_reflections) {
-		reflections_component.bind_reflections(camera->eye, shader_pass);
-	} else {
-		shader_pass->setUniform("u_skybox_texture", skybox_texture, 9);
-	}
+	reflections_component.bind_reflections(reflections_component.enable_reflections ? reflections_component.find_probes(camera->eye) : sProbeBlend(), shader_pass, skybox_texture);
 	shader_pass->setUniform("u_skybox_env_texture", skybox_texture, 9);
 	shadowmap_renderer.bind_shadows(shader_pass);
 
@@ -344,7 +349,8 @@ void GTR::Renderer::tonemappingPass() {
 	glDisable(GL_DEPTH_TEST);
 	Mesh* quad = Mesh::getQuad();
 
-	Shader* shader = Shader::Get("tonemapping_pass");
+	static const Handle<Shader> sh_tonemapping_pass("tonemapping_pass");
+	Shader* shader = sh_tonemapping_pass.get();
 
 	shader->enable();
 
@@ -356,7 +362,7 @@ void GTR::Renderer::tonemappingPass() {
 	glEnable(GL_DEPTH_TEST);
 }
 
-void GTR:: Renderer::renderDeferredPlainDrawCall(const sDrawCall& draw_call, const Scene* scene) {
+void GTR:: Renderer::renderDeferredPlainDrawCall(const sDrawCall& draw_call, const Scene* scene, const SKINNING::sInstances* instances) {
 	//in case there is nothing to do
 	if (!draw_call.mesh || !draw_call.mesh->getNumVertices() || !draw_call.material)
 		return;
@@ -375,7 +381,7 @@ void GTR:: Renderer::renderDeferredPlainDrawCall(const sDrawCall& draw_call, con
 	assert(glGetError() == GL_NO_ERROR);
 
 	//chose a shader
-	shader = Shader::Get("deferred_plane_opaque");
+	shader = ShaderVariants::Get(VARIANT_DEFERRED_GEOMETRY, get_material_features(draw_call) | get_renderer_features());
 
 	assert(glGetError() == GL_NO_ERROR);
 
@@ -386,22 +392,24 @@ void GTR:: Renderer::renderDeferredPlainDrawCall(const sDrawCall& draw_call, con
 	camera = draw_call.camera;
 
 	//upload uniforms
-	shader->setUniform("u_viewprojection", draw_call.camera->viewprojection_matrix);
-	shader->setUniform("u_camera_position", draw_call.camera->eye);
-	shader->setUniform("u_model", draw_call.model);
+	shader->setUniform(UNIFORM::u_viewprojection, draw_call.camera->viewprojection_matrix);
+	shader->setUniform(UNIFORM::u_camera_position, draw_call.camera->eye);
+	shader->setUniform(UNIFORM::u_model, draw_call.model);
 	float t = getTime();
-	shader->setUniform("u_time", t);
+	shader->setUniform(UNIFORM::u_time, t);
 
 	// Material properties
-	shader->setUniform("u_color", draw_call.material->color);
+	shader->setUniform(UNIFORM::u_color, draw_call.material->color);
 	bind_textures(draw_call.material, shader);
-	shader->setUniform("u_material_type", draw_call.pbr_structure);
 
 	//this is used to say which is the alpha threshold to what we should not paint a pixel on the screen (to cut polygons according to texture alpha)
-	shader->setUniform("u_alpha_cutoff", draw_call.material->alpha_mode == GTR::eAlphaMode::MASK ? draw_call.material->alpha_cutoff : 0);
+	shader->setUniform(UNIFORM::u_alpha_cutoff, draw_call.material->alpha_mode == GTR::eAlphaMode::MASK ? draw_call.material->alpha_cutoff : 0);
 
 	//do the draw call that renders the mesh into the screen
-	draw_call.mesh->render(GL_TRIANGLES);
+	if (instances)
+		SKINNING::render(shader, draw_call.mesh, *instances, draw_call.lod);
+	else
+		SKINNING::render(shader, draw_call);
 
 	//disable shader
 	shader->disable();
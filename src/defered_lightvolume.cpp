@@ -19,7 +19,7 @@ void GTR::Renderer::renderDeferredLightVolumes(CULLING::sSceneCulling *scene_dat
 
 	Mesh* sphere_mesh = Mesh::Get("data/meshes/sphere.obj", false);
 	Mesh* cone_mesh = Mesh::Get("data/meshes/cone.obj", false);
-	Shader* shader = Shader::Get("deferred_lightpass");
+	Shader* shader = ShaderVariants::Get(VARIANT_DEFERRED_LIGHTPASS, get_renderer_features());
 	assert(glGetError() == GL_NO_ERROR);
 
 	shader->enable();
@@ -106,7 +106,8 @@ void GTR::Renderer::renderDeferredLightVolumes(CULLING::sSceneCulling *scene_dat
 	glDepthMask(false);
 	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-	Shader *shaderp = Shader::Get("flat");
+	static const Handle<Shader> sh_flat("flat");
+	Shader *shaderp = sh_flat.get();
 	assert(glGetError() == GL_NO_ERROR);
 
 	shaderp->enable();
@@ -5,6 +5,12 @@
 #include "mesh.h"
 
 namespace GTR {
+	// The two reflection probes with more weight, see reflections.h. The weights of unused probes are 0
+	struct sProbeBlend {
+		int indices[2] = { 0, 0 };
+		float weights[2] = { 0.0f, 0.0f };
+	};
+
 	struct sDrawCall {
 		Matrix44 model;
 		Mesh* mesh;
@@ -14,6 +20,10 @@ namespace GTR {
 		ePBR_Type pbr_structure;
 
 		BoundingBox aabb; // Mesh Nounding box
+		int palette_offset = -1; // In the skinning palettes of the frame, -1 if it is not skinned
+		uint8_t lod = 0; // See mesh_lod.h
+		float lod_scale = 0.0f; // Pixels per unit of the mesh, to select the LOD of other passes
+		sProbeBlend probe_blend; // Looked up once per frame by sReflections_Component::assign_probes
 
 		uint16_t light_count;
 		LightEntity* lights_for_call[MAX_LIGHT_NUM];
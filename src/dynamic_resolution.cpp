@@ -0,0 +1,89 @@
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+
+void GTR::sDynamicResolution_Component::update_frame_time() {
+	Uint64 now = SDL_GetPerformanceCounter();
+	if (last_counter == 0) {
+		last_counter = now;
+		return;
+	}
+
+	float frame_ms = (float)((now - last_counter) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+	last_counter = now;
+
+	// Exponential average, to ignore the single slow frames
+	smoothed_frame_ms = (smoothed_frame_ms == 0.0f) ? frame_ms : (smoothed_frame_ms * 0.9f + frame_ms * 0.1f);
+	frames_since_change++;
+
+	// When disabled, the scale is set by hand
+	if (!enabled || frames_since_change < cooldown_frames) {
+		return;
+	}
+
+	// Different thresholds for going down and up, to avoid bouncing between two scales
+	float new_scale = render_scale;
+	if (smoothed_frame_ms > target_frame_ms * 1.05f) {
+		new_scale -= scale_step;
+	} else if (smoothed_frame_ms < target_frame_ms * 0.85f) {
+		new_scale += scale_step;
+	}
+	new_scale = clamp(new_scale, min_scale, 1.0f);
+
+	if (new_scale != render_scale) {
+		render_scale = new_scale;
+		frames_since_change = 0;
+	}
+}
+
+void GTR::sDynamicResolution_Component::reset_history() {
+	last_counter = 0;
+	smoothed_frame_ms = 0.0f;
+	frames_since_change = 0;
+}
+
+vec2 GTR::sDynamicResolution_Component::get_render_resolution(const vec2& screen_size) const {
+	// Parenthesized so the max macro of windows.h does not expand
+	return vec2((std::max)(1.0f, floorf(screen_size.x * render_scale)), (std::max)(1.0f, floorf(screen_size.y * render_scale)));
+}
+
+Texture* GTR::sDynamicResolution_Component::upscale(Texture* source) {
+	static const Handle<Shader> sh_upscale("upscale");
+	Shader* shader = sh_upscale.get();
+	Mesh* quad = Mesh::getQuad();
+
+	upscale_fbo->bind();
+
+	shader->enable();
+	shader->setUniform("u_color_tex", source, 0);
+	shader->setUniform("u_sharpness", sharpness);
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	quad->render(GL_TRIANGLES);
+
+	shader->disable();
+	upscale_fbo->unbind();
+
+	return upscale_fbo->color_textures[0];
+}
+
+void GTR::sDynamicResolution_Component::render_imgui(const vec2& screen_size) {
+#ifndef SKIP_IMGUI
+	if (ImGui::TreeNode("Dynamic resolution")) {
+		ImGui::Checkbox("Enable dynamic resolution", &enabled);
+		ImGui::SliderFloat("Target frame (ms)", &target_frame_ms, 4.0f, 50.0f);
+		ImGui::SliderFloat("Min scale", &min_scale, 0.25f, 1.0f);
+		ImGui::SliderFloat("Upscale sharpness", &sharpness, 0.0f, 1.0f);
+		if (!enabled) {
+			// Manual scale
+			ImGui::SliderFloat("Render scale", &render_scale, min_scale, 1.0f);
+		}
+
+		vec2 render_size = get_render_resolution(screen_size);
+		ImGui::Text("Frame time: %.2f ms", smoothed_frame_ms);
+		ImGui::Text("Internal resolution: %d x %d (%.0f%%)", (int)render_size.x, (int)render_size.y, render_scale * 100.0f);
+		ImGui::TreePop();
+	}
+#endif
+}
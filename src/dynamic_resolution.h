@@ -0,0 +1,48 @@
+#pragma once
+#include "includes.h"
+#include "texture.h"
+#include "shader.h"
+#include "mesh.h"
+#include "fbo.h"
+
+// ================
+//  DYNAMIC RESOLUTION
+// ================
+// The scene is rendered at screen_size * render_scale, and upscaled to the screen
+// at the end of the frame. When enabled, the scale follows the measured frame time
+// so it stays close to the target.
+
+namespace GTR {
+
+	struct sDynamicResolution_Component {
+		// Transient, set by the frame graph
+		FBO* upscale_fbo = NULL;
+
+		bool enabled = false;
+		float render_scale = 1.0f;
+
+		float target_frame_ms = 16.6f;
+		float min_scale = 0.5f;
+		// The scale moves in steps, so the render graph does not create a new target each frame
+		float scale_step = 0.05f;
+		// Frames to wait after a change, so the new scale is measured before moving again
+		int cooldown_frames = 30;
+
+		float sharpness = 0.25f;
+
+		// Stats
+		float smoothed_frame_ms = 0.0f;
+		int frames_since_change = 0;
+		Uint64 last_counter = 0;
+
+		void update_frame_time();
+		// Forget the measures, used when something makes a frame much slower (resizing)
+		void reset_history();
+
+		vec2 get_render_resolution(const vec2& screen_size) const;
+
+		Texture* upscale(Texture* source);
+
+		void render_imgui(const vec2 &screen_size);
+	};
+};
@@ -2,12 +2,180 @@
 #include <fstream>
 #include <cmath>
 #include <cassert>
+#include <cstring>
 #include <algorithm>
+#include <mutex>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "../utils.h"
 #include "hdre.h"
 
 std::map<std::string, HDRE*> HDRE::s_loaded_hdres;
+bool HDRE::write_compact_cache = false;
+
+// ================
+//  PIXEL FORMATS
+// ================
+
+static float halfToFloat(unsigned short h)
+{
+	unsigned int sign = (h & 0x8000) << 16;
+	unsigned int exponent = (h >> 10) & 0x1F;
+	unsigned int mantissa = h & 0x3FF;
+	unsigned int bits;
+
+	if (exponent == 0)
+	{
+		if (mantissa == 0)
+			bits = sign;
+		else
+		{
+			// Denormal, normalize it
+			exponent = 127 - 15 + 1;
+			while (!(mantissa & 0x400))
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+		}
+	}
+	else if (exponent == 31)
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	else
+		bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+
+	float result;
+	memcpy(&result, &bits, sizeof(float));
+	return result;
+}
+
+static void rgbeToFloat(const byte* rgbe, float* rgb)
+{
+	if (rgbe[3] == 0)
+	{
+		rgb[0] = rgb[1] = rgb[2] = 0.0f;
+		return;
+	}
+	float f = (float)ldexp(1.0, rgbe[3] - (128 + 8));
+	rgb[0] = rgbe[0] * f;
+	rgb[1] = rgbe[1] * f;
+	rgb[2] = rgbe[2] * f;
+}
+
+// As in the EXT_texture_shared_exponent spec: 9 bits of mantissa per channel and a 5 bit exponent
+static unsigned int floatToRGB9E5(const float* rgb)
+{
+	const int N = 9, B = 15;
+	const float max_value = 65408.0f; // (2^9 - 1) / 2^9 * 2^(31 - 15)
+
+	float c[3];
+	for (int i = 0; i < 3; i++)
+		c[i] = rgb[i] > 0.0f ? fmin(rgb[i], max_value) : 0.0f; // Also removes the NaNs
+
+	float max_c = fmax(c[0], fmax(c[1], c[2]));
+	if (max_c == 0.0f)
+		return 0;
+
+	int exp_shared = (int)fmax(-B - 1, floor(log2(max_c))) + 1 + B;
+	double scale = pow(2.0, exp_shared - B - N);
+	if ((int)floor(max_c / scale + 0.5) == (1 << N))
+	{
+		exp_shared++;
+		scale *= 2.0;
+	}
+
+	unsigned int packed = (unsigned int)exp_shared << 27;
+	for (int i = 0; i < 3; i++)
+		packed |= ((unsigned int)floor(c[i] / scale + 0.5) & 0x1FF) << (9 * i);
+	return packed;
+}
+
+static int getBytesPerPixel(short type, short num_channels)
+{
+	switch (type)
+	{
+	case HDRE_TYPE_FLOAT: return 4 * num_channels;
+	case HDRE_TYPE_HALF: return 2 * num_channels;
+	case HDRE_TYPE_RGBE:
+	case HDRE_TYPE_RGB9E5: return 4;
+	default: return 0;
+	}
+}
+
+// ================
+//  MAPPED FILE
+// ================
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file_handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file_handle, &file_size);
+	HANDLE mapping_handle = file_size.QuadPart ? CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	void* view = mapping_handle ? MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+	// The view keeps the mapping alive
+	if (mapping_handle)
+		CloseHandle(mapping_handle);
+	CloseHandle(file_handle);
+
+	if (!view)
+		return false;
+	size = (size_t)file_size.QuadPart;
+	data = (const byte*)view;
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat file_stat;
+	void* view = MAP_FAILED;
+	if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+		view = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (view == MAP_FAILED)
+		return false;
+	size = (size_t)file_stat.st_size;
+	data = (const byte*)view;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (!data)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap((void*)data, size);
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+// ================
+//  HDRE
+// ================
 
 HDRE::HDRE()
 {
@@ -34,8 +202,12 @@ void HDRE::init()
             pixels_h[i][j] = nullptr;
             pixels_f[i][j] = nullptr;
             pixels_b[i][j] = nullptr;
+            pixels_e[i][j] = nullptr;
         }
     }
+
+    for (int i = 0; i < N_MAX_LEVELS; i++)
+        level_width[i] = 0;
 }
 
 HDRE::~HDRE()
@@ -68,7 +240,7 @@ HDRE::~HDRE()
 	return level;
 }*/
 
-float* HDRE::getData()
+byte* HDRE::getData()
 {
 	return this->data;
 }
@@ -100,41 +272,55 @@ short* HDRE::getFaceh(int level, int face)
     return this->pixels_h[level][face];
 }
 
+unsigned int** HDRE::getFacese(int level)
+{
+    return this->pixels_e[level];
+}
+unsigned int* HDRE::getFacee(int level, int face)
+{
+    return this->pixels_e[level][face];
+}
+
 
 bool HDRE::load(const char* filename)
 {
 	assert(filename);
 
-	FILE *f = fopen(filename,"rb");
-	if (f == nullptr)
+	if (!file.open(filename))
 		return false;
 
-	sHDREHeader HDREHeader;
-
-	fread(&HDREHeader, sizeof(sHDREHeader), 1, f);
+	if (file.size < sizeof(sHDREHeader))
+	{
+		printf("HDRE file too small: %s\n", filename);
+		return false;
+	}
 
-	if (HDREHeader.type != 3) {
-        printf("HDRE Header has wrong type: %d\n", HDREHeader.type);
-        throw ("ArrayType not supported. Please export in Float32Array.");
-    }
+	memcpy(&this->header, file.data, sizeof(sHDREHeader));
 
-    this->header = HDREHeader;
+	int bytes_per_pixel = getBytesPerPixel(header.type, header.numChannels);
+	if (bytes_per_pixel == 0)
+	{
+		printf("HDRE Header has wrong type: %d\n", header.type);
+		return false;
+	}
 
-	int width = HDREHeader.width;
-	int height = HDREHeader.height;
+	int width = header.width;
+	int height = header.height;
 
 	this->width = width;
 	this->height = height;
 
-	int dataSize = 0;
+	// Get the size of each level in the file
+	size_t level_offset[N_LEVELS];
+	size_t dataSize = 0;
 	int w = width;
 
-	// Get number of floats inside the HDRE
-	// Per channel & Per face
 	for (int i = 0; i < N_LEVELS; i++)
 	{
 		int mip_level = i + 1;
-		dataSize += w * w * N_FACES * HDREHeader.numChannels;
+		level_width[i] = w;
+		level_offset[i] = dataSize;
+		dataSize += (size_t)w * w * N_FACES * bytes_per_pixel;
 
 		//w = std::max(8, (int)(width / pow(2.0, mip_level)));
 		w = fmax(8, (int)(width / pow(2.0, mip_level)));
@@ -143,89 +329,122 @@ bool HDRE::load(const char* filename)
 			w = (int)(width / pow(2.0, mip_level));
 	}
 
-	this->data = new float[dataSize];
-
-	fseek(f, HDREHeader.headerSize, SEEK_SET);
-
-	fread(this->data, sizeof(float) * dataSize, 1, f);
-	fclose(f);
+	if (header.headerSize + dataSize > file.size)
+	{
+		printf("HDRE file is truncated: %s\n", filename);
+		return false;
+	}
 
-	// get separated levels
+	const byte* payload = file.data + header.headerSize;
 
-	w = width;
-	int mapOffset = 0;
-    int mapPrevOffset = 0;
+	// The GPU has no RGBE format, convert it to RGB9E5 (same size)
+	if (header.type == HDRE_TYPE_RGBE)
+	{
+		this->data = new byte[dataSize];
+		unsigned int* packed = (unsigned int*)this->data;
+		for (size_t k = 0; k < dataSize / 4; k++)
+		{
+			float rgb[3];
+			rgbeToFloat(payload + k * 4, rgb);
+			packed[k] = floatToRGB9E5(rgb);
+		}
+		payload = this->data;
+		header.type = HDRE_TYPE_RGB9E5;
+		header.numChannels = 3;
+	}
 
 	int nFullMips = 0;
+	w = width;
 	while (w)
     {
 	    nFullMips++;
 	    w >>= 1;
     }
 	assert(nFullMips <= N_MAX_LEVELS);
-	levels = nFullMips;
-	w = width;
-    printf("Load %d mips of HDRE texture\n", nFullMips);
+	levels = nFullMips < N_LEVELS ? nFullMips : N_LEVELS;
+    printf("Load %d mips of HDRE texture\n", levels);
 
-    int i;
-    for (i = 0; i < N_LEVELS; i++)
+	// The faces point to the mapped file (or the converted data), nothing is copied
+	for (int i = 0; i < levels; i++)
 	{
-		int mip_level = i + 1;
-		int faceSize = w * w * HDREHeader.numChannels;
-		int mapSize = faceSize * N_FACES;
-
-		int faceOffset = 0;
+		size_t faceSize = (size_t)level_width[i] * level_width[i] * bytes_per_pixel;
 
 		for (int j = 0; j < N_FACES; j++)
 		{
-			// allocate memory
-			this->pixels_f[i][j] = new float[faceSize];
-
-			// set data
-			for (int k = 0; k < faceSize; k++) {
+			byte* face = (byte*)payload + level_offset[i] + faceSize * j;
 
-				float value = this->data[mapOffset + faceOffset + k];
-
-				this->pixels_f[i][j][k] = value;
+			switch (header.type)
+			{
+			case HDRE_TYPE_FLOAT: pixels_f[i][j] = (float*)face; break;
+			case HDRE_TYPE_HALF: pixels_h[i][j] = (short*)face; break;
+			case HDRE_TYPE_RGB9E5: pixels_e[i][j] = (unsigned int*)face; break;
 			}
-
-			// update face offset
-			faceOffset += faceSize;
 		}
-
-		// update level offset
-		mapPrevOffset = mapOffset;
-		mapOffset += mapSize;
-		// reassign width for next level
-		//w = std::max(8, (int)(width / pow(2.0, mip_level)));
-		w = fmax(8, (int)(width / pow(2.0, mip_level)));
-
-		if (this->header.version > 2.0)
-			w = (int)(width / pow(2.0, mip_level));
 	}
 	std::cout << std::endl << " + '" << filename << "' (v" << this->header.version << ") loaded successfully" << std::endl;
 	return true;
 }
 
+bool HDRE::saveCompact(const char* filename)
+{
+	FILE* f = fopen(filename, "wb");
+	if (f == nullptr)
+		return false;
+
+	sHDREHeader compactHeader = this->header;
+	compactHeader.type = HDRE_TYPE_RGB9E5;
+	compactHeader.numChannels = 3;
+	compactHeader.bitsPerChannel = 9;
+	compactHeader.headerSize = sizeof(sHDREHeader);
+	fwrite(&compactHeader, sizeof(sHDREHeader), 1, f);
+
+	// The load expects N_LEVELS levels, the ones without data are written black
+	std::vector<unsigned int> packed;
+	for (int i = 0; i < N_LEVELS; i++)
+	{
+		int faceSize = level_width[i] * level_width[i];
+		packed.resize(faceSize);
+
+		for (int j = 0; j < N_FACES; j++)
+		{
+			for (int k = 0; k < faceSize; k++)
+			{
+				float rgb[3] = { 0.0f, 0.0f, 0.0f };
+				if (i < levels && header.type == HDRE_TYPE_FLOAT)
+					memcpy(rgb, pixels_f[i][j] + k * header.numChannels, sizeof(rgb));
+				else if (i < levels && header.type == HDRE_TYPE_HALF)
+					for (int c = 0; c < 3; c++)
+						rgb[c] = halfToFloat(pixels_h[i][j][k * header.numChannels + c]);
+
+				packed[k] = (i < levels && header.type == HDRE_TYPE_RGB9E5) ? pixels_e[i][j][k] : floatToRGB9E5(rgb);
+			}
+			fwrite(packed.data(), sizeof(unsigned int), faceSize, f);
+		}
+	}
+
+	bool ok = ferror(f) == 0;
+	fclose(f);
+	return ok;
+}
+
 bool HDRE::clean()
 {
 	try
 	{
+		// The faces only point to data or to the file
 		if (data)
-			delete data;
+			delete[] data;
+		data = nullptr;
+		file.close();
 
         for (int j = 0; j < N_FACES; j++)
         {
-            for (int i = 0; i < N_LEVELS; i++)
+            for (int i = 0; i < N_MAX_LEVELS; i++)
             {
-				delete pixels_h[i][j];
 				pixels_h[i][j] = nullptr;
+				pixels_f[i][j] = nullptr;
+				pixels_e[i][j] = nullptr;
 			}
-            for (int i = 0; i < N_LEVELS; i++)
-            {
-                delete pixels_f[i][j];
-                pixels_f[i][j] = nullptr;
-            }
 		}
 
 		return true;
@@ -239,8 +458,13 @@ bool HDRE::clean()
 	return false;
 }
 
+// Also called from the background thread, when loading asynchronously
+static std::recursive_mutex s_hdres_mutex;
+
 HDRE* HDRE::Get(const char* filename)
 {
+	const std::lock_guard<std::recursive_mutex> lock(s_hdres_mutex);
+
 	auto it = s_loaded_hdres.find(filename);
 	if (it != s_loaded_hdres.end())
 		return it->second;
@@ -255,4 +479,39 @@ HDRE* HDRE::Get(const char* filename)
 
 	s_loaded_hdres[filename] = hdre;
 	return hdre;
+}
+
+HDRE* HDRE::GetCompact(const char* filename)
+{
+	const std::lock_guard<std::recursive_mutex> lock(s_hdres_mutex);
+
+	std::string compact_filename = std::string(filename) + ".compact";
+
+	struct stat source_stat, compact_stat;
+	bool has_source = stat(filename, &source_stat) == 0;
+	bool has_compact = stat(compact_filename.c_str(), &compact_stat) == 0;
+
+	if (has_compact && (!has_source || compact_stat.st_mtime >= source_stat.st_mtime))
+	{
+		HDRE* compact = Get(compact_filename.c_str());
+		if (compact)
+			return compact;
+	}
+
+	HDRE* hdre = Get(filename);
+	if (!write_compact_cache || !hdre || hdre->getType() == HDRE_TYPE_RGB9E5)
+		return hdre;
+
+	if (!hdre->saveCompact(compact_filename.c_str()))
+	{
+		std::cout << "Could not write the compact HDRE '" << compact_filename << "'" << std::endl;
+		return hdre;
+	}
+
+	// Use the compact one, so the first run looks (and costs) the same as the next ones
+	HDRE* compact = Get(compact_filename.c_str());
+	if (!compact)
+		return hdre;
+	delete hdre;
+	return compact;
 }
\ No newline at end of file
@@ -9,6 +9,14 @@
 
 typedef unsigned char byte;
 
+// Payload types of the file (header.type)
+enum eHDREType {
+	HDRE_TYPE_RGBE = 2,		// Uint8, RGB with a shared exponent (Radiance)
+	HDRE_TYPE_FLOAT = 3,	// Float32
+	HDRE_TYPE_HALF = 4,		// Uint16 with half floats
+	HDRE_TYPE_RGB9E5 = 5	// Uint32, the shared exponent format of the GPU
+};
+
 typedef struct {
 
 	char signature[4];
@@ -45,27 +53,43 @@ typedef struct {
 
 } sHDRELevel;
 
+// Read only view of a file, the OS loads the pages when they are accessed
+class MappedFile {
+public:
+	const byte* data = nullptr;
+	size_t size = 0;
+
+	~MappedFile() { close(); }
+
+	bool open(const char* filename);
+	void close();
+};
+
 class HDRE {
 
 private:
 
     std::string filename;
-	float* data; // only f32 now
+	MappedFile file;
+	byte* data; // Only when the payload has to be converted, otherwise the faces point to the file
 
     float* pixels_f[N_MAX_LEVELS][N_FACES]; // Xpos, Xneg, Ypos, Yneg, Zpos, Zneg
     short* pixels_h[N_MAX_LEVELS][N_FACES]; // Xpos, Xneg, Ypos, Yneg, Zpos, Zneg
     byte* pixels_b[N_MAX_LEVELS][N_FACES]; // Xpos, Xneg, Ypos, Yneg, Zpos, Zneg
+    unsigned int* pixels_e[N_MAX_LEVELS][N_FACES]; // Xpos, Xneg, Ypos, Yneg, Zpos, Zneg
+    int level_width[N_MAX_LEVELS];
 
 	bool clean();
 	void init();
 
 public:
 	static std::map<std::string, HDRE*> s_loaded_hdres;
+	static bool write_compact_cache; // Off by default, GetCompact only reads the caches that already exist
 
 	sHDREHeader header;
 	int width;
 	int height;
-    int levels = N_MAX_LEVELS;
+    int levels = N_MAX_LEVELS; // Levels with data
 
 	HDRE();
 	HDRE(const char* filename);
@@ -74,6 +98,9 @@ public:
 	bool load(const char* filename);
 	//bool load(void* data, int size);
 
+	// Writes all the levels as RGB9E5
+	bool saveCompact(const char* filename);
+
 	// useful methods
 	float getMaxLuminance() { return this->header.maxLuminance; };
 	float* getSHCoeffs()
@@ -83,7 +110,10 @@ public:
 		return nullptr;
 	}
 
-	float* getData(); // All pixel data
+	short getType() { return this->header.type; };
+	int getLevelWidth(int level) { return this->level_width[level]; };
+
+	byte* getData(); // Converted pixel data, null when read from the file
 
 	float* getFacef(int level, int face);	// Specific level and face
 	float** getFacesf(int level = 0);		// [[]]: Array per face with all level data
@@ -94,7 +124,13 @@ public:
     short* getFaceh(int level, int face);	// Specific level and face
 	short** getFacesh(int level = 0);		// [[]]: Array per face with all level data
 
+    unsigned int* getFacee(int level, int face);	// Specific level and face
+	unsigned int** getFacese(int level = 0);		// [[]]: Array per face with all level data
+
 	//sHDRELevel getLevel(int level = 0);
 
 	static HDRE* Get(const char* filename);
+	// Loads the compact cache of the file (filename + ".compact") if it is up to date, else the file.
+	// With write_compact_cache, the missing or old caches are written
+	static HDRE* GetCompact(const char* filename);
 };
@@ -51,7 +51,7 @@ void FBO::freeTextures()
 	owns_textures = false;
 }
 
-bool FBO::create( int width, int height, int num_textures, int format, int type, bool use_depth_texture)
+bool FBO::create( int width, int height, int num_textures, int format, int type, bool use_depth_texture, const int* internal_formats)
 {
 	assert(glGetError() == GL_NO_ERROR);
 	assert(width && height);
@@ -63,7 +63,8 @@ bool FBO::create( int width, int height, int num_textures, int format, int type,
 	std::vector<Texture*> textures(4);
 	for (int i = 0; i < num_textures; ++i)
 	{
-		Texture* colortex = textures[i] = new Texture(width, height, format, type, false); //,NULL, format == GL_RGBA ? GL_RGBA8 : GL_RGB8 
+		int internal_format = internal_formats ? internal_formats[i] : 0;
+		Texture* colortex = textures[i] = new Texture(width, height, format, type, false, NULL, internal_format);
 		glBindTexture(colortex->texture_type, colortex->texture_id);	//we activate this id to tell opengl we are going to use this texture
 		glTexParameteri(colortex->texture_type, GL_TEXTURE_MAG_FILTER, GL_NEAREST);	//set the min filter
 		glTexParameteri(colortex->texture_type, GL_TEXTURE_MIN_FILTER, GL_NEAREST);   //set the mag filter
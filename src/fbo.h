@@ -24,7 +24,8 @@ public:
 	FBO();
 	~FBO();
 
-	bool create(int width, int height, int num_textures = 1, int format = GL_RGB, int type = GL_UNSIGNED_BYTE, bool use_depth_texture = true );
+	//internal_formats: optional, one sized format per texture (0 to use the default of format and type)
+	bool create(int width, int height, int num_textures = 1, int format = GL_RGB, int type = GL_UNSIGNED_BYTE, bool use_depth_texture = true, const int* internal_formats = NULL );
 	bool setTexture(Texture* texture, int cubemap_face = -1);
 	bool setTextures(std::vector<Texture*> textures, Texture* depth = NULL, int cubemap_face = -1);
 	bool setDepthOnly(int width, int height); //use this for shadowmaps
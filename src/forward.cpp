@@ -61,69 +61,61 @@ inline void GTR::Renderer::forwardSingleRenderDrawCall(const sDrawCall& draw_cal
 	assert(glGetError() == GL_NO_ERROR);
 
 	//chose a shader
-	shader = Shader::Get("forward_singlepass_pbr");
+	shader = ShaderVariants::Get(VARIANT_FORWARD_PBR, get_material_features(draw_call) | get_renderer_features());
 
 	assert(glGetError() == GL_NO_ERROR);
 
-	// Prepare shadow ids
-	int* shadow_ids = (int*)malloc(sizeof(int) * draw_call.light_count);
-	for (int i = 0; i < draw_call.light_count; i++) {
-		shadow_ids[i] = (int) draw_call.lights_for_call[i]->shadow_id;
-	}
-
 	//no shader? then nothing to render
 	if (!shader)
 		return;
 	shader->enable();
 
+	// Prepare shadow ids
+	int shadow_ids[MAX_LIGHT_NUM];
+	for (int i = 0; i < draw_call.light_count; i++) {
+		shadow_ids[i] = (int) draw_call.lights_for_call[i]->shadow_id;
+	}
+
 	// Upload light data
 	// Common data of the lights
-	shader->setUniform("u_ambient_light", ambient_ligh);
-	shader->setUniform3Array("u_light_pos", (float*)draw_call.light_positions, draw_call.light_count);
-	shader->setUniform3Array("u_light_color", (float*)draw_call.light_color, draw_call.light_count);
-	shader->setUniform1Array("u_light_type", (int*)draw_call.light_type, draw_call.light_count);
-	shader->setUniform1Array("u_light_shadow_id", shadow_ids, draw_call.light_count);
-	shader->setUniform1Array("u_light_max_dist", (float*)draw_call.light_max_distance, draw_call.light_count);
-	shader->setUniform1Array("u_light_intensities", draw_call.light_intensities, draw_call.light_count);
-	shader->setUniform("u_num_lights", draw_call.light_count);
-
-	free(shadow_ids);
+	shader->setUniform(UNIFORM::u_ambient_light, ambient_ligh);
+	shader->setUniform3Array(UNIFORM::u_light_pos, (float*)draw_call.light_positions, draw_call.light_count);
+	shader->setUniform3Array(UNIFORM::u_light_color, (float*)draw_call.light_color, draw_call.light_count);
+	shader->setUniform1Array(UNIFORM::u_light_type, (int*)draw_call.light_type, draw_call.light_count);
+	shader->setUniform1Array(UNIFORM::u_light_shadow_id, shadow_ids, draw_call.light_count);
+	shader->setUniform1Array(UNIFORM::u_light_max_dist, (float*)draw_call.light_max_distance, draw_call.light_count);
+	shader->setUniform1Array(UNIFORM::u_light_intensities, draw_call.light_intensities, draw_call.light_count);
+	shader->setUniform(UNIFORM::u_num_lights, draw_call.light_count);
 
 	// Spotlight data of the lights
-	shader->setUniform3Array("u_light_direction", (float*)draw_call.light_direction, draw_call.light_count);
-	shader->setUniform1Array("u_light_cone_angle", (float*)draw_call.light_cone_angle, draw_call.light_count);
-	shader->setUniform1Array("u_light_cone_decay", (float*)draw_call.light_cone_decay, draw_call.light_count);
+	shader->setUniform3Array(UNIFORM::u_light_direction, (float*)draw_call.light_direction, draw_call.light_count);
+	shader->setUniform1Array(UNIFORM::u_light_cone_angle, (float*)draw_call.light_cone_angle, draw_call.light_count);
+	shader->setUniform1Array(UNIFORM::u_light_cone_decay, (float*)draw_call.light_cone_decay, draw_call.light_count);
 
 	//upload uniforms
-	shader->setUniform("u_viewprojection", cam->viewprojection_matrix);
-	shader->setUniform("u_camera_position", cam->eye);
-	shader->setUniform("u_model", draw_call.model);
+	shader->setUniform(UNIFORM::u_viewprojection, cam->viewprojection_matrix);
+	shader->setUniform(UNIFORM::u_camera_position, cam->eye);
+	shader->setUniform(UNIFORM::u_model, draw_call.model);
 	float t = getTime();
-	shader->setUniform("u_time", t);
+	shader->setUniform(UNIFORM::u_time, t);
 
 	// Material properties
-	shader->setUniform("u_color", draw_call.material->color);
-	int enabled_texteres = bind_textures(draw_call.material, shader);
+	shader->setUniform(UNIFORM::u_color, draw_call.material->color);
+	bind_textures(draw_call.material, shader);
 	//shader->setUniform("u_ambient_occlusion_tex", Texture::getWhiteTexture(), 5);
 
-	shader->setUniform("u_enabled_texteres", enabled_texteres);
-
 	// Set the shadowmap
 	shadowmap_renderer.bind_shadows(shader);
 
 	irradiance_component.bind_GI(shader);
 	
-	if (reflections) {
-		reflections_component.bind_reflections(draw_call.aabb.center, shader);
-	} else {
-		shader->setUniform("u_skybox_texture", skybox_texture, 9);
-	}
+	reflections_component.bind_reflections(reflections ? draw_call.probe_blend : sProbeBlend(), shader, skybox_texture);
 
 	//this is used to say which is the alpha threshold to what we should not paint a pixel on the screen (to cut polygons according to texture alpha)
-	shader->setUniform("u_alpha_cutoff", draw_call.material->alpha_mode == GTR::eAlphaMode::MASK ? draw_call.material->alpha_cutoff : 0);
+	shader->setUniform(UNIFORM::u_alpha_cutoff, draw_call.material->alpha_mode == GTR::eAlphaMode::MASK ? draw_call.material->alpha_cutoff : 0);
 
 	//do the draw call that renders the mesh into the screen
-	draw_call.mesh->render(GL_TRIANGLES);
+	SKINNING::render(shader, draw_call);
 
 	//disable shader
 	shader->disable();
@@ -150,7 +142,8 @@ inline void GTR::Renderer::forwardMultiRenderDrawCall(const sDrawCall& draw_call
 	assert(glGetError() == GL_NO_ERROR);
 
 	//chose a shader
-	shader = Shader::Get("multi_phong");
+	static const Handle<Shader> sh_multi_phong("multi_phong");
+	shader = sh_multi_phong.get();
 
 	assert(glGetError() == GL_NO_ERROR);
 
@@ -165,14 +158,14 @@ inline void GTR::Renderer::forwardMultiRenderDrawCall(const sDrawCall& draw_call
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	//upload uniforms
-	shader->setUniform("u_viewprojection", cam->viewprojection_matrix);
-	shader->setUniform("u_camera_position", cam->eye);
-	shader->setUniform("u_model", draw_call.model);
+	shader->setUniform(UNIFORM::u_viewprojection, cam->viewprojection_matrix);
+	shader->setUniform(UNIFORM::u_camera_position, cam->eye);
+	shader->setUniform(UNIFORM::u_model, draw_call.model);
 	float t = getTime();
-	shader->setUniform("u_time", t);
+	shader->setUniform(UNIFORM::u_time, t);
 
 	// Material properties
-	shader->setUniform("u_color", draw_call.material->color);
+	shader->setUniform(UNIFORM::u_color, draw_call.material->color);
 	bind_textures(draw_call.material, shader);
 
 	// Set the shadowmap
@@ -180,36 +173,36 @@ inline void GTR::Renderer::forwardMultiRenderDrawCall(const sDrawCall& draw_call
 	glEnable(GL_BLEND);
 
 	//this is used to say which is the alpha threshold to what we should not paint a pixel on the screen (to cut polygons according to texture alpha)
-	shader->setUniform("u_alpha_cutoff", draw_call.material->alpha_mode == GTR::eAlphaMode::MASK ? draw_call.material->alpha_cutoff : 0);
+	shader->setUniform(UNIFORM::u_alpha_cutoff, draw_call.material->alpha_mode == GTR::eAlphaMode::MASK ? draw_call.material->alpha_cutoff : 0);
 
-	shader->setUniform("u_ambient_light", scene->ambient_light);
+	shader->setUniform(UNIFORM::u_ambient_light, scene->ambient_light);
 	for (int light_id = 0; light_id < draw_call.light_count; light_id++) {
 		if (light_id == 0) {
-			shader->setUniform("u_ambient_light", scene->ambient_light);
+			shader->setUniform(UNIFORM::u_ambient_light, scene->ambient_light);
 		}
 		else if (light_id == 1) {
 			// Set blending to additive
 			glBlendFunc(GL_SRC_ALPHA, GL_ONE);
 			// Set the ambient and the emissive textures for the next passes
-			shader->setUniform("u_ambient_light", vec3(0.0f, 0.0f, 0.0f));
-			shader->setUniform("u_emmisive_tex", Texture::getBlackTexture(), 1);
+			shader->setUniform(UNIFORM::u_ambient_light, vec3(0.0f, 0.0f, 0.0f));
+			shader->setUniform(UNIFORM::u_emmisive_tex, Texture::getBlackTexture(), 1);
 		}
 		// Upload light data
 		// Common data of the lights
-		shader->setUniform("u_light_pos", draw_call.light_positions[light_id]);
-		shader->setUniform("u_light_color", draw_call.light_color[light_id]);
-		shader->setUniform("u_light_type", draw_call.light_type[light_id]);
-		shader->setUniform("u_light_max_dist", draw_call.light_max_distance[light_id]);
-		shader->setUniform("u_light_intensities", draw_call.light_intensities[light_id]);
-		shader->setUniform("u_light_id", draw_call.light_shadow_id[light_id]);
+		shader->setUniform(UNIFORM::u_light_pos, draw_call.light_positions[light_id]);
+		shader->setUniform(UNIFORM::u_light_color, draw_call.light_color[light_id]);
+		shader->setUniform(UNIFORM::u_light_type, draw_call.light_type[light_id]);
+		shader->setUniform(UNIFORM::u_light_max_dist, draw_call.light_max_distance[light_id]);
+		shader->setUniform(UNIFORM::u_light_intensities, draw_call.light_intensities[light_id]);
+		shader->setUniform(UNIFORM::u_light_id, draw_call.light_shadow_id[light_id]);
 
 		// Spotlight data of the lights
-		shader->setUniform("u_light_direction", draw_call.light_direction[light_id]);
-		shader->setUniform("u_light_cone_angle", draw_call.light_cone_angle[light_id]);
-		shader->setUniform("u_light_cone_decay", draw_call.light_cone_decay[light_id]);
+		shader->setUniform(UNIFORM::u_light_direction, draw_call.light_direction[light_id]);
+		shader->setUniform(UNIFORM::u_light_cone_angle, draw_call.light_cone_angle[light_id]);
+		shader->setUniform(UNIFORM::u_light_cone_decay, draw_call.light_cone_decay[light_id]);
 
 		//do the draw call that renders the mesh into the screen
-		draw_call.mesh->render(GL_TRIANGLES);
+		draw_call.mesh->render(GL_TRIANGLES, -1, 0, draw_call.lod);
 	}
 
 	//disable shader
@@ -1327,6 +1327,15 @@ BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box)
 	return BoundingBox(box_max - halfsize, halfsize );
 }
 
+//the skinned vertices are a blend of the vertex moved by each of its bones, so they are inside the union of the boxes
+BoundingBox transformBoundingBox(const Matrix44* bone_matrices, const int bone_count, const Matrix44& model, const BoundingBox& box)
+{
+	BoundingBox result = transformBoundingBox(bone_matrices[0] * model, box);
+	for (int i = 1; i < bone_count; ++i)
+		result = mergeBoundingBoxes(result, transformBoundingBox(bone_matrices[i] * model, box));
+	return result;
+}
+
 BoundingBox mergeBoundingBoxes(const BoundingBox& a, const BoundingBox& b)
 {
 	BoundingBox result;
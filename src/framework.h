@@ -373,6 +373,8 @@ public:
 //applies a transform to a AABB from object to world
 BoundingBox mergeBoundingBoxes(const BoundingBox& a, const BoundingBox& b);
 BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box);
+//the box of a skinned mesh, the bind pose box moved by every bone of the palette and then by the model
+BoundingBox transformBoundingBox(const Matrix44* bone_matrices, const int bone_count, const Matrix44& model, const BoundingBox& box);
 
 float signedDistanceToPlane(const Vector4& plane, const Vector3& point);
 int planeBoxOverlap( const Vector4& plane, const Vector3& center, const Vector3& halfsize );
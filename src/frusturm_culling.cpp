@@ -1,4 +1,8 @@
 #include "frusturm_culling.h"
+#include "skinning.h"
+#include "animation_batch.h"
+#include "mesh_lod.h"
+#include "occlusion_culling.h"
 
 
 namespace GTR {
@@ -11,6 +15,9 @@ namespace GTR {
 		bool opaque_draw_call_distance_comp(const GTR::sDrawCall& d1, const GTR::sDrawCall& d2) {
 			return d1.camera_distance < d2.camera_distance;
 		}
+		bool decal_texture_comp(const GTR::DecalEntity* d1, const GTR::DecalEntity* d2) {
+			return d1->color_tex < d2->color_tex;
+		}
 
 		void frustrum_culling(std::vector<GTR::BaseEntity*> entities, sSceneCulling* culling_result, Camera *cam) {
 			int total_light_count = 0;
@@ -43,14 +50,26 @@ namespace GTR {
 						culling_result->_scene_non_directonal_lights.push_back(curr_light);
 					}
 				}
+				else if (ent->entity_type == DECALL) {
+					DecalEntity* decal = (DecalEntity*)ent;
+					// The volume of the decal is a unit cube on its model
+					BoundingBox world_bounding = transformBoundingBox(decal->model, BoundingBox(Vector3(0.0f, 0.0f, 0.0f), Vector3(0.5f, 0.5f, 0.5f)));
+					if (decal->color_tex && cam->testBoxInFrustum(world_bounding.center, world_bounding.halfsize)) {
+						culling_result->_decals.push_back(decal);
+					}
+				}
 			}
 
 			// Accourding tot the rendering data, add it to the rendering queue
 			for (uint16_t i = 0; i < culling_result->scene_prefabs.size(); i++) {
 				PrefabEntity* pent = culling_result->scene_prefabs[i];
-				culling_result->add_to_render_queue(pent->model, &(pent->prefab->root), cam, pent->pbr_structure);
+				culling_result->add_to_render_queue(pent->model, &(pent->prefab->root), cam, pent->pbr_structure, pent);
 			}
 
+			// The objects behind the biggest ones are hidden before the lights and the sorting
+			if (culling_result->occlusion_culling)
+				OCCLUSION::cull(cam, culling_result);
+
 			// Iterate all the lights on the scene
 			for (uint16_t light_i = 0; light_i < culling_result->_scene_non_directonal_lights.size(); light_i++) {
 				LightEntity* curr_light = culling_result->_scene_non_directonal_lights[light_i];
@@ -91,11 +110,12 @@ namespace GTR {
 			// Order the opaque & translucent
 			std::sort(culling_result->_opaque_objects.begin(), culling_result->_opaque_objects.end(), opaque_draw_call_distance_comp);
 			std::sort(culling_result->_translucent_objects.begin(), culling_result->_translucent_objects.end(), translucent_draw_call_distance_comp);
+			std::sort(culling_result->_decals.begin(), culling_result->_decals.end(), decal_texture_comp);
 		}
 
 
 
-			void sSceneCulling::add_to_render_queue(const Matrix44& prefab_model, GTR::Node* node, Camera* camera, ePBR_Type pbr) {
+			void sSceneCulling::add_to_render_queue(const Matrix44& prefab_model, GTR::Node* node, Camera* camera, ePBR_Type pbr, PrefabEntity* entity) {
 				if (!node->visible)
 					return;
 
@@ -108,28 +128,56 @@ namespace GTR {
 					//compute the bounding box of the object in world space (by using the mesh bounding box transformed to world space)
 					BoundingBox world_bounding = transformBoundingBox(node_model, node->mesh->box);
 
+					// The animated meshes use the palette of their instance in the animation batch. The pose can go
+					// out of the bind pose box, so the box is the one of the palette, for the frustum and the occlusion
+					int batch_instance = -1;
+					if (SKINNING::enabled && entity && entity->animation && node->mesh->bones_info.size())
+					{
+						const AnimationBatch& batch = ANIMATION_BATCH::scene_batch;
+						batch_instance = entity->getAnimationInstance(node->mesh);
+						const int bone_count = (batch_instance >= 0 && batch_instance < (int)batch.instances.size()) ? batch.getPaletteSize(batch_instance) : 0;
+						if (bone_count)
+							world_bounding = transformBoundingBox(batch.getPalette(batch_instance), bone_count, node_model, node->mesh->box);
+					}
+
 					//if bounding box is inside the camera frustum then the object is probably visible
 					if (camera->testBoxInFrustum(world_bounding.center, world_bounding.halfsize))
 					{
 						// Compute the closest distance between the bounding box of the mesh and the camera
 						float camera_distance = Min((world_bounding.center + world_bounding.halfsize).distance(camera->eye), world_bounding.center.distance(camera->eye));
 						camera_distance = Min(camera_distance, (world_bounding.center - world_bounding.halfsize).distance(camera->eye));
-						add_draw_instance(node_model, node->mesh, node->material, camera, world_bounding.center.distance(camera->eye), world_bounding, pbr);
+						const int palette_offset = (batch_instance != -1) ? SKINNING::get_palette_offset(batch_instance) : -1;
+						// The LOD by the error of the mesh on the screen
+						const float lod_scale = camera->getProjectedScale(world_bounding.center, MESH_LOD::get_model_scale(node_model));
+						int lod = 0;
+						if (node->mesh->lods.size() && lod_hysteresis && entity) {
+							auto it = entity->node_lods.find(node);
+							lod = MESH_LOD::select_lod(node->mesh, lod_scale, lod_bias, (it != entity->node_lods.end()) ? it->second : -1);
+							entity->node_lods[node] = (uint8_t)lod;
+						}
+						else if (node->mesh->lods.size())
+							lod = MESH_LOD::select_lod(node->mesh, lod_scale, lod_bias);
+						if (lod_hysteresis)
+							MESH_LOD::count_selected(lod);
+						add_draw_instance(node_model, node->mesh, node->material, camera, world_bounding.center.distance(camera->eye), world_bounding, pbr, palette_offset, (uint8_t)lod, lod_scale);
+						// The skinned meshes move away from their bind pose, they can not occlude
+						if (occlusion_culling && entity && entity->occluder && palette_offset == -1 && node->material->alpha_mode == NO_ALPHA)
+							_occluder_candidates.push_back((uint32_t)_opaque_objects.size() - 1);
 					}
 				}
 
 				//iterate recursively with children
 				for (int i = 0; i < node->children.size(); ++i)
-					add_to_render_queue(prefab_model, node->children[i], camera, pbr);
+					add_to_render_queue(prefab_model, node->children[i], camera, pbr, entity);
 			}
 
-			void sSceneCulling::add_draw_instance(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera, const float camera_distance, const BoundingBox& aabb, const ePBR_Type pbr) {
+			void sSceneCulling::add_draw_instance(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera, const float camera_distance, const BoundingBox& aabb, const ePBR_Type pbr, const int palette_offset, const uint8_t lod, const float lod_scale) {
 				// Based on the material, we add it to the translucent or the opaque queue
 				if (material->alpha_mode != NO_ALPHA) {
-					_translucent_objects.push_back(sDrawCall{ model, mesh, material, camera, camera_distance, pbr, aabb });
+					_translucent_objects.push_back(sDrawCall{ model, mesh, material, camera, camera_distance, pbr, aabb, palette_offset, lod, lod_scale });
 				}
 				else {
-					_opaque_objects.push_back(sDrawCall{ model, mesh, material, camera,  camera_distance, pbr, aabb });
+					_opaque_objects.push_back(sDrawCall{ model, mesh, material, camera,  camera_distance, pbr, aabb, palette_offset, lod, lod_scale });
 				}
 			}
 	};
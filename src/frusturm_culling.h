@@ -26,6 +26,14 @@ namespace GTR {
 			std::vector<sDrawCall> _translucent_objects;
 			std::vector<LightEntity*> _scene_non_directonal_lights;
 			std::vector<LightEntity*> _scene_directional_lights;
+			std::vector<DecalEntity*> _decals; // Sorted by texture, for batching
+			std::vector<sDrawCall> _occluded_objects; // Hidden by the occluders, they still cast shadows
+			std::vector<uint32_t> _occluder_candidates; // Indices in _opaque_objects, see OCCLUSION
+
+			// Of the pass, see MESH_LOD. The hysteresis is only for the main view, it keeps the LODs in the entities
+			float lod_bias = 0.0f;
+			bool lod_hysteresis = false;
+			bool occlusion_culling = false; // Only for the main view
 
 			inline void clear() {
 				_opaque_objects.clear();
@@ -33,12 +41,16 @@ namespace GTR {
 				_scene_directional_lights.clear();
 				_scene_non_directonal_lights.clear();
 				scene_prefabs.clear();
+				_decals.clear();
+				_occluded_objects.clear();
+				_occluder_candidates.clear();
 			}
 
 
-			void add_to_render_queue(const Matrix44& prefab_model, GTR::Node* node, Camera* camera, ePBR_Type pbr);
+			// The entity gives the palettes of the skinned meshes
+			void add_to_render_queue(const Matrix44& prefab_model, GTR::Node* node, Camera* camera, ePBR_Type pbr, PrefabEntity* entity = NULL);
 
-			void add_draw_instance(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera, const float camera_distance, const BoundingBox& aabb, const ePBR_Type pbr);
+			void add_draw_instance(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera, const float camera_distance, const BoundingBox& aabb, const ePBR_Type pbr, const int palette_offset = -1, const uint8_t lod = 0, const float lod_scale = 0.0f);
 		};
 	};
 };
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include "includes.h"
 #include "renderer.h"
 #include "frusturm_culling.h"
+#include "mesh_lod.h"
+#include <cstdio>
 
 void GTR::sGI_Component::init(Renderer* rend_inst) {
 	renderer_instance = rend_inst;
@@ -14,63 +16,248 @@ void GTR::sGI_Component::init(Renderer* rend_inst) {
 		GL_FLOAT, 
 		true);
 
-	//probe_position[0] = vec3(00.0f, 020.0f, 0.0f);
-	//used_probe[0] = true;
-	//probe_position[1] = vec3(0, 50.0, 0);
 	create_probe_area(origin_probe_position, probe_area_size, probe_distnace_radius);
+
+	static_assert(sizeof(sGIBlock) % 16 == 0, "std140 blocks are padded to 16 bytes");
+	gi_block.create("GIBlock", GI_BLOCK_BINDING, sizeof(sGIBlock));
+}
+
+void GTR::sGI_Component::upload_GI_block() {
+	sGIBlock block;
+	block.irr_start = origin_probe_position;
+	block.irr_radius = probe_distnace_radius;
+	block.irr_size = vec3((float)(int)probe_area_size.x, (float)(int)probe_area_size.y, (float)(int)probe_area_size.z);
+	block.irr_probe_count = probe_size;
+	block.irr_end = probe_end_position;
+	block.use_irradiance = use_GI ? 1 : 0;
+	block.irr_tex_size = probe_texture ? vec2(probe_texture->width, probe_texture->height) : vec2(0.0f, 0.0f);
+
+	gi_block.upload(&block);
 }
 
 void GTR::sGI_Component::create_probe_area(const vec3 postion, const vec3 size, const float probe_radius_size) {
-	
-	bool has_size_changed = old_probe_size.x != size.x ||
-							old_probe_size.y != size.y ||
-							old_probe_size.z != size.z;
-	if (has_size_changed) {
-		if (probe_pos != NULL) {
-			free(probe_pos);
-			free(harmonics);
-		}
+	origin_probe_position = postion;
+	probe_area_size = size;
+	probe_distnace_radius = probe_radius_size;
+	probe_end_position = postion + vec3((int)size.x - 1, (int)size.y - 1, (int)size.z - 1) * probe_radius_size;
+
+	brick_dims[0] = ((int)size.x + GI_BRICK_SIZE - 1) / GI_BRICK_SIZE;
+	brick_dims[1] = ((int)size.y + GI_BRICK_SIZE - 1) / GI_BRICK_SIZE;
+	brick_dims[2] = ((int)size.z + GI_BRICK_SIZE - 1) / GI_BRICK_SIZE;
 
-		probe_pos = (vec3*)malloc(sizeof(vec3) * size.x * size.y * size.z);
-		probe_size = size.x * size.y * size.z;
-		harmonics = (SphericalHarmonics*)malloc(sizeof(SphericalHarmonics) * size.x * size.y * size.z);
+	brick_indirection.assign(brick_dims[0] * brick_dims[1] * brick_dims[2], GI_EMPTY_BRICK);
+	brick_count = 0;
+	probe_size = 0;
+	probe_pos.clear();
+	harmonics.clear();
+
+	upload_probe_textures();
+}
+
+// Walk the nodes, as the culling does, to get the world AABBs with a mesh
+inline void add_node_boxes(const Matrix44& prefab_model, GTR::Node* node, std::vector<BoundingBox>* boxes) {
+	if (!node->visible)
+		return;
+
+	if (node->mesh) {
+		boxes->push_back(transformBoundingBox(node->getGlobalMatrix(true) * prefab_model, node->mesh->box));
 	}
 
-	for (float y = 0.0f; y < size.y; y++ ) {
-		for (float z = 0.0f; z < size.z; z++) {
-			for (float x = 0.0f; x < size.x; x++) {
-				//
+	for (int i = 0; i < node->children.size(); ++i)
+		add_node_boxes(prefab_model, node->children[i], boxes);
+}
 
-					// Store the current ir probe
-				int probe_index = x + y * size.x + z * size.x * size.y;
-				// Store the current ir probe
-				probe_pos[probe_index] = postion + vec3(x, y, z) * probe_radius_size;
-			}
+void GTR::sGI_Component::allocate_bricks(const std::vector<BaseEntity*> &entity_list) {
+	create_probe_area(origin_probe_position, probe_area_size, probe_distnace_radius);
+
+	std::vector<BoundingBox> boxes;
+	for (int i = 0; i < entity_list.size(); i++) {
+		BaseEntity* entity = entity_list[i];
+		if (!entity->visible || entity->entity_type != PREFAB) {
+			continue;
+		}
+		PrefabEntity* prefab_entity = (PrefabEntity*)entity;
+		if (prefab_entity->prefab) {
+			add_node_boxes(prefab_entity->model, &prefab_entity->prefab->root, &boxes);
 		}
 	}
 
-	origin_probe_position = postion;
-	old_probe_size = size;
-
-	if (has_size_changed) {
-		if (probe_texture != NULL) {
-			delete probe_texture;
+	// A brick is kept if its box, grown by a probe distance, touches some geometry.
+	// This only discards the empty space, the big meshes (walls, rooms) have big AABBs
+	const float brick_extent = GI_BRICK_SIZE * probe_distnace_radius;
+	const vec3 brick_halfsize = vec3(1.0f, 1.0f, 1.0f) * (0.5f * (GI_BRICK_SIZE - 1) * probe_distnace_radius + probe_distnace_radius);
+
+	for (int z = 0; z < brick_dims[2]; z++) {
+		for (int y = 0; y < brick_dims[1]; y++) {
+			for (int x = 0; x < brick_dims[0]; x++) {
+				const vec3 brick_origin = origin_probe_position + vec3(x, y, z) * brick_extent;
+				const vec3 brick_center = brick_origin + vec3(1.0f, 1.0f, 1.0f) * (0.5f * (GI_BRICK_SIZE - 1) * probe_distnace_radius);
+
+				bool is_near_geometry = false;
+				for (uint32_t i = 0; i < boxes.size() && !is_near_geometry; i++) {
+					const vec3 distance = boxes[i].center - brick_center;
+					is_near_geometry = fabs(distance.x) <= boxes[i].halfsize.x + brick_halfsize.x &&
+										fabs(distance.y) <= boxes[i].halfsize.y + brick_halfsize.y &&
+										fabs(distance.z) <= boxes[i].halfsize.z + brick_halfsize.z;
+				}
+
+				if (!is_near_geometry || brick_count >= MAX_GI_BRICK_COUNT) {
+					continue;
+				}
+
+				brick_indirection[x + y * brick_dims[0] + z * brick_dims[0] * brick_dims[1]] = brick_count++;
+
+				for (int pz = 0; pz < GI_BRICK_SIZE; pz++) {
+					for (int py = 0; py < GI_BRICK_SIZE; py++) {
+						for (int px = 0; px < GI_BRICK_SIZE; px++) {
+							probe_pos.push_back(brick_origin + vec3(px, py, pz) * probe_distnace_radius);
+						}
+					}
+				}
+			}
 		}
-		probe_texture = new Texture(9, probe_size, GL_RGB, GL_FLOAT);
 	}
+
+	probe_size = probe_pos.size();
+	harmonics.assign(probe_size, SphericalHarmonics());
 }
 
 void GTR::sGI_Component::compute_all_probes(const std::vector<BaseEntity*> &entity_list) {
+	allocate_bricks(entity_list);
+	if (probe_size == 0) {
+		return;
+	}
+
 	for (int i = 0; i < probe_size; i++) {
-		render_to_probe(entity_list, i);
+		// The bricks on the border overhang the grid, the shader never reads those probes
+		if (!is_probe_outside_grid(i)) {
+			render_to_probe(entity_list, i);
+		}
+	}
+	upload_probe_textures();
+
+	if (!bake_filename.empty() && !save_probes(bake_filename.c_str())) {
+		std::cout << " - Could not save the baked probes to " << bake_filename << std::endl;
+	}
+}
+
+void GTR::sGI_Component::upload_probe_textures() {
+	if (probe_texture != NULL) {
+		delete probe_texture;
+	}
+	if (indirection_texture != NULL) {
+		delete indirection_texture;
 	}
-	probe_texture->bind();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	probe_texture->unbind();
-	probe_texture->upload(GL_RGB, GL_FLOAT, false, (uint8_t*) harmonics);
+
+	// SH stored as half floats on the GPU, there is always at least a row so the sampler is valid
+	probe_texture = new Texture(9 * GI_BRICK_PROBES, max(brick_count, 1), GL_RGB, GL_FLOAT, false, brick_count > 0 ? (Uint8*)&harmonics[0] : NULL, GL_RGB16F);
+
+	indirection_texture = new Texture();
+	indirection_texture->create3D(brick_dims[0], brick_dims[1], brick_dims[2], GL_RED_INTEGER, GL_UNSIGNED_SHORT, false, (Uint8*)&brick_indirection[0], GL_R16UI);
+
+	// Both are read with texelFetch, and the integer textures are incomplete with linear filtering
+	Texture* textures[2] = { probe_texture, indirection_texture };
+	for (int i = 0; i < 2; i++) {
+		glBindTexture(textures[i]->texture_type, textures[i]->texture_id);
+		glTexParameteri(textures[i]->texture_type, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(textures[i]->texture_type, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	}
+	glBindTexture(GL_TEXTURE_3D, 0);
 }
 
+void GTR::sGI_Component::set_scene(const Scene* scene) {
+	std::string filename = scene->filename;
+	const size_t extension = filename.find_last_of('.');
+	filename = (extension == std::string::npos ? filename : filename.substr(0, extension)) + ".probes";
+
+	if (filename == bake_filename) {
+		return;
+	}
+	bake_filename = filename;
+	load_probes(bake_filename.c_str());
+}
+
+bool GTR::sGI_Component::save_probes(const char* filename) const {
+	FILE* file = fopen(filename, "wb");
+	if (file == NULL) {
+		return false;
+	}
+
+	sGIBakeHeader header;
+	header.magic = GI_BAKE_MAGIC;
+	header.version = GI_BAKE_VERSION;
+	header.origin = origin_probe_position;
+	header.probe_distance = probe_distnace_radius;
+	header.probe_dims[0] = (int)probe_area_size.x;
+	header.probe_dims[1] = (int)probe_area_size.y;
+	header.probe_dims[2] = (int)probe_area_size.z;
+	header.brick_size = GI_BRICK_SIZE;
+	header.brick_count = brick_count;
+
+	fwrite(&header, 1, sizeof(header), file);
+	fwrite(&brick_indirection[0], sizeof(uint16_t), brick_indirection.size(), file);
+	if (probe_size > 0) {
+		fwrite(&harmonics[0], sizeof(SphericalHarmonics), probe_size, file);
+	}
+	fclose(file);
+	return true;
+}
+
+bool GTR::sGI_Component::load_probes(const char* filename) {
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL) {
+		return false;
+	}
+
+	sGIBakeHeader header;
+	if (fread(&header, 1, sizeof(header), file) != sizeof(header) ||
+		header.magic != GI_BAKE_MAGIC || header.version != GI_BAKE_VERSION ||
+		header.brick_size != GI_BRICK_SIZE || header.brick_count > MAX_GI_BRICK_COUNT ||
+		header.probe_dims[0] < 1 || header.probe_dims[1] < 1 || header.probe_dims[2] < 1) {
+		std::cout << " - Ignoring the baked probes of " << filename << ", old format" << std::endl;
+		fclose(file);
+		return false;
+	}
+
+	// The bake defines the area
+	create_probe_area(header.origin, vec3(header.probe_dims[0], header.probe_dims[1], header.probe_dims[2]), header.probe_distance);
+
+	bool is_valid = fread(&brick_indirection[0], sizeof(uint16_t), brick_indirection.size(), file) == brick_indirection.size();
+
+	probe_size = header.brick_count * GI_BRICK_PROBES;
+	harmonics.resize(probe_size);
+	is_valid = is_valid && (probe_size == 0 || fread(&harmonics[0], sizeof(SphericalHarmonics), probe_size, file) == probe_size);
+	fclose(file);
+
+	if (!is_valid) {
+		std::cout << " - The baked probes of " << filename << " are truncated" << std::endl;
+		create_probe_area(origin_probe_position, probe_area_size, probe_distnace_radius);
+		return false;
+	}
+
+	// The positions are not stored, they follow the order of the bricks
+	brick_count = header.brick_count;
+	probe_pos.resize(probe_size);
+	for (int z = 0; z < brick_dims[2]; z++) {
+		for (int y = 0; y < brick_dims[1]; y++) {
+			for (int x = 0; x < brick_dims[0]; x++) {
+				const uint16_t brick = brick_indirection[x + y * brick_dims[0] + z * brick_dims[0] * brick_dims[1]];
+				if (brick == GI_EMPTY_BRICK || brick >= brick_count) {
+					continue;
+				}
+				const vec3 brick_origin = origin_probe_position + vec3(x, y, z) * (GI_BRICK_SIZE * probe_distnace_radius);
+				for (int i = 0; i < GI_BRICK_PROBES; i++) {
+					const vec3 local = vec3(i % GI_BRICK_SIZE, (i / GI_BRICK_SIZE) % GI_BRICK_SIZE, i / (GI_BRICK_SIZE * GI_BRICK_SIZE));
+					probe_pos[brick * GI_BRICK_PROBES + i] = brick_origin + local * probe_distnace_radius;
+				}
+			}
+		}
+	}
+
+	upload_probe_textures();
+	std::cout << " + Loaded " << brick_count << " probe bricks from " << filename << std::endl;
+	return true;
+}
 
 // Generate probe coefficients
 void GTR::sGI_Component::render_to_probe(const std::vector<BaseEntity*> &entity_list, const uint32_t probe_id) {
@@ -91,6 +278,7 @@ void GTR::sGI_Component::render_to_probe(const std::vector<BaseEntity*> &entity_
 
 		// Given the scene, and a camara, perform frustum culling
 		CULLING::sSceneCulling culling_result;
+		culling_result.lod_bias = MESH_LOD::pass_bias[MESH_LOD::PASS_PROBES];
 		// Note: maybe start from scene culling is a bit of a waste
 		CULLING::frustrum_culling(entity_list, &culling_result, &render_cam);
 
@@ -147,17 +335,32 @@ void GTR::sGI_Component::render_imgui() {
 		if (ImGui::Button("Compute GI")) {
 			compute_all_probes(*renderer_instance->entity_list);
 		}
+		ImGui::SameLine();
+		if (ImGui::Button("Reload bake") && !bake_filename.empty()) {
+			load_probes(bake_filename.c_str());
+		}
 
 		ImGui::Checkbox("Use irradiance", &use_GI);
 		ImGui::Checkbox("Show render probes", &debug_show_spheres);
 
+		// Against the dense grid that the bricks replace
+		const int dense_probes = (int)probe_area_size.x * (int)probe_area_size.y * (int)probe_area_size.z;
+		const float to_KB = 1.0f / 1024.0f;
+		ImGui::Text("Bricks: %d / %d", brick_count, (int)brick_indirection.size());
+		ImGui::Text("Probes: %d (dense grid: %d)", probe_size, dense_probes);
+		ImGui::Text("GPU memory: %.1f KB (dense float grid: %.1f KB)",
+			(probe_size * 9 * 3 * 2 + brick_indirection.size() * sizeof(uint16_t)) * to_KB,
+			dense_probes * sizeof(SphericalHarmonics) * to_KB);
+		ImGui::Text("Bake file: %s", bake_filename.c_str());
+
 		ImGui::TreePop();
 	}
 }
 
 void GTR::sGI_Component::debug_render_probe(const uint32_t probe_id, const float radius, Camera* cam) {
 	Mesh* sphere = Mesh::Get("data/meshes/sphere.obj", false);
-	Shader* shader = Shader::Get("probe");
+	static const Handle<Shader> sh_probe("probe");
+	Shader* shader = sh_probe.get();
 
 	mat4 model;
 	model.setTranslation(probe_pos[probe_id].x, probe_pos[probe_id].y, probe_pos[probe_id].z);
@@ -7,62 +7,119 @@
 #include "texture.h"
 #include "shader.h"
 #include "scene.h"
+#include "uniform_buffer.h"
+#include <vector>
+#include <string>
 
 namespace GTR {
 
-#define MAX_PROBE_COUNT 530
+// The probe grid is split in bricks of GI_BRICK_SIZE^3 probes, and only the
+// bricks close to geometry are allocated and baked
+#define GI_BRICK_SIZE 4
+#define GI_BRICK_PROBES (GI_BRICK_SIZE * GI_BRICK_SIZE * GI_BRICK_SIZE)
+#define GI_EMPTY_BRICK 0xFFFF
+// The SH texture has a row per brick
+#define MAX_GI_BRICK_COUNT 4096
+
+#define GI_BAKE_MAGIC 0x56504947 // "GIPV"
+#define GI_BAKE_VERSION 1
 
 	class Renderer;
 
+	// Same layout as GIBlock in the shader atlas (std140)
+	struct sGIBlock {
+		vec3 irr_start;
+		float irr_radius;
+		vec3 irr_size;
+		int irr_probe_count;
+		vec3 irr_end;
+		int use_irradiance;
+		vec2 irr_tex_size;
+		float padding[2];
+	};
+
+	// Header of the baked probes file, followed by the brick indirection (uint16 per brick)
+	// and the SH of the allocated bricks
+	struct sGIBakeHeader {
+		uint32_t magic;
+		uint32_t version;
+		vec3 origin;
+		float probe_distance;
+		int probe_dims[3];
+		int brick_size;
+		int brick_count;
+	};
+
 	struct sGI_Component {
 		Renderer* renderer_instance;
 		FBO* irradiance_fbo;
 
+		// SH of the allocated bricks, 9 texels per probe and a row per brick (half float)
 		Texture* probe_texture = NULL;
+		// 3D texture with the row of each brick in probe_texture, GI_EMPTY_BRICK when it is not allocated
+		Texture* indirection_texture = NULL;
+		UniformBuffer gi_block;
 
+		// Allocated probes, GI_BRICK_PROBES per brick, in the order of the rows
 		int probe_size = 0;
-		vec3* probe_pos = NULL;
-		SphericalHarmonics* harmonics = NULL;
+		std::vector<vec3> probe_pos;
+		std::vector<SphericalHarmonics> harmonics;
+
+		int brick_dims[3] = { 0, 0, 0 };
+		std::vector<uint16_t> brick_indirection;
+		int brick_count = 0;
 		
 		vec3 origin_probe_position = vec3(-350.0f, 28.0f, -400.0f);
 		vec3 probe_end_position = vec3();
 		vec3 probe_area_size = vec3(9.0f, 3.00f, 10.0f);
-		vec3 old_probe_size = vec3();
 		float probe_distnace_radius = 100.0f;
 
+		// Baked probes of the current scene, next to the scene file
+		std::string bake_filename;
+
 		bool debug_show_spheres = false;
 
 		bool use_GI = false;
 
 		void init(Renderer *rend_inst);
 
+		// Resets the bricks, the area needs to be baked again
 		void create_probe_area(const vec3 postion, const vec3 size, const float probe_area_size);
 
+		// Allocates the bricks that overlap the world AABB of a prefab node
+		void allocate_bricks(const std::vector<BaseEntity*> &entity_list);
+
 		void compute_all_probes(const std::vector<BaseEntity*> &entity_list);
 
 		void render_to_probe(const std::vector<BaseEntity*> &entity_list, const uint32_t probe_id);
 
+		void upload_probe_textures();
+
+		// Loads the bake of the scene when it changes
+		void set_scene(const Scene* scene);
+		bool save_probes(const char* filename) const;
+		bool load_probes(const char* filename);
+
 		void render_imgui();
 
 		void debug_render_probe(const uint32_t probe_id, const float radius, Camera* cam);
 
 		void debug_render_all_probes(const float radius, Camera* cam);
 
-		inline void bind_GI(Shader *shad) {
+		// Once per frame, the shaders read the grid from the GIBlock
+		void upload_GI_block();
 
-			shad->setUniform("u_gi_probe_tex", probe_texture, 6);
-			shad->setUniform("u_irr_start", origin_probe_position);
-			shad->setUniform("u_irr_end", probe_end_position);
-			shad->setUniform("u_irr_size", probe_area_size);
-			shad->setUniform("u_irr_radius", probe_distnace_radius);
-			shad->setUniform("u_irr_tex_size", vec2(probe_texture->width, probe_texture->height));
-			shad->setUniform("u_irr_probe_count", probe_size);
-			//std::cout << probe_count << std::endl;
-			if (use_GI) {
-				shad->setUniform("u_use_irradiance", 1);
-			} else {
-				shad->setUniform("u_use_irradiance", 0);
-			}
+		// The probe is in a brick that overhangs the grid
+		inline bool is_probe_outside_grid(const uint32_t probe_id) const {
+			const vec3 grid_pos = (probe_pos[probe_id] - origin_probe_position) * (1.0f / probe_distnace_radius);
+			return grid_pos.x > probe_area_size.x - 0.5f || grid_pos.y > probe_area_size.y - 0.5f || grid_pos.z > probe_area_size.z - 0.5f;
+		}
+
+		inline void bind_GI(Shader *shad) {
+			static const sUniformHandle u_gi_probe_tex("u_gi_probe_tex");
+			static const sUniformHandle u_gi_indirection_tex("u_gi_indirection_tex");
+			shad->setUniform(u_gi_probe_tex, probe_texture, 6);
+			shad->setUniform(u_gi_indirection_tex, indirection_texture, 7);
 		}
 	};
 };
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include "extra/cgltf.h"
 
 #include "mesh.h"
+#include "mesh_lod.h"
+#include "mesh_optimizer.h"
 #include "texture.h"
 #include "material.h"
 #include "prefab.h"
@@ -152,12 +154,66 @@ void parseGLTFBufferIndices(std::vector<unsigned int>& container, cgltf_accessor
 	}
 }
 
-std::vector<Mesh*> parseGLTFMesh(cgltf_mesh* meshdata, const char* basename)
+//fills the streams of a primitive, without GL calls so it can run in the loading threads
+Mesh* decodeGLTFPrimitive(cgltf_primitive* primitive)
+{
+	Mesh* mesh = new Mesh();
+
+    //streams
+	for (int j = 0; j < primitive->attributes_count; ++j)
+	{
+		cgltf_attribute* attr = &primitive->attributes[j];
+
+        //std::string attrname = attr->name;
+		if (attr->type == cgltf_attribute_type_position)
+		{
+			parseGLTFBufferVector3(mesh->vertices, attr->data);
+			if (attr->data->has_min && attr->data->has_max)
+			{
+				mesh->aabb_min = attr->data->min;
+				mesh->aabb_max = attr->data->max;
+				mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5f;
+				mesh->box.halfsize = mesh->aabb_max - mesh->box.center;
+			}
+			else
+				mesh->updateBoundingBox();
+		}
+		else
+		if (attr->type == cgltf_attribute_type_normal)
+			parseGLTFBufferVector3(mesh->normals, attr->data);
+		else
+		if (attr->type == cgltf_attribute_type_texcoord)
+		{
+			if (strcmp(attr->name,"TEXCOORD_1") == 0) //secondary UV set
+				parseGLTFBufferVector2(mesh->m_uvs1, attr->data);
+			else
+				parseGLTFBufferVector2(mesh->uvs, attr->data);
+		}
+
+		if (primitive->indices && primitive->indices->count)
+			parseGLTFBufferIndices(mesh->m_indices, primitive->indices);
+	}
+
+	//there is no .BIN for the primitives, they are optimized every time, in the loading threads
+	MESH_OPTIMIZER::optimize(mesh);
+	if (MESH_LOD::generate_on_load)
+		MESH_LOD::generate_lods(mesh);
+	return mesh;
+}
+
+//decoded has the meshes of the primitives already decoded in a loading thread, or NULL
+//with the index of the mesh in the file, the meshes can be read again after being evicted
+std::vector<Mesh*> parseGLTFMesh(cgltf_mesh* meshdata, const char* basename, std::vector<Mesh*>* decoded = NULL, int mesh_index = -1)
 {
 	std::vector<Mesh*> result;
 
+	//the hash of "basename::meshname::", the submesh names are only built to register them
+	uint64_t mesh_hash = 0;
 	if (meshdata->name)
+	{
 		stdlog( std::string("\t<- MESH: ") + meshdata->name);
+		mesh_hash = hashAssetName("::", hashAssetName(meshdata->name, hashAssetName("::", hashAssetName(basename))));
+	}
 
     //submeshes
 	for (int i = 0; i < meshdata->primitives_count; ++i)
@@ -165,11 +221,9 @@ std::vector<Mesh*> parseGLTFMesh(cgltf_mesh* meshdata, const char* basename)
 		cgltf_primitive* primitive = &meshdata->primitives[i];
 		Mesh* mesh = NULL;
 
-		std::string submesh_name;
 		if (meshdata->name)
 		{
-			submesh_name = std::string(basename) + std::string("::") + std::string(meshdata->name) + std::string("::") + std::to_string(i);
-			mesh = Mesh::Get(submesh_name.c_str(), true);
+			mesh = Mesh::Find(hashAssetNumber(i, mesh_hash));
 			if (mesh)
 			{
 				result.push_back(mesh);
@@ -177,45 +231,29 @@ std::vector<Mesh*> parseGLTFMesh(cgltf_mesh* meshdata, const char* basename)
 			}
 		}
 
-		mesh = new Mesh();
-
-        //streams
-		for (int j = 0; j < primitive->attributes_count; ++j)
+		if (decoded && (*decoded)[i])
 		{
-			cgltf_attribute* attr = &primitive->attributes[j];
-
-            //std::string attrname = attr->name;
-			if (attr->type == cgltf_attribute_type_position)
-			{
-				parseGLTFBufferVector3(mesh->vertices, attr->data);
-				if (attr->data->has_min && attr->data->has_max)
-				{
-					mesh->aabb_min = attr->data->min;
-					mesh->aabb_max = attr->data->max;
-					mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5f;
-					mesh->box.halfsize = mesh->aabb_max - mesh->box.center;
-				}
-				else
-					mesh->updateBoundingBox();
-			}
-			else
-			if (attr->type == cgltf_attribute_type_normal)
-				parseGLTFBufferVector3(mesh->normals, attr->data);
-			else
-			if (attr->type == cgltf_attribute_type_texcoord)
-			{
-				if (strcmp(attr->name,"TEXCOORD_1") == 0) //secondary UV set
-					parseGLTFBufferVector2(mesh->m_uvs1, attr->data);
-				else
-					parseGLTFBufferVector2(mesh->uvs, attr->data);
-			}
-
-			if (primitive->indices && primitive->indices->count)
-				parseGLTFBufferIndices(mesh->m_indices, primitive->indices);
+			mesh = (*decoded)[i];
+			(*decoded)[i] = NULL; //owned by the registry now
 		}
+		else
+			mesh = decodeGLTFPrimitive(primitive);
+
 		mesh->uploadToVRAM();
+		if (mesh_index != -1)
+		{
+			std::string filename = basename;
+			mesh->reload_callback = [filename, mesh_index, i](Mesh* dst) {
+				Mesh* data = readGLTFPrimitive(filename.c_str(), mesh_index, i);
+				if (!data)
+					return false;
+				dst->takeBuffers(data);
+				delete data;
+				return true;
+			};
+		}
 		if (meshdata->name)
-			mesh->registerMesh(submesh_name);
+			mesh->registerMesh(std::string(basename) + "::" + meshdata->name + "::" + std::to_string(i));
 		result.push_back(mesh);
 	}
 
@@ -289,19 +327,15 @@ Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
 GTR::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 {
 	GTR::Material* material = NULL;
-	std::string name;
 	if (matdata->name)
-	{
-		name = std::string(basename) + std::string("::") + std::string(matdata->name);
-		material = GTR::Material::Get(name.c_str());
-	}
+		material = GTR::Material::Get(hashAssetName(matdata->name, hashAssetName("::", hashAssetName(basename))));
 	
 	if (material)
 		return material;
 
 	material = new GTR::Material();
 	if (matdata->name)
-		material->registerMaterial(name.c_str());
+		material->registerMaterial((std::string(basename) + std::string("::") + std::string(matdata->name)).c_str());
 
 	material->alpha_mode = (GTR::eAlphaMode)matdata->alpha_mode;
 	material->alpha_cutoff = matdata->alpha_cutoff;
@@ -379,8 +413,24 @@ void parseGLTFTransform(cgltf_node* node, Matrix44 &model)
 	}
 }
 
+//the meshes decoded in the loading thread for a cgltf mesh, or NULL
+std::vector<Mesh*>* getDecodedMeshes(sGLTFData* gltf, cgltf_mesh* mesh)
+{
+	if (!gltf)
+		return NULL;
+	return &gltf->meshes[mesh - gltf->data->meshes];
+}
+
+//the index to read the mesh again from the file, -1 if it was loaded from memory
+int getReloadIndex(sGLTFData* gltf, cgltf_mesh* mesh)
+{
+	if (!gltf || !gltf->from_file)
+		return -1;
+	return (int)(mesh - gltf->data->meshes);
+}
+
 //GLTF PARSING: you can pass the node or it will create it
-GTR::Node* parseGLTFNode(cgltf_node* node, GTR::Node* scenenode = NULL, const char* basename = NULL)
+GTR::Node* parseGLTFNode(cgltf_node* node, GTR::Node* scenenode = NULL, const char* basename = NULL, sGLTFData* gltf = NULL)
 {
 	if (scenenode == NULL)
 		scenenode = new GTR::Node();
@@ -399,7 +449,7 @@ GTR::Node* parseGLTFNode(cgltf_node* node, GTR::Node* scenenode = NULL, const ch
 		if (node->mesh->primitives_count > 1)
 		{
 			std::vector<Mesh*> meshes;
-			meshes = parseGLTFMesh(node->mesh, basename);
+			meshes = parseGLTFMesh(node->mesh, basename, getDecodedMeshes(gltf, node->mesh), getReloadIndex(gltf, node->mesh));
 
 			for (int i = 0; i < node->mesh->primitives_count; ++i)
 			{
@@ -418,7 +468,7 @@ GTR::Node* parseGLTFNode(cgltf_node* node, GTR::Node* scenenode = NULL, const ch
 			if (!scenenode->mesh)
 			{
 				std::vector<Mesh*> meshes;
-				meshes = parseGLTFMesh(node->mesh, basename);
+				meshes = parseGLTFMesh(node->mesh, basename, getDecodedMeshes(gltf, node->mesh), getReloadIndex(gltf, node->mesh));
 				//printf("Parsed GLTF mesh %s (success)\n", node->name);
 				//return nullptr;
 				if(meshes.size())
@@ -431,7 +481,7 @@ GTR::Node* parseGLTFNode(cgltf_node* node, GTR::Node* scenenode = NULL, const ch
 	}
 
 	for (int i = 0; i < node->children_count; ++i)
-		scenenode->addChild(parseGLTFNode(node->children[i],NULL, basename));
+		scenenode->addChild(parseGLTFNode(node->children[i],NULL, basename, gltf));
 
 	return scenenode;
 }
@@ -464,9 +514,49 @@ cgltf_result internalOpenMemory(const struct cgltf_memory_options* memory_option
 	return cgltf_result_success;
 }
 
-GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& options)
+//loads the buffers and decodes the meshes, no GL calls
+sGLTFData* decodeGLTF(const char* filename, cgltf_data* data, cgltf_options& options)
 {
-	cgltf_result result;
+	cgltf_result result = cgltf_load_buffers(&options, data, filename);
+	if (result != cgltf_result_success) {
+		stdlog(std::string("[BIN NOT FOUND]:") + filename);
+		cgltf_free(data);
+		return NULL;
+	}
+
+	sGLTFData* gltf = new sGLTFData();
+	gltf->filename = filename;
+	gltf->data = data;
+	gltf->meshes.resize(data->meshes_count);
+	for (int i = 0; i < data->meshes_count; ++i)
+		for (int j = 0; j < data->meshes[i].primitives_count; ++j)
+			gltf->meshes[i].push_back(decodeGLTFPrimitive(&data->meshes[i].primitives[j]));
+
+	return gltf;
+}
+
+void freeGLTF(sGLTFData* gltf)
+{
+	if (!gltf)
+		return;
+
+	//the meshes that were not used, because they were already loaded
+	for (int i = 0; i < gltf->meshes.size(); ++i)
+		for (int j = 0; j < gltf->meshes[i].size(); ++j)
+			delete gltf->meshes[i][j];
+
+	//frees all data, including bin
+	cgltf_free(gltf->data);
+	delete gltf;
+}
+
+GTR::Prefab* buildGLTF(sGLTFData* gltf)
+{
+	if (!gltf)
+		return NULL;
+
+	const char* filename = gltf->filename.c_str();
+	cgltf_data* data = gltf->data;
 
 	if (data->scenes_count > 1)
 		std::cout << "[WARN] more than one scene, skipping the rest" << std::endl;
@@ -483,31 +573,20 @@ GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 	const char* basename_start = strrchr(filename, '/');
 	strcpy(basename, basename_start+1);
 
-	{
-		result = cgltf_load_buffers(&options, data, filename);
-		if (result != cgltf_result_success) {
-			stdlog(std::string("[BIN NOT FOUND]:") + filename);
-			return NULL;
-		}
-	}
-
 	GTR::Prefab* prefab = new GTR::Prefab();
 
 	{
 		if (scene->nodes_count > 1)
 		{
-			cgltf_node *root = nullptr;
-			float fiTotal = 1.0f / (float) scene->nodes_count;
 			for (int i = 0; i < scene->nodes_count; ++i)
 			{
-				float fProgress = ((float) i * fiTotal) * 100.0f;
-				GTR::Node *node = parseGLTFNode(scene->nodes[i], NULL, filename);
+				GTR::Node *node = parseGLTFNode(scene->nodes[i], NULL, filename, gltf);
 				prefab->root.addChild(node);
 			}
 		}
 		else
 		{
-			parseGLTFNode(scene->nodes[0], &prefab->root, filename);
+			parseGLTFNode(scene->nodes[0], &prefab->root, filename, gltf);
 		}
 	}
 
@@ -531,48 +610,72 @@ GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 	prefab->updateNodesByName();
 	prefab->updateBounding();
 
-	//frees all data, including bin
-	cgltf_free(data);
+	stdlog( std::string(" - Loaded ") + filename );
 
-    stdlog( std::string(" - Loaded ") + filename );
+	freeGLTF(gltf);
 
-    return prefab;
+	return prefab;
 }
 
-GTR::Prefab* loadGLTF(const std::vector<unsigned char>& dat, const std::string& path)
+sGLTFData* readGLTF(const char* filename)
 {
+	stdlog(std::string("loading gltf... ") + filename);
 	cgltf_options options;
 	memset(&options, 0, sizeof(cgltf_options));
 	cgltf_data *data = NULL;
 
-	g_buffer = dat;
-	options.file.read = internalOpenMemory;
-	cgltf_result result = cgltf_parse_file(&options, path.c_str(), &data);
+	options.file.read = internalOpenFile;
+	cgltf_result result = cgltf_parse_file(&options, filename, &data);
 
 	if (result != cgltf_result_success) {
 		std::cout << "[NOT FOUND]" << std::endl;
 		return NULL;
 	}
-	return loadGLTF(path.c_str(), data, options);
+
+	sGLTFData* gltf = decodeGLTF(filename, data, options);
+	if (gltf)
+		gltf->from_file = true;
+	return gltf;
 }
 
-GTR::Prefab* loadGLTF(const char* filename)
+Mesh* readGLTFPrimitive(const char* filename, int mesh_index, int primitive_index)
 {
-	stdlog(std::string("loading gltf... ") + filename);
 	cgltf_options options;
 	memset(&options, 0, sizeof(cgltf_options));
 	cgltf_data *data = NULL;
 
-	{
-		options.file.read = internalOpenFile;
-		cgltf_result result = cgltf_parse_file(&options, filename, &data);
+	options.file.read = internalOpenFile;
+	if (cgltf_parse_file(&options, filename, &data) != cgltf_result_success)
+		return NULL;
 
-		if (result != cgltf_result_success) {
-			std::cout << "[NOT FOUND]" << std::endl;
-			return NULL;
-		}
+	Mesh* mesh = NULL;
+	if (cgltf_load_buffers(&options, data, filename) == cgltf_result_success &&
+		mesh_index < data->meshes_count && primitive_index < data->meshes[mesh_index].primitives_count)
+		mesh = decodeGLTFPrimitive(&data->meshes[mesh_index].primitives[primitive_index]);
+
+	cgltf_free(data);
+	return mesh;
+}
+
+GTR::Prefab* loadGLTF(const std::vector<unsigned char>& dat, const std::string& path)
+{
+	cgltf_options options;
+	memset(&options, 0, sizeof(cgltf_options));
+	cgltf_data *data = NULL;
+
+	g_buffer = dat;
+	options.file.read = internalOpenMemory;
+	cgltf_result result = cgltf_parse_file(&options, path.c_str(), &data);
+
+	if (result != cgltf_result_success) {
+		std::cout << "[NOT FOUND]" << std::endl;
+		return NULL;
 	}
+	return buildGLTF(decodeGLTF(path.c_str(), data, options));
+}
 
-	return loadGLTF(filename, data, options);
+GTR::Prefab* loadGLTF(const char* filename)
+{
+	return buildGLTF(readGLTF(filename));
 }
 
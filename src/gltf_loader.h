@@ -2,6 +2,22 @@
 
 #include "prefab.h"
 
+struct cgltf_data;
+
+//a gltf read and decoded in memory, ready to be uploaded to the GPU
+struct sGLTFData {
+	std::string filename;
+	cgltf_data* data = NULL;
+	std::vector<std::vector<Mesh*>> meshes; //decoded primitives of every mesh
+	bool from_file = false; //the meshes can be read again from the file
+};
+
 GTR::Prefab* loadGLTF(const char* filename);
 //GTR::Prefab* loadGLTF(const char* filename, cgltf_data* data, cgltf_options& options);
 GTR::Prefab* loadGLTF(const std::vector<unsigned char>& data, const std::string& path);
+
+//the loading is split so the file and the meshes can be decoded in other threads
+sGLTFData* readGLTF(const char* filename); //no GL calls, safe in a loading thread
+GTR::Prefab* buildGLTF(sGLTFData* gltf); //main thread only, uploads and frees the data
+void freeGLTF(sGLTFData* gltf);
+Mesh* readGLTFPrimitive(const char* filename, int mesh_index, int primitive_index); //no GL calls
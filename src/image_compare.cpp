@@ -0,0 +1,92 @@
+#include "image_compare.h"
+
+void GTR::sImageCompare_Component::present(Texture* image) {
+	if (capture_requested) {
+		capture(image);
+		capture_requested = false;
+	}
+
+	bool same_size = reference && reference->width == image->width && reference->height == image->height;
+	if (measure_requested && same_size) {
+		measure(image);
+	}
+	measure_requested = false;
+
+	if (!show_difference || !same_size) {
+		image->toViewport();
+		return;
+	}
+
+	static const Handle<Shader> sh_image_difference("image_difference");
+	Shader* shader = sh_image_difference.get();
+	shader->enable();
+	shader->setUniform("u_reference_tex", reference, 1);
+	shader->setUniform("u_gain", difference_gain);
+	image->toViewport(shader);
+}
+
+void GTR::sImageCompare_Component::capture(Texture* image) {
+	if (!reference || reference->width != image->width || reference->height != image->height) {
+		delete reference;
+		reference = new Texture(image->width, image->height, GL_RGBA, GL_FLOAT, false);
+	}
+	image->copyTo(reference);
+	rmse = -1.0f;
+}
+
+// RMSE over the clamped RGB, as it would be shown on the screen
+void GTR::sImageCompare_Component::measure(Texture* image) {
+	// The readback is done in float, so the 8 bit images are converted first
+	Texture float_image(image->width, image->height, GL_RGBA, GL_FLOAT, false);
+	image->copyTo(&float_image);
+
+	FloatImage current, ref;
+	current.num_channels = ref.num_channels = 4;
+	current.fromTexture(&float_image);
+	ref.fromTexture(reference);
+
+	double sum = 0.0;
+	max_error = 0.0f;
+	for (unsigned int y = 0; y < current.height; y++) {
+		for (unsigned int x = 0; x < current.width; x++) {
+			Vector4 a = current.getPixel(x, y);
+			Vector4 b = ref.getPixel(x, y);
+			float errors[3] = { clamp(a.x, 0.0f, 1.0f) - clamp(b.x, 0.0f, 1.0f),
+								clamp(a.y, 0.0f, 1.0f) - clamp(b.y, 0.0f, 1.0f),
+								clamp(a.z, 0.0f, 1.0f) - clamp(b.z, 0.0f, 1.0f) };
+			for (int c = 0; c < 3; c++) {
+				sum += errors[c] * errors[c];
+				max_error = max(max_error, fabsf(errors[c]));
+			}
+		}
+	}
+
+	rmse = (float)sqrt(sum / (current.width * current.height * 3.0));
+	psnr = (rmse > 0.0f) ? 20.0f * log10f(1.0f / rmse) : 999.0f;
+}
+
+void GTR::sImageCompare_Component::render_imgui() {
+#ifndef SKIP_IMGUI
+	if (ImGui::TreeNode("Image compare")) {
+		if (ImGui::Button("Capture reference")) {
+			capture_requested = true;
+		}
+
+		if (reference) {
+			ImGui::SameLine();
+			if (ImGui::Button("Measure difference")) {
+				measure_requested = true;
+			}
+			ImGui::Checkbox("Show difference", &show_difference);
+			ImGui::SliderFloat("Difference gain", &difference_gain, 1.0f, 100.0f);
+
+			if (rmse >= 0.0f) {
+				ImGui::Text("RMSE: %.5f  Max: %.4f  PSNR: %.2f dB", rmse, max_error, psnr);
+			}
+		} else {
+			ImGui::Text("No reference captured");
+		}
+		ImGui::TreePop();
+	}
+#endif
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "includes.h"
+#include "texture.h"
+#include "shader.h"
+#include "mesh.h"
+#include "fbo.h"
+
+// ================
+//  IMAGE COMPARE
+// ================
+// Keeps a copy of the final image as a reference, to compare the frames of a
+// different configuration (ex: the packed G-buffer) against it.
+
+namespace GTR {
+
+	struct sImageCompare_Component {
+		Texture* reference = NULL;
+
+		bool capture_requested = false;
+		bool measure_requested = false;
+		bool show_difference = false;
+		float difference_gain = 10.0f;
+
+		// Stats of the last measure
+		float rmse = -1.0f;
+		float max_error = 0.0f;
+		float psnr = 0.0f;
+
+		// Draws the image to the viewport (or its difference with the reference),
+		// capturing or measuring it first if requested
+		void present(Texture* image);
+
+		void render_imgui();
+
+	private:
+		void capture(Texture* image);
+		void measure(Texture* image);
+	};
+};
@@ -251,6 +251,9 @@ int main(int argc, char **argv)
 
 	Input::init(window);
 
+	//the loading threads, the scene already uses them in the application constructor
+	TaskManager::workers.startThread(max((int)std::thread::hardware_concurrency() - 1, 1));
+
 	//launch the application (app is a global variable)
 	app = new Application(window_width, window_height, window);
 
@@ -6,21 +6,18 @@
 
 using namespace GTR;
 
-std::map<std::string, Material*> Material::sMaterials;
+AssetRegistry<Material> Material::sMaterials("Material", 1 << 13);
 
 Material* Material::Get(const char* name)
 {
 	assert(name);
-	std::map<std::string, Material*>::iterator it = sMaterials.find(name);
-	if (it != sMaterials.end())
-		return it->second;
-	return NULL;
+	return sMaterials.find(name);
 }
 
 void Material::registerMaterial(const char* name)
 {
 	this->name = name;
-	sMaterials[name] = this;
+	sMaterials.add(name, this);
 
 	// Ugly Hack for clouds sorting problem
 	if (!strcmp(name, "Clouds"))
@@ -33,22 +30,39 @@ void Material::registerMaterial(const char* name)
 Material::~Material()
 {
 	if (name.size())
-	{
-		auto it = sMaterials.find(name);
-		if (it != sMaterials.end())
-			sMaterials.erase(it);
-	}
+		sMaterials.remove(name, this);
+}
+
+//the textures are referenced while the material is
+void addTextureRefs(Material* material, int delta)
+{
+	Sampler* samplers[] = { &material->color_texture, &material->emissive_texture, &material->opacity_texture,
+		&material->metallic_roughness_texture, &material->occlusion_texture, &material->normal_texture };
+	for (int i = 0; i < 6; ++i)
+		if (samplers[i]->texture)
+			samplers[i]->texture->ref_count += delta;
+}
+
+void Material::addRef()
+{
+	if (ref_count++ == 0)
+		addTextureRefs(this, 1);
+}
+
+void Material::releaseRef()
+{
+	assert(ref_count > 0);
+	if (--ref_count == 0)
+		addTextureRefs(this, -1);
 }
 
 void Material::Release()
 {
 	std::vector<Material *>mats;
 
-	for (auto mp : sMaterials)
-	{
-		Material *m = mp.second;
+	sMaterials.forEach([&mats](const std::string& name, Material* m) {
 		mats.push_back(m);
-	}
+	});
 
 	for (Material *m : mats)
 	{
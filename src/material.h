@@ -1,6 +1,7 @@
 #pragma once
 
 #include "framework.h"
+#include "asset_registry.h"
 #include <cassert>
 #include <map>
 #include <string>
@@ -38,8 +39,9 @@ namespace GTR {
 	class Material {
 	public:
 		//static manager to reuse materials
-		static std::map<std::string, Material*> sMaterials;
+		static AssetRegistry<Material> sMaterials;
 		static Material* Get(const char* name);
+		static Material* Get(uint64_t name_hash) { return sMaterials.find(name_hash); }
 		std::string name;
 		void registerMaterial(const char* name);
 
@@ -73,6 +75,13 @@ namespace GTR {
 
 		static void Release();
 
+		//memory management, see asset_memory.h
+		int ref_count = 0; //prefabs in use with this material
+		void addRef();
+		void releaseRef();
+
 		void renderInMenu();
 	};
-};
\ No newline at end of file
+};
+
+template<> inline AssetRegistry<GTR::Material>& getAssetRegistry<GTR::Material>() { return GTR::Material::sMaterials; }
\ No newline at end of file
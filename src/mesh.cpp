@@ -1,5 +1,10 @@
 #include "mesh.h"
-#include "extra/textparser.h"
+#include "mesh_parser.h"
+#include "mesh_lod.h"
+#include "mesh_optimizer.h"
+#include "asset_memory.h"
+#include "animation_batch.h"
+#include "task.h"
 #include "utils.h"
 #include "shader.h"
 #include "includes.h"
@@ -21,7 +26,7 @@ bool Mesh::use_binary = false;			//checks if there is .wbin, it there is one tri
 bool Mesh::auto_upload_to_vram = true;	//uploads the mesh to the GPU VRAM to speed up rendering
 bool Mesh::interleave_meshes = true;	//places the geometry in an interleaved array
 
-std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
+AssetRegistry<Mesh> Mesh::sMeshesLoaded("Mesh", 1 << 15);
 long Mesh::num_meshes_rendered = 0;
 long Mesh::num_triangles_rendered = 0;
 
@@ -35,6 +40,7 @@ Mesh::Mesh()
 	radius = 0;
 	vertices_vbo_id = uvs_vbo_id = uvs1_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
 	collision_model = NULL;
+	last_used_frame = ASSET_MEMORY::frame;
 
 	clear();
 }
@@ -42,10 +48,32 @@ Mesh::Mesh()
 Mesh::~Mesh()
 {
 	clear();
+	if (bones_info.size())
+		ANIMATION_BATCH::removeBoneRemaps(this);
 }
 
 
 void Mesh::clear()
+{
+	freeVBOs();
+
+	//buffers
+	vertices.clear();
+	normals.clear();
+	uvs.clear();
+	colors.clear();
+	interleaved.clear();
+	m_indices.clear();
+	lods.clear();
+	bones.clear();
+	weights.clear();
+	m_uvs1.clear();
+
+	if (collision_model)
+		delete (CollisionModel3D*)collision_model;
+}
+
+void Mesh::freeVBOs()
 {
 	//Free VBOs
 	#ifdef USE_OPENGL_EXT
@@ -91,20 +119,93 @@ void Mesh::clear()
 
 	//VBOs ids
 	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = uvs1_vbo_id = 0;
+	vram_bytes = 0;
+}
 
-	//buffers
-	vertices.clear();
-	normals.clear();
-	uvs.clear();
-	colors.clear();
-	interleaved.clear();
-	m_indices.clear();
-	bones.clear();
-	weights.clear();
-	m_uvs1.clear();
+size_t Mesh::getRAMBytes() const
+{
+	return vertices.capacity() * sizeof(Vector3) + normals.capacity() * sizeof(Vector3) + uvs.capacity() * sizeof(Vector2) +
+		m_uvs1.capacity() * sizeof(Vector2) + colors.capacity() * sizeof(Vector4) + interleaved.capacity() * sizeof(tInterleaved) +
+		m_indices.capacity() * sizeof(unsigned int) + bones.capacity() * sizeof(Vector4ub) + weights.capacity() * sizeof(Vector4);
+}
 
-	if (collision_model)
-		delete (CollisionModel3D*)collision_model;
+//frees the GPU buffers, the mesh is uploaded again from the CPU copy or the source file when rendered
+void Mesh::evictFromVRAM()
+{
+	if (evicted || !canEvict())
+		return;
+	freeVBOs();
+	evicted = true;
+}
+
+//only when it can be read again from the file, the render works with the VBOs alone
+void Mesh::releaseCPUData()
+{
+	if (evicted || !reload_callback || collision_model || !(vertices_vbo_id || interleaved_vbo_id))
+		return;
+	std::vector<Vector3>().swap(vertices);
+	std::vector<Vector3>().swap(normals);
+	std::vector<Vector2>().swap(uvs);
+	std::vector<Vector2>().swap(m_uvs1);
+	std::vector<Vector4>().swap(colors);
+	std::vector<tInterleaved>().swap(interleaved);
+	std::vector<unsigned int>().swap(m_indices);
+	std::vector<Vector4ub>().swap(bones);
+	std::vector<Vector4>().swap(weights);
+}
+
+bool Mesh::restore()
+{
+	if (hasCPUData())
+	{
+		uploadToVRAM();
+		evicted = false;
+		return true;
+	}
+
+	if (reloading || !reload_callback)
+		return false;
+
+	//read it in a loading thread, the upload is done in the main thread
+	reloading = true;
+	ASSET_MEMORY::reload_count++;
+	Mesh* mesh = this;
+	std::function<bool(Mesh*)> callback = reload_callback;
+	TaskManager::workers.addTask(new Task([mesh, callback]() {
+		Mesh* data = new Mesh();
+		bool loaded = callback(data);
+		TaskManager::foreground.addTask(new Task([mesh, data, loaded]() {
+			if (loaded)
+			{
+				mesh->takeBuffers(data);
+				if (mesh->evicted)
+				{
+					mesh->uploadToVRAM();
+					mesh->evicted = false;
+				}
+			}
+			else
+				std::cout << "[ERROR]: Mesh could not be reloaded: " << mesh->name << std::endl;
+			mesh->reloading = false;
+			delete data;
+		}));
+	}));
+	return false;
+}
+
+void Mesh::takeBuffers(Mesh* other)
+{
+	vertices.swap(other->vertices);
+	normals.swap(other->normals);
+	uvs.swap(other->uvs);
+	m_uvs1.swap(other->m_uvs1);
+	colors.swap(other->colors);
+	interleaved.swap(other->interleaved);
+	m_indices.swap(other->m_indices);
+	lods.swap(other->lods);
+	cache_stats = other->cache_stats;
+	bones.swap(other->bones);
+	weights.swap(other->weights);
 }
 
 int vertex_location = -1;
@@ -128,7 +229,8 @@ void Mesh::enableBuffers(Shader* sh)
 	int offset_normal = 0;
 	int offset_uv = 0;
 
-	if (interleaved.size())
+	//the buffers can be in VRAM without the CPU copy
+	if (interleaved.size() || interleaved_vbo_id)
 	{
 		spacing = sizeof(tInterleaved);
 		offset_normal = sizeof(Vector3);
@@ -149,7 +251,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	normal_location = -1;
-	if (normals.size() || spacing)
+	if (normals.size() || normals_vbo_id || spacing)
 	{
 		normal_location = sh->getAttribLocation("a_normal");
 		if (normal_location != -1)
@@ -167,7 +269,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	uv_location = -1;
-	if (uvs.size() || spacing)
+	if (uvs.size() || uvs_vbo_id || spacing)
 	{
 		uv_location = sh->getAttribLocation("a_coord");
 		if (uv_location != -1)
@@ -185,7 +287,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	uv1_location = -1;
-	if (m_uvs1.size())
+	if (m_uvs1.size() || uvs1_vbo_id)
 	{
 		uv1_location = sh->getAttribLocation("a_coord1");
 		if (uv1_location != -1)
@@ -203,7 +305,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	color_location = -1;
-	if (colors.size())
+	if (colors.size() || colors_vbo_id)
 	{
 		color_location = sh->getAttribLocation("a_color");
 		if (color_location != -1)
@@ -221,7 +323,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	bones_location = -1;
-	if (bones.size())
+	if (bones.size() || bones_vbo_id)
 	{
 		bones_location = sh->getAttribLocation("a_bones");
 		if (bones_location != -1)
@@ -237,7 +339,7 @@ void Mesh::enableBuffers(Shader* sh)
 		}
 	}
 	weights_location = -1;
-	if (weights.size())
+	if (weights.size() || weights_vbo_id)
 	{
 		weights_location = sh->getAttribLocation("a_weights");
 		if (weights_location != -1)
@@ -255,7 +357,7 @@ void Mesh::enableBuffers(Shader* sh)
 
 }
 
-void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
+void Mesh::render(unsigned int primitive, int submesh_id, int num_instances, int lod)
 {
     //return;
 
@@ -265,14 +367,19 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 		assert(0 && "no shader or shader not compiled or enabled");
 		return;
 	}
-	assert((interleaved.size() || vertices.size()) && "No vertices in this mesh");
+	assert(getNumVertices() && "No vertices in this mesh");
+
+	//evicted from VRAM, nothing is drawn until it is back
+	if (evicted && !restore())
+		return;
+	last_used_frame = ASSET_MEMORY::frame;
 
 	//bind buffers to attribute locations
 	enableBuffers(shader);
 	checkGLErrors();
 
 	//draw call
-	drawCall(primitive, submesh_id, num_instances);
+	drawCall(primitive, submesh_id, num_instances, lod);
 	checkGLErrors();
 
 	//unbind them
@@ -280,15 +387,13 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 	checkGLErrors();
 }
 
-void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
+void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances, int lod)
 {
 	int start = 0; //in primitives
-	int size = (int)vertices.size();
-	if (m_indices.size())
-		size = (int)m_indices.size();
-	else
-	if (interleaved.size())
-		size = (int)interleaved.size();
+	int size = (int)getNumVertices();
+	int num_indices = m_indices.size() ? (int)m_indices.size() : uploaded_index_count;
+	if (num_indices)
+		size = num_indices;
 
 	if (submesh_id > -1)
 	{
@@ -298,18 +403,23 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 		size = submesh.start + submesh.length;
 	}
 
+	//the LODs are ranges of the indices, LOD 0 does not include the ones of the others
+	int first_index = 0;
+	if (lods.size() && submesh_id == -1)
+	{
+		const sMeshLOD& mesh_lod = lods[lod < (int)lods.size() ? lod : (int)lods.size() - 1];
+		first_index = mesh_lod.start;
+		size = mesh_lod.length;
+	}
+
 	//DRAW
-	if (m_indices.size())
+	if (num_indices)
 	{
 		if (num_instances > 0)
 		{
 			assert(indices_vbo_id && "indices must be uploaded to the GPU");
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-			#ifdef OPENGL_ES3
-				glDrawElementsInstanced(primitive, size, GL_UNSIGNED_INT, (void*)(start + sizeof(Vector3u)), num_instances);
-            #else
-				assert(0 && "not supported in OpenGL ES2");
-            #endif
+			glDrawElementsInstanced(primitive, size, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3u) + first_index * sizeof(unsigned int)), num_instances);
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 		}
 		else
@@ -318,25 +428,19 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 			{
 				/*if (size != 90)*/ {
 					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-					glDrawElements(primitive, size, GL_UNSIGNED_INT,(void *) (start * sizeof(Vector3u)));
+					glDrawElements(primitive, size, GL_UNSIGNED_INT,(void *) (start * sizeof(Vector3u) + first_index * sizeof(unsigned int)));
 					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 				}
 				checkGLErrors();
 			}
 			else
-				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&m_indices[0] + start)); //no multiply, its a vector3u pointer)
+				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&m_indices[0] + start + first_index)); //no multiply, its a vector3u pointer)
 		}
 	}
 	else
 	{
 		if (num_instances > 0)
-		{
-			#ifdef OPENGL_ES3
-				glDrawArraysInstanced(primitive, start, size, num_instances);
-            #else
-				assert(0 && "not supported in OpenGL ES2");
-            #endif
-		}
+			glDrawArraysInstanced(primitive, start, size, num_instances);
 		else
 			glDrawArrays(primitive, start, size);
 	}
@@ -359,49 +463,66 @@ void Mesh::disableBuffers(Shader* shader)
 }
 
 GLuint instances_buffer_id = 0;
+GLuint palette_offsets_buffer_id = 0;
 
 //should be faster but in some system it is slower
-void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int num_instances)
+void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int num_instances, const int* palette_offsets, int lod)
 {
 	if (!num_instances)
 		return;
 
-	#ifdef OPENGL_ES3
-		Shader* shader = Shader::current;
-		assert(shader && "shader must be enabled");
+	Shader* shader = Shader::current;
+	assert(shader && "shader must be enabled");
 
-		if (instances_buffer_id == 0)
-			glGenBuffersARB(1, &instances_buffer_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(Matrix44), instanced_models, GL_STREAM_DRAW_ARB);
+	if (instances_buffer_id == 0)
+		glGenBuffersARB(1, &instances_buffer_id);
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
+	glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(Matrix44), instanced_models, GL_STREAM_DRAW_ARB);
 
-		int attribLocation = shader->getAttribLocation("u_model");
-		assert(attribLocation != -1 && "shader must have attribute mat4 u_model (not a uniform)");
-		if (attribLocation == -1)
-			return; //this shader doesnt support instanced model
+	int attribLocation = shader->getAttribLocation("u_model");
+	assert(attribLocation != -1 && "shader must have attribute mat4 u_model (not a uniform)");
+	if (attribLocation == -1)
+		return; //this shader doesnt support instanced model
 
-		//mat4 count as 4 different attributes of vec4... (thanks opengl...)
-		for (int k = 0; k < 4; ++k)
-		{
-			glEnableVertexAttribArray(attribLocation + k );
-			int offset = sizeof(float) * 4 * k;
-			const Uint8* addr = (Uint8*) offset;
-			glVertexAttribPointer(attribLocation + k, 4, GL_FLOAT, false, sizeof(Matrix44), addr);
-			glVertexAttribDivisor(attribLocation + k, 1); // This makes it instanced!
-		}
+	//mat4 count as 4 different attributes of vec4... (thanks opengl...)
+	for (int k = 0; k < 4; ++k)
+	{
+		glEnableVertexAttribArray(attribLocation + k );
+		int offset = sizeof(float) * 4 * k;
+		const Uint8* addr = (Uint8*) offset;
+		glVertexAttribPointer(attribLocation + k, 4, GL_FLOAT, false, sizeof(Matrix44), addr);
+		glVertexAttribDivisor(attribLocation + k, 1); // This makes it instanced!
+	}
 
-		//regular render
-		render(primitive, 0, num_instances);
+	//the skinned instances also have the offset of their palette
+	int paletteLocation = palette_offsets ? shader->getAttribLocation("a_palette_offset") : -1;
+	if (paletteLocation != -1)
+	{
+		if (palette_offsets_buffer_id == 0)
+			glGenBuffersARB(1, &palette_offsets_buffer_id);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, palette_offsets_buffer_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(int), palette_offsets, GL_STREAM_DRAW_ARB);
+		glEnableVertexAttribArray(paletteLocation);
+		glVertexAttribIPointer(paletteLocation, 1, GL_INT, sizeof(int), NULL);
+		glVertexAttribDivisor(paletteLocation, 1);
+	}
+	//the meshes without VBOs need no buffer bound
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
 
-		//disable instanced attribs
-		for (int k = 0; k < 4; ++k)
-		{
-			glDisableVertexAttribArray(attribLocation + k);
-			glVertexAttribDivisor(attribLocation + k, 0);
-		}
-    #else
-		assert(0 && "not supported");
-    #endif
+	//regular render, of the whole mesh
+	render(primitive, -1, num_instances, lod);
+
+	//disable instanced attribs
+	for (int k = 0; k < 4; ++k)
+	{
+		glDisableVertexAttribArray(attribLocation + k);
+		glVertexAttribDivisor(attribLocation + k, 0);
+	}
+	if (paletteLocation != -1)
+	{
+		glDisableVertexAttribArray(paletteLocation);
+		glVertexAttribDivisor(paletteLocation, 0);
+	}
 }
 
 //super obsolete rendering method, do not use
@@ -590,7 +711,12 @@ void Mesh::uploadToVRAM()
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	checkGLErrors();
-	//clear buffers to save memory
+
+	uploaded_vertex_count = getNumVertices();
+	uploaded_index_count = (int)m_indices.size();
+	vram_bytes = (interleaved.size() ? interleaved.size() * sizeof(tInterleaved) : vertices.size() * sizeof(Vector3) + uvs.size() * sizeof(Vector2) + normals.size() * sizeof(Vector3)) +
+		m_uvs1.size() * sizeof(Vector2) + colors.size() * sizeof(Vector4) + bones.size() * sizeof(Vector4ub) + weights.size() * sizeof(Vector4) + m_indices.size() * sizeof(unsigned int);
+	//clear buffers to save memory: done by ASSET_MEMORY when it goes over the RAM budget
 }
 
 bool Mesh::createCollisionModel(bool is_static)
@@ -602,10 +728,12 @@ bool Mesh::createCollisionModel(bool is_static)
 
 	if (m_indices.size()) //indexed
 	{
-		collision_model->setTriangleNumber((int)m_indices.size() / 3);
+		//only LOD 0, the other LODs are after its indices
+		unsigned int num_indices = lods.size() ? (unsigned int)lods[0].length : (unsigned int)m_indices.size();
+		collision_model->setTriangleNumber((int)num_indices / 3);
 
 		if (interleaved.size())
-			for (unsigned int i = 0; i < m_indices.size(); i+=3)
+			for (unsigned int i = 0; i < num_indices; i+=3)
 			{
 				auto v1 = interleaved[m_indices[i+0]];
 				auto v2 = interleaved[m_indices[i+1]];
@@ -613,7 +741,7 @@ bool Mesh::createCollisionModel(bool is_static)
 				collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
 			}
 		else
-		for (unsigned int i = 0; i < m_indices.size(); i+=3)
+		for (unsigned int i = 0; i < num_indices; i+=3)
 		{
 			auto v1 = vertices[m_indices[i+0]];
 			auto v2 = vertices[m_indices[i+1]];
@@ -750,7 +878,9 @@ typedef struct
 	int num_submeshes;
 	Matrix44 bind_matrix;
 	char streams[8]; //Vertex/Interlaved|Normal|Uvs|Color|Indices|Bones|Weights|Extra|Uvs1
-	char extra[32]; //unused
+	int num_lods;
+	sMeshCacheStats cache_stats;
+	char extra[12]; //unused
 } sMeshInfo;
 
 bool Mesh::readBin(const char* filename)
@@ -826,7 +956,7 @@ bool Mesh::readBin(const char* filename)
 	{
 		m_indices.resize(info.num_indices);
 		memcpy((void*)&m_indices[0], pos, sizeof(unsigned int) * info.num_indices);
-		pos += sizeof(Vector3u) * info.num_indices;
+		pos += sizeof(unsigned int) * info.num_indices;
 	}
 
 	if (info.streams[5] == 'B')
@@ -863,11 +993,17 @@ bool Mesh::readBin(const char* filename)
 	box.halfsize = info.halfsize;
 	radius = info.radius;
 	bind_matrix = info.bind_matrix;
+	cache_stats = info.cache_stats;
 
 	submeshes.resize(info.num_submeshes);
 	memcpy(&submeshes[0], pos, sizeof(sSubmeshInfo) * info.num_submeshes);
 	pos += sizeof(sSubmeshInfo) * info.num_submeshes;
 
+	lods.resize(info.num_lods);
+	if (info.num_lods)
+		memcpy(&lods[0], pos, sizeof(sMeshLOD) * info.num_lods);
+	pos += sizeof(sMeshLOD) * info.num_lods;
+
 	createCollisionModel();
 	return true;
 }
@@ -902,6 +1038,8 @@ bool Mesh::writeBin(const char* filename)
 	info.num_bones = bones_info.size();
 	info.bind_matrix = bind_matrix;
 	info.num_submeshes = submeshes.size();
+	info.num_lods = lods.size();
+	info.cache_stats = cache_stats;
 
 	info.streams[0] = interleaved.size() ? 'I' : 'V';
 	info.streams[1] = normals.size() ? 'N' : ' ';
@@ -943,6 +1081,8 @@ bool Mesh::writeBin(const char* filename)
 		fwrite((void*)&m_uvs1[0], m_uvs1.size() * sizeof(Vector2), 1, f);
 
 	fwrite((void*)&submeshes[0], submeshes.size() * sizeof(sSubmeshInfo), 1, f);
+	if (lods.size())
+		fwrite((void*)&lods[0], lods.size() * sizeof(sMeshLOD), 1, f);
 
 	fclose(f);
 	return true;
@@ -950,132 +1090,10 @@ bool Mesh::writeBin(const char* filename)
 
 bool Mesh::loadASE(const char* filename)
 {
-	int nVtx,nFcs;
-	int count;
-	int vId,aId,bId,cId;
-	float vtxX,vtxY,vtxZ;
-	float nX,nY,nZ;
-	TextParser t;
-	if (t.create(filename) == false)
+	std::string data;
+	if (!readFile(filename, data))
 		return false;
-
-	t.seek("*MESH_NUMVERTEX");
-	nVtx = t.getint();
-	t.seek("*MESH_NUMFACES");
-	nFcs = t.getint();
-
-	normals.resize(nFcs*3);
-	vertices.resize(nFcs*3);
-	uvs.resize(nFcs*3);
-
-	std::vector<Vector3> unique_vertices;
-	unique_vertices.resize(nVtx);
-
-	const float max_float = 10000000;
-	const float min_float = -10000000;
-	aabb_min.set(max_float,max_float,max_float);
-	aabb_max.set(min_float,min_float,min_float);
-
-	//load unique vertices
-	for(count=0;count<nVtx;count++)
-	{
-		t.seek("*MESH_VERTEX");
-		vId = t.getint();
-		vtxX=(float)t.getfloat();
-		vtxY= (float)t.getfloat();
-		vtxZ= (float)t.getfloat();
-		Vector3 v(-vtxX,vtxZ,vtxY);
-		unique_vertices[count] = v;
-		aabb_min.setMin( v );
-		aabb_max.setMax( v );
-	}
-	box.center = (aabb_max + aabb_min) * 0.5;
-	box.halfsize = (aabb_max - box.center);
-	radius = (float)fmax( aabb_max.length(), aabb_min.length() );
-	
-	int prev_mat = 0;
-
-	sSubmeshInfo submesh;
-	memset(&submesh, 0, sizeof(submesh));
-
-	//load faces
-	for(count=0;count<nFcs;count++)
-	{
-		t.seek("*MESH_FACE");
-		t.seek("A:");
-		aId = t.getint();
-		t.seek("B:");
-		bId = t.getint();
-		t.seek("C:");
-		cId = t.getint();
-		vertices[count*3 + 0] = unique_vertices[aId];
-		vertices[count*3 + 1] = unique_vertices[bId];
-		vertices[count*3 + 2] = unique_vertices[cId];
-
-		t.seek("*MESH_MTLID");
-		int current_mat = t.getint();
-		if (current_mat != prev_mat)
-		{
-			submesh.length = count * 3 - submesh.start;
-			submeshes.push_back( submesh );
-			memset(&submesh, 0, sizeof(submesh));
-			submesh.start = count * 3;
-			prev_mat = current_mat;
-		}
-	}
-
-	submesh.length = count * 3 - submesh.start;
-	submeshes.push_back(submesh);
-
-	t.seek("*MESH_NUMTVERTEX");
-	nVtx = t.getint();
-	std::vector<Vector2> unique_uvs;
-	unique_uvs.resize(nVtx);
-
-	for(count=0;count<nVtx;count++)
-	{
-		t.seek("*MESH_TVERT");
-		vId = t.getint();
-		vtxX= (float)t.getfloat();
-		vtxY= (float)t.getfloat();
-		unique_uvs[count]=Vector2(vtxX,vtxY);
-	}
-
-	t.seek("*MESH_NUMTVFACES");
-	nFcs = t.getint();
-	for(count=0;count<nFcs;count++)
-	{
-		t.seek("*MESH_TFACE");
-		t.getint(); //num face
-		uvs[count*3] = unique_uvs[ t.getint() ];
-		uvs[count*3+1] = unique_uvs[ t.getint() ];
-		uvs[count*3+2] = unique_uvs[ t.getint() ];
-	}
-
-	//normals
-	for(count=0;count<nFcs;count++)
-	{
-		t.seek("*MESH_VERTEXNORMAL");
-		aId = t.getint();
-		nX = (float)t.getfloat();
-		nY = (float)t.getfloat();
-		nZ = (float)t.getfloat();
-		normals[count*3]=Vector3(-nX,nZ,nY);
-		t.seek("*MESH_VERTEXNORMAL");
-		aId = t.getint();
-		nX = (float)t.getfloat();
-		nY = (float)t.getfloat();
-		nZ = (float)t.getfloat();
-		normals[count*3+1]=Vector3(-nX,nZ,nY);
-		t.seek("*MESH_VERTEXNORMAL");
-		aId = t.getint();
-		nX = (float)t.getfloat();
-		nY = (float)t.getfloat();
-		nZ = (float)t.getfloat();
-		normals[count*3+2]=Vector3(-nX,nZ,nY);
-	}
-
-	return true;
+	return MESH_PARSER::parse_ase(data.c_str(), data.size(), this);
 }
 
 bool Mesh::loadOBJ(const char* filename)
@@ -1083,136 +1101,8 @@ bool Mesh::loadOBJ(const char* filename)
 	std::string data;
 	if(!readFile(filename,data))
 		return false;
-	char* pos = &data[0];
-	char line[255];
-	int i = 0;
-
-	std::vector<Vector3> indexed_positions;
-	std::vector<Vector3> indexed_normals;
-	std::vector<Vector2> indexed_uvs;
-
-	const float max_float = 10000000;
-	const float min_float = -10000000;
-	aabb_min.set(max_float,max_float,max_float);
-	aabb_max.set(min_float,min_float,min_float);
-
-	unsigned int vertex_i = 0;
-
-	sSubmeshInfo submesh_info;
-	int last_submesh_vertex = 0;
-	memset(&submesh_info, 0, sizeof(submesh_info));
-
-	//parse file
-	while(*pos != 0)
-	{
-		if (*pos == '\n') pos++;
-		if (*pos == '\r') pos++;
-
-		//read one line
-		i = 0;
-		while(i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
-		memcpy(line,pos,i);
-		line[i] = 0;
-		pos = pos + i;
-
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
-		if (*line == '#' || *line == 0) continue; //comment
-
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line," ");
-
-		if (tokens.empty()) continue;
-
-		if (tokens[0] == "v" && tokens.size() == 4)
-		{
-			Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_positions.push_back(v);
-
-			aabb_min.setMin( v );
-			aabb_max.setMax( v );
-		}
-		else if (tokens[0] == "vt" && tokens.size() >= 3)
-		{
-			Vector2 v((float)atof(tokens[1].c_str()), 1.0 - (float)atof(tokens[2].c_str()) );
-			indexed_uvs.push_back(v);
-		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
-		{
-			Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_normals.push_back(v);
-		}
-		else if (tokens[0] == "s") //surface? it appears one time before the faces
-		{
-			//process mesh: ????
-			//if (uvs.size() == 0 && indexed_uvs.size() )
-			//	uvs.resize(1);
-		}
-		else if (tokens[0] == "usemtl") //surface? it appears one time before the faces
-		{
-			if (last_submesh_vertex != vertices.size())
-			{
-				submesh_info.length = vertices.size() - submesh_info.start;
-				last_submesh_vertex = vertices.size();
-				submeshes.push_back(submesh_info);
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy(submesh_info.name, tokens[1].c_str());
-				submesh_info.start = last_submesh_vertex;
-			}
-			else
-				strcpy(submesh_info.material, tokens[1].c_str());
-		}
-		else if (tokens[0] == "g") //surface? it appears one time before the faces
-		{
-			if (last_submesh_vertex != vertices.size())
-			{
-				submesh_info.length = vertices.size() - submesh_info.start;
-				last_submesh_vertex = vertices.size();
-				submeshes.push_back(submesh_info);
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy( submesh_info.name, tokens[1].c_str());
-				submesh_info.start = last_submesh_vertex;
-			}
-		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
-		{
-			Vector3 v1,v2,v3;
-			v1.parseFromText( tokens[1].c_str(), '/' );
-
-			for (unsigned int iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
-			{
-				v2.parseFromText( tokens[iPoly].c_str(), '/' );
-				v3.parseFromText( tokens[iPoly+1].c_str(), '/' );
-
-				vertices.push_back( indexed_positions[ (unsigned int)(v1.x) -1 ] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v2.x) -1] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v3.x) -1] );
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
-
-				if (indexed_uvs.size() > 0)
-				{
-					uvs.push_back( indexed_uvs[(unsigned int)(v1.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v2.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v3.y) -1] );
-				}
-
-				if (indexed_normals.size() > 0)
-				{
-					normals.push_back( indexed_normals[(unsigned int)(v1.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v2.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v3.z) -1] );
-				}
-			}
-		}
-	}
-
-	box.center = (aabb_max + aabb_min) * 0.5;
-	box.halfsize = (aabb_max - box.center);
-	radius = (float)fmax( aabb_max.length(), aabb_min.length() );
-
-	submesh_info.length = vertices.size() - last_submesh_vertex;
-	submeshes.push_back(submesh_info);
-	return true;
+	//big files are parsed in chunks, on several threads
+	return MESH_PARSER::parse_obj(data.c_str(), data.size(), this, MESH_PARSER::get_thread_count());
 }
 
 bool Mesh::loadMESH(const char* filename)
@@ -1233,6 +1123,7 @@ bool Mesh::loadMESH(const char* filename)
 	fclose(f);
 	data[size] = 0;
 	char* pos = data;
+	const char* end = data + size;
 	char word[255];
 
 	while (*pos)
@@ -1244,24 +1135,24 @@ bool Mesh::loadMESH(const char* filename)
 			pos = fetchWord(pos, word);
 			std::string str(word);
 			if (str == "vertices")
-				pos = fetchBufferVec3(pos, vertices);
+				pos = (char*)MESH_PARSER::parse_mesh_buffer(pos, end, vertices);
 			else if (str == "normals")
-				pos = fetchBufferVec3(pos, normals);
+				pos = (char*)MESH_PARSER::parse_mesh_buffer(pos, end, normals);
 			else if (str == "coords")
-				pos = fetchBufferVec2(pos, uvs);
+				pos = (char*)MESH_PARSER::parse_mesh_buffer(pos, end, uvs);
 			else if (str == "colors")
-				pos = fetchBufferVec4(pos, colors);
+				pos = (char*)MESH_PARSER::parse_mesh_buffer(pos, end, colors);
 			else if (str == "bone_indices")
-				pos = fetchBufferVec4ub(pos, bones);
+				pos = (char*)MESH_PARSER::parse_mesh_buffer(pos, end, bones);
 			else if (str == "weights")
-				pos = fetchBufferVec4(pos, weights);
+				pos = (char*)MESH_PARSER::parse_mesh_buffer(pos, end, weights);
 			else
 				pos = fetchEndLine(pos);
 		}
 		else if (type == '*') //buffer
 		{
 			pos = fetchWord(pos, word);
-			pos = fetchBufferVec3u(pos, m_indices);
+			pos = (char*)MESH_PARSER::parse_mesh_buffer(pos, end, m_indices);
 		}
 		else if (type == '@') //info
 		{
@@ -1556,18 +1447,43 @@ Mesh* Mesh::getQuad()
 	return quad;
 }
 
+//used after an eviction, safe in a loading thread
+bool Mesh::reloadFile(const std::string& filename)
+{
+	std::string ext = filename.substr(filename.find_last_of(".") + 1);
+	bool loaded = false;
+	if (ext == "mbin" || ext == "MBIN")
+		loaded = readBin(filename.c_str());
+	else if (use_binary && readBin((filename + ".mbin").c_str()))
+		loaded = true;
+	else if (ext == "obj" || ext == "OBJ")
+		loaded = loadOBJ(filename.c_str());
+	else if (ext == "ase" || ext == "ASE")
+		loaded = loadASE(filename.c_str());
+	else if (ext == "mesh" || ext == "MESH")
+		loaded = loadMESH(filename.c_str());
+
+	if (loaded && !lods.size())
+	{
+		MESH_OPTIMIZER::optimize(this);
+		if (MESH_LOD::generate_on_load)
+			MESH_LOD::generate_lods(this);
+	}
+	if (loaded && interleave_meshes && interleaved.size() == 0)
+		interleaveBuffers();
+	return loaded;
+}
+
 Mesh* Mesh::Get(const char* filename, bool skip_load)
 {
 	assert(filename);
-	std::map<std::string, Mesh*>::iterator it = sMeshesLoaded.find(filename);
-	if (it != sMeshesLoaded.end())
-		return it->second;
-
-	if (skip_load)
-		return NULL;
+	Mesh* m = sMeshesLoaded.find(filename);
+	if (m || skip_load)
+		return m;
 
-	Mesh* m = new Mesh();
+	m = new Mesh();
 	std::string name = filename;
+	m->reload_callback = [name](Mesh* dst) { return dst->reloadFile(name); };
 
 	//detect format
 	char file_format = 0;
@@ -1610,11 +1526,13 @@ Mesh* Mesh::Get(const char* filename, bool skip_load)
 		}
 
 		std::cout << "[OK BIN]  Faces: " << (m->interleaved.size() ? m->interleaved.size() : m->vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-		sMeshesLoaded[filename] = m;
+		sMeshesLoaded.add(filename, m);
 		return m;
 	}
 
 	//load the ascii version
+	struct stat file_stats;
+	double text_megabytes = (stat(filename, &file_stats) == 0) ? file_stats.st_size / (1024.0 * 1024.0) : 0.0;
 	bool loaded = false;
 	if (file_format == FORMAT_OBJ)
 		loaded = m->loadOBJ(filename);
@@ -1629,6 +1547,14 @@ Mesh* Mesh::Get(const char* filename, bool skip_load)
 		std::cout << "[ERROR]: Mesh not found" << std::endl;
 		return NULL;
 	}
+	double parse_time = max((getTime() - time) * 0.001, 0.001);
+	std::cout << "[" << (int)(text_megabytes / parse_time) << " MB/s] ";
+
+	//indexed and reordered for the vertex cache, then the simplified versions, they are saved in the .BIN
+	if (MESH_OPTIMIZER::optimize(m))
+		std::cout << "[ACMR " << m->cache_stats.acmr_before << " -> " << m->cache_stats.acmr << "] ";
+	if (MESH_LOD::generate_on_load && MESH_LOD::generate_lods(m))
+		std::cout << "[LODS " << m->lods.size() << "] ";
 
 	//to optimize, interleave the meshes
 	if (interleave_meshes)
@@ -1659,15 +1585,14 @@ Mesh* Mesh::Get(const char* filename, bool skip_load)
 void Mesh::registerMesh( std::string name )
 {
 	this->name = name;
-	sMeshesLoaded[name] = this;
+	sMeshesLoaded.add(name, this);
 }
 
 void Mesh::Release()
 {
-	for (auto m : sMeshesLoaded)
-	{
-        stdlog("Destroy mesh: " + m.first );
-		delete m.second;
-	}
+	sMeshesLoaded.forEach([](const std::string& name, Mesh* mesh) {
+        stdlog("Destroy mesh: " + name );
+		delete mesh;
+	});
 	sMeshesLoaded.clear();
 }
@@ -3,16 +3,18 @@
 
 #include <vector>
 #include "framework.h"
+#include "asset_registry.h"
 
 #include <map>
 #include <string>
+#include <functional>
 
 class Shader; //for binding
 class Image; //for displace
 class Skeleton; //for skinned meshes
 
 //version from 11/5/2020
-#define MESH_BIN_VERSION 11 //this is used to regenerate bins if the format changes
+#define MESH_BIN_VERSION 13 //this is used to regenerate bins if the format changes
 
 struct BoneInfo {
 	char name[32]; //max 32 chars per bone name
@@ -27,10 +29,27 @@ struct sSubmeshInfo
 	int length;//in primitive
 };
 
+//a level of detail, a range of m_indices, see mesh_lod.h
+struct sMeshLOD
+{
+	int start; //in indices
+	int length; //in indices
+	float error; //max distance to the original surface, in object units
+};
+
+//post-transform cache of LOD 0 before and after the import, see mesh_optimizer.h
+struct sMeshCacheStats
+{
+	float acmr_before; //vertex shader invocations per triangle
+	float atvr_before; //vertex shader invocations per vertex
+	float acmr;
+	float atvr;
+};
+
 class Mesh
 {
 public:
-	static std::map<std::string, Mesh*> sMeshesLoaded;
+	static AssetRegistry<Mesh> sMeshesLoaded;
 	static bool use_binary; //always load the binary version of a mesh when possible
 	static bool interleave_meshes; //loaded meshes will me automatically interleaved
 	static bool auto_upload_to_vram; //loaded meshes will be stored in the VRAM
@@ -56,6 +75,8 @@ public:
 	std::vector< tInterleaved > interleaved; //to render interleaved
 
 	std::vector<unsigned int> m_indices; //for indexed meshes
+	std::vector<sMeshLOD> lods; //empty or LOD 0 first, their indices go after the ones of LOD 0
+	sMeshCacheStats cache_stats = {}; //zero if it was not optimized
 
 	//for animated meshes
 	std::vector< Vector4ub > bones; //tells which bones afect the vertex (4 max)
@@ -80,26 +101,49 @@ public:
 	unsigned int weights_vbo_id;
 	unsigned int uvs1_vbo_id;
 
+	//sizes of the uploaded buffers, so the CPU copy can be freed
+	int uploaded_vertex_count = 0;
+	int uploaded_index_count = 0;
+	size_t vram_bytes = 0;
+
+	//memory management, see asset_memory.h
+	int ref_count = 0; //prefabs in use with this mesh
+	uint32_t last_used_frame;
+	bool evicted = false; //the VRAM copy was freed, it is restored when rendered
+	bool reloading = false;
+	std::function<bool(Mesh*)> reload_callback; //reads the buffers from the source file, in a loading thread
+	uint32_t last_occluder_frame = 0; //the occlusion culling rasterizes the CPU copy, the RAM budget keeps it while it is recent
+
 	Mesh();
 	~Mesh();
 
 	void clear();
-
-	void render( unsigned int primitive, int submesh_id = -1, int num_instances = 0 );
-	void renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int number);
+	void freeVBOs();
+
+	inline bool hasCPUData() const { return vertices.size() || interleaved.size(); }
+	size_t getRAMBytes() const;
+	bool canEvict() const { return hasCPUData() || reload_callback; }
+	void evictFromVRAM();
+	void releaseCPUData();
+	bool restore(); //false while it is not in VRAM
+	void takeBuffers(Mesh* other);
+	bool reloadFile(const std::string& filename); //reads the buffers as Get, without uploading them
+
+	void render( unsigned int primitive, int submesh_id = -1, int num_instances = 0, int lod = 0 );
+	void renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int number, const int* palette_offsets = NULL, int lod = 0); //the offsets go to the int attribute a_palette_offset
 	void renderBounding( const Matrix44& model, bool world_bounding = true );
 	void renderFixedPipeline(int primitive); //sloooooooow
 	//void renderAnimated(unsigned int primitive, Skeleton *sk);
 
 	void enableBuffers(Shader* shader);
-	void drawCall(unsigned int primitive, int submesh_id, int num_instances);
+	void drawCall(unsigned int primitive, int submesh_id, int num_instances, int lod = 0);
 	void disableBuffers(Shader* shader);
 
 	bool readBin(const char* filename);
 	bool writeBin(const char* filename);
 
 	unsigned int getNumSubmeshes() { return (unsigned int)submeshes.size(); }
-	unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size(); }
+	unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : vertices.size() ? (unsigned int)vertices.size() : (unsigned int)uploaded_vertex_count; }
 
 	//collision testing
 	void* collision_model;
@@ -110,6 +154,7 @@ public:
 
 	//loader
 	static Mesh* Get(const char* filename, bool skip_load = false);
+	static Mesh* Find(uint64_t name_hash) { return sMeshesLoaded.find(name_hash); } //only the loaded ones
 	static void Release();
 	void registerMesh(std::string name);
 
@@ -135,4 +180,6 @@ private:
 	bool loadMESH(const char* filename); //personal format used for animations
 };
 
+template<> inline AssetRegistry<Mesh>& getAssetRegistry<Mesh>() { return Mesh::sMeshesLoaded; }
+
 #endif
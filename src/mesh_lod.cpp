@@ -0,0 +1,448 @@
+#include "mesh_lod.h"
+
+#include "mesh.h"
+#include "mesh_optimizer.h"
+#include "includes.h"
+
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+
+namespace MESH_LOD {
+
+	bool enabled = true;
+	bool generate_on_load = true;
+	float pixel_error = 1.0f;
+	float hysteresis = 0.25f;
+	float pass_bias[PASS_COUNT] = { 0.0f, 1.0f, 2.0f };
+
+	float triangle_ratio = 0.5f;
+	float max_error = 0.05f;
+	int min_triangles = 256;
+
+	static std::atomic<int> generated_meshes(0);
+	static std::atomic<long long> generate_us(0);
+	static int selected[MESH_MAX_LODS] = {};
+
+	// Symmetric 4x4 matrix of the plane equations, the error of a point is p^T Q p
+	struct sQuadric {
+		double a2 = 0.0, ab = 0.0, ac = 0.0, ad = 0.0;
+		double b2 = 0.0, bc = 0.0, bd = 0.0;
+		double c2 = 0.0, cd = 0.0;
+		double d2 = 0.0;
+
+		inline void addPlane(const Vector3& normal, const Vector3& point, const double weight) {
+			const double a = normal.x, b = normal.y, c = normal.z;
+			const double d = -(a * point.x + b * point.y + c * point.z);
+			a2 += a * a * weight; ab += a * b * weight; ac += a * c * weight; ad += a * d * weight;
+			b2 += b * b * weight; bc += b * c * weight; bd += b * d * weight;
+			c2 += c * c * weight; cd += c * d * weight;
+			d2 += d * d * weight;
+		}
+		inline void add(const sQuadric& q) {
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+			b2 += q.b2; bc += q.bc; bd += q.bd;
+			c2 += q.c2; cd += q.cd;
+			d2 += q.d2;
+		}
+		inline double error(const Vector3& p) const {
+			const double x = p.x, y = p.y, z = p.z;
+			const double result = a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x
+				+ b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y
+				+ c2 * z * z + 2.0 * cd * z + d2;
+			return result > 0.0 ? result : 0.0;
+		}
+	};
+
+	struct sEdge {
+		unsigned int a, b; // Positions, a < b
+		inline bool operator<(const sEdge& e) const { return a != e.a ? a < e.a : b < e.b; }
+		inline bool operator==(const sEdge& e) const { return a == e.a && b == e.b; }
+	};
+
+	inline sEdge make_edge(const unsigned int a, const unsigned int b) {
+		return (a < b) ? sEdge{ a, b } : sEdge{ b, a };
+	}
+
+	struct sCollapse {
+		unsigned int from, to; // Positions
+		double cost;
+	};
+
+	// The state of the simplification of a mesh, the LODs are generated one after the other
+	struct sSimplifier {
+		std::vector<Vector3> positions; // Per vertex
+		std::vector<unsigned int> position_ids; // Per vertex, the same for all the vertices at a position
+		std::vector<Vector3> position_values; // Per position
+		std::vector<sQuadric> quadrics; // Per position
+		std::vector<unsigned int> indices; // Of the current LOD
+
+		// Of the current LOD, built again in every pass
+		std::vector<unsigned int> first_triangle; // Per position, in triangles_of
+		std::vector<unsigned int> triangles_of;
+		std::vector<sEdge> edges; // Sorted, unique
+		std::vector<sEdge> border_edges; // Sorted, the edges of a single triangle
+		std::vector<bool> is_border; // Per position
+
+		inline unsigned int positionOf(const size_t corner) const { return position_ids[indices[corner]]; }
+
+		void weldPositions();
+		void computeQuadrics();
+		void buildAdjacency();
+		bool getVertexRemap(const unsigned int from, const unsigned int to, std::vector<std::pair<unsigned int, unsigned int>>& remap) const;
+		bool flipsTriangles(const unsigned int from, const unsigned int to) const;
+		int collapsePass(const int max_removed, const double max_cost, double& pass_cost);
+	};
+
+	// Sorted by position, the vertices with the same one are a seam
+	void sSimplifier::weldPositions() {
+		const unsigned int count = (unsigned int)positions.size();
+		std::vector<unsigned int> order(count);
+		for (unsigned int i = 0; i < count; i++)
+			order[i] = i;
+		auto is_less = [this](const unsigned int a, const unsigned int b) {
+			const Vector3& pa = positions[a];
+			const Vector3& pb = positions[b];
+			if (pa.x != pb.x) return pa.x < pb.x;
+			if (pa.y != pb.y) return pa.y < pb.y;
+			return pa.z < pb.z;
+		};
+		std::sort(order.begin(), order.end(), is_less);
+
+		position_ids.resize(count);
+		position_values.clear();
+		for (unsigned int i = 0; i < count; i++) {
+			if (i == 0 || is_less(order[i - 1], order[i]))
+				position_values.push_back(positions[order[i]]);
+			position_ids[order[i]] = (unsigned int)position_values.size() - 1;
+		}
+
+		// The triangles with two corners at the same position have no area, like the ones of the poles of a sphere
+		size_t index_count = 0;
+		for (size_t t = 0; t < indices.size(); t += 3) {
+			const unsigned int p0 = positionOf(t), p1 = positionOf(t + 1), p2 = positionOf(t + 2);
+			if (p0 == p1 || p1 == p2 || p0 == p2)
+				continue;
+			for (int k = 0; k < 3; k++)
+				indices[index_count++] = indices[t + k];
+		}
+		indices.resize(index_count);
+	}
+
+	// The planes of the faces, and a plane perpendicular to the open borders so they keep their shape
+	void sSimplifier::computeQuadrics() {
+		quadrics.assign(position_values.size(), sQuadric());
+		buildAdjacency();
+
+		for (size_t t = 0; t < indices.size(); t += 3) {
+			const Vector3& p0 = positions[indices[t]];
+			const Vector3 face_normal = (positions[indices[t + 1]] - p0).cross(positions[indices[t + 2]] - p0);
+			const double length = face_normal.length();
+			if (length <= 0.0)
+				continue;
+			const Vector3 normal = face_normal * (float)(1.0 / length);
+			for (int k = 0; k < 3; k++) {
+				const unsigned int a = positionOf(t + k);
+				const unsigned int b = positionOf(t + (k + 1) % 3);
+				quadrics[a].addPlane(normal, p0, 1.0);
+				if (!std::binary_search(border_edges.begin(), border_edges.end(), make_edge(a, b)))
+					continue;
+
+				Vector3 border_normal = (position_values[b] - position_values[a]).cross(normal);
+				const double border_length = border_normal.length();
+				if (border_length <= 0.0)
+					continue;
+				border_normal = border_normal * (float)(1.0 / border_length);
+				quadrics[a].addPlane(border_normal, position_values[a], 4.0);
+				quadrics[b].addPlane(border_normal, position_values[a], 4.0);
+			}
+		}
+	}
+
+	void sSimplifier::buildAdjacency() {
+		const size_t num_positions = position_values.size();
+		first_triangle.assign(num_positions + 1, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+			first_triangle[positionOf(i) + 1]++;
+		for (size_t p = 0; p < num_positions; p++)
+			first_triangle[p + 1] += first_triangle[p];
+
+		std::vector<unsigned int> filled(first_triangle.begin(), first_triangle.end() - 1);
+		triangles_of.resize(indices.size());
+		for (size_t i = 0; i < indices.size(); i++)
+			triangles_of[filled[positionOf(i)]++] = (unsigned int)(i / 3);
+
+		edges.clear();
+		for (size_t t = 0; t < indices.size(); t += 3)
+			for (int k = 0; k < 3; k++)
+				edges.push_back(make_edge(positionOf(t + k), positionOf(t + (k + 1) % 3)));
+		std::sort(edges.begin(), edges.end());
+
+		border_edges.clear();
+		is_border.assign(num_positions, false);
+		size_t unique_count = 0;
+		for (size_t i = 0; i < edges.size(); ) {
+			size_t j = i + 1;
+			while (j < edges.size() && edges[j] == edges[i])
+				j++;
+			if (j - i == 1) {
+				border_edges.push_back(edges[i]);
+				is_border[edges[i].a] = is_border[edges[i].b] = true;
+			}
+			edges[unique_count++] = edges[i];
+			i = j;
+		}
+		edges.resize(unique_count);
+	}
+
+	// Every vertex at from goes to the vertex at to of the triangles they share. A vertex that shares no
+	// triangle with to, or several with different vertices, would stretch the attributes across a seam
+	bool sSimplifier::getVertexRemap(const unsigned int from, const unsigned int to, std::vector<std::pair<unsigned int, unsigned int>>& remap) const {
+		remap.clear();
+		int seen_count = 0;
+		unsigned int seen[16];
+		for (unsigned int i = first_triangle[from]; i < first_triangle[from + 1]; i++) {
+			const size_t t = triangles_of[i] * 3;
+			unsigned int from_vertex = 0, to_vertex = 0;
+			bool has_to = false;
+			for (int k = 0; k < 3; k++) {
+				if (positionOf(t + k) == from)
+					from_vertex = indices[t + k];
+				else if (positionOf(t + k) == to) {
+					to_vertex = indices[t + k];
+					has_to = true;
+				}
+			}
+
+			if (std::find(seen, seen + seen_count, from_vertex) == seen + seen_count) {
+				if (seen_count == 16)
+					return false;
+				seen[seen_count++] = from_vertex;
+			}
+			if (!has_to)
+				continue;
+
+			bool found = false;
+			for (auto& pair : remap) {
+				if (pair.first != from_vertex)
+					continue;
+				if (pair.second != to_vertex)
+					return false;
+				found = true;
+			}
+			if (!found)
+				remap.push_back(std::make_pair(from_vertex, to_vertex));
+		}
+		return (int)remap.size() == seen_count;
+	}
+
+	// The triangles that remain must not turn over
+	bool sSimplifier::flipsTriangles(const unsigned int from, const unsigned int to) const {
+		const Vector3& target = position_values[to];
+		for (unsigned int i = first_triangle[from]; i < first_triangle[from + 1]; i++) {
+			const size_t t = triangles_of[i] * 3;
+			Vector3 p[3];
+			int moved = -1;
+			bool has_to = false;
+			for (int k = 0; k < 3; k++) {
+				const unsigned int position = positionOf(t + k);
+				p[k] = position_values[position];
+				if (position == from)
+					moved = k;
+				has_to = has_to || position == to;
+			}
+			if (has_to)
+				continue;
+
+			const Vector3 before = (p[1] - p[0]).cross(p[2] - p[0]);
+			p[moved] = target;
+			const Vector3 after = (p[1] - p[0]).cross(p[2] - p[0]);
+			const double lengths = before.length() * after.length();
+			if (lengths <= 0.0 || dot(before, after) < 0.25 * lengths)
+				return true;
+		}
+		return false;
+	}
+
+	// Collapses the cheapest edges that do not share triangles, returns the triangles removed
+	int sSimplifier::collapsePass(const int max_removed, const double max_cost, double& pass_cost) {
+		buildAdjacency();
+
+		// Both directions of every edge, a border position only moves along the border
+		std::vector<sCollapse> collapses;
+		collapses.reserve(edges.size() * 2);
+		for (const sEdge& edge : edges) {
+			const bool is_border_edge = std::binary_search(border_edges.begin(), border_edges.end(), edge);
+			for (int direction = 0; direction < 2; direction++) {
+				const unsigned int from = direction ? edge.b : edge.a;
+				const unsigned int to = direction ? edge.a : edge.b;
+				if (is_border[from] && !is_border_edge)
+					continue;
+				const double cost = quadrics[from].error(position_values[to]);
+				if (cost <= max_cost)
+					collapses.push_back({ from, to, cost });
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const sCollapse& a, const sCollapse& b) { return a.cost < b.cost; });
+
+		// The triangles around a collapse are not valid until the next pass
+		std::vector<bool> locked(position_values.size(), false);
+		std::vector<unsigned int> vertex_remap(positions.size());
+		for (unsigned int i = 0; i < vertex_remap.size(); i++)
+			vertex_remap[i] = i;
+
+		std::vector<std::pair<unsigned int, unsigned int>> remap;
+		int removed = 0;
+		pass_cost = 0.0;
+		for (const sCollapse& collapse : collapses) {
+			if (removed >= max_removed)
+				break;
+			if (locked[collapse.from] || locked[collapse.to])
+				continue;
+			if (!getVertexRemap(collapse.from, collapse.to, remap) || flipsTriangles(collapse.from, collapse.to))
+				continue;
+
+			for (auto& pair : remap)
+				vertex_remap[pair.first] = pair.second;
+			for (unsigned int i = first_triangle[collapse.from]; i < first_triangle[collapse.from + 1]; i++) {
+				const size_t t = triangles_of[i] * 3;
+				bool has_to = false;
+				for (int k = 0; k < 3; k++) {
+					locked[positionOf(t + k)] = true;
+					has_to = has_to || positionOf(t + k) == collapse.to;
+				}
+				removed += has_to ? 1 : 0;
+			}
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			pass_cost = max(pass_cost, collapse.cost);
+		}
+		if (!removed)
+			return 0;
+
+		// The collapsed triangles have two corners at the same position now
+		size_t count = 0;
+		for (size_t t = 0; t < indices.size(); t += 3) {
+			const unsigned int i0 = vertex_remap[indices[t]], i1 = vertex_remap[indices[t + 1]], i2 = vertex_remap[indices[t + 2]];
+			const unsigned int p0 = position_ids[i0], p1 = position_ids[i1], p2 = position_ids[i2];
+			if (p0 == p1 || p1 == p2 || p0 == p2)
+				continue;
+			indices[count++] = i0;
+			indices[count++] = i1;
+			indices[count++] = i2;
+		}
+		indices.resize(count);
+		return removed;
+	}
+
+	bool generate_lods(Mesh* mesh) {
+		const int triangle_count = (int)mesh->m_indices.size() / 3;
+		if (mesh->lods.size() || !mesh->hasCPUData() || mesh->m_indices.size() % 3 || triangle_count < min_triangles)
+			return false;
+
+		const Uint64 start = SDL_GetPerformanceCounter();
+		sSimplifier simplifier;
+		const size_t vertex_count = mesh->interleaved.size() ? mesh->interleaved.size() : mesh->vertices.size();
+		simplifier.positions.resize(vertex_count);
+		for (size_t i = 0; i < vertex_count; i++)
+			simplifier.positions[i] = mesh->interleaved.size() ? mesh->interleaved[i].vertex : mesh->vertices[i];
+		simplifier.indices = mesh->m_indices;
+		simplifier.weldPositions();
+		simplifier.computeQuadrics();
+
+		// The error limit is relative to the size of the mesh
+		Vector3 min_position = simplifier.position_values[0], max_position = min_position;
+		for (const Vector3& p : simplifier.position_values) {
+			min_position.set(min(min_position.x, p.x), min(min_position.y, p.y), min(min_position.z, p.z));
+			max_position.set(max(max_position.x, p.x), max(max_position.y, p.y), max(max_position.z, p.z));
+		}
+		const double max_distance = max_error * (max_position - min_position).length() * 0.5;
+		const double max_cost = max_distance * max_distance;
+
+		std::vector<unsigned int> all_indices = mesh->m_indices;
+		std::vector<sMeshLOD> lods;
+		lods.push_back({ 0, triangle_count * 3, 0.0f });
+		double error = 0.0;
+		int current = triangle_count;
+		for (int lod = 1; lod < MESH_MAX_LODS; lod++) {
+			const int previous = lods.back().length / 3;
+			const int target = (int)(previous * triangle_ratio);
+			while (current > target) {
+				double pass_cost = 0.0;
+				if (!simplifier.collapsePass(current - target, max_cost, pass_cost))
+					break;
+				error = max(error, pass_cost);
+				current = (int)simplifier.indices.size() / 3;
+			}
+
+			// Not worth the indices if it is almost the same
+			if (current > previous * 0.8f || current == 0)
+				break;
+			lods.push_back({ (int)all_indices.size(), current * 3, (float)sqrt(error) });
+			all_indices.insert(all_indices.end(), simplifier.indices.begin(), simplifier.indices.end());
+			if (MESH_OPTIMIZER::enabled)
+				MESH_OPTIMIZER::optimize_vertex_cache(&all_indices[lods.back().start], lods.back().length, vertex_count);
+			if (current > target)
+				break;
+		}
+
+		generate_us += (long long)((SDL_GetPerformanceCounter() - start) * 1000000.0 / (double)SDL_GetPerformanceFrequency());
+		if (lods.size() < 2)
+			return false;
+		mesh->m_indices.swap(all_indices);
+		mesh->lods.swap(lods);
+		generated_meshes++;
+		return true;
+	}
+
+	int select_lod(const Mesh* mesh, const float pixels_per_unit, const float bias, const int previous_lod) {
+		if (!enabled || mesh->lods.size() < 2)
+			return 0;
+
+		const float threshold = pixel_error * powf(2.0f, bias);
+		for (int lod = (int)mesh->lods.size() - 1; lod > 0; --lod) {
+			// Going to a coarser LOD needs a smaller error than staying in it
+			float limit = threshold;
+			if (previous_lod != -1)
+				limit *= (lod > previous_lod) ? (1.0f - hysteresis) : (1.0f + hysteresis);
+			if (mesh->lods[lod].error * pixels_per_unit <= limit)
+				return lod;
+		}
+		return 0;
+	}
+
+	void begin_frame() {
+		for (int i = 0; i < MESH_MAX_LODS; i++)
+			selected[i] = 0;
+	}
+
+	void count_selected(const int lod) {
+		selected[lod]++;
+	}
+
+	void render_imgui() {
+#ifndef SKIP_IMGUI
+		if (ImGui::TreeNode("Mesh LOD")) {
+			ImGui::Checkbox("Enabled", &enabled);
+			ImGui::SliderFloat("Pixel error", &pixel_error, 0.1f, 16.0f);
+			ImGui::SliderFloat("Hysteresis", &hysteresis, 0.0f, 0.9f);
+			ImGui::SliderFloat("Camera bias", &pass_bias[PASS_CAMERA], -2.0f, 4.0f);
+			ImGui::SliderFloat("Shadows bias", &pass_bias[PASS_SHADOWS], -2.0f, 4.0f);
+			ImGui::SliderFloat("Probes bias", &pass_bias[PASS_PROBES], -2.0f, 4.0f);
+
+			ImGui::Checkbox("Generate on load", &generate_on_load);
+			ImGui::SliderFloat("Triangle ratio", &triangle_ratio, 0.1f, 0.9f);
+			ImGui::SliderFloat("Max error", &max_error, 0.001f, 0.2f);
+
+			int triangles[MESH_MAX_LODS] = {};
+			Mesh::sMeshesLoaded.forEach([&triangles](const std::string& name, Mesh* mesh) {
+				for (int i = 0; i < (int)mesh->lods.size(); i++)
+					triangles[i] += mesh->lods[i].length / 3;
+			});
+			ImGui::Text("Meshes with LODs: %d, generated in %.1f ms", generated_meshes.load(), generate_us.load() * 0.001);
+			for (int i = 0; i < MESH_MAX_LODS; i++)
+				ImGui::Text("LOD %d: %d triangles, %d draw calls", i, triangles[i], selected[i]);
+			ImGui::TreePop();
+		}
+#endif
+	}
+};
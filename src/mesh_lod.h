@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include "framework.h"
+
+class Mesh;
+
+// ================
+//  MESH LOD
+// ================
+// Simplified versions of the indexed meshes, generated when they are loaded. The LODs
+// share the vertices of the mesh, only their indices are added after the ones of LOD 0,
+// so a LOD is a range of the index buffer. The simplification collapses edges in the order
+// of their quadric error (sum of the squared distances to the planes of the original faces).
+// The vertices with the same position and different attributes are kept together: a UV or
+// normal seam only collapses along the seam, and the open borders only along the border.
+// The culling selects the LOD by its error projected on the screen, with hysteresis.
+
+#define MESH_MAX_LODS 4
+
+namespace MESH_LOD {
+
+	enum ePass {
+		PASS_CAMERA = 0,
+		PASS_SHADOWS,
+		PASS_PROBES,
+		PASS_COUNT
+	};
+
+	extern bool enabled;
+	extern bool generate_on_load;
+	extern float pixel_error; // Max error on the screen, in the units of Camera::getProjectedScale
+	extern float hysteresis; // Fraction of pixel_error, to not switch back and forth at the limit
+	extern float pass_bias[PASS_COUNT]; // In LOD levels, each one doubles the allowed error
+
+	// Generation
+	extern float triangle_ratio; // Of each LOD from the previous one
+	extern float max_error; // Relative to the radius of the mesh, the chain stops before
+	extern int min_triangles; // Smaller meshes have no LODs
+
+	// The meshes with indices and CPU data. Safe in the loading threads
+	bool generate_lods(Mesh* mesh);
+
+	// The coarsest LOD with a projected error below the threshold, previous_lod is -1 without hysteresis
+	int select_lod(const Mesh* mesh, const float pixels_per_unit, const float bias, const int previous_lod = -1);
+
+	// Largest scale of the axes, to move the error of the mesh to world units
+	inline float get_model_scale(const Matrix44& model) {
+		float x = (float)Vector3(model.m[0], model.m[1], model.m[2]).length();
+		float y = (float)Vector3(model.m[4], model.m[5], model.m[6]).length();
+		float z = (float)Vector3(model.m[8], model.m[9], model.m[10]).length();
+		float scale = (x > y) ? x : y;
+		return (scale > z) ? scale : z;
+	}
+
+	// Draw calls of the camera per LOD, reset every frame
+	void begin_frame();
+	void count_selected(const int lod);
+
+	void render_imgui();
+};
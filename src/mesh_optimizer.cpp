@@ -0,0 +1,401 @@
+#include "mesh_optimizer.h"
+
+#include "mesh.h"
+#include "includes.h"
+
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+
+namespace MESH_OPTIMIZER {
+
+	bool enabled = true;
+	bool reorder_overdraw = true;
+	int cache_size = 16;
+	float overdraw_threshold = 1.05f;
+
+	static std::atomic<int> optimized_meshes(0);
+	static std::atomic<long long> vertices_before(0);
+	static std::atomic<long long> vertices_after(0);
+	static std::atomic<long long> optimize_us(0);
+
+	static const unsigned int NO_VERTEX = ~0u;
+
+	// The bytes of a vertex in one of the streams of the mesh
+	struct sStream {
+		const char* data;
+		size_t stride;
+	};
+
+	template<typename T>
+	inline void add_stream(std::vector<sStream>& streams, const std::vector<T>& stream, const size_t vertex_count) {
+		if (stream.size() == vertex_count)
+			streams.push_back({ (const char*)stream.data(), sizeof(T) });
+	}
+
+	// The vertices with a remap go to that position, the others are dropped
+	template<typename T>
+	inline void remap_stream(std::vector<T>& stream, const std::vector<unsigned int>& remap, const size_t new_count) {
+		if (stream.size() != remap.size())
+			return;
+		std::vector<T> result(new_count);
+		for (size_t i = 0; i < remap.size(); i++)
+			if (remap[i] != NO_VERTEX)
+				result[remap[i]] = stream[i];
+		stream.swap(result);
+	}
+
+	static void remap_streams(Mesh* mesh, const std::vector<unsigned int>& remap, const size_t new_count) {
+		remap_stream(mesh->vertices, remap, new_count);
+		remap_stream(mesh->normals, remap, new_count);
+		remap_stream(mesh->uvs, remap, new_count);
+		remap_stream(mesh->m_uvs1, remap, new_count);
+		remap_stream(mesh->colors, remap, new_count);
+		remap_stream(mesh->interleaved, remap, new_count);
+		remap_stream(mesh->bones, remap, new_count);
+		remap_stream(mesh->weights, remap, new_count);
+	}
+
+	// FNV-1a of the bytes of the vertex in all the streams
+	inline uint64_t hash_vertex(const std::vector<sStream>& streams, const size_t vertex) {
+		uint64_t hash = 14695981039346656037ull;
+		for (const sStream& stream : streams) {
+			const unsigned char* bytes = (const unsigned char*)stream.data + vertex * stream.stride;
+			for (size_t i = 0; i < stream.stride; i++)
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	inline bool same_vertex(const std::vector<sStream>& streams, const size_t a, const size_t b) {
+		for (const sStream& stream : streams)
+			if (memcmp(stream.data + a * stream.stride, stream.data + b * stream.stride, stream.stride) != 0)
+				return false;
+		return true;
+	}
+
+	// The corners with the same bytes in every stream become one vertex, returns the vertex count
+	static size_t weld(Mesh* mesh) {
+		const size_t vertex_count = mesh->getNumVertices();
+		std::vector<sStream> streams;
+		add_stream(streams, mesh->vertices, vertex_count);
+		add_stream(streams, mesh->normals, vertex_count);
+		add_stream(streams, mesh->uvs, vertex_count);
+		add_stream(streams, mesh->m_uvs1, vertex_count);
+		add_stream(streams, mesh->colors, vertex_count);
+		add_stream(streams, mesh->interleaved, vertex_count);
+		add_stream(streams, mesh->bones, vertex_count);
+		add_stream(streams, mesh->weights, vertex_count);
+
+		// Open addressing, the table is at most half full
+		size_t table_size = 1;
+		while (table_size < vertex_count * 2)
+			table_size *= 2;
+		std::vector<unsigned int> table(table_size, NO_VERTEX);
+		std::vector<unsigned int> remap(vertex_count, NO_VERTEX);
+		mesh->m_indices.resize(vertex_count);
+
+		size_t unique_count = 0;
+		for (size_t i = 0; i < vertex_count; i++) {
+			size_t slot = hash_vertex(streams, i) & (table_size - 1);
+			while (table[slot] != NO_VERTEX && !same_vertex(streams, table[slot], i))
+				slot = (slot + 1) & (table_size - 1);
+
+			if (table[slot] == NO_VERTEX) {
+				table[slot] = (unsigned int)i;
+				remap[i] = (unsigned int)unique_count++;
+			}
+			else
+				remap[i] = remap[table[slot]];
+			mesh->m_indices[i] = remap[i];
+		}
+
+		// The first corner of each vertex is the one kept
+		std::vector<unsigned int> first_remap(vertex_count, NO_VERTEX);
+		std::vector<bool> is_written(unique_count, false);
+		for (size_t i = 0; i < vertex_count; i++) {
+			if (!is_written[remap[i]]) {
+				first_remap[i] = remap[i];
+				is_written[remap[i]] = true;
+			}
+		}
+		remap_streams(mesh, first_remap, unique_count);
+		return unique_count;
+	}
+
+	unsigned int simulate_cache(const unsigned int* indices, const size_t index_count, const size_t vertex_count) {
+		std::vector<unsigned int> timestamps(vertex_count, 0);
+		unsigned int time = cache_size + 1;
+		unsigned int misses = 0;
+		for (size_t i = 0; i < index_count; i++) {
+			const unsigned int vertex = indices[i];
+			if (time - timestamps[vertex] > (unsigned int)cache_size) {
+				timestamps[vertex] = time++;
+				misses++;
+			}
+		}
+		return misses;
+	}
+
+	void optimize_vertex_cache(unsigned int* indices, const size_t index_count, const size_t vertex_count, std::vector<unsigned int>* hard_boundaries) {
+		const size_t triangle_count = index_count / 3;
+		if (!triangle_count)
+			return;
+
+		// The triangles of every vertex
+		std::vector<unsigned int> offsets(vertex_count + 1, 0);
+		for (size_t i = 0; i < index_count; i++)
+			offsets[indices[i] + 1]++;
+		for (size_t v = 0; v < vertex_count; v++)
+			offsets[v + 1] += offsets[v];
+		std::vector<unsigned int> live(vertex_count);
+		for (size_t v = 0; v < vertex_count; v++)
+			live[v] = offsets[v + 1] - offsets[v];
+		std::vector<unsigned int> triangles(index_count);
+		{
+			std::vector<unsigned int> filled(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < index_count; i++)
+				triangles[filled[indices[i]]++] = (unsigned int)(i / 3);
+		}
+
+		std::vector<unsigned int> result(index_count);
+		std::vector<unsigned int> cache_time(vertex_count, 0);
+		std::vector<bool> emitted(triangle_count, false);
+		std::vector<unsigned int> dead_end;
+		dead_end.reserve(index_count);
+		unsigned int time = cache_size + 1;
+		size_t cursor = 0; // Next vertex in order, when the dead end stack is empty
+		size_t written = 0;
+
+		unsigned int fanning = indices[0];
+		while (true) {
+			// All the triangles around the fanning vertex
+			const size_t fan_start = written;
+			for (unsigned int i = offsets[fanning]; i < offsets[fanning + 1]; i++) {
+				const unsigned int triangle = triangles[i];
+				if (emitted[triangle])
+					continue;
+				emitted[triangle] = true;
+				for (int k = 0; k < 3; k++) {
+					const unsigned int vertex = indices[triangle * 3 + k];
+					result[written++] = vertex;
+					dead_end.push_back(vertex);
+					live[vertex]--;
+					if (time - cache_time[vertex] > (unsigned int)cache_size)
+						cache_time[vertex] = time++;
+				}
+			}
+
+			// The vertex of the fan that will still be in the cache after its own fan, the oldest one
+			unsigned int next = NO_VERTEX;
+			int best_priority = -1;
+			for (size_t i = fan_start; i < written; i++) {
+				const unsigned int vertex = result[i];
+				if (!live[vertex])
+					continue;
+				int priority = 0;
+				if ((int)(time - cache_time[vertex]) + 2 * (int)live[vertex] <= cache_size)
+					priority = (int)(time - cache_time[vertex]);
+				if (priority > best_priority) {
+					best_priority = priority;
+					next = vertex;
+				}
+			}
+
+			// Dead end, a recent vertex with triangles left, or the next one in order
+			while (next == NO_VERTEX && !dead_end.empty()) {
+				const unsigned int vertex = dead_end.back();
+				dead_end.pop_back();
+				if (live[vertex])
+					next = vertex;
+			}
+			while (next == NO_VERTEX && cursor < vertex_count) {
+				if (live[cursor])
+					next = (unsigned int)cursor;
+				cursor++;
+			}
+			if (next == NO_VERTEX)
+				break;
+
+			if (hard_boundaries && time - cache_time[next] > (unsigned int)cache_size)
+				hard_boundaries->push_back((unsigned int)(written / 3));
+			fanning = next;
+		}
+
+		memcpy(indices, result.data(), index_count * sizeof(unsigned int));
+	}
+
+	// Splits the hard clusters where their own ACMR is close to the one of the whole range, and sorts the
+	// clusters by how much they face out of the center, the outer ones are drawn first and occlude the others
+	static void optimize_overdraw(unsigned int* indices, const size_t index_count, const std::vector<Vector3>& positions, const std::vector<unsigned int>& hard_boundaries) {
+		const size_t triangle_count = index_count / 3;
+		const double acmr = simulate_cache(indices, index_count, positions.size()) / (double)triangle_count;
+
+		std::vector<unsigned int> cluster_starts;
+		std::vector<unsigned int> timestamps(positions.size(), 0);
+		unsigned int time = cache_size + 1;
+		size_t hard = 0;
+		unsigned int misses = 0, cluster_triangles = 0;
+		for (unsigned int t = 0; t < triangle_count; t++) {
+			const bool is_hard = (hard < hard_boundaries.size() && hard_boundaries[hard] == t);
+			hard += is_hard ? 1 : 0;
+			const bool is_soft = cluster_triangles && misses <= overdraw_threshold * acmr * cluster_triangles;
+			if (t == 0 || is_hard || is_soft) {
+				cluster_starts.push_back(t);
+				time += cache_size + 1; // Flushes the cache
+				misses = cluster_triangles = 0;
+			}
+			for (int k = 0; k < 3; k++) {
+				const unsigned int vertex = indices[t * 3 + k];
+				if (time - timestamps[vertex] > (unsigned int)cache_size) {
+					timestamps[vertex] = time++;
+					misses++;
+				}
+			}
+			cluster_triangles++;
+		}
+		cluster_starts.push_back((unsigned int)triangle_count);
+		const size_t cluster_count = cluster_starts.size() - 1;
+		if (cluster_count < 2)
+			return;
+
+		// The centers and normals are weighted by the area
+		Vector3 center(0.0f, 0.0f, 0.0f);
+		double total_area = 0.0;
+		std::vector<Vector3> cluster_centers(cluster_count, Vector3(0.0f, 0.0f, 0.0f));
+		std::vector<Vector3> cluster_normals(cluster_count, Vector3(0.0f, 0.0f, 0.0f));
+		for (size_t c = 0; c < cluster_count; c++) {
+			double cluster_area = 0.0;
+			for (unsigned int t = cluster_starts[c]; t < cluster_starts[c + 1]; t++) {
+				const Vector3& p0 = positions[indices[t * 3]];
+				const Vector3& p1 = positions[indices[t * 3 + 1]];
+				const Vector3& p2 = positions[indices[t * 3 + 2]];
+				const Vector3 normal = (p1 - p0).cross(p2 - p0);
+				const float area = (float)normal.length();
+				cluster_centers[c] = cluster_centers[c] + (p0 + p1 + p2) * (area / 3.0f);
+				cluster_normals[c] = cluster_normals[c] + normal;
+				cluster_area += area;
+			}
+			center = center + cluster_centers[c];
+			if (cluster_area > 0.0)
+				cluster_centers[c] = cluster_centers[c] * (float)(1.0 / cluster_area);
+			total_area += cluster_area;
+		}
+		if (total_area <= 0.0)
+			return;
+		center = center * (float)(1.0 / total_area);
+
+		std::vector<float> sort_keys(cluster_count);
+		std::vector<unsigned int> order(cluster_count);
+		for (size_t c = 0; c < cluster_count; c++) {
+			const float length = (float)cluster_normals[c].length();
+			sort_keys[c] = (length > 0.0f) ? dot(cluster_centers[c] - center, cluster_normals[c]) / length : 0.0f;
+			order[c] = (unsigned int)c;
+		}
+		std::stable_sort(order.begin(), order.end(), [&sort_keys](const unsigned int a, const unsigned int b) { return sort_keys[a] > sort_keys[b]; });
+
+		std::vector<unsigned int> result;
+		result.reserve(index_count);
+		for (const unsigned int c : order)
+			result.insert(result.end(), indices + cluster_starts[c] * 3, indices + cluster_starts[c + 1] * 3);
+		memcpy(indices, result.data(), index_count * sizeof(unsigned int));
+	}
+
+	bool optimize(Mesh* mesh) {
+		if (!enabled || !mesh->hasCPUData() || mesh->lods.size())
+			return false;
+
+		const Uint64 start = SDL_GetPerformanceCounter();
+		const size_t vertex_count = mesh->getNumVertices();
+		size_t index_count = mesh->m_indices.size();
+
+		// Without indices every corner is a vertex
+		sMeshCacheStats& stats = mesh->cache_stats;
+		if (!index_count) {
+			if (vertex_count % 3)
+				return false;
+			stats.acmr_before = 3.0f;
+			stats.atvr_before = 1.0f;
+			weld(mesh);
+			index_count = mesh->m_indices.size();
+		}
+		else {
+			if (index_count % 3)
+				return false;
+			const unsigned int misses = simulate_cache(mesh->m_indices.data(), index_count, vertex_count);
+			stats.acmr_before = misses / (float)(index_count / 3);
+			stats.atvr_before = misses / (float)vertex_count;
+		}
+
+		const size_t welded_count = mesh->getNumVertices();
+		std::vector<Vector3> positions(welded_count);
+		for (size_t i = 0; i < welded_count; i++)
+			positions[i] = mesh->interleaved.size() ? mesh->interleaved[i].vertex : mesh->vertices[i];
+
+		// The triangles stay in their submesh, the submeshes are in corners
+		std::vector<unsigned int> ranges;
+		for (const sSubmeshInfo& submesh : mesh->submeshes) {
+			if (submesh.start % 3 || submesh.length % 3 || submesh.start + submesh.length > (int)index_count) {
+				ranges.clear();
+				break;
+			}
+			if (submesh.length)
+				ranges.push_back(submesh.start);
+		}
+		if (ranges.empty() || ranges[0] != 0)
+			ranges.assign(1, 0);
+		ranges.push_back((unsigned int)index_count);
+
+		for (size_t r = 0; r + 1 < ranges.size(); r++) {
+			unsigned int* indices = mesh->m_indices.data() + ranges[r];
+			const size_t range_count = ranges[r + 1] - ranges[r];
+			std::vector<unsigned int> hard_boundaries;
+			optimize_vertex_cache(indices, range_count, welded_count, &hard_boundaries);
+			if (reorder_overdraw)
+				optimize_overdraw(indices, range_count, positions, hard_boundaries);
+		}
+
+		// The vertices in the order of their first use, the unused ones are dropped
+		std::vector<unsigned int> remap(welded_count, NO_VERTEX);
+		unsigned int used_count = 0;
+		for (unsigned int& index : mesh->m_indices) {
+			if (remap[index] == NO_VERTEX)
+				remap[index] = used_count++;
+			index = remap[index];
+		}
+		remap_streams(mesh, remap, used_count);
+
+		const unsigned int misses = simulate_cache(mesh->m_indices.data(), index_count, used_count);
+		stats.acmr = misses / (float)(index_count / 3);
+		stats.atvr = misses / (float)used_count;
+
+		optimized_meshes++;
+		vertices_before += (long long)vertex_count;
+		vertices_after += (long long)used_count;
+		optimize_us += (long long)((SDL_GetPerformanceCounter() - start) * 1000000.0 / (double)SDL_GetPerformanceFrequency());
+		return true;
+	}
+
+	void render_imgui() {
+#ifndef SKIP_IMGUI
+		if (ImGui::TreeNode("Mesh optimizer")) {
+			ImGui::Checkbox("Enabled", &enabled);
+			ImGui::Checkbox("Reorder for overdraw", &reorder_overdraw);
+			ImGui::SliderInt("Cache size", &cache_size, 4, 64);
+			ImGui::SliderFloat("Overdraw threshold", &overdraw_threshold, 1.0f, 1.5f);
+
+			ImGui::Text("Meshes: %d, optimized in %.1f ms", optimized_meshes.load(), optimize_us.load() * 0.001);
+			ImGui::Text("Vertices: %lld -> %lld", vertices_before.load(), vertices_after.load());
+			if (ImGui::TreeNode("ACMR / ATVR per mesh")) {
+				Mesh::sMeshesLoaded.forEach([](const std::string& name, Mesh* mesh) {
+					const sMeshCacheStats& stats = mesh->cache_stats;
+					if (stats.acmr > 0.0f)
+						ImGui::Text("%s: ACMR %.2f -> %.2f, ATVR %.2f -> %.2f", name.c_str(), stats.acmr_before, stats.acmr, stats.atvr_before, stats.atvr);
+				});
+				ImGui::TreePop();
+			}
+			ImGui::TreePop();
+		}
+#endif
+	}
+};
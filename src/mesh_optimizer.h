@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include "framework.h"
+
+class Mesh;
+
+// ================
+//  MESH OPTIMIZER
+// ================
+// Runs when a mesh is imported, before its LODs are generated, and the result goes to the .BIN.
+// The meshes without indices are welded: the corners with the same attributes become one
+// vertex. The triangles are reordered for the post-transform cache with Tipsify (Sander et al.),
+// then split in clusters that are sorted from the outside in to reduce the overdraw, and the
+// vertices are renumbered in the order of their first use so the fetches are sequential.
+// ACMR is the vertex shader invocations per triangle, ATVR the invocations per vertex (1 is ideal).
+
+namespace MESH_OPTIMIZER {
+
+	extern bool enabled;
+	extern bool reorder_overdraw;
+	extern int cache_size; // Of the simulated FIFO cache, for Tipsify and the statistics
+	extern float overdraw_threshold; // A cluster can have this times the ACMR of the mesh
+
+	// Welds, reorders and fills mesh->cache_stats. Safe in the loading threads
+	bool optimize(Mesh* mesh);
+
+	// Tipsify of a list of triangles, the indices are below vertex_count. The hard boundaries
+	// are where the cache is flushed, in triangles
+	void optimize_vertex_cache(unsigned int* indices, const size_t index_count, const size_t vertex_count, std::vector<unsigned int>* hard_boundaries = NULL);
+
+	// Cache misses of a FIFO cache of cache_size
+	unsigned int simulate_cache(const unsigned int* indices, const size_t index_count, const size_t vertex_count);
+
+	void render_imgui();
+};
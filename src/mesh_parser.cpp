@@ -0,0 +1,770 @@
+#include "mesh_parser.h"
+
+#include "mesh.h"
+#include "utils.h"
+#include "includes.h"
+#include "task.h"
+
+#include <thread>
+#include <functional>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+
+namespace MESH_PARSER {
+
+	int max_threads = 0;
+
+	static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+									1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	int get_thread_count() {
+		const int cores = (int)std::thread::hardware_concurrency();
+		return (max_threads > 0) ? max_threads : max(cores, 1);
+	}
+
+	const char* parse_float(const char* pos, const char* end, float* result) {
+		pos = skip_spaces(pos, end);
+		bool is_negative = false;
+		if (pos < end && (*pos == '-' || *pos == '+')) {
+			is_negative = *pos == '-';
+			pos++;
+		}
+
+		// Up to 18 significant digits in the mantissa, the rest only move the exponent
+		const uint64_t max_mantissa = 100000000000000000ULL;
+		uint64_t mantissa = 0;
+		int exponent = 0;
+		for (; pos < end && is_digit(*pos); pos++) {
+			if (mantissa < max_mantissa) {
+				mantissa = mantissa * 10 + (*pos - '0');
+			} else {
+				exponent++;
+			}
+		}
+		if (pos < end && *pos == '.') {
+			for (pos++; pos < end && is_digit(*pos); pos++) {
+				if (mantissa < max_mantissa) {
+					mantissa = mantissa * 10 + (*pos - '0');
+					exponent--;
+				}
+			}
+		}
+		if (pos < end && (*pos == 'e' || *pos == 'E')) {
+			int exponent_value = 0;
+			pos = parse_int(pos + 1, end, &exponent_value);
+			exponent += max(-400, min(exponent_value, 400));
+		}
+
+		double value = (double)mantissa;
+		for (; exponent > 22; exponent -= 22) value *= POW10[22];
+		for (; exponent < -22; exponent += 22) value /= POW10[22];
+		value = (exponent >= 0) ? value * POW10[exponent] : value / POW10[-exponent];
+
+		*result = (float)(is_negative ? -value : value);
+		return pos;
+	}
+
+	// ================
+	//  OBJ
+	// ================
+
+	// 1 based indices, as in the file. 0 when missing
+	struct sObjCorner {
+		int position;
+		int uv;
+		int normal;
+	};
+
+	// A "g" or "usemtl", before the corner
+	struct sObjEvent {
+		uint32_t corner;
+		bool is_group;
+		char name[64];
+	};
+
+	struct sObjChunk {
+		const char* start = NULL;
+		const char* end = NULL;
+
+		std::vector<Vector3> positions;
+		std::vector<Vector2> uvs;
+		std::vector<Vector3> normals;
+		std::vector<sObjCorner> corners; // 3 per triangle
+		std::vector<sObjEvent> events;
+
+		Vector3 aabb_min;
+		Vector3 aabb_max;
+
+		// Where the chunk starts in the merged arrays
+		size_t position_offset = 0;
+		size_t uv_offset = 0;
+		size_t normal_offset = 0;
+		size_t corner_offset = 0;
+
+		int invalid_indices = 0;
+	};
+
+	// Parses a "v", "v/vt", "v//vn" or "v/vt/vn" face corner
+	inline const char* parse_corner(const char* pos, const char* end, sObjCorner* corner) {
+		corner->uv = 0;
+		corner->normal = 0;
+		pos = parse_int(pos, end, &corner->position);
+		if (pos < end && *pos == '/') {
+			pos = (pos + 1 < end && pos[1] == '/') ? pos + 1 : parse_int(pos + 1, end, &corner->uv);
+			if (pos < end && *pos == '/') {
+				pos = parse_int(pos + 1, end, &corner->normal);
+			}
+		}
+		return skip_word(pos, end);
+	}
+
+	// Copies the first word after pos, truncated to the 64 chars of the submesh info
+	inline void copy_name(const char* pos, const char* end, char* name) {
+		pos = skip_spaces(pos, end);
+		int length = 0;
+		while (pos < end && !is_space(*pos) && !is_end_of_line(*pos) && length < 63) {
+			name[length++] = *pos++;
+		}
+		name[length] = 0;
+	}
+
+	static void parse_obj_chunk(sObjChunk* chunk) {
+		const float max_float = 10000000;
+		const float min_float = -10000000;
+		chunk->aabb_min.set(max_float, max_float, max_float);
+		chunk->aabb_max.set(min_float, min_float, min_float);
+
+		const char* pos = chunk->start;
+		const char* end = chunk->end;
+		while (pos < end) {
+			pos = skip_spaces(pos, end);
+			const size_t left = end - pos;
+
+			if (left > 2 && pos[0] == 'v' && is_space(pos[1])) {
+				Vector3 v;
+				pos = parse_float(pos + 1, end, &v.x);
+				pos = parse_float(pos, end, &v.y);
+				pos = parse_float(pos, end, &v.z);
+				chunk->positions.push_back(v);
+				chunk->aabb_min.setMin(v);
+				chunk->aabb_max.setMax(v);
+			}
+			else if (left > 3 && pos[0] == 'v' && pos[1] == 't' && is_space(pos[2])) {
+				Vector2 v;
+				pos = parse_float(pos + 2, end, &v.x);
+				pos = parse_float(pos, end, &v.y);
+				v.y = 1.0f - v.y;
+				chunk->uvs.push_back(v);
+			}
+			else if (left > 3 && pos[0] == 'v' && pos[1] == 'n' && is_space(pos[2])) {
+				Vector3 v;
+				pos = parse_float(pos + 2, end, &v.x);
+				pos = parse_float(pos, end, &v.y);
+				pos = parse_float(pos, end, &v.z);
+				chunk->normals.push_back(v);
+			}
+			else if (left > 2 && pos[0] == 'f' && is_space(pos[1])) {
+				// Triangle fan of the polygon
+				sObjCorner first, previous, current;
+				int corner_count = 0;
+				pos = skip_spaces(pos + 1, end);
+				while (pos < end && !is_end_of_line(*pos)) {
+					pos = parse_corner(pos, end, &current);
+					if (corner_count == 0) {
+						first = current;
+					} else if (corner_count >= 2) {
+						chunk->corners.push_back(first);
+						chunk->corners.push_back(previous);
+						chunk->corners.push_back(current);
+					}
+					previous = current;
+					corner_count++;
+					pos = skip_spaces(pos, end);
+				}
+			}
+			else if (match_word(pos, end, "usemtl") || match_word(pos, end, "g")) {
+				sObjEvent event;
+				event.corner = chunk->corners.size();
+				event.is_group = pos[0] == 'g';
+				copy_name(skip_word(pos, end), end, event.name);
+				chunk->events.push_back(event);
+			}
+
+			pos = skip_line(pos, end);
+		}
+	}
+
+	inline size_t resolve_index(const int index, const size_t count, int* invalid_indices) {
+		if (index < 1 || (size_t)index > count) {
+			(*invalid_indices)++;
+			return 0;
+		}
+		return index - 1;
+	}
+
+	inline void close_submesh(Mesh* mesh, sSubmeshInfo* submesh_info, const int vertex_count) {
+		submesh_info->length = vertex_count - submesh_info->start;
+		mesh->submeshes.push_back(*submesh_info);
+		memset(submesh_info, 0, sizeof(sSubmeshInfo));
+		submesh_info->start = vertex_count;
+	}
+
+	bool parse_obj(const char* data, const size_t size, Mesh* mesh, const int num_threads) {
+		// Split at line boundaries, the small files are not worth the threads
+		const size_t max_chunks = max(size / OBJ_MIN_CHUNK_BYTES, (size_t)1);
+		const int num_chunks = (int)min((size_t)max(num_threads, 1), max_chunks);
+
+		std::vector<sObjChunk> chunks(num_chunks);
+		const char* end = data + size;
+		const char* chunk_start = data;
+		for (int i = 0; i < num_chunks; i++) {
+			const char* split = data + size * (i + 1) / num_chunks;
+			chunks[i].start = chunk_start;
+			chunks[i].end = (i == num_chunks - 1) ? end : skip_line(max(split, chunk_start), end);
+			chunk_start = chunks[i].end;
+		}
+
+		// In the shared pool, the loads already run in its threads and new ones would oversubscribe the cores
+		TaskManager::workers.parallelFor(num_chunks, [&chunks](int i) { parse_obj_chunk(&chunks[i]); });
+
+		// Merge the attributes in file order
+		size_t position_count = 0, uv_count = 0, normal_count = 0, corner_count = 0;
+		for (int i = 0; i < num_chunks; i++) {
+			sObjChunk& chunk = chunks[i];
+			chunk.position_offset = position_count;
+			chunk.uv_offset = uv_count;
+			chunk.normal_offset = normal_count;
+			chunk.corner_offset = corner_count;
+			position_count += chunk.positions.size();
+			uv_count += chunk.uvs.size();
+			normal_count += chunk.normals.size();
+			corner_count += chunk.corners.size();
+		}
+
+		if (corner_count > 0 && position_count == 0) {
+			std::cerr << "OBJ has faces without vertices" << std::endl;
+			return false;
+		}
+
+		std::vector<Vector3> positions(position_count);
+		std::vector<Vector2> uvs(uv_count);
+		std::vector<Vector3> normals(normal_count);
+		for (int i = 0; i < num_chunks; i++) {
+			const sObjChunk& chunk = chunks[i];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.position_offset);
+			std::copy(chunk.uvs.begin(), chunk.uvs.end(), uvs.begin() + chunk.uv_offset);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normal_offset);
+		}
+
+		// Resolve the corners, each chunk writes its own range of the mesh
+		mesh->vertices.resize(corner_count);
+		mesh->uvs.resize(uv_count > 0 ? corner_count : 0);
+		mesh->normals.resize(normal_count > 0 ? corner_count : 0);
+
+		TaskManager::workers.parallelFor(num_chunks, [&](int i) {
+			sObjChunk& chunk = chunks[i];
+			for (size_t j = 0; j < chunk.corners.size(); j++) {
+				const sObjCorner& corner = chunk.corners[j];
+				const size_t vertex = chunk.corner_offset + j;
+				mesh->vertices[vertex] = positions[resolve_index(corner.position, position_count, &chunk.invalid_indices)];
+				if (uv_count > 0) {
+					mesh->uvs[vertex] = uvs[resolve_index(corner.uv, uv_count, &chunk.invalid_indices)];
+				}
+				if (normal_count > 0) {
+					mesh->normals[vertex] = normals[resolve_index(corner.normal, normal_count, &chunk.invalid_indices)];
+				}
+			}
+		});
+
+		// The submeshes and the bounds, in order
+		int invalid_indices = 0;
+		mesh->aabb_min = chunks[0].aabb_min;
+		mesh->aabb_max = chunks[0].aabb_max;
+
+		sSubmeshInfo submesh_info;
+		memset(&submesh_info, 0, sizeof(submesh_info));
+		int last_submesh_vertex = 0;
+
+		for (int i = 0; i < num_chunks; i++) {
+			const sObjChunk& chunk = chunks[i];
+			invalid_indices += chunk.invalid_indices;
+			mesh->aabb_min.setMin(chunk.aabb_min);
+			mesh->aabb_max.setMax(chunk.aabb_max);
+
+			for (uint32_t j = 0; j < chunk.events.size(); j++) {
+				const sObjEvent& event = chunk.events[j];
+				const int vertex_count = (int)(chunk.corner_offset + event.corner);
+				if (last_submesh_vertex != vertex_count) {
+					close_submesh(mesh, &submesh_info, vertex_count);
+					last_submesh_vertex = vertex_count;
+					strcpy(submesh_info.name, event.name);
+				} else if (!event.is_group) {
+					strcpy(submesh_info.material, event.name);
+				}
+			}
+		}
+
+		submesh_info.length = (int)corner_count - last_submesh_vertex;
+		mesh->submeshes.push_back(submesh_info);
+
+		mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5;
+		mesh->box.halfsize = (mesh->aabb_max - mesh->box.center);
+		mesh->radius = (float)fmax(mesh->aabb_max.length(), mesh->aabb_min.length());
+
+		if (invalid_indices > 0) {
+			std::cerr << "OBJ with " << invalid_indices << " invalid face indices" << std::endl;
+		}
+		return true;
+	}
+
+	bool parse_obj_legacy(const std::string& data, Mesh* mesh)
+	{
+		const char* pos = &data[0];
+		char line[255];
+		int i = 0;
+
+		std::vector<Vector3> indexed_positions;
+		std::vector<Vector3> indexed_normals;
+		std::vector<Vector2> indexed_uvs;
+
+		const float max_float = 10000000;
+		const float min_float = -10000000;
+		mesh->aabb_min.set(max_float, max_float, max_float);
+		mesh->aabb_max.set(min_float, min_float, min_float);
+
+		sSubmeshInfo submesh_info;
+		int last_submesh_vertex = 0;
+		memset(&submesh_info, 0, sizeof(submesh_info));
+
+		//parse file
+		while (*pos != 0)
+		{
+			if (*pos == '\n') pos++;
+			if (*pos == '\r') pos++;
+
+			//read one line
+			i = 0;
+			while (i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
+			memcpy(line, pos, i);
+			line[i] = 0;
+			pos = pos + i;
+
+			if (*line == '#' || *line == 0) continue; //comment
+
+			//tokenize line
+			std::vector<std::string> tokens = tokenize(line, " ");
+
+			if (tokens.empty()) continue;
+
+			if (tokens[0] == "v" && tokens.size() == 4)
+			{
+				Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()));
+				indexed_positions.push_back(v);
+
+				mesh->aabb_min.setMin(v);
+				mesh->aabb_max.setMax(v);
+			}
+			else if (tokens[0] == "vt" && tokens.size() >= 3)
+			{
+				Vector2 v((float)atof(tokens[1].c_str()), 1.0 - (float)atof(tokens[2].c_str()));
+				indexed_uvs.push_back(v);
+			}
+			else if (tokens[0] == "vn" && tokens.size() == 4)
+			{
+				Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()));
+				indexed_normals.push_back(v);
+			}
+			else if (tokens[0] == "usemtl" && tokens.size() > 1)
+			{
+				if (last_submesh_vertex != mesh->vertices.size())
+				{
+					last_submesh_vertex = mesh->vertices.size();
+					close_submesh(mesh, &submesh_info, last_submesh_vertex);
+					strcpy(submesh_info.name, tokens[1].c_str());
+				}
+				else
+					strcpy(submesh_info.material, tokens[1].c_str());
+			}
+			else if (tokens[0] == "g" && tokens.size() > 1)
+			{
+				if (last_submesh_vertex != mesh->vertices.size())
+				{
+					last_submesh_vertex = mesh->vertices.size();
+					close_submesh(mesh, &submesh_info, last_submesh_vertex);
+					strcpy(submesh_info.name, tokens[1].c_str());
+				}
+			}
+			else if (tokens[0] == "f" && tokens.size() >= 4)
+			{
+				Vector3 v1, v2, v3;
+				v1.parseFromText(tokens[1].c_str(), '/');
+
+				for (unsigned int iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
+				{
+					v2.parseFromText(tokens[iPoly].c_str(), '/');
+					v3.parseFromText(tokens[iPoly + 1].c_str(), '/');
+
+					mesh->vertices.push_back(indexed_positions[(unsigned int)(v1.x) - 1]);
+					mesh->vertices.push_back(indexed_positions[(unsigned int)(v2.x) - 1]);
+					mesh->vertices.push_back(indexed_positions[(unsigned int)(v3.x) - 1]);
+
+					if (indexed_uvs.size() > 0)
+					{
+						mesh->uvs.push_back(indexed_uvs[(unsigned int)(v1.y) - 1]);
+						mesh->uvs.push_back(indexed_uvs[(unsigned int)(v2.y) - 1]);
+						mesh->uvs.push_back(indexed_uvs[(unsigned int)(v3.y) - 1]);
+					}
+
+					if (indexed_normals.size() > 0)
+					{
+						mesh->normals.push_back(indexed_normals[(unsigned int)(v1.z) - 1]);
+						mesh->normals.push_back(indexed_normals[(unsigned int)(v2.z) - 1]);
+						mesh->normals.push_back(indexed_normals[(unsigned int)(v3.z) - 1]);
+					}
+				}
+			}
+		}
+
+		mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5;
+		mesh->box.halfsize = (mesh->aabb_max - mesh->box.center);
+		mesh->radius = (float)fmax(mesh->aabb_max.length(), mesh->aabb_min.length());
+
+		submesh_info.length = mesh->vertices.size() - last_submesh_vertex;
+		mesh->submeshes.push_back(submesh_info);
+		return true;
+	}
+
+	// ================
+	//  ASE
+	// ================
+
+	// Finds a " key" in the line, and returns the position after it
+	inline const char* find_in_line(const char* pos, const char* line_end, const char* key) {
+		const size_t key_length = strlen(key);
+		for (; pos + key_length <= line_end; pos++) {
+			if (is_space(*pos) && memcmp(pos + 1, key, key_length) == 0) {
+				return pos + 1 + key_length;
+			}
+		}
+		return NULL;
+	}
+
+	inline int parse_index(const char* pos, const char* end, const size_t count) {
+		int index = 0;
+		parse_int(pos, end, &index);
+		return (index >= 0 && (size_t)index < count) ? index : 0;
+	}
+
+	bool parse_ase(const char* data, const size_t size, Mesh* mesh) {
+		const char* pos = data;
+		const char* end = data + size;
+
+		std::vector<Vector3> unique_vertices;
+		std::vector<Vector2> unique_uvs;
+		size_t vertex_count = 0, face_count = 0, tvertex_count = 0, tface_count = 0, normal_count = 0;
+		bool has_mesh = false;
+
+		const float max_float = 10000000;
+		const float min_float = -10000000;
+		mesh->aabb_min.set(max_float, max_float, max_float);
+		mesh->aabb_max.set(min_float, min_float, min_float);
+
+		int prev_mat = 0;
+		sSubmeshInfo submesh;
+		memset(&submesh, 0, sizeof(submesh));
+
+		while (pos < end) {
+			pos = skip_spaces(pos, end);
+			if (pos == end || *pos != '*') {
+				pos = skip_line(pos, end);
+				continue;
+			}
+
+			const char* word_end = skip_word(pos, end);
+			if (match_word(pos, end, "*MESH_NUMVERTEX")) {
+				// Only the first object, as the old loader
+				if (has_mesh) {
+					break;
+				}
+				has_mesh = true;
+				int count = 0;
+				parse_int(word_end, end, &count);
+				unique_vertices.resize(max(count, 0));
+			}
+			else if (match_word(pos, end, "*MESH_NUMFACES")) {
+				int count = 0;
+				parse_int(word_end, end, &count);
+				mesh->vertices.resize(max(count, 0) * 3);
+				mesh->normals.resize(max(count, 0) * 3);
+				mesh->uvs.resize(max(count, 0) * 3);
+			}
+			else if (match_word(pos, end, "*MESH_VERTEX") && vertex_count < unique_vertices.size()) {
+				int id;
+				float x, y, z;
+				pos = parse_int(word_end, end, &id);
+				pos = parse_float(pos, end, &x);
+				pos = parse_float(pos, end, &y);
+				pos = parse_float(pos, end, &z);
+				Vector3 v(-x, z, y);
+				unique_vertices[vertex_count++] = v;
+				mesh->aabb_min.setMin(v);
+				mesh->aabb_max.setMax(v);
+			}
+			else if (match_word(pos, end, "*MESH_FACE") && face_count * 3 < mesh->vertices.size()) {
+				const char* line_end = word_end;
+				while (line_end < end && !is_end_of_line(*line_end)) line_end++;
+
+				const char* a = find_in_line(word_end, line_end, "A:");
+				const char* b = find_in_line(word_end, line_end, "B:");
+				const char* c = find_in_line(word_end, line_end, "C:");
+				const char* mtl = find_in_line(word_end, line_end, "*MESH_MTLID");
+				const size_t first = face_count * 3;
+				mesh->vertices[first + 0] = unique_vertices[a ? parse_index(a, line_end, unique_vertices.size()) : 0];
+				mesh->vertices[first + 1] = unique_vertices[b ? parse_index(b, line_end, unique_vertices.size()) : 0];
+				mesh->vertices[first + 2] = unique_vertices[c ? parse_index(c, line_end, unique_vertices.size()) : 0];
+
+				int current_mat = prev_mat;
+				if (mtl) {
+					parse_int(mtl, line_end, &current_mat);
+				}
+				if (current_mat != prev_mat) {
+					submesh.length = first - submesh.start;
+					mesh->submeshes.push_back(submesh);
+					memset(&submesh, 0, sizeof(submesh));
+					submesh.start = first;
+					prev_mat = current_mat;
+				}
+				face_count++;
+			}
+			else if (match_word(pos, end, "*MESH_NUMTVERTEX")) {
+				int count = 0;
+				parse_int(word_end, end, &count);
+				unique_uvs.resize(max(count, 0));
+			}
+			else if (match_word(pos, end, "*MESH_TVERT") && tvertex_count < unique_uvs.size()) {
+				int id;
+				Vector2 uv;
+				pos = parse_int(word_end, end, &id);
+				pos = parse_float(pos, end, &uv.x);
+				pos = parse_float(pos, end, &uv.y);
+				unique_uvs[tvertex_count++] = uv;
+			}
+			else if (match_word(pos, end, "*MESH_TFACE") && tface_count * 3 < mesh->uvs.size() && !unique_uvs.empty()) {
+				int id, a, b, c;
+				pos = parse_int(word_end, end, &id);
+				pos = parse_int(pos, end, &a);
+				pos = parse_int(pos, end, &b);
+				pos = parse_int(pos, end, &c);
+				const size_t uv_count = unique_uvs.size();
+				mesh->uvs[tface_count * 3 + 0] = unique_uvs[(a >= 0 && (size_t)a < uv_count) ? a : 0];
+				mesh->uvs[tface_count * 3 + 1] = unique_uvs[(b >= 0 && (size_t)b < uv_count) ? b : 0];
+				mesh->uvs[tface_count * 3 + 2] = unique_uvs[(c >= 0 && (size_t)c < uv_count) ? c : 0];
+				tface_count++;
+			}
+			else if (match_word(pos, end, "*MESH_VERTEXNORMAL") && normal_count < mesh->normals.size()) {
+				int id;
+				float x, y, z;
+				pos = parse_int(word_end, end, &id);
+				pos = parse_float(pos, end, &x);
+				pos = parse_float(pos, end, &y);
+				pos = parse_float(pos, end, &z);
+				mesh->normals[normal_count++] = Vector3(-x, z, y);
+			}
+
+			pos = skip_line(pos, end);
+		}
+
+		if (!has_mesh) {
+			return false;
+		}
+
+		submesh.length = face_count * 3 - submesh.start;
+		mesh->submeshes.push_back(submesh);
+
+		mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5;
+		mesh->box.halfsize = (mesh->aabb_max - mesh->box.center);
+		mesh->radius = (float)fmax(mesh->aabb_max.length(), mesh->aabb_min.length());
+		return true;
+	}
+
+	// ================
+	//  MESH
+	// ================
+
+	// Reads the count of a "count,v,v,v...\n" buffer
+	inline const char* parse_buffer_count(const char* pos, const char* end, int* count) {
+		float value = 0.0f;
+		pos = parse_float(pos, end, &value);
+		*count = max((int)value, 0);
+		return (pos < end && *pos == ',') ? pos + 1 : pos;
+	}
+
+	// Calls write(i, value) for the first count numbers of the line, and moves to the next line
+	template <typename F>
+	inline const char* parse_buffer_values(const char* pos, const char* end, const size_t count, F write) {
+		for (size_t i = 0; i < count && pos < end && !is_end_of_line(*pos); i++) {
+			float value = 0.0f;
+			pos = parse_float(pos, end, &value);
+			write(i, value);
+			while (pos < end && (*pos == ',' || is_space(*pos))) pos++;
+		}
+		return skip_line(pos, end);
+	}
+
+	// For the vectors of floats
+	template <typename T>
+	inline const char* parse_float_buffer(const char* pos, const char* end, std::vector<T>& dst) {
+		const size_t floats_per_item = sizeof(T) / sizeof(float);
+		int count = 0;
+		pos = parse_buffer_count(pos, end, &count);
+		dst.resize(count / floats_per_item);
+		float* out = dst.empty() ? NULL : (float*)&dst[0];
+		return parse_buffer_values(pos, end, dst.size() * floats_per_item, [out](const size_t i, const float value) { out[i] = value; });
+	}
+
+	const char* parse_mesh_buffer(const char* pos, const char* end, std::vector<Vector2>& dst) {
+		return parse_float_buffer(pos, end, dst);
+	}
+
+	const char* parse_mesh_buffer(const char* pos, const char* end, std::vector<Vector3>& dst) {
+		return parse_float_buffer(pos, end, dst);
+	}
+
+	const char* parse_mesh_buffer(const char* pos, const char* end, std::vector<Vector4>& dst) {
+		return parse_float_buffer(pos, end, dst);
+	}
+
+	const char* parse_mesh_buffer(const char* pos, const char* end, std::vector<Vector4ub>& dst) {
+		int count = 0;
+		pos = parse_buffer_count(pos, end, &count);
+		dst.resize(count / 4);
+		return parse_buffer_values(pos, end, dst.size() * 4, [&dst](const size_t i, const float value) { dst[i / 4].v[i % 4] = (unsigned char)value; });
+	}
+
+	// The indices as integers, the floats lose them past 2^24
+	const char* parse_mesh_buffer(const char* pos, const char* end, std::vector<unsigned int>& dst) {
+		int count = 0;
+		pos = parse_buffer_count(pos, end, &count);
+		dst.resize(count);
+		int invalid_indices = 0;
+		for (int i = 0; i < count && pos < end && !is_end_of_line(*pos); i++) {
+			int value = 0;
+			pos = parse_int(pos, end, &value);
+			// Some exporters write "12.000000", an index with a fraction is not valid
+			bool has_fraction = false;
+			if (pos < end && *pos == '.') {
+				for (pos++; pos < end && is_digit(*pos); pos++) {
+					has_fraction |= *pos != '0';
+				}
+			}
+			if (has_fraction || value < 0) {
+				invalid_indices++;
+				value = 0;
+			}
+			dst[i] = (unsigned int)value;
+			while (pos < end && (*pos == ',' || is_space(*pos))) pos++;
+		}
+		if (invalid_indices > 0) {
+			std::cerr << "MESH with " << invalid_indices << " invalid indices" << std::endl;
+		}
+		return skip_line(pos, end);
+	}
+
+	// ================
+	//  BENCHMARK
+	// ================
+
+	void sBenchmark::generate_obj() {
+		obj_text.clear();
+		obj_text.reserve((size_t)grid_size * grid_size * 120);
+
+		// A wavy grid, so the numbers have all their digits
+		char line[256];
+		const float step = 1.0f / (grid_size - 1);
+		for (int z = 0; z < grid_size; z++) {
+			for (int x = 0; x < grid_size; x++) {
+				const float height = sinf(x * 0.05f) * cosf(z * 0.07f);
+				const Vector3 normal = Vector3(-0.05f * cosf(x * 0.05f) * cosf(z * 0.07f), 1.0f, 0.07f * sinf(x * 0.05f) * sinf(z * 0.07f)).normalize();
+				int length = snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvt %.6f %.6f\nvn %.6f %.6f %.6f\n",
+					x * 0.1f, height, z * 0.1f, x * step, z * step, normal.x, normal.y, normal.z);
+				obj_text.append(line, length);
+			}
+		}
+
+		obj_text += "g grid\nusemtl grid_material\n";
+		for (int z = 0; z < grid_size - 1; z++) {
+			for (int x = 0; x < grid_size - 1; x++) {
+				const int a = z * grid_size + x + 1;
+				const int b = a + 1;
+				const int c = a + grid_size + 1;
+				const int d = a + grid_size;
+				int length = snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, d, d, d);
+				obj_text.append(line, length);
+			}
+		}
+
+		generated_grid_size = grid_size;
+	}
+
+	inline double get_seconds_since(const Uint64 start) {
+		return (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	}
+
+	void sBenchmark::run() {
+		if (generated_grid_size != grid_size) {
+			generate_obj();
+		}
+
+		const double megabytes = obj_text.size() / (1024.0 * 1024.0);
+		thread_count = get_thread_count();
+
+		Mesh legacy, single_thread, multi_thread;
+
+		Uint64 start = SDL_GetPerformanceCounter();
+		parse_obj_legacy(obj_text, &legacy);
+		legacy_mb_s = megabytes / get_seconds_since(start);
+
+		start = SDL_GetPerformanceCounter();
+		parse_obj(obj_text.c_str(), obj_text.size(), &single_thread, 1);
+		single_thread_mb_s = megabytes / get_seconds_since(start);
+
+		start = SDL_GetPerformanceCounter();
+		parse_obj(obj_text.c_str(), obj_text.size(), &multi_thread, thread_count);
+		multi_thread_mb_s = megabytes / get_seconds_since(start);
+
+		// The result has to be the same as the old loader
+		vertex_count = generated_grid_size * generated_grid_size;
+		max_difference = (legacy.vertices.size() == multi_thread.vertices.size()) ? 0.0f : 1e10f;
+		for (size_t i = 0; i < legacy.vertices.size() && i < multi_thread.vertices.size(); i++) {
+			const Vector3 vertex_difference = legacy.vertices[i] - multi_thread.vertices[i];
+			const Vector2 uv_difference = legacy.uvs[i] - multi_thread.uvs[i];
+			max_difference = max(max_difference, (float)max(vertex_difference.length(), uv_difference.length()));
+		}
+
+		has_run = true;
+	}
+
+	void render_imgui() {
+#ifndef SKIP_IMGUI
+		static sBenchmark benchmark;
+		if (ImGui::TreeNode("Mesh parser")) {
+			ImGui::SliderInt("Threads (0: all cores)", &max_threads, 0, 32);
+			ImGui::SliderInt("Benchmark grid", &benchmark.grid_size, 100, 2000);
+			if (ImGui::Button("Run OBJ benchmark")) {
+				benchmark.run();
+			}
+
+			if (benchmark.has_run) {
+				ImGui::Text("OBJ: %.1f MB, %d vertices", benchmark.obj_text.size() / (1024.0 * 1024.0), benchmark.vertex_count);
+				ImGui::Text("Legacy: %.1f MB/s", benchmark.legacy_mb_s);
+				ImGui::Text("1 thread: %.1f MB/s (x%.1f)", benchmark.single_thread_mb_s, benchmark.single_thread_mb_s / benchmark.legacy_mb_s);
+				ImGui::Text("%d threads: %.1f MB/s (x%.1f)", benchmark.thread_count, benchmark.multi_thread_mb_s, benchmark.multi_thread_mb_s / benchmark.legacy_mb_s);
+				ImGui::Text("Max difference with legacy: %g", benchmark.max_difference);
+			}
+			ImGui::TreePop();
+		}
+#endif
+	}
+};
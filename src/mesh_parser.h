@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "framework.h"
+
+class Mesh;
+
+// ================
+//  MESH PARSER
+// ================
+// Allocation free parsing of the text mesh formats (OBJ, ASE, MESH). The numbers
+// are read in place, without copying the lines or the words. The big OBJs are
+// split in chunks at line boundaries, parsed in parallel in the workers pool and merged in order.
+
+namespace MESH_PARSER {
+
+	// Files smaller than this are parsed in a single chunk
+#define OBJ_MIN_CHUNK_BYTES (1024 * 1024)
+
+	// Chunks a big file is split in, parsed in the TaskManager::workers pool. 0 for one per core
+	extern int max_threads;
+	int get_thread_count();
+
+	inline bool is_space(const char c) { return c == ' ' || c == '\t'; }
+	inline bool is_digit(const char c) { return c >= '0' && c <= '9'; }
+	inline bool is_end_of_line(const char c) { return c == '\n' || c == '\r'; }
+
+	inline const char* skip_spaces(const char* pos, const char* end) {
+		while (pos < end && is_space(*pos)) pos++;
+		return pos;
+	}
+
+	// Moves to the start of the next line
+	inline const char* skip_line(const char* pos, const char* end) {
+		while (pos < end && *pos != '\n') pos++;
+		return (pos < end) ? pos + 1 : end;
+	}
+
+	// Moves after the current word
+	inline const char* skip_word(const char* pos, const char* end) {
+		while (pos < end && !is_space(*pos) && !is_end_of_line(*pos)) pos++;
+		return pos;
+	}
+
+	// The word at pos is exactly the keyword
+	inline bool match_word(const char* pos, const char* end, const char* keyword) {
+		while (*keyword && pos < end && *pos == *keyword) { pos++; keyword++; }
+		return *keyword == 0 && (pos == end || is_space(*pos) || is_end_of_line(*pos));
+	}
+
+	// Parses a decimal integer after the spaces, the result is 0 if there is no number
+	inline const char* parse_int(const char* pos, const char* end, int* result) {
+		pos = skip_spaces(pos, end);
+		bool is_negative = false;
+		if (pos < end && (*pos == '-' || *pos == '+')) {
+			is_negative = *pos == '-';
+			pos++;
+		}
+		int value = 0;
+		for (; pos < end && is_digit(*pos); pos++) {
+			value = value * 10 + (*pos - '0');
+		}
+		*result = is_negative ? -value : value;
+		return pos;
+	}
+
+	// Parses a float after the spaces (same syntax as strtof, without inf/nan)
+	const char* parse_float(const char* pos, const char* end, float* result);
+
+	// Parses the text of an OBJ into the mesh, as the old loader did
+	bool parse_obj(const char* data, const size_t size, Mesh* mesh, const int num_threads);
+	// The loader that tokenized each line, kept as the baseline of the benchmark
+	bool parse_obj_legacy(const std::string& data, Mesh* mesh);
+
+	bool parse_ase(const char* data, const size_t size, Mesh* mesh);
+
+	// The "count,v,v,v...\n" buffers of the MESH format, parsed in the destination
+	const char* parse_mesh_buffer(const char* pos, const char* end, std::vector<Vector2>& dst);
+	const char* parse_mesh_buffer(const char* pos, const char* end, std::vector<Vector3>& dst);
+	const char* parse_mesh_buffer(const char* pos, const char* end, std::vector<Vector4>& dst);
+	const char* parse_mesh_buffer(const char* pos, const char* end, std::vector<Vector4ub>& dst);
+	const char* parse_mesh_buffer(const char* pos, const char* end, std::vector<unsigned int>& dst);
+
+	// Generates a grid OBJ in memory and times the legacy and the new parser
+	struct sBenchmark {
+		int grid_size = 1000; // grid_size^2 vertices
+		int generated_grid_size = 0;
+		std::string obj_text;
+
+		double legacy_mb_s = 0.0;
+		double single_thread_mb_s = 0.0;
+		double multi_thread_mb_s = 0.0;
+		int thread_count = 0;
+		int vertex_count = 0;
+		float max_difference = 0.0f; // Between the legacy and the new result
+		bool has_run = false;
+
+		void generate_obj();
+		void run();
+	};
+
+	void render_imgui();
+};
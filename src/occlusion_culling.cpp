@@ -0,0 +1,257 @@
+#include "occlusion_culling.h"
+
+#include "frusturm_culling.h"
+#include "camera.h"
+#include "task.h"
+#include "asset_memory.h"
+#include "includes.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace OCCLUSION {
+
+	bool enabled = true;
+	bool use_threads = true;
+	bool cull_shadow_casters = false;
+	int buffer_width = 256;
+	int max_occluders = 32;
+	float min_occluder_size = 5.0f;
+	sStats stats;
+
+	static DepthBuffer buffer;
+	static std::vector<std::vector<sScreenVertex>> occluder_triangles; // Per occluder, 3 vertices per triangle
+	static sBenchmark benchmark;
+
+	// The clip space vertices of setup_occluder, kept between the frames in every thread
+	struct sOccluderScratch {
+		std::vector<Vector4> clip;
+		std::vector<uint32_t> stamps; // The vertex is in clip if its stamp is the one of the current occluder
+		uint32_t stamp = 0;
+	};
+	static thread_local sOccluderScratch scratch;
+
+	static void setup_occluder(const GTR::sDrawCall& draw_call, const Matrix44& viewprojection, const float width, const float height, std::vector<sScreenVertex>& triangles) {
+		triangles.clear();
+		Mesh* mesh = draw_call.mesh;
+		const bool is_interleaved = mesh->interleaved.size() > 0;
+		const size_t vertex_count = is_interleaved ? mesh->interleaved.size() : mesh->vertices.size();
+		if (!vertex_count)
+			return;
+
+		const Matrix44 mvp = draw_call.model * viewprojection;
+		if (scratch.clip.size() < vertex_count) {
+			scratch.clip.resize(vertex_count);
+			scratch.stamps.resize(vertex_count, 0);
+		}
+
+		if (!mesh->m_indices.size()) {
+			for (size_t i = 0; i < vertex_count; i++) {
+				const Vector3& p = is_interleaved ? mesh->interleaved[i].vertex : mesh->vertices[i];
+				scratch.clip[i] = mvp * Vector4(p.x, p.y, p.z, 1.0f);
+			}
+			for (size_t i = 0; i + 2 < vertex_count; i += 3)
+				clip_triangle(scratch.clip[i], scratch.clip[i + 1], scratch.clip[i + 2], width, height, triangles);
+			return;
+		}
+
+		// Only the vertices of the triangles, once each
+		if (++scratch.stamp == 0) {
+			std::fill(scratch.stamps.begin(), scratch.stamps.end(), 0);
+			scratch.stamp = 1;
+		}
+		const auto transform = [mesh, is_interleaved, &mvp](const unsigned int index) -> const Vector4& {
+			if (scratch.stamps[index] != scratch.stamp) {
+				const Vector3& p = is_interleaved ? mesh->interleaved[index].vertex : mesh->vertices[index];
+				scratch.clip[index] = mvp * Vector4(p.x, p.y, p.z, 1.0f);
+				scratch.stamps[index] = scratch.stamp;
+			}
+			return scratch.clip[index];
+		};
+
+		// LOD 0, the silhouette of the simplified ones is not conservative
+		const size_t start = mesh->lods.size() ? mesh->lods[0].start : 0;
+		const size_t length = mesh->lods.size() ? mesh->lods[0].length : mesh->m_indices.size();
+		const unsigned int* indices = &mesh->m_indices[start];
+		for (size_t i = 0; i + 2 < length; i += 3)
+			clip_triangle(transform(indices[i]), transform(indices[i + 1]), transform(indices[i + 2]), width, height, triangles);
+	}
+
+	// Fills the hidden flags of the opaque and translucent draw calls, returns how many are hidden
+	static int run_culling(Camera* camera, GTR::CULLING::sSceneCulling* culling, const int occluder_count, const bool parallel, std::vector<bool>& hidden_opaque, std::vector<bool>& hidden_translucent, sStats& run_stats) {
+		run_stats = sStats();
+		std::vector<GTR::sDrawCall>& opaque = culling->_opaque_objects;
+		std::vector<GTR::sDrawCall>& translucent = culling->_translucent_objects;
+		hidden_opaque.assign(opaque.size(), false);
+		hidden_translucent.assign(translucent.size(), false);
+
+		const Uint64 start = SDL_GetPerformanceCounter();
+		const int width = max(buffer_width / OCCLUSION_TILE_SIZE, 1) * OCCLUSION_TILE_SIZE;
+		const int height = max((int)(width / camera->aspect) / OCCLUSION_TILE_SIZE, 1) * OCCLUSION_TILE_SIZE;
+		buffer.resize(width, height);
+
+		// The biggest ones on the screen
+		std::vector<std::pair<float, uint32_t>> occluders;
+		for (const uint32_t i : culling->_occluder_candidates) {
+			const float size = opaque[i].lod_scale * opaque[i].mesh->radius;
+			if (size >= min_occluder_size)
+				occluders.push_back(std::make_pair(size, i));
+		}
+		size_t count = min(occluders.size(), (size_t)max(occluder_count, 0));
+		std::partial_sort(occluders.begin(), occluders.begin() + count, occluders.end(), [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) { return a.first > b.first; });
+		occluders.resize(count);
+
+		// The RAM budget keeps the CPU copy of the chosen ones for a while, it is read again if it was released
+		count = 0;
+		for (const auto& occluder : occluders) {
+			Mesh* mesh = opaque[occluder.second].mesh;
+			mesh->last_occluder_frame = ASSET_MEMORY::frame;
+			if (mesh->hasCPUData())
+				occluders[count++] = occluder;
+			else if (!mesh->reloading)
+				mesh->restore();
+		}
+		occluders.resize(count);
+
+		if (occluder_triangles.size() < count)
+			occluder_triangles.resize(count);
+		const Matrix44& viewprojection = camera->viewprojection_matrix;
+		auto setup_job = [&occluders, &opaque, &viewprojection, width, height](const int i) {
+			setup_occluder(opaque[occluders[i].second], viewprojection, (float)width, (float)height, occluder_triangles[i]);
+		};
+
+		// Bands of tile rows
+		const int band_count = parallel ? min(buffer.tiles_y, TaskManager::workers.getThreadCount() + 1) : 1;
+		const int tiles_per_band = (buffer.tiles_y + band_count - 1) / band_count;
+		auto raster_job = [count, tiles_per_band](const int band) {
+			const int min_tile_y = band * tiles_per_band;
+			const int max_tile_y = min(min_tile_y + tiles_per_band, buffer.tiles_y);
+			if (min_tile_y >= max_tile_y)
+				return;
+			const int min_y = min_tile_y * OCCLUSION_TILE_SIZE, max_y = max_tile_y * OCCLUSION_TILE_SIZE;
+			buffer.clear(min_y, max_y);
+			for (size_t i = 0; i < count; i++)
+				buffer.rasterize(occluder_triangles[i].data(), occluder_triangles[i].size() / 3, min_y, max_y);
+			buffer.buildHiZ(min_tile_y, max_tile_y);
+		};
+
+		if (parallel) {
+			TaskManager::workers.parallelFor((int)count, setup_job);
+			TaskManager::workers.parallelFor(band_count, raster_job);
+		}
+		else {
+			for (int i = 0; i < (int)count; i++)
+				setup_job(i);
+			raster_job(0);
+		}
+
+		run_stats.occluders = (int)count;
+		for (size_t i = 0; i < count; i++)
+			run_stats.occluder_triangles += (int)occluder_triangles[i].size() / 3;
+		const Uint64 raster_end = SDL_GetPerformanceCounter();
+
+		// The occluders are not tested, the nearest corner of their box is always in front of them
+		std::vector<bool> is_occluder(opaque.size(), false);
+		for (const auto& occluder : occluders)
+			is_occluder[occluder.second] = true;
+
+		int culled = 0;
+		float rect[4], nearest;
+		for (size_t i = 0; i < opaque.size(); i++) {
+			if (is_occluder[i])
+				continue;
+			run_stats.tested++;
+			if (project_box(opaque[i].aabb, viewprojection, (float)width, (float)height, rect, &nearest) && buffer.isOccluded(rect[0], rect[1], rect[2], rect[3], nearest)) {
+				hidden_opaque[i] = true;
+				culled++;
+			}
+		}
+		for (size_t i = 0; i < translucent.size(); i++) {
+			run_stats.tested++;
+			if (project_box(translucent[i].aabb, viewprojection, (float)width, (float)height, rect, &nearest) && buffer.isOccluded(rect[0], rect[1], rect[2], rect[3], nearest)) {
+				hidden_translucent[i] = true;
+				culled++;
+			}
+		}
+
+		run_stats.culled = culled;
+		const double frequency = (double)SDL_GetPerformanceFrequency();
+		run_stats.raster_ms = (raster_end - start) * 1000.0 / frequency;
+		run_stats.test_ms = (SDL_GetPerformanceCounter() - raster_end) * 1000.0 / frequency;
+		return culled;
+	}
+
+	// Keeps the order of the visible ones
+	static void move_hidden(std::vector<GTR::sDrawCall>& draw_calls, const std::vector<bool>& hidden, std::vector<GTR::sDrawCall>& occluded) {
+		size_t count = 0;
+		for (size_t i = 0; i < draw_calls.size(); i++) {
+			if (hidden[i])
+				occluded.push_back(draw_calls[i]);
+			else if (count != i)
+				draw_calls[count++] = draw_calls[i];
+			else
+				count++;
+		}
+		draw_calls.resize(count);
+	}
+
+	void cull(Camera* camera, GTR::CULLING::sSceneCulling* culling) {
+		stats = sStats();
+		if (!enabled || camera->type != Camera::PERSPECTIVE || culling->_occluder_candidates.empty())
+			return;
+
+		if (benchmark.pending)
+			benchmark.run(camera, culling);
+
+		std::vector<bool> hidden_opaque, hidden_translucent;
+		if (!run_culling(camera, culling, max_occluders, use_threads, hidden_opaque, hidden_translucent, stats))
+			return;
+		move_hidden(culling->_opaque_objects, hidden_opaque, culling->_occluded_objects);
+		move_hidden(culling->_translucent_objects, hidden_translucent, culling->_occluded_objects);
+		culling->_occluder_candidates.clear(); // The indices are not valid anymore
+	}
+
+	void sBenchmark::run(Camera* camera, GTR::CULLING::sSceneCulling* culling) {
+		std::vector<bool> hidden_opaque, hidden_translucent;
+		sStats run_stats;
+		for (int step = 0; step < STEPS; step++) {
+			for (int threaded = 0; threaded < 2; threaded++) {
+				const Uint64 start = SDL_GetPerformanceCounter();
+				for (int r = 0; r < repetitions; r++)
+					culled[step] = run_culling(camera, culling, occluder_counts[step], threaded == 1, hidden_opaque, hidden_translucent, run_stats);
+				const double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency() / repetitions;
+				(threaded ? multi_thread_ms : single_thread_ms)[step] = ms;
+			}
+		}
+		tested = run_stats.tested;
+		pending = false;
+		has_run = true;
+	}
+
+	void render_imgui() {
+#ifndef SKIP_IMGUI
+		if (ImGui::TreeNode("Occlusion culling")) {
+			ImGui::Checkbox("Enabled", &enabled);
+			ImGui::Checkbox("Threads", &use_threads);
+			ImGui::Checkbox("Cull shadow casters", &cull_shadow_casters);
+			ImGui::SliderInt("Buffer width", &buffer_width, 64, 1024);
+			ImGui::SliderInt("Max occluders", &max_occluders, 0, 256);
+			ImGui::SliderFloat("Min occluder size", &min_occluder_size, 0.0f, 50.0f);
+
+			ImGui::Text("Buffer: %dx%d", buffer.width, buffer.height);
+			ImGui::Text("Occluders: %d (%d triangles)", stats.occluders, stats.occluder_triangles);
+			ImGui::Text("Culled: %d of %d", stats.culled, stats.tested);
+			ImGui::Text("Raster: %.3f ms, test: %.3f ms", stats.raster_ms, stats.test_ms);
+
+			if (ImGui::Button("Run benchmark"))
+				benchmark.pending = true;
+			if (benchmark.has_run) {
+				ImGui::Text("%d draw calls tested", benchmark.tested);
+				for (int step = 0; step < sBenchmark::STEPS; step++)
+					ImGui::Text("%d occluders: %d culled, %.3f ms (1 thread: %.3f ms)", benchmark.occluder_counts[step], benchmark.culled[step], benchmark.multi_thread_ms[step], benchmark.single_thread_ms[step]);
+			}
+			ImGui::TreePop();
+		}
+#endif
+	}
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vector>
+#include "framework.h"
+
+class Camera;
+
+namespace GTR {
+	namespace CULLING {
+		struct sSceneCulling;
+	};
+};
+
+// ==================
+//  OCCLUSION CULLING
+// ==================
+// Software occlusion culling of the main view. The opaque draw calls that are biggest on the screen
+// are the occluders. Their full detail mesh (LOD 0) is transformed and rasterized into a small depth
+// buffer on the CPU, in bands of rows in the worker threads, 4 pixels at a time with SSE2. The simplified
+// LODs are not used, their silhouette can go out of the real one and hide objects that are visible.
+// The buffer keeps 1/w so the depth is linear on the screen. A hierarchical level keeps the farthest
+// depth of every tile. A draw call is hidden when the nearest corner of its box is behind every tile
+// or pixel it covers. Only the meshes with their CPU copy can occlude.
+
+#define OCCLUSION_TILE_SIZE 8
+
+namespace OCCLUSION {
+
+	extern bool enabled;
+	extern bool use_threads;
+	extern bool cull_shadow_casters; // The hidden objects can cast visible shadows, so they are kept for the shadows by default
+	extern int buffer_width; // The height follows the aspect of the camera
+	extern int max_occluders;
+	extern float min_occluder_size; // Projected radius, in the units of Camera::getProjectedScale
+
+	// In pixels, and 1/w as the depth
+	struct sScreenVertex {
+		float x, y, z;
+	};
+
+	class DepthBuffer {
+	public:
+		int width = 0; // Multiples of the tile size
+		int height = 0;
+		int tiles_x = 0;
+		int tiles_y = 0;
+		std::vector<float> depth; // 1/w per pixel, 0 where there is nothing
+		std::vector<float> hiz; // Per tile, the farthest depth of its pixels
+
+		void resize(const int width, const int height);
+
+		// Only the rows [min_y, max_y) are written, the bands can be rasterized in different threads
+		void clear(const int min_y, const int max_y);
+		void rasterize(const sScreenVertex* vertices, const size_t triangle_count, const int min_y, const int max_y);
+		void buildHiZ(const int min_tile_y, const int max_tile_y);
+
+		// The rect is in pixels, nearest is the 1/w of the closest point of the object
+		bool isOccluded(const float min_x, const float min_y, const float max_x, const float max_y, const float nearest) const;
+	};
+
+	// Appends the triangle in pixels and counter clockwise, clipped against the near plane. The vertices are in clip space
+	void clip_triangle(const Vector4& a, const Vector4& b, const Vector4& c, const float width, const float height, std::vector<sScreenVertex>& triangles);
+	// The screen rect (min x, min y, max x, max y) and the nearest 1/w of a box, false if it crosses the near plane
+	bool project_box(const BoundingBox& box, const Matrix44& viewprojection, const float width, const float height, float* rect, float* nearest);
+
+	struct sStats {
+		int occluders = 0;
+		int occluder_triangles = 0;
+		int tested = 0;
+		int culled = 0;
+		double raster_ms = 0.0; // Setup, rasterization and hierarchical depth
+		double test_ms = 0.0;
+	};
+	extern sStats stats;
+
+	// Rasterizes the occluders and moves the hidden draw calls to _occluded_objects
+	void cull(Camera* camera, GTR::CULLING::sSceneCulling* culling);
+
+	// Objects culled vs. cost for several occluder counts, with the draw calls of the next frame
+	struct sBenchmark {
+		static const int STEPS = 6;
+		int occluder_counts[STEPS] = { 4, 8, 16, 32, 64, 128 };
+		int culled[STEPS] = {};
+		double single_thread_ms[STEPS] = {};
+		double multi_thread_ms[STEPS] = {};
+		int tested = 0;
+		int repetitions = 10;
+		bool pending = false;
+		bool has_run = false;
+
+		void run(Camera* camera, GTR::CULLING::sSceneCulling* culling);
+	};
+
+	void render_imgui();
+};
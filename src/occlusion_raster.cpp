@@ -0,0 +1,200 @@
+#include "occlusion_culling.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE2
+#include <emmintrin.h>
+#endif
+
+// The depth buffer and the triangle setup of OCCLUSION, without the scene and the GL parts,
+// so the tests can build them alone
+
+namespace OCCLUSION {
+
+	void DepthBuffer::resize(const int new_width, const int new_height) {
+		if (new_width == width && new_height == height)
+			return;
+		width = new_width;
+		height = new_height;
+		tiles_x = width / OCCLUSION_TILE_SIZE;
+		tiles_y = height / OCCLUSION_TILE_SIZE;
+		depth.assign(width * height, 0.0f);
+		hiz.assign(tiles_x * tiles_y, 0.0f);
+	}
+
+	void DepthBuffer::clear(const int min_y, const int max_y) {
+		std::fill(depth.begin() + min_y * width, depth.begin() + max_y * width, 0.0f);
+	}
+
+	void DepthBuffer::rasterize(const sScreenVertex* vertices, const size_t triangle_count, const int min_y, const int max_y) {
+		for (size_t t = 0; t < triangle_count; t++) {
+			const sScreenVertex& v0 = vertices[t * 3];
+			const sScreenVertex& v1 = vertices[t * 3 + 1];
+			const sScreenVertex& v2 = vertices[t * 3 + 2];
+
+			// The pixels with the center in the bounds, clamped to the band
+			const int x0 = std::max((int)floorf(std::min(v0.x, std::min(v1.x, v2.x))), 0);
+			const int x1 = std::min((int)ceilf(std::max(v0.x, std::max(v1.x, v2.x))), width - 1);
+			const int y0 = std::max((int)floorf(std::min(v0.y, std::min(v1.y, v2.y))), min_y);
+			const int y1 = std::min((int)ceilf(std::max(v0.y, std::max(v1.y, v2.y))), max_y - 1);
+			if (x0 > x1 || y0 > y1)
+				continue;
+
+			// Edge functions, the triangles are counter clockwise so the inside is positive
+			const float a0 = v0.y - v1.y, b0 = v1.x - v0.x, c0 = -(a0 * v0.x + b0 * v0.y);
+			const float a1 = v1.y - v2.y, b1 = v2.x - v1.x, c1 = -(a1 * v1.x + b1 * v1.y);
+			const float a2 = v2.y - v0.y, b2 = v0.x - v2.x, c2 = -(a2 * v2.x + b2 * v2.y);
+
+			// 1/w is linear on the screen
+			const float area = b0 * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+			const float dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+			const float dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+			const float zc = v0.z - dzdx * v0.x - dzdy * v0.y;
+
+			const int start_x = x0 & ~3; // The rows are multiples of 4
+			for (int y = y0; y <= y1; y++) {
+				const float py = y + 0.5f;
+				float* row = &depth[y * width];
+#ifdef OCCLUSION_SSE2
+				const __m128 zero = _mm_setzero_ps();
+				const __m128 step = _mm_set1_ps(4.0f);
+				const __m128 va0 = _mm_set1_ps(a0), va1 = _mm_set1_ps(a1), va2 = _mm_set1_ps(a2), vdzdx = _mm_set1_ps(dzdx);
+				const __m128 row0 = _mm_set1_ps(b0 * py + c0), row1 = _mm_set1_ps(b1 * py + c1), row2 = _mm_set1_ps(b2 * py + c2), rowz = _mm_set1_ps(dzdy * py + zc);
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)start_x), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+				for (int x = start_x; x <= x1; x += 4) {
+					const __m128 e0 = _mm_add_ps(_mm_mul_ps(va0, px), row0);
+					const __m128 e1 = _mm_add_ps(_mm_mul_ps(va1, px), row1);
+					const __m128 e2 = _mm_add_ps(_mm_mul_ps(va2, px), row2);
+					const __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+					const __m128 z = _mm_add_ps(_mm_mul_ps(vdzdx, px), rowz);
+					const __m128 old = _mm_loadu_ps(row + x);
+					const __m128 nearest = _mm_max_ps(old, z);
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+					px = _mm_add_ps(px, step);
+				}
+#else
+				for (int x = start_x; x <= x1; x++) {
+					const float px = x + 0.5f;
+					if (a0 * px + b0 * py + c0 < 0.0f || a1 * px + b1 * py + c1 < 0.0f || a2 * px + b2 * py + c2 < 0.0f)
+						continue;
+					const float z = dzdx * px + dzdy * py + zc;
+					if (z > row[x])
+						row[x] = z;
+				}
+#endif
+			}
+		}
+	}
+
+	void DepthBuffer::buildHiZ(const int min_tile_y, const int max_tile_y) {
+		for (int ty = min_tile_y; ty < max_tile_y; ty++) {
+			for (int tx = 0; tx < tiles_x; tx++) {
+				float farthest = 3.4e+38F;
+				for (int y = ty * OCCLUSION_TILE_SIZE; y < (ty + 1) * OCCLUSION_TILE_SIZE; y++) {
+					const float* row = &depth[y * width + tx * OCCLUSION_TILE_SIZE];
+					for (int x = 0; x < OCCLUSION_TILE_SIZE; x++)
+						farthest = std::min(farthest, row[x]);
+				}
+				hiz[ty * tiles_x + tx] = farthest;
+			}
+		}
+	}
+
+	bool DepthBuffer::isOccluded(const float min_x, const float min_y, const float max_x, const float max_y, const float nearest) const {
+		const int x0 = std::max((int)floorf(min_x), 0), x1 = std::min((int)floorf(max_x), width - 1);
+		const int y0 = std::max((int)floorf(min_y), 0), y1 = std::min((int)floorf(max_y), height - 1);
+		if (x0 > x1 || y0 > y1)
+			return false;
+
+		for (int ty = y0 / OCCLUSION_TILE_SIZE; ty <= y1 / OCCLUSION_TILE_SIZE; ty++) {
+			for (int tx = x0 / OCCLUSION_TILE_SIZE; tx <= x1 / OCCLUSION_TILE_SIZE; tx++) {
+				// All the tile is in front
+				if (nearest < hiz[ty * tiles_x + tx])
+					continue;
+
+				// Only the pixels of the tile in the rect
+				const int px0 = std::max(x0, tx * OCCLUSION_TILE_SIZE), px1 = std::min(x1, (tx + 1) * OCCLUSION_TILE_SIZE - 1);
+				const int py0 = std::max(y0, ty * OCCLUSION_TILE_SIZE), py1 = std::min(y1, (ty + 1) * OCCLUSION_TILE_SIZE - 1);
+				for (int y = py0; y <= py1; y++)
+					for (int x = px0; x <= px1; x++)
+						if (depth[y * width + x] <= nearest)
+							return false;
+			}
+		}
+		return true;
+	}
+
+	// To pixels, counter clockwise
+	static void add_triangle(const Vector4& a, const Vector4& b, const Vector4& c, const float width, const float height, std::vector<sScreenVertex>& triangles) {
+		sScreenVertex v[3];
+		const Vector4* clip[3] = { &a, &b, &c };
+		for (int k = 0; k < 3; k++) {
+			const float inv_w = 1.0f / clip[k]->w;
+			v[k] = { (clip[k]->x * inv_w * 0.5f + 0.5f) * width, (clip[k]->y * inv_w * 0.5f + 0.5f) * height, inv_w };
+		}
+
+		const float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+		if (area == 0.0f)
+			return;
+		if (area < 0.0f)
+			std::swap(v[1], v[2]);
+		triangles.insert(triangles.end(), v, v + 3);
+	}
+
+	// Clipped against the near plane (z = -w), the other planes only clamp the bounds of the raster
+	void clip_triangle(const Vector4& a, const Vector4& b, const Vector4& c, const float width, const float height, std::vector<sScreenVertex>& triangles) {
+		const Vector4* input[3] = { &a, &b, &c };
+		float distances[3];
+		int inside_count = 0;
+		for (int k = 0; k < 3; k++) {
+			distances[k] = input[k]->z + input[k]->w;
+			inside_count += (distances[k] >= 0.0f) ? 1 : 0;
+		}
+		if (inside_count == 3) {
+			add_triangle(a, b, c, width, height, triangles);
+			return;
+		}
+		if (inside_count == 0)
+			return;
+
+		Vector4 polygon[4];
+		int count = 0;
+		for (int k = 0; k < 3; k++) {
+			const int next = (k + 1) % 3;
+			if (distances[k] >= 0.0f)
+				polygon[count++] = *input[k];
+			if ((distances[k] >= 0.0f) != (distances[next] >= 0.0f)) {
+				const float t = distances[k] / (distances[k] - distances[next]);
+				const Vector4& p = *input[k];
+				const Vector4& q = *input[next];
+				polygon[count++] = Vector4(p.x + (q.x - p.x) * t, p.y + (q.y - p.y) * t, p.z + (q.z - p.z) * t, p.w + (q.w - p.w) * t);
+			}
+		}
+		for (int k = 2; k < count; k++)
+			add_triangle(polygon[0], polygon[k - 1], polygon[k], width, height, triangles);
+	}
+
+	// The screen rect and the nearest 1/w of a box, false if it crosses the near plane
+	bool project_box(const BoundingBox& box, const Matrix44& viewprojection, const float width, const float height, float* rect, float* nearest) {
+		rect[0] = rect[1] = 3.4e+38F;
+		rect[2] = rect[3] = -3.4e+38F;
+		*nearest = 0.0f;
+		for (int k = 0; k < 8; k++) {
+			const Vector3 corner = box.center + Vector3((k & 1) ? box.halfsize.x : -box.halfsize.x, (k & 2) ? box.halfsize.y : -box.halfsize.y, (k & 4) ? box.halfsize.z : -box.halfsize.z);
+			const Vector4 clip = viewprojection * Vector4(corner.x, corner.y, corner.z, 1.0f);
+			if (clip.z + clip.w < 0.0f || clip.w <= 0.0f)
+				return false;
+			const float inv_w = 1.0f / clip.w;
+			const float x = (clip.x * inv_w * 0.5f + 0.5f) * width;
+			const float y = (clip.y * inv_w * 0.5f + 0.5f) * height;
+			rect[0] = std::min(rect[0], x);
+			rect[1] = std::min(rect[1], y);
+			rect[2] = std::max(rect[2], x);
+			rect[3] = std::max(rect[3], y);
+			*nearest = std::max(*nearest, inv_w);
+		}
+		return true;
+	}
+};
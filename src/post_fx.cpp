@@ -1,55 +1,70 @@
 #include "post_fx.h"
+#include "utils.h"
 
-void GTR::sPostFX_Component::init(const vec2& size) {
-	post_fx_1 = new FBO();
-	post_fx_2 = new FBO();
-
-	post_fx_2->create(size.x, size.y, 1, GL_RGBA, GL_FLOAT);
-	post_fx_1->create(size.x, size.y, 1, GL_RGBA, GL_FLOAT);
-
+void GTR::sPostFX_Component::init() {
 	memset(enabled, false, sizeof(enabled));
+	load_color_lut("data/textures/color_lut.png");
 }
 
-Texture* GTR::sPostFX_Component::add_postFX(Texture* text) {
-	if (!enable_postFX)
-		return text;
-
-	FBO* fbo_list[2] = {post_fx_1, post_fx_2};
-
-	int fbo_index = 0;
-
-	Mesh *quad = Mesh::getQuad();
-
-	// Copy to start the poing pong
-	post_fx_2->bind();
-	text->copyTo(NULL);
-	post_fx_2->unbind();
-
-	for (int i = 0; i < POSTFX_COUNT; i++) {
-		if (!enabled[i])
-			continue;
+// The LUT is a strip of COLOR_LUT_SIZE slices along x, one per blue value.
+// Without the file, the identity is used
+void GTR::sPostFX_Component::load_color_lut(const char* filename) {
+	const int size = COLOR_LUT_SIZE;
+	std::vector<Uint8> data(size * size * size * 3);
+
+	Image strip;
+	std::vector<unsigned char> buffer;
+	const bool has_strip = readFileBin(filename, buffer) && strip.loadPNG(buffer, true) && strip.width == size * size && strip.height == size;
+
+	for (int b = 0; b < size; b++) {
+		for (int g = 0; g < size; g++) {
+			for (int r = 0; r < size; r++) {
+				Uint8* texel = &data[((b * size + g) * size + r) * 3];
+				if (has_strip) {
+					Color color = strip.getPixel(b * size + r, g);
+					texel[0] = color.x; texel[1] = color.y; texel[2] = color.z;
+				} else {
+					texel[0] = r * 255 / (size - 1); texel[1] = g * 255 / (size - 1); texel[2] = b * 255 / (size - 1);
+				}
+			}
+		}
+	}
 
-		FBO* curr_fbo = fbo_list[fbo_index];
-		FBO* prev_fbo = fbo_list[(fbo_index == 0) ? 1 : 0];
+	color_lut = new Texture();
+	color_lut->create3D(size, size, size, GL_RGB, GL_UNSIGNED_BYTE, false, data.data(), GL_RGB8);
+}
 
-		curr_fbo->bind();
+Texture* GTR::sPostFX_Component::post_pass(Texture* hdr_tex, const Tonemapping_Component* tonemapping, const bool use_tonemapping) {
+	uint64_t features = get_fused_features();
+	if (use_tonemapping) {
+		features |= tonemapping->get_features();
+	}
 
-		curr_fbo->enableSingleBuffer(0);
-		glClearColor(0.1, 0.1, 0.1, 1.0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	Shader* shader = ShaderVariants::Get(VARIANT_POST_UBER, features);
+	if (!shader) {
+		return hdr_tex;
+	}
 
-		Shader* shader = Shader::Get(shaders[i]);
-		shader->enable();
+	post_fbo->bind();
 
-		shader->setUniform("u_color_tex", prev_fbo->color_textures[0], 1);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
 
-		quad->render(GL_TRIANGLES);
+	shader->enable();
+	shader->setUniform("u_color_tex", hdr_tex, 0);
+	tonemapping->set_uniforms(shader);
+	shader->setUniform("u_lut_tex", color_lut, 1);
+	shader->setUniform("u_lut_intensity", lut_intensity);
+	shader->setUniform("u_vignette_intensity", vignette_intensity);
+	shader->setUniform("u_vignette_smoothness", vignette_smoothness);
+	shader->setUniform("u_grain_intensity", grain_intensity);
+	shader->setUniform("u_frame", (float)(frame++ % 1024));
 
-		shader->disable();
+	Mesh::getQuad()->render(GL_TRIANGLES);
 
-		curr_fbo->unbind();
+	shader->disable();
+	post_fbo->unbind();
+	glEnable(GL_DEPTH_TEST);
 
-		// Ping pong
-		fbo_index = (fbo_index == 0) ? 1 : 0;
-	}
+	return post_fbo->color_textures[0];
 }
\ No newline at end of file
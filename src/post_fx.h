@@ -5,6 +5,15 @@
 #include "mesh.h"
 #include "fbo.h"
 #include "scene.h"
+#include "tonemapping.h"
+
+// ================
+//  POST FX
+// ================
+// The tonemapper and the per pixel effects are fused in one pass, a variant of
+// the post_uber shader, that writes the 8 bit target.
+
+#define COLOR_LUT_SIZE 16
 
 namespace GTR {
 	
@@ -19,37 +28,74 @@ namespace GTR {
 	struct sPostFX_Component {
 		const char* names[POSTFX_COUNT] = {
 			"Chromatic aberration",
+			"Vignette",
 			"LUT",
 			"Grain"
 		};
 
-		const char* shaders[POSTFX_COUNT] = {
-			"chrom_aberr"
+		// Variant bit of the effects fused in the post pass
+		const uint64_t fused_features[POSTFX_COUNT] = {
+			FEATURE_CHROM_ABERR,
+			FEATURE_VIGNETTE,
+			FEATURE_COLOR_LUT,
+			FEATURE_FILM_GRAIN
 		};
 
-		FBO* post_fx_1 = NULL;
-		FBO* post_fx_2 = NULL;
+		// Transient, set by the frame graph
+		FBO* post_fbo = NULL; // 8 bit, result of the fused pass
 
 		bool enabled[POSTFX_COUNT];
 
 		bool enable_postFX = true;
 
-		void init(const vec2 &size);
-		
-		Texture* add_postFX(Texture *text);
+		float vignette_intensity = 0.5f;
+		float vignette_smoothness = 0.5f;
+		float lut_intensity = 1.0f;
+		float grain_intensity = 0.05f;
+		uint32_t frame = 0;
+
+		Texture* color_lut = NULL; // COLOR_LUT_SIZE^3
+
+		void init();
+
+		// Tonemapping and the fused effects, to the 8 bit target
+		Texture* post_pass(Texture* hdr_tex, const Tonemapping_Component* tonemapping, const bool use_tonemapping);
+
+		inline uint64_t get_fused_features() const {
+			uint64_t features = 0;
+			for (int i = 0; i < POSTFX_COUNT; i++) {
+				if (enable_postFX && enabled[i])
+					features |= fused_features[i];
+			}
+			return features;
+		}
 
 		inline void render_imgui() {
+#ifndef SKIP_IMGUI
 			if (ImGui::TreeNode("Post FX")) {
 				ImGui::Text("Enable or disable PostFX");
 				for (int i = 0; i < POSTFX_COUNT; i++) {
 					ImGui::Checkbox(names[i], &enabled[i]);
 				}
+				if (enabled[VIGNET]) {
+					ImGui::SliderFloat("Vignette intensity", &vignette_intensity, 0.0f, 1.0f);
+					ImGui::SliderFloat("Vignette smoothness", &vignette_smoothness, 0.05f, 1.0f);
+				}
+				if (enabled[LUT]) {
+					ImGui::SliderFloat("LUT intensity", &lut_intensity, 0.0f, 1.0f);
+				}
+				if (enabled[GRAIN]) {
+					ImGui::SliderFloat("Grain intensity", &grain_intensity, 0.0f, 0.3f);
+				}
 
 				ImGui::Checkbox("Disable ALL postFx", &enable_postFX);
 
 				ImGui::TreePop();
 			}
-			
+#endif
 		};
+
+	private:
+		void load_color_lut(const char* filename);
 	};
 };
\ No newline at end of file
@@ -186,11 +186,7 @@ Prefab::Prefab()
 Prefab::~Prefab()
 {
 	if (name.size())
-	{
-		auto it = sPrefabsLoaded.find(name);
-		if (it != sPrefabsLoaded.end())
-			sPrefabsLoaded.erase(it);
-	}
+		sPrefabsLoaded.remove(name, this);
 }
 
 void Prefab::updateBounding()
@@ -198,16 +194,15 @@ void Prefab::updateBounding()
 	bounding = root.getBoundingBox();
 }
 
-std::map<std::string, Prefab*> Prefab::sPrefabsLoaded;
+AssetRegistry<Prefab> Prefab::sPrefabsLoaded("Prefab", 1 << 10);
 
 Prefab* Prefab::Get(const char* filename)
 {
 	assert(filename);
-	std::map<std::string, Prefab*>::iterator it = sPrefabsLoaded.find(filename);
-	if (it != sPrefabsLoaded.end())
-		return it->second;
+	Prefab* prefab = sPrefabsLoaded.find(filename);
+	if (prefab)
+		return prefab;
 
-	Prefab* prefab = nullptr;
 	{
 		if (!prefab)
 			prefab = loadGLTF(filename);
@@ -223,10 +218,45 @@ Prefab* Prefab::Get(const char* filename)
 	return prefab;
 }
 
+Prefab* Prefab::Find(const char* filename)
+{
+	assert(filename);
+	return sPrefabsLoaded.find(filename);
+}
+
+//the meshes and materials of the nodes are referenced while the prefab is
+void addNodeRefs(Node* node, bool add)
+{
+	if (node->mesh)
+		node->mesh->ref_count += add ? 1 : -1;
+	if (node->material)
+	{
+		if (add)
+			node->material->addRef();
+		else
+			node->material->releaseRef();
+	}
+	for (int i = 0; i < node->children.size(); ++i)
+		addNodeRefs(node->children[i], add);
+}
+
+void Prefab::addRef()
+{
+	if (ref_count++ == 0)
+		addNodeRefs(&root, true);
+}
+
+void Prefab::releaseRef()
+{
+	assert(ref_count > 0);
+	if (--ref_count == 0)
+		addNodeRefs(&root, false);
+}
+
 void Prefab::registerPrefab(std::string name)
 {
 	this->name = name;
-	sPrefabsLoaded[name] = this;
+	sPrefabsLoaded.add(name, this);
 }
 
 Node* Prefab::getNodeByName(const char* name)
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "framework.h"
+#include "asset_registry.h"
 #include <cassert>
 #include <map>
 #include <string>
@@ -111,9 +112,17 @@ namespace GTR {
 		Node* getNodeByName(const char* name);
 
 				//Manager to cache loaded prefabs
-		static std::map<std::string, Prefab*> sPrefabsLoaded;
+		static AssetRegistry<Prefab> sPrefabsLoaded;
 		static Prefab* Get(const char* filename);
+		static Prefab* Find(const char* filename); //only if already loaded, does not load it
 		void registerPrefab(std::string name);
+
+		//memory management, see asset_memory.h
+		int ref_count = 0; //entities using it
+		void addRef();
+		void releaseRef();
 	};
 
 };
+
+template<> inline AssetRegistry<GTR::Prefab>& getAssetRegistry<GTR::Prefab>() { return GTR::Prefab::sPrefabsLoaded; }
@@ -4,115 +4,310 @@
 
 void GTR::sReflections_Component::init(Renderer* rend_inst) {
 	renderer_instance = rend_inst;
-	memset(is_in_use, false, sizeof(sReflections_Component::is_in_use));
 
-	ref_fbo = new FBO();
+	// Cubemap array, with the mips of the roughness
+	mip_count = (int)log2((float)REF_PROBE_SIZE) + 1;
+	glGenTextures(1, &probe_array);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, probe_array);
+	for (int level = 0; level < mip_count; level++) {
+		int size = REF_PROBE_SIZE >> level;
+		glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, level, GL_RGB8, size, size, MAX_REF_PROBE_COUNT * 6, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+	glGenFramebuffers(1, &capture_fbo);
+	glGenRenderbuffers(1, &capture_depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, capture_depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, REF_PROBE_SIZE, REF_PROBE_SIZE);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, capture_fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, capture_depth);
+
+	glGenFramebuffers(2, mip_fbos);
+	glBindFramebuffer(GL_FRAMEBUFFER, mip_fbos[0]);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_FRAMEBUFFER, mip_fbos[1]);
+	const GLenum draw_buffer = GL_COLOR_ATTACHMENT0;
+	glDrawBuffers(1, &draw_buffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	int probe = init_probe();
-	probe_position[probe] = vec3(80.0f, 100.0, .0f);
+	probes[probe].position = vec3(80.0f, 100.0, .0f);
 	probe = init_probe();
-	probe_position[probe] = vec3(-270.0f, 100.0, .0f);
+	probes[probe].position = vec3(-270.0f, 100.0, .0f);
 	probe = init_probe();
-	probe_position[probe] = vec3(104.0f, 100.0, 220.0f);
+	probes[probe].position = vec3(104.0f, 100.0, 220.0f);
 	probe = init_probe();
-	probe_position[probe] = vec3(-145.0f, 100.0, 220.0f);
+	probes[probe].position = vec3(-145.0f, 100.0, 220.0f);
 	probe = init_probe();
-	probe_position[probe] = vec3(83.0f, 100.0, -244.0f);
+	probes[probe].position = vec3(83.0f, 100.0, -244.0f);
 	probe = init_probe();
-	probe_position[probe] = vec3(-166.0f, 100.0, -244.0f);
+	probes[probe].position = vec3(-166.0f, 100.0, -244.0f);
+
+	capture_all_probes();
 }
 
 void GTR::sReflections_Component::clean() {
-
+	glDeleteTextures(1, &probe_array);
+	glDeleteRenderbuffers(1, &capture_depth);
+	glDeleteFramebuffers(1, &capture_fbo);
+	glDeleteFramebuffers(2, mip_fbos);
 }
 
+// Returns -1 when all the layers of the array are in use
 int GTR::sReflections_Component::init_probe() {
 	int i = 0;
 	for (; i < MAX_REF_PROBE_COUNT; i++) {
-		if (is_in_use[i])
-			continue;
-		break;
+		if (!probes[i].in_use)
+			break;
+	}
+	if (i == MAX_REF_PROBE_COUNT) {
+		return -1;
 	}
 
-	probe_cubemap[i] = new Texture();
-	probe_cubemap[i]->createCubemap(512, 512,
-		NULL, 
-		GL_RGB, 
-		GL_UNSIGNED_INT, 
-		true);
-	is_in_use[i] = true;
-	probe_position[i] = vec3(0.0f, 100.0f, 0.0f);
+	probes[i] = sReflectionProbe();
+	probes[i].in_use = true;
+	probes[i].position = vec3(0.0f, 100.0f, 0.0f);
+	grid_dirty = true;
 
 	return i;
 }
 
+void GTR::sReflections_Component::capture_probe(const int probe_id) {
+	if (std::find(capture_queue.begin(), capture_queue.end(), probe_id) == capture_queue.end()) {
+		capture_queue.push_back(probe_id);
+	}
+}
+
+void GTR::sReflections_Component::capture_all_probes() {
+	for (int i = 0; i < MAX_REF_PROBE_COUNT; i++) {
+		if (!probes[i].in_use)
+			continue;
+		capture_probe(i);
+	}
+}
+
+// Renders the next faces of the queue, faces_per_frame at most
+void GTR::sReflections_Component::update_captures(const std::vector<BaseEntity*>& entity_list) {
+	if (grid_dirty) {
+		build_grid();
+	}
+	// Nothing uses the probes
+	if (!enable_reflections && !debug_render) {
+		return;
+	}
+
+	for (int i = 0; i < faces_per_frame && !capture_queue.empty(); i++) {
+		const int probe_id = capture_queue.front();
+
+		// The culling is done once for the six faces, with a box around the probe
+		if (capture_face == 0) {
+			Camera box_cam;
+			box_cam.setOrthographic(-capture_far, capture_far, -capture_far, capture_far, -capture_far, capture_far);
+			box_cam.lookAt(probes[probe_id].position, probes[probe_id].position + vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, 1.0f, 0.0f));
+			box_cam.fov = 90.0f; // Of the faces, for the projected scale of the LODs
+			capture_culling.clear();
+			capture_culling.lod_bias = MESH_LOD::pass_bias[MESH_LOD::PASS_PROBES];
+			CULLING::frustrum_culling(entity_list, &capture_culling, &box_cam);
+		}
+
+		render_capture_face(probe_id, capture_face);
+		capture_face++;
 
-void GTR::sReflections_Component::capture_probe(const std::vector<BaseEntity*>& entity_list, 
-												const int probe_id) {
+		if (capture_face == 6) {
+			generate_probe_mips(probe_id);
+
+			probes[probe_id].captured = true;
+			capture_queue.pop_front();
+			capture_face = 0;
+			capture_culling.clear();
+		}
+	}
+}
+
+void GTR::sReflections_Component::render_capture_face(const int probe_id, const int face) {
 	Camera render_cam;
+	render_cam.setPerspective(90.0f, 1.0f, 0.1f, capture_far);
 
-	render_cam.setPerspective(90.0f, 1.0f, 0.1f, 1000.0f);
+	// Set camera looking at the direction
+	vec3 eye = probes[probe_id].position;
+	vec3 front = cubemapFaceNormals[face][2];
+	vec3 center = eye + front;
+	vec3 up = cubemapFaceNormals[face][1];
 
-	for (int i = 0; i < 6; i++) {
-		// Set camera looking at the direction
-		vec3 eye = probe_position[probe_id];
-		vec3 front = cubemapFaceNormals[i][2];
-		vec3 center = eye + front;
-		vec3 up = cubemapFaceNormals[i][1];
+	render_cam.lookAt(eye, center, up);
 
-		render_cam.lookAt(eye, center, up);
+	glBindFramebuffer(GL_FRAMEBUFFER, capture_fbo);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, probe_array, 0, probe_id * 6 + face);
+	const GLenum draw_buffer = GL_COLOR_ATTACHMENT0;
+	glDrawBuffers(1, &draw_buffer);
+	glPushAttrib(GL_VIEWPORT_BIT);
+	glViewport(0, 0, REF_PROBE_SIZE, REF_PROBE_SIZE);
 
-		// Given the scene, and a camara, perform frustum culling
-		CULLING::sSceneCulling culling_result;
-		// Note: maybe start from scene culling is a bit of a waste
-		CULLING::frustrum_culling(entity_list, &culling_result, &render_cam);
+	glClearColor(0.0, 0.0, 0.0, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		// Bind and enable the fbo
-		ref_fbo->setTexture(probe_cubemap[probe_id], i);
-		ref_fbo->bind();
-		ref_fbo->enableSingleBuffer(0);
+	renderer_instance->render_skybox(&render_cam);
 
-		glClearColor(0.0, 0.0, 0.0, 1.0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	// First, render the opaque object
+	for (uint16_t i = 0; i < capture_culling._opaque_objects.size(); i++) {
+		renderer_instance->forwardSingleRenderDrawCall(capture_culling._opaque_objects[i], &render_cam, renderer_instance->current_scene->ambient_light, false, false);
+	}
 
-		renderer_instance->render_skybox(&render_cam);
+	// then, render the translucnet, and masked objects
+	for (uint16_t i = 0; i < capture_culling._translucent_objects.size(); i++) {
+		renderer_instance->forwardSingleRenderDrawCall(capture_culling._translucent_objects[i], &render_cam, renderer_instance->current_scene->ambient_light, false, false);
+	}
 
-		// First, render the opaque object
-		for (uint16_t i = 0; i < culling_result._opaque_objects.size(); i++) {
-			renderer_instance->forwardSingleRenderDrawCall(culling_result._opaque_objects[i], &render_cam, renderer_instance->current_scene->ambient_light, false, false);
-		}
+	glDepthFunc(GL_LESS);
+	glPopAttrib();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-		// then, render the translucnet, and masked objects
-		for (uint16_t i = 0; i < culling_result._translucent_objects.size(); i++) {
-			renderer_instance->forwardSingleRenderDrawCall(culling_result._translucent_objects[i], &render_cam, renderer_instance->current_scene->ambient_light, false, false);
+// Each level is a linear blit of the previous one, only in the six layers of the probe
+void GTR::sReflections_Component::generate_probe_mips(const int probe_id) {
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, mip_fbos[0]);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mip_fbos[1]);
+	for (int level = 1; level < mip_count; level++) {
+		const int src_size = REF_PROBE_SIZE >> (level - 1);
+		const int dst_size = REF_PROBE_SIZE >> level;
+		for (int face = 0; face < 6; face++) {
+			glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, probe_array, level - 1, probe_id * 6 + face);
+			glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, probe_array, level, probe_id * 6 + face);
+			glBlitFramebuffer(0, 0, src_size, src_size, 0, 0, dst_size, dst_size, GL_COLOR_BUFFER_BIT, GL_LINEAR);
 		}
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-		culling_result.clear();
+void GTR::sReflections_Component::build_grid() {
+	grid_dirty = false;
+	cell_start.clear();
+	cell_probes.clear();
 
-		glDepthFunc(GL_LESS);
-		ref_fbo->unbind();
+	// Bounds of all the influence spheres
+	vec3 grid_max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	grid_min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	for (int i = 0; i < MAX_REF_PROBE_COUNT; i++) {
+		if (!probes[i].in_use)
+			continue;
+		const vec3 radius = vec3(probes[i].influence_radius, probes[i].influence_radius, probes[i].influence_radius);
+		grid_min = vec3(min(grid_min.x, probes[i].position.x - radius.x), min(grid_min.y, probes[i].position.y - radius.y), min(grid_min.z, probes[i].position.z - radius.z));
+		grid_max = vec3(max(grid_max.x, probes[i].position.x + radius.x), max(grid_max.y, probes[i].position.y + radius.y), max(grid_max.z, probes[i].position.z + radius.z));
+	}
+	if (grid_min.x > grid_max.x) {
+		grid_dims[0] = grid_dims[1] = grid_dims[2] = 0;
+		return;
 	}
 
-	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
-	probe_cubemap[probe_id]->generateMipmaps();
+	// The cells grow if the grid would be too big
+	const vec3 extent = grid_max - grid_min;
+	const float cell_size = max(min_cell_size, max(extent.x, max(extent.y, extent.z)) / 32.0f);
+	for (int a = 0; a < 3; a++) {
+		grid_dims[a] = (int)ceil(extent.v[a] / cell_size) + 1;
+	}
+	grid_cell_size = cell_size;
+
+	const int cell_count = grid_dims[0] * grid_dims[1] * grid_dims[2];
+	cell_start.resize(cell_count + 1);
+	for (int z = 0, cell = 0; z < grid_dims[2]; z++) {
+		for (int y = 0; y < grid_dims[1]; y++) {
+			for (int x = 0; x < grid_dims[0]; x++, cell++) {
+				cell_start[cell] = (uint32_t)cell_probes.size();
+				// Closest point of the cell to the probe
+				const vec3 cell_min = grid_min + vec3(x, y, z) * cell_size;
+				for (int i = 0; i < MAX_REF_PROBE_COUNT; i++) {
+					if (!probes[i].in_use)
+						continue;
+					const vec3& p = probes[i].position;
+					vec3 closest = vec3(clamp(p.x, cell_min.x, cell_min.x + cell_size), clamp(p.y, cell_min.y, cell_min.y + cell_size), clamp(p.z, cell_min.z, cell_min.z + cell_size));
+					if ((closest - p).length() < probes[i].influence_radius) {
+						cell_probes.push_back((uint8_t)i);
+					}
+				}
+			}
+		}
+	}
+	cell_start[cell_count] = (uint32_t)cell_probes.size();
 }
 
+GTR::sProbeBlend GTR::sReflections_Component::find_probes(const vec3& pos) const {
+	sProbeBlend blend;
+	if (grid_dims[0] == 0) {
+		return blend;
+	}
 
-void GTR::sReflections_Component::capture_all_probes(const std::vector<BaseEntity*>& entity_list) {
-	for (int i = 0; i < MAX_REF_PROBE_COUNT; i++) {
-		if (!is_in_use[i])
+	int cell_coords[3];
+	for (int a = 0; a < 3; a++) {
+		cell_coords[a] = (int)floor((pos.v[a] - grid_min.v[a]) / grid_cell_size);
+		if (cell_coords[a] < 0 || cell_coords[a] >= grid_dims[a]) {
+			return blend;
+		}
+	}
+	const int cell = (cell_coords[2] * grid_dims[1] + cell_coords[1]) * grid_dims[0] + cell_coords[0];
+
+	// The two probes with more weight
+	for (uint32_t i = cell_start[cell]; i < cell_start[cell + 1]; i++) {
+		const sReflectionProbe& probe = probes[cell_probes[i]];
+		if (!probe.captured)
 			continue;
-		capture_probe(entity_list, i);
+		const float radius = probe.influence_radius;
+		float weight = clamp((radius - (pos - probe.position).length()) / (radius * blend_band), 0.0f, 1.0f);
+		if (weight > blend.weights[0]) {
+			blend.weights[1] = blend.weights[0];
+			blend.indices[1] = blend.indices[0];
+			blend.weights[0] = weight;
+			blend.indices[0] = cell_probes[i];
+		} else if (weight > blend.weights[1]) {
+			blend.weights[1] = weight;
+			blend.indices[1] = cell_probes[i];
+		}
 	}
+
+	// Inside of both, they share the weight
+	const float total = blend.weights[0] + blend.weights[1];
+	if (total > 1.0f) {
+		blend.weights[0] /= total;
+		blend.weights[1] /= total;
+	}
+	return blend;
 }
 
+void GTR::sReflections_Component::assign_probes(CULLING::sSceneCulling* culling) const {
+	for (size_t i = 0; i < culling->_opaque_objects.size(); i++) {
+		culling->_opaque_objects[i].probe_blend = find_probes(culling->_opaque_objects[i].aabb.center);
+	}
+	for (size_t i = 0; i < culling->_translucent_objects.size(); i++) {
+		culling->_translucent_objects[i].probe_blend = find_probes(culling->_translucent_objects[i].aabb.center);
+	}
+}
+
+void GTR::sReflections_Component::bind_reflections(const sProbeBlend& blend, Shader* shad, Texture* skybox) const {
+	shad->setUniform(UNIFORM::u_skybox_texture, skybox, REF_SKYBOX_SLOT);
+
+	// The array is always bound, a sampler cannot be left on the unit of another type
+	glActiveTexture(GL_TEXTURE0 + REF_PROBE_ARRAY_SLOT);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, probe_array);
+	shad->setUniform1("u_probe_array", REF_PROBE_ARRAY_SLOT);
+
+	shad->setUniform2("u_probe_indices", blend.indices[0], blend.indices[1]);
+	shad->setUniform("u_probe_weights", vec2(blend.weights[0], blend.weights[1]));
+}
 
 void GTR::sReflections_Component::render_probe(Camera& cam, const int probe_id) {
 	Mesh* sphere = Mesh::Get("data/meshes/sphere.obj", false);
-	Shader* shader = Shader::Get("ref_probe");
+	static const Handle<Shader> sh_ref_probe("ref_probe");
+	Shader* shader = sh_ref_probe.get();
 
+	const vec3& position = probes[probe_id].position;
 	mat4 model;
-	model.setTranslation(probe_position[probe_id].x, probe_position[probe_id].y, probe_position[probe_id].z);
+	model.setTranslation(position.x, position.y, position.z);
 	model.scale(10.0f, 10.0f, 10.0f);
 
 	shader->enable();
@@ -120,7 +315,10 @@ void GTR::sReflections_Component::render_probe(Camera& cam, const int probe_id)
 	shader->setUniform("u_model", model);
 	shader->setUniform("u_viewprojection", cam.viewprojection_matrix);
 	shader->setUniform("u_camera_position", cam.eye);
-	shader->setUniform("u_skybox_texture", probe_cubemap[probe_id], 1);
+	glActiveTexture(GL_TEXTURE0 + 1);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, probe_array);
+	shader->setUniform1("u_probe_array", 1);
+	shader->setUniform("u_probe_index", probe_id);
 
 	sphere->render(GL_TRIANGLES);
 
@@ -131,7 +329,7 @@ void GTR::sReflections_Component::render_probes(Camera& cam) {
 	if (!debug_render)
 		return;
 	for (int i = 0; i < MAX_REF_PROBE_COUNT; i++) {
-		if (!is_in_use[i])
+		if (!probes[i].in_use || !probes[i].captured)
 			continue;
 
 		render_probe(cam, i);
@@ -139,23 +337,42 @@ void GTR::sReflections_Component::render_probes(Camera& cam) {
 }
 
 void GTR::sReflections_Component::debug_imgui() {
+#ifndef SKIP_IMGUI
 	if (ImGui::TreeNode("Reflection probes")) {
-		ImGui::Text("Probe positions");
+		ImGui::Text("Probe positions and influence radius");
 		for (int i = 0; i < MAX_REF_PROBE_COUNT; i++) {
-			if (!is_in_use[i])
+			if (!probes[i].in_use)
 				continue;
-			ImGui::SliderFloat3((char*) &i, (float*)&probe_position[i], -1000.0f, 1000.0f);
+			ImGui::PushID(i);
+			if (ImGui::SliderFloat3("Position", (float*)&probes[i].position, -1000.0f, 1000.0f)) {
+				// The faces already captured are from the old position, it starts again
+				if (!capture_queue.empty() && capture_queue.front() == i) {
+					capture_face = 0;
+				}
+				capture_probe(i);
+				grid_dirty = true;
+			}
+			grid_dirty |= ImGui::SliderFloat("Radius", &probes[i].influence_radius, 10.0f, 1000.0f);
+			ImGui::PopID();
 		}
 		ImGui::Separator();
 
 		if (ImGui::Button("Add probe")) {
-			init_probe();
+			int probe = init_probe();
+			if (probe != -1) {
+				capture_probe(probe);
+			}
 		}
 		if (ImGui::Button("Calculate reflections")) {
-			capture_all_probes(*renderer_instance->entity_list);
+			capture_all_probes();
 		}
+		ImGui::SliderInt("Captured faces per frame", &faces_per_frame, 1, 6);
+		ImGui::SliderFloat("Blend band", &blend_band, 0.01f, 1.0f);
+		ImGui::Text("Pending captures: %d", (int)capture_queue.size());
+		ImGui::Text("Grid: %d x %d x %d, cell %.0f", grid_dims[0], grid_dims[1], grid_dims[2], grid_cell_size);
 		ImGui::Checkbox("Show ref probes ", &debug_render);
 		ImGui::Checkbox("Enable reflections ", &enable_reflections);
 		ImGui::TreePop();
 	}
+#endif
 }
\ No newline at end of file
@@ -4,21 +4,61 @@
 #include "scene.h"
 #include "texture.h"
 #include "shader.h"
+#include "frusturm_culling.h"
+#include <vector>
+#include <deque>
+
+// ================
+//  REFLECTION PROBES
+// ================
+// All the probes are layers of one cubemap array. A uniform grid over their
+// influence spheres gives the probes near a position, and the two with more
+// weight are blended (the rest of the weight goes to the skybox).
+// The captures are queued, and only a few faces are rendered each frame.
 
 namespace GTR {
 
-#define MAX_REF_PROBE_COUNT 13
+#define MAX_REF_PROBE_COUNT 32
+#define REF_PROBE_SIZE 256
+// Texture units, after the shadowmap
+#define REF_SKYBOX_SLOT 9
+#define REF_PROBE_ARRAY_SLOT 10
 
 	class Renderer;
 
+	struct sReflectionProbe {
+		vec3 position;
+		float influence_radius = 300.0f;
+		bool in_use = false;
+		bool captured = false; // Until its six faces are rendered, it is not used
+	};
+
 	struct sReflections_Component {
 		Renderer* renderer_instance;
 
-		FBO* ref_fbo = NULL;
-
-		Texture* probe_cubemap[MAX_REF_PROBE_COUNT];
-		vec3     probe_position[MAX_REF_PROBE_COUNT];
-		bool     is_in_use[MAX_REF_PROBE_COUNT];
+		sReflectionProbe probes[MAX_REF_PROBE_COUNT];
+		GLuint probe_array = 0; // Cubemap array, a layer per probe face
+		int mip_count = 0;
+
+		// Capture
+		GLuint capture_fbo = 0;
+		GLuint mip_fbos[2] = { 0, 0 }; // Read and draw, to downsample the faces of one probe
+		GLuint capture_depth = 0;
+		std::deque<int> capture_queue; // The front one is being captured
+		int capture_face = 0;
+		CULLING::sSceneCulling capture_culling; // Of the whole probe, shared by its faces
+		int faces_per_frame = 1;
+		float capture_far = 1000.0f;
+
+		// Uniform grid of the influence spheres, in compressed rows
+		vec3 grid_min;
+		float min_cell_size = 100.0f;
+		float grid_cell_size = 0.0f;
+		int grid_dims[3] = { 0, 0, 0 };
+		std::vector<uint32_t> cell_start; // Cell i has the probes [cell_start[i], cell_start[i + 1])
+		std::vector<uint8_t> cell_probes;
+		bool grid_dirty = true;
+		float blend_band = 0.3f; // Part of the radius where the weight fades out
 
 		bool debug_render = false;
 		bool enable_reflections = false;
@@ -29,32 +69,25 @@ namespace GTR {
 		int init_probe();
 		void render_probe(Camera& cam, const int probe_id);
 		void render_probes(Camera& cam);
-		void capture_probe(const std::vector<BaseEntity*>& entity_list, const int probe_id);
-		void capture_all_probes(const std::vector<BaseEntity*>& entity_list);
-
-		inline bool bind_reflections(const vec3 pos, 
-									 Shader *shad) const {
-			int lowest_index = 0;
-			float min_dist = FLT_MAX;
 
-			for (int i = 0; i < MAX_REF_PROBE_COUNT; i++) {
-				if (!is_in_use[i]) {
-					continue;
-				}
+		// Queues the capture, done by update_captures in the next frames
+		void capture_probe(const int probe_id);
+		void capture_all_probes();
+		void update_captures(const std::vector<BaseEntity*>& entity_list);
 
-				float dist = (pos - probe_position[i]).length();
+		void build_grid();
+		sProbeBlend find_probes(const vec3& pos) const;
+		// The probes of each draw call of the frame, so they are not looked up in every pass
+		void assign_probes(CULLING::sSceneCulling* culling) const;
 
-				if (dist < min_dist) {
-					lowest_index = i;
-					min_dist = dist;
-				}
-			}
-
-			shad->setUniform("u_skybox_texture", probe_cubemap[lowest_index], 9);
-
-			return min_dist != FLT_MAX;
-		}
+		// Also binds the skybox, for the weight that no probe covers
+		void bind_reflections(const sProbeBlend& blend, Shader* shad, Texture* skybox) const;
 
 		void debug_imgui();
+
+	private:
+		void render_capture_face(const int probe_id, const int face);
+		// glGenerateMipmap would do all the layers of the array
+		void generate_probe_mips(const int probe_id);
 	};
 }
\ No newline at end of file
@@ -0,0 +1,308 @@
+#include "render_graph.h"
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+namespace GTR {
+
+	inline int get_format_channels(const int format) {
+		switch (format) {
+		case GL_RED:
+		case GL_LUMINANCE: return 1;
+		case GL_RG: return 2;
+		case GL_RGB: return 3;
+		default: return 4;
+		}
+	}
+
+	inline int get_type_size(const int type) {
+		switch (type) {
+		case GL_UNSIGNED_BYTE: return 1;
+		case GL_HALF_FLOAT: return 2;
+		default: return 4;
+		}
+	}
+
+	inline int get_internal_format_size(const int internal_format) {
+		switch (internal_format) {
+		case GL_R8: return 1;
+		case GL_RG8:
+		case GL_R16F: return 2;
+		case GL_RGB8: return 3;
+		case GL_RGBA8:
+		case GL_SRGB8_ALPHA8:
+		case GL_RG16:
+		case GL_RG16F:
+		case GL_R32F:
+		case GL_RGB10_A2:
+		case GL_R11F_G11F_B10F: return 4;
+		case GL_RGBA16:
+		case GL_RGBA16F: return 8;
+		default: return 16;
+		}
+	}
+
+	// Note: FBOs without a depth texture still get a depth renderbuffer,
+	// and the depth only FBOs a RGBA8 color renderbuffer
+	size_t get_target_bytes(const sRenderTargetDesc& desc, const int width, const int height) {
+		size_t color_bpp = (desc.num_textures == 0) ? 4 : 0;
+		for (int i = 0; i < desc.num_textures; i++) {
+			color_bpp += (desc.internal_formats[i] != 0) ? get_internal_format_size(desc.internal_formats[i]) : get_format_channels(desc.format) * get_type_size(desc.type);
+		}
+		size_t depth_bpp = 4;
+		return (size_t)width * (size_t)height * (color_bpp + depth_bpp);
+	}
+
+	void sRenderGraph::begin_frame(const vec2& screen_resolution) {
+		resolution = screen_resolution;
+		resources.clear();
+		passes.clear();
+
+		// Free the targets that have not been used for a while
+		for (int i = pool.size() - 1; i >= 0; i--) {
+			pool[i].in_use = false;
+			if (pool[i].unused_frames > max_unused_frames) {
+				delete pool[i].fbo;
+				pool.erase(pool.begin() + i);
+			}
+		}
+	}
+
+	int sRenderGraph::create_target(const char* name, const sRenderTargetDesc& desc) {
+		sResource res;
+		res.name = name;
+		res.desc = desc;
+		resources.push_back(res);
+		return resources.size() - 1;
+	}
+
+	int sRenderGraph::import_target(const char* name, FBO* fbo) {
+		assert(fbo && "Importing a NULL FBO");
+		sResource res;
+		res.name = name;
+		res.imported = fbo;
+		resources.push_back(res);
+		return resources.size() - 1;
+	}
+
+	// NOTE: the returned reference is only valid until the next add_pass
+	sRenderPass& sRenderGraph::add_pass(const char* name, const bool enabled, std::function<void()> execute) {
+		sRenderPass pass;
+		pass.name = name;
+		pass.enabled = enabled;
+		pass.execute = execute;
+		passes.push_back(pass);
+		return passes.back();
+	}
+
+	// Find which resource is actually read, following the forwards of the disabled passes.
+	// Returns -1 if the resource is only written by disabled passes
+	int sRenderGraph::resolve_read(const int resource, const int pass_index) const {
+		bool has_disabled_writer = false;
+		for (int i = pass_index - 1; i >= 0; i--) {
+			const sRenderPass& pass = passes[i];
+			if (std::find(pass.writes.begin(), pass.writes.end(), resource) == pass.writes.end()) {
+				continue;
+			}
+
+			if (pass.enabled) {
+				return resource;
+			}
+
+			for (uint16_t j = 0; j < pass.forwards.size(); j++) {
+				if (pass.forwards[j].second == resource) {
+					return resolve_read(pass.forwards[j].first, i);
+				}
+			}
+			has_disabled_writer = true;
+		}
+		return (has_disabled_writer && !resources[resource].imported) ? -1 : resource;
+	}
+
+	void sRenderGraph::get_target_size(const sRenderTargetDesc& desc, int* width, int* height) const {
+		if (desc.absolute_size) {
+			*width = (int)desc.width;
+			*height = (int)desc.height;
+		} else {
+			*width = (int)(resolution.x * desc.width);
+			*height = (int)(resolution.y * desc.height);
+		}
+		*width = (*width < 1) ? 1 : *width;
+		*height = (*height < 1) ? 1 : *height;
+	}
+
+	int sRenderGraph::acquire_from_pool(const sRenderTargetDesc& desc, const int width, const int height) {
+		for (uint16_t i = 0; i < pool.size(); i++) {
+			sPooledTarget& target = pool[i];
+			if (target.in_use || target.width != width || target.height != height) {
+				continue;
+			}
+			if (target.desc.num_textures != desc.num_textures ||
+				target.desc.format != desc.format ||
+				target.desc.type != desc.type ||
+				target.desc.use_depth != desc.use_depth ||
+				target.desc.linear_filter != desc.linear_filter ||
+				memcmp(target.desc.internal_formats, desc.internal_formats, sizeof(desc.internal_formats)) != 0) {
+				continue;
+			}
+
+			target.in_use = true;
+			target.unused_frames = 0;
+			return i;
+		}
+
+		// No free target with this layout, create a new one
+		sPooledTarget target;
+		target.desc = desc;
+		target.width = width;
+		target.height = height;
+		target.in_use = true;
+		target.fbo = new FBO();
+		if (desc.num_textures == 0) {
+			target.fbo->setDepthOnly(width, height);
+		} else {
+			target.fbo->create(width, height, desc.num_textures, desc.format, desc.type, desc.use_depth, desc.internal_formats);
+		}
+		if (desc.linear_filter) {
+			for (int i = 0; i < desc.num_textures; i++) {
+				Texture* texture = target.fbo->color_textures[i];
+				glBindTexture(texture->texture_type, texture->texture_id);
+				glTexParameteri(texture->texture_type, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+				glTexParameteri(texture->texture_type, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			}
+		}
+		pool.push_back(target);
+
+		return pool.size() - 1;
+	}
+
+	void sRenderGraph::compile() {
+		// Cull the passes, from the last to the first: a pass is alive if it is enabled,
+		// and it is an output or writes something that an alive pass reads
+		std::vector<bool> is_needed(resources.size(), false);
+		culled_pass_count = 0;
+
+		for (int i = passes.size() - 1; i >= 0; i--) {
+			sRenderPass& pass = passes[i];
+			pass.culled = !pass.enabled;
+
+			if (!pass.culled && !pass.is_output) {
+				bool writes_needed = false;
+				for (uint16_t j = 0; j < pass.writes.size(); j++) {
+					writes_needed |= is_needed[pass.writes[j]];
+				}
+				pass.culled = !writes_needed;
+			}
+
+			if (pass.culled) {
+				culled_pass_count++;
+				continue;
+			}
+
+			for (uint16_t j = 0; j < pass.reads.size(); j++) {
+				int res_id = resolve_read(pass.reads[j], i);
+				if (res_id != -1) {
+					is_needed[res_id] = true;
+				}
+			}
+		}
+
+		// Compute the lifetime of the resources
+		for (uint16_t i = 0; i < passes.size(); i++) {
+			sRenderPass& pass = passes[i];
+			if (pass.culled) {
+				continue;
+			}
+
+			for (uint16_t j = 0; j < pass.reads.size() + pass.writes.size(); j++) {
+				int res_id = (j < pass.reads.size()) ? resolve_read(pass.reads[j], i) : pass.writes[j - pass.reads.size()];
+				if (res_id == -1) {
+					continue;
+				}
+				sResource& res = resources[res_id];
+				res.first_use = (res.first_use == -1) ? i : res.first_use;
+				res.last_use = i;
+			}
+		}
+
+		// Assign the transient resources to the pool, in order of execution
+		for (uint16_t i = 0; i < pool.size(); i++) {
+			pool[i].in_use = false;
+			pool[i].unused_frames++;
+		}
+
+		frame_target_bytes = 0;
+		for (uint16_t i = 0; i < passes.size(); i++) {
+			if (passes[i].culled) {
+				continue;
+			}
+
+			for (uint16_t r = 0; r < resources.size(); r++) {
+				sResource& res = resources[r];
+				if (res.imported || res.first_use != i) {
+					continue;
+				}
+				int width, height;
+				get_target_size(res.desc, &width, &height);
+				res.pool_index = acquire_from_pool(res.desc, width, height);
+				frame_target_bytes += get_target_bytes(res.desc, width, height);
+			}
+
+			// The resources that end here can be reused by the next passes
+			for (uint16_t r = 0; r < resources.size(); r++) {
+				sResource& res = resources[r];
+				if (!res.imported && res.last_use == i) {
+					pool[res.pool_index].in_use = false;
+				}
+			}
+		}
+	}
+
+	void sRenderGraph::execute() {
+		for (uint16_t i = 0; i < passes.size(); i++) {
+			if (passes[i].culled || !passes[i].execute) {
+				continue;
+			}
+			passes[i].execute();
+		}
+	}
+
+	FBO* sRenderGraph::get_fbo(const int resource) {
+		sResource& res = resources[resource];
+		if (res.imported) {
+			return res.imported;
+		}
+		assert(res.pool_index != -1 && "Render target not allocated, is the pass culled?");
+		return (res.pool_index == -1) ? NULL : pool[res.pool_index].fbo;
+	}
+
+	size_t sRenderGraph::get_pool_bytes() const {
+		size_t total = 0;
+		for (uint16_t i = 0; i < pool.size(); i++) {
+			total += get_target_bytes(pool[i].desc, pool[i].width, pool[i].height);
+		}
+		return total;
+	}
+
+	void sRenderGraph::release_pool() {
+		for (uint16_t i = 0; i < pool.size(); i++) {
+			delete pool[i].fbo;
+		}
+		pool.clear();
+	}
+
+	void sRenderGraph::render_imgui() {
+#ifndef SKIP_IMGUI
+		if (ImGui::TreeNode("Render graph")) {
+			const float to_MB = 1.0f / (1024.0f * 1024.0f);
+			ImGui::Text("Pooled targets: %d (%.2f MB)", (int)pool.size(), get_pool_bytes() * to_MB);
+			ImGui::Text("Without aliasing: %.2f MB", frame_target_bytes * to_MB);
+			ImGui::Text("Culled passes: %d / %d", culled_pass_count, (int)passes.size());
+			for (uint16_t i = 0; i < passes.size(); i++) {
+				ImGui::Text("%s %s", passes[i].culled ? "[culled]" : "        ", passes[i].name.c_str());
+			}
+			ImGui::TreePop();
+		}
+#endif
+	}
+};
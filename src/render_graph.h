@@ -0,0 +1,113 @@
+#pragma once
+
+#include "includes.h"
+#include "framework.h"
+#include "fbo.h"
+#include <vector>
+#include <string>
+#include <functional>
+
+// ================
+//  RENDER GRAPH
+// ================
+// The frame is described as a list of passes that declare which render targets
+// they read and write. Before executing, the graph culls the disabled or unused
+// passes and assigns the transient targets from a pool, so two targets that are
+// never alive at the same time share the same FBO.
+
+namespace GTR {
+
+	// Size of the target is relative to the graph resolution, unless absolute_size.
+	// With no textures, the target only has a depth texture
+	struct sRenderTargetDesc {
+		float width = 1.0f;
+		float height = 1.0f;
+		bool absolute_size = false;
+		int num_textures = 1;
+		int format = GL_RGBA;
+		int type = GL_FLOAT;
+		bool use_depth = false;
+		// Optional sized format per texture, 0 to use the default of format and type
+		int internal_formats[4] = { 0, 0, 0, 0 };
+		// The FBO textures are nearest by default, for the targets that are sampled between texels
+		bool linear_filter = false;
+	};
+
+	struct sRenderGraph;
+
+	struct sRenderPass {
+		std::string name;
+		bool enabled = true;
+		bool is_output = false; // Has side effects (draws to screen, persistent data)
+		bool culled = false;
+
+		std::vector<int> reads;
+		std::vector<int> writes;
+		// When the pass is culled, readers of .second read .first instead
+		std::vector<std::pair<int, int>> forwards;
+
+		std::function<void()> execute;
+
+		inline sRenderPass& read(const int resource) { reads.push_back(resource); return *this; }
+		inline sRenderPass& write(const int resource) { writes.push_back(resource); return *this; }
+		inline sRenderPass& forward(const int from, const int to) { forwards.push_back({ from, to }); return *this; }
+		inline sRenderPass& output() { is_output = true; return *this; }
+	};
+
+	struct sRenderGraph {
+		struct sResource {
+			std::string name;
+			sRenderTargetDesc desc;
+			FBO* imported = NULL; // Persistent targets, not owned by the pool
+			int first_use = -1;
+			int last_use = -1;
+			int pool_index = -1;
+		};
+
+		struct sPooledTarget {
+			sRenderTargetDesc desc;
+			int width = 0;
+			int height = 0;
+			FBO* fbo = NULL;
+			bool in_use = false;
+			int unused_frames = 0;
+		};
+
+		vec2 resolution;
+
+		std::vector<sResource> resources;
+		std::vector<sRenderPass> passes;
+		std::vector<sPooledTarget> pool;
+
+		// Pooled targets that are not used by a frame for this long are freed
+		int max_unused_frames = 3;
+
+		// Stats of the last compiled frame
+		int culled_pass_count = 0;
+		size_t frame_target_bytes = 0; // What the alive targets would cost without aliasing
+
+		void begin_frame(const vec2 &screen_resolution);
+
+		int create_target(const char* name, const sRenderTargetDesc& desc);
+		int import_target(const char* name, FBO* fbo);
+
+		sRenderPass& add_pass(const char* name, const bool enabled, std::function<void()> execute);
+
+		void compile();
+		void execute();
+
+		FBO* get_fbo(const int resource);
+
+		size_t get_pool_bytes() const;
+		void release_pool();
+
+		void render_imgui();
+
+	private:
+		int resolve_read(const int resource, const int pass_index) const;
+		int acquire_from_pool(const sRenderTargetDesc& desc, const int width, const int height);
+		void get_target_size(const sRenderTargetDesc& desc, int* width, int* height) const;
+	};
+
+	size_t get_target_bytes(const sRenderTargetDesc& desc, const int width, const int height);
+};
@@ -3,10 +3,41 @@
 
 using namespace GTR;
 
+namespace GTR {
+	namespace UNIFORM {
+		const sUniformHandle u_viewprojection("u_viewprojection");
+		const sUniformHandle u_camera_position("u_camera_position");
+		const sUniformHandle u_model("u_model");
+		const sUniformHandle u_time("u_time");
+		const sUniformHandle u_color("u_color");
+		const sUniformHandle u_alpha_cutoff("u_alpha_cutoff");
+		const sUniformHandle u_ambient_light("u_ambient_light");
+		const sUniformHandle u_num_lights("u_num_lights");
+		const sUniformHandle u_light_pos("u_light_pos");
+		const sUniformHandle u_light_color("u_light_color");
+		const sUniformHandle u_light_type("u_light_type");
+		const sUniformHandle u_light_shadow_id("u_light_shadow_id");
+		const sUniformHandle u_light_max_dist("u_light_max_dist");
+		const sUniformHandle u_light_intensities("u_light_intensities");
+		const sUniformHandle u_light_direction("u_light_direction");
+		const sUniformHandle u_light_cone_angle("u_light_cone_angle");
+		const sUniformHandle u_light_cone_decay("u_light_cone_decay");
+		const sUniformHandle u_light_id("u_light_id");
+		const sUniformHandle u_skybox_texture("u_skybox_texture");
+		const sUniformHandle u_emmisive_factor("u_emmisive_factor");
+		const sUniformHandle u_texture("u_texture");
+		const sUniformHandle u_emmisive_tex("u_emmisive_tex");
+		const sUniformHandle u_met_rough_tex("u_met_rough_tex");
+		const sUniformHandle u_normal_tex("u_normal_tex");
+		const sUniformHandle u_occlusion_tex("u_occlusion_tex");
+	};
+};
+
 void Renderer::render_skybox(Camera *camera) {
 	// Render skybox
 	Mesh* sphere = Mesh::Get("data/meshes/sphere.obj");
-	Shader* shader = Shader::Get("skybox");
+	static const Handle<Shader> sh_skybox("skybox");
+	Shader* shader = sh_skybox.get();
 	shader->enable();
 
 	glDisable(GL_CULL_FACE);
@@ -38,9 +69,17 @@ void Renderer::renderScene(GTR::Scene* scene, Camera* camera)
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	checkGLErrors();
 
+	dynamic_resolution.update_frame_time();
+
 	//render entities
 	CULLING::sSceneCulling culling_result;
+	culling_result.lod_bias = MESH_LOD::pass_bias[MESH_LOD::PASS_CAMERA];
+	culling_result.lod_hysteresis = true;
+	culling_result.occlusion_culling = true;
 
+	// The culling adds the palettes of the visible skinned meshes, and counts the LODs
+	SKINNING::begin_frame();
+	MESH_LOD::begin_frame();
 	CULLING::frustrum_culling(scene->entities, &culling_result, camera);
 	entity_list = &scene->entities;
 	current_scene = scene;
@@ -49,49 +88,191 @@ void Renderer::renderScene(GTR::Scene* scene, Camera* camera)
 	shadowmap_renderer.add_scene_data(&culling_result);
 	shadowmap_renderer.render_scene_shadows(camera);
 
-	//reflections_component.capture_all_probes(*entity_list);
-
-	// Render scene
-	switch (current_pipeline) {
-	case FORWARD:
-		forwardRenderScene(scene, camera, final_illumination_fbo, &culling_result, use_irradiance);
-		break;
-	case DEFERRED:
-		deferredRenderScene(scene, camera, final_illumination_fbo, &culling_result);
-		break;
-	default:
-		break;
+	// Loads the baked probes of a new scene
+	irradiance_component.set_scene(scene);
+	irradiance_component.upload_GI_block();
+
+	// A few faces of the pending probe captures
+	reflections_component.update_captures(*entity_list);
+	if (reflections_component.enable_reflections)
+		reflections_component.assign_probes(&culling_result);
+
+	// Build the frame graph =====
+	const bool is_deferred = current_pipeline == DEFERRED;
+	const bool show_result = !is_deferred || deferred_output == RESULT;
+	const bool show_ao = is_deferred && (deferred_output == AMBIENT_OCCLUSION || deferred_output == AMBIENT_OCCLUSION_BLUR);
+
+	sRenderTargetDesc hdr_desc; // Full resolution RGBA32F
+	sRenderTargetDesc illumination_desc = hdr_desc;
+	illumination_desc.use_depth = true;
+	sRenderTargetDesc gbuffer_desc = illumination_desc;
+	gbuffer_desc.num_textures = 4;
+	if (use_packed_gbuffer) {
+		const int packed_formats[4] = { GL_SRGB8_ALPHA8, GL_RG16, GL_RGBA8, GL_RGBA8 };
+		gbuffer_desc.type = GL_UNSIGNED_BYTE;
+		memcpy(gbuffer_desc.internal_formats, packed_formats, sizeof(packed_formats));
+	}
+	sRenderTargetDesc decals_depth_desc;
+	decals_depth_desc.num_textures = 0; // Depth only
+	decals_depth_desc.use_depth = true;
+	sRenderTargetDesc ao_desc; // AO and linear depth, at a fraction of the resolution
+	ao_desc.width = ao_desc.height = 1.0f / ao_component.resolution_divider;
+	ao_desc.format = GL_RG;
+	ao_desc.type = GL_HALF_FLOAT;
+	ao_desc.internal_formats[0] = GL_RG16F;
+	sRenderTargetDesc ao_upsample_desc;
+	ao_upsample_desc.format = GL_RGB;
+	ao_upsample_desc.type = GL_UNSIGNED_BYTE;
+	sRenderTargetDesc bloom_desc; // Packed float, the bloom does not need alpha
+	bloom_desc.format = GL_RGB;
+	bloom_desc.internal_formats[0] = GL_R11F_G11F_B10F;
+	bloom_desc.linear_filter = true;
+	sRenderTargetDesc volumetric_desc = hdr_desc;
+	volumetric_desc.width = volumetric_desc.height = 1.0f / 3.0f;
+
+	// The scene is rendered at the internal resolution, and upscaled to the screen at the end
+	const vec2 screen_size = vec2(Application::instance->window_width, Application::instance->window_height);
+	const vec2 render_size = dynamic_resolution.get_render_resolution(screen_size);
+	const bool needs_upscale = render_size.x != screen_size.x || render_size.y != screen_size.y;
+
+	sRenderTargetDesc upscale_desc;
+	upscale_desc.absolute_size = true;
+	upscale_desc.width = screen_size.x;
+	upscale_desc.height = screen_size.y;
+	upscale_desc.type = GL_UNSIGNED_BYTE;
+
+	frame_graph.begin_frame(render_size);
+
+	int gbuffer = frame_graph.create_target("gbuffer", gbuffer_desc);
+	int decals_depth = frame_graph.create_target("decals depth", decals_depth_desc);
+	int ao = frame_graph.create_target("ssao", ao_desc);
+	int ao_upsampled = frame_graph.create_target("ssao upsampled", ao_upsample_desc);
+	int illumination = frame_graph.create_target("illumination", illumination_desc);
+	int volumetric = frame_graph.create_target("volumetric", volumetric_desc);
+	int volumetric_comp = frame_graph.create_target("volumetric composition", hdr_desc);
+	// The bloom chain is relative to the resolution, so it follows the resizes
+	const int bloom_levels = bloom_component.get_level_count(render_size);
+	int bloom_mips[BLOOM_MAX_LEVELS];
+	for (int i = 0; i < bloom_levels; i++) {
+		sRenderTargetDesc mip_desc = bloom_desc;
+		mip_desc.width = mip_desc.height = 1.0f / (float)(2 << i);
+		bloom_mips[i] = frame_graph.create_target("bloom mip", mip_desc);
+	}
+	int bloom = frame_graph.create_target("bloom", bloom_desc);
+	// Small target for the luminance histogram, read back by the CPU
+	sRenderTargetDesc luminance_desc;
+	luminance_desc.width = luminance_desc.height = LUM_TARGET_SIZE;
+	luminance_desc.absolute_size = true;
+	luminance_desc.format = GL_RED;
+	luminance_desc.internal_formats[0] = GL_R32F;
+	int luminance = frame_graph.create_target("luminance", luminance_desc);
+	// After the tonemapping, the image is 8 bit
+	sRenderTargetDesc ldr_desc;
+	ldr_desc.type = GL_UNSIGNED_BYTE;
+	int post = frame_graph.create_target("post", ldr_desc);
+	int upscaled = frame_graph.create_target("upscaled", upscale_desc);
+
+	// The passes are executed inside this function, so they can share the frame locals
+	Texture* ao_tex = Texture::getWhiteTexture();
+	Texture* end_result = NULL;
+	bool ao_computed = false;
+	bool volumetric_computed = false;
+
+	sRenderPass& gbuffer_pass = frame_graph.add_pass("GBuffer", is_deferred, [&]() {
+		deferred_gbuffer = frame_graph.get_fbo(gbuffer);
+		depth_decal_fbo = (culling_result._decals.size() > 0) ? frame_graph.get_fbo(decals_depth) : NULL;
+		Uint64 submit_start = SDL_GetPerformanceCounter();
+		deferredGeometryPass(scene, camera, &culling_result);
+		measure_submit(submit_start);
+	}).write(gbuffer);
+	if (culling_result._decals.size() > 0) {
+		gbuffer_pass.write(decals_depth);
 	}
 
-	// Irradiance test
-	final_illumination_fbo->bind();
-
-	irradiance_component.debug_render_all_probes(10.0f, camera);
-
-	reflections_component.render_probes(*camera);
-
-	final_illumination_fbo->unbind();
-
+	frame_graph.add_pass("SSAO", is_deferred && ((use_ssao && show_result) || show_ao), [&]() {
+		ao_component.ao_fbo = frame_graph.get_fbo(ao);
+		ao_component.upsample_fbo = frame_graph.get_fbo(ao_upsampled);
+		ao_tex = ao_component.compute_AO(deferred_gbuffer->depth_texture, deferred_gbuffer->color_textures[1], camera, use_packed_gbuffer);
+		ao_computed = true;
+	}).read(gbuffer).write(ao).write(ao_upsampled);
+
+	sRenderPass& lighting_pass = frame_graph.add_pass("Lighting", true, [&]() {
+		final_illumination_fbo = frame_graph.get_fbo(illumination);
+
+		if (is_deferred) {
+			deferredRenderScene(scene, camera, final_illumination_fbo, &culling_result, ao_tex);
+		} else {
+			Uint64 submit_start = SDL_GetPerformanceCounter();
+			forwardRenderScene(scene, camera, final_illumination_fbo, &culling_result, use_irradiance);
+			measure_submit(submit_start);
+		}
 
-	if (deferred_output != RESULT && current_pipeline == DEFERRED) {
-		return;
+		// Irradiance test
+		final_illumination_fbo->bind();
+		irradiance_component.debug_render_all_probes(10.0f, camera);
+		reflections_component.render_probes(*camera);
+		final_illumination_fbo->unbind();
+
+		end_result = final_illumination_fbo->color_textures[0];
+	}).read(gbuffer).read(ao).read(ao_upsampled).write(illumination);
+	// The deferred debug views are drawn directly to the screen
+	if (!show_result) {
+		lighting_pass.output();
 	}
 
-	// Post-processing Tonemmaping
-	Texture* end_result = final_illumination_fbo->color_textures[0];
-
-	if (current_pipeline == DEFERRED) {
+	const bool use_ray_march = volumetric_component.mode == VOLUMETRIC_RAY_MARCH;
+	sRenderPass& volumetric_pass = frame_graph.add_pass("Volumetric", is_deferred && show_result && volumetric_component.enable_volumetric, [&, use_ray_march]() {
+		// The froxel volumes are owned by the component
+		volumetric_component.vol_fbo = use_ray_march ? frame_graph.get_fbo(volumetric) : NULL;
+		volumetric_component.comp_FBO = frame_graph.get_fbo(volumetric_comp);
 		end_result = volumetric_component.render(camera, vec2(), &culling_result, &shadowmap_renderer, end_result, deferred_gbuffer->depth_texture);
+		volumetric_computed = true;
+	}).read(illumination).read(gbuffer).write(volumetric_comp).forward(illumination, volumetric_comp);
+	if (use_ray_march) {
+		volumetric_pass.write(volumetric);
 	}
 
-	end_result = bloom_component.bloom_pass(end_result);
-
-	// Only add tonemapping if its the final image
-	if (deferred_output == RESULT) {
-		end_result = tonemapping_component.pass(end_result);
+	sRenderPass& bloom_pass = frame_graph.add_pass("Bloom", show_result && bloom_component.enabled_bloom, [&]() {
+		for (int i = 0; i < bloom_levels; i++) {
+			bloom_component.mip_FBOs[i] = frame_graph.get_fbo(bloom_mips[i]);
+		}
+		bloom_component.composite_FBO = frame_graph.get_fbo(bloom);
+		end_result = bloom_component.bloom_pass(end_result);
+	}).read(volumetric_comp).write(bloom).forward(volumetric_comp, bloom);
+	for (int i = 0; i < bloom_levels; i++) {
+		bloom_pass.write(bloom_mips[i]);
 	}
 
-	end_result->toViewport();
+	// Only add tonemapping if its the final image
+	const bool use_tonemapping = deferred_output == RESULT;
+	frame_graph.add_pass("Exposure", use_tonemapping, [&]() {
+		tonemapping_component.luminance_fbo = frame_graph.get_fbo(luminance);
+		tonemapping_component.update_exposure(end_result);
+	}).read(bloom).write(luminance);
+
+	// Tonemapping and the per pixel effects, in one pass
+	frame_graph.add_pass("Post", show_result, [&, use_tonemapping]() {
+		postFX_component.post_fbo = frame_graph.get_fbo(post);
+		end_result = postFX_component.post_pass(end_result, &tonemapping_component, use_tonemapping);
+	}).read(bloom).read(luminance).write(post);
+
+	frame_graph.add_pass("Upscale", show_result && needs_upscale, [&]() {
+		dynamic_resolution.upscale_fbo = frame_graph.get_fbo(upscaled);
+		end_result = dynamic_resolution.upscale(end_result);
+	}).read(post).write(upscaled).forward(post, upscaled);
+
+	frame_graph.add_pass("Present", show_result, [&]() {
+		image_compare.present(end_result);
+	}).read(upscaled).output();
+
+	frame_graph.compile();
+	frame_graph.execute();
+
+	// The histories are from an older frame when their pass was disabled or culled
+	if (!ao_computed)
+		ao_component.history_valid = false;
+	if (!volumetric_computed)
+		volumetric_component.history_valid = false;
 
 	// Cleanup & debug
 	culling_result.clear();
@@ -181,7 +362,8 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
     assert(glGetError() == GL_NO_ERROR);
 
 	//chose a shader
-	shader = Shader::Get("texture");
+	static const Handle<Shader> sh_texture("texture");
+	shader = sh_texture.get();
 
     assert(glGetError() == GL_NO_ERROR);
 
@@ -215,30 +397,94 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
 }
 
 
+// GPU formats of the HDRE payloads: the float ones are stored in half floats,
+// and the shared exponent one as it is (4 bytes per pixel)
+void GTR::getHDREFormat(HDRE* hdre, unsigned int* format, unsigned int* type, unsigned int* internal_format)
+{
+	*format = (hdre->header.numChannels == 3) ? GL_RGB : GL_RGBA;
+	*internal_format = GL_RGB16F;
+
+	switch (hdre->getType()) {
+	case HDRE_TYPE_HALF:
+		*type = GL_HALF_FLOAT;
+		break;
+	case HDRE_TYPE_RGB9E5:
+		*format = GL_RGB;
+		*type = GL_UNSIGNED_INT_5_9_9_9_REV;
+		*internal_format = GL_RGB9_E5;
+		break;
+	default:
+		*type = GL_FLOAT;
+		break;
+	}
+}
+
+// The levels are uploaded from the smallest, and only the uploaded ones are sampled,
+// so the texture is complete (and blurrier) while loading
+void GTR::uploadHDRELevel(Texture* texture, HDRE* hdre, const int level)
+{
+	if (level == hdre->levels - 1) {
+		unsigned int format, type, internal_format;
+		getHDREFormat(hdre, &format, &type, &internal_format);
+		texture->createCubemap(hdre->width, hdre->height, NULL, format, type, true, internal_format);
+
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texture->texture_id);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, hdre->levels - 1);
+	}
+
+	Uint8** faces = NULL;
+	switch (hdre->getType()) {
+	case HDRE_TYPE_HALF: faces = (Uint8**)hdre->getFacesh(level); break;
+	case HDRE_TYPE_RGB9E5: faces = (Uint8**)hdre->getFacese(level); break;
+	default: faces = (Uint8**)hdre->getFacesf(level); break;
+	}
+	texture->uploadCubemap(texture->format, texture->type, false, faces, texture->internal_format, level);
+
+	glBindTexture(GL_TEXTURE_CUBE_MAP, texture->texture_id);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, level);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	texture->loading = (level != 0);
+}
+
 Texture* GTR::CubemapFromHDRE(const char* filename)
 {
-	HDRE* hdre = HDRE::Get(filename);
+	HDRE* hdre = HDRE::GetCompact(filename);
 	if (!hdre)
 		return NULL;
 
 	Texture* texture = new Texture();
-	if (hdre->getFacesf(0))
-	{
-		texture->createCubemap(hdre->width, hdre->height, (Uint8**)hdre->getFacesf(0),
-			hdre->header.numChannels == 3 ? GL_RGB : GL_RGBA, GL_FLOAT);
-		for (int i = 1; i < hdre->levels; ++i)
-			texture->uploadCubemap(texture->format, texture->type, false,
-				(Uint8**)hdre->getFacesf(i), GL_RGBA32F, i);
+	for (int i = hdre->levels - 1; i >= 0; i--) {
+		uploadHDRELevel(texture, hdre, i);
 	}
-	else
-		if (hdre->getFacesh(0))
-		{
-			texture->createCubemap(hdre->width, hdre->height, (Uint8**)hdre->getFacesh(0),
-				hdre->header.numChannels == 3 ? GL_RGB : GL_RGBA, GL_HALF_FLOAT);
-			for (int i = 1; i < hdre->levels; ++i)
-				texture->uploadCubemap(texture->format, texture->type, false,
-					(Uint8**)hdre->getFacesh(i), GL_RGBA16F, i);
+	return texture;
+}
+
+// Returns a black cubemap, the file is read in the background thread
+// and the main thread uploads one level per frame
+Texture* GTR::CubemapFromHDREAsync(const char* filename)
+{
+	Texture* texture = new Texture();
+	Uint8 black[3] = { 0, 0, 0 };
+	Uint8* black_faces[6] = { black, black, black, black, black, black };
+	texture->createCubemap(1, 1, black_faces, GL_RGB, GL_UNSIGNED_BYTE, false);
+	texture->loading = true;
+
+	std::string name = filename;
+	TaskManager::background.addTask(new Task([texture, name]() {
+		HDRE* hdre = HDRE::GetCompact(name.c_str());
+		if (!hdre) {
+			std::cout << "Could not load the HDRE " << name << std::endl;
+			return;
 		}
+
+		for (int i = hdre->levels - 1; i >= 0; i--) {
+			TaskManager::foreground.addTask(new Task([texture, hdre, i]() {
+				uploadHDRELevel(texture, hdre, i);
+			}));
+		}
+	}));
+
 	return texture;
 }
 
@@ -252,20 +498,26 @@ void Renderer::init() {
 	tonemapping_component.init();
 	irradiance_component.init(this);
 	reflections_component.init(this);
-	volumetric_component.init(vec2(Application::instance->window_width, Application::instance->window_height));
-	bloom_component.init(vec2(Application::instance->window_width, Application::instance->window_height));
-	postFX_component.init(vec2(Application::instance->window_width, Application::instance->window_height));
+	postFX_component.init();
 
-	final_illumination_fbo = new FBO();
+	// Every variant is compiled and used once now, so none is compiled in the middle of a frame
+	ShaderVariants::precompile_all();
+	std::vector<Shader*> variants;
+	ShaderVariants::get_all(&variants);
+	Shader::WarmUp(variants);
 
-	final_illumination_fbo->create(Application::instance->window_width, Application::instance->window_height,
-		1,
-		GL_RGBA,
-		GL_FLOAT,
-		true);
+	// The render targets of the frame are allocated by the frame graph
 
-	// No need to add any preparations for forward renderer
-	_init_deferred_renderer();
+	skybox_texture = CubemapFromHDREAsync("data/night.hdre");
 
-	skybox_texture = CubemapFromHDRE("data/night.hdre");
-}
\ No newline at end of file
+	decal_cube = new Mesh();
+	decal_cube->createCube();
+	decal_cube->uploadToVRAM();
+}
+
+// The frame graph already follows the window size, but the targets of the old
+// size are freed now instead of waiting for them to expire
+void Renderer::onResize() {
+	frame_graph.release_pool();
+	dynamic_resolution.reset_history();
+}
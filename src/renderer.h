@@ -23,6 +23,17 @@
 #include "volumetric.h"
 #include "bloom.h"
 #include "post_fx.h"
+#include "render_graph.h"
+#include "dynamic_resolution.h"
+#include "image_compare.h"
+#include "shader_variants.h"
+#include "mesh_parser.h"
+#include "animation_clip.h"
+#include "animation_batch.h"
+#include "skinning.h"
+#include "mesh_lod.h"
+#include "mesh_optimizer.h"
+#include "occlusion_culling.h"
 #include <functional>
 #include <algorithm>
 
@@ -39,6 +50,35 @@ namespace GTR {
 	class Prefab;
 	class Material;
 
+	// Handles of the uniforms set for every draw call
+	namespace UNIFORM {
+		extern const sUniformHandle u_viewprojection;
+		extern const sUniformHandle u_camera_position;
+		extern const sUniformHandle u_model;
+		extern const sUniformHandle u_time;
+		extern const sUniformHandle u_color;
+		extern const sUniformHandle u_alpha_cutoff;
+		extern const sUniformHandle u_ambient_light;
+		extern const sUniformHandle u_num_lights;
+		extern const sUniformHandle u_light_pos;
+		extern const sUniformHandle u_light_color;
+		extern const sUniformHandle u_light_type;
+		extern const sUniformHandle u_light_shadow_id;
+		extern const sUniformHandle u_light_max_dist;
+		extern const sUniformHandle u_light_intensities;
+		extern const sUniformHandle u_light_direction;
+		extern const sUniformHandle u_light_cone_angle;
+		extern const sUniformHandle u_light_cone_decay;
+		extern const sUniformHandle u_light_id;
+		extern const sUniformHandle u_skybox_texture;
+		extern const sUniformHandle u_emmisive_factor;
+		extern const sUniformHandle u_texture;
+		extern const sUniformHandle u_emmisive_tex;
+		extern const sUniformHandle u_met_rough_tex;
+		extern const sUniformHandle u_normal_tex;
+		extern const sUniformHandle u_occlusion_tex;
+	};
+
 	enum eRenderPipe : int {
 		FORWARD = 0,
 		DEFERRED
@@ -69,10 +109,15 @@ namespace GTR {
 			OCCLUSION_MAT = 10000
 		};
 
+		// Transient targets, assigned by the frame graph each frame
 		FBO* deferred_gbuffer = NULL;
 		FBO* final_illumination_fbo = NULL;
+		FBO* depth_decal_fbo = NULL;
+
+		sRenderGraph frame_graph;
 
 		Texture* skybox_texture = NULL;
+		Mesh* decal_cube = NULL;
 
 		Camera* camera;
 
@@ -85,6 +130,8 @@ namespace GTR {
 		sVolumetric_Component volumetric_component;
 		SBloom_Component bloom_component;
 		sPostFX_Component postFX_component;
+		sDynamicResolution_Component dynamic_resolution;
+		sImageCompare_Component image_compare;
 
 		// CONFIG FLAGS =====
 		eRenderPipe current_pipeline = FORWARD;
@@ -92,6 +139,8 @@ namespace GTR {
 		bool use_single_pass = true;
 		bool render_light_volumes = false;
 		bool use_ssao = true;
+		// RGBA8 sRGB albedo + occlusion, RG16 octahedral normals, RGBA8 materials and RGBM emissive
+		bool use_packed_gbuffer = false;
 		bool use_irradiance = false;
 
 		// DEBUG FLAGS ====
@@ -100,7 +149,9 @@ namespace GTR {
 		bool show_shadowmap = false;
 		bool liniearize_shadowmap_vis = false;
 
-		FBO *depth_decal_fbo = NULL;
+		// STATS ====
+		// CPU time of sending the geometry draw calls, averaged
+		float submit_cpu_ms = 0.0f;
 
 	public:
 		std::vector<BaseEntity*>* entity_list;
@@ -108,6 +159,7 @@ namespace GTR {
 		//add here your functions
 		//...
 		void init();
+		void onResize();
 
 		// Scene
 		void compute_visible_objects(Camera* camera, std::vector<sDrawCall>* opaque_calls, std::vector<sDrawCall>* translucent_calls);
@@ -118,17 +170,18 @@ namespace GTR {
 		void renderDeferredLightVolumes(CULLING::sSceneCulling* scene_data);
 		void tonemappingPass();
 
-		void deferredRenderDecal(const DecalEntity* ent, Camera* cam, Texture* depth);
+		void deferredRenderDecals(const std::vector<DecalEntity*>& decals, Camera* cam);
 
 		void render_skybox(Camera* camera);
 
 		void forwardRenderScene(const Scene* scene, Camera* camera, FBO* resulting_fbo, CULLING::sSceneCulling* scene_data, const bool use_irradiance);
-		void deferredRenderScene(const Scene* scene, Camera* camera, FBO* resulting_fbo, CULLING::sSceneCulling* scene_data);
+		void deferredGeometryPass(const Scene* scene, Camera* camera, CULLING::sSceneCulling* scene_data);
+		void deferredRenderScene(const Scene* scene, Camera* camera, FBO* resulting_fbo, CULLING::sSceneCulling* scene_data, Texture* ao_tex);
 
-		void renderDeferredPlainDrawCall(const sDrawCall& draw_call, const Scene* scene);
-		void renderDefferredPass(const Scene* scene, CULLING::sSceneCulling* scene_data);
-
-		void _init_deferred_renderer();
+		// With instances, the skinned draw calls with the same mesh and material as this one are drawn at once
+		void renderDeferredPlainDrawCall(const sDrawCall& draw_call, const Scene* scene, const SKINNING::sInstances* instances = NULL);
+		void renderDefferredPass(const Scene* scene, CULLING::sSceneCulling* scene_data, Texture* ao_tex);
+		void renderGBufferDebug(const int texture_index);
 
 		void add_to_render_queue(const Matrix44& prefab_model, GTR::Node* node, Camera* camera, ePBR_Type pbr);
 
@@ -153,6 +206,23 @@ namespace GTR {
 		// =======================
 		// INLINE FUNCTIONS
 		// =======================
+		inline void measure_submit(const Uint64 start) {
+			float ms = (float)((SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+			submit_cpu_ms = submit_cpu_ms * 0.95f + ms * 0.05f;
+		}
+
+		// Features of the current config, for the shader variants
+		inline uint64_t get_renderer_features() const {
+			uint64_t features = 0;
+			if (irradiance_component.use_GI) {
+				features |= FEATURE_IRRADIANCE;
+			}
+			if (use_packed_gbuffer) {
+				features |= FEATURE_PACKED_GBUFFER;
+			}
+			return features;
+		}
+
 		inline int bind_textures(const Material* material, Shader* shader) {
 			int enabled_textures = 0;
 			Texture* albedo_texture = NULL, * emmisive_texture = NULL, * mr_texture = NULL, * normal_texture = NULL;
@@ -174,9 +244,9 @@ namespace GTR {
 			if (emmisive_texture == NULL) {
 				enabled_textures += eTextMaterials::EMMISIVE_MAT;
 				emmisive_texture = Texture::getBlackTexture(); //a 1x1 black texture
-				shader->setUniform("u_emmisive_factor", material->emissive_factor);
+				shader->setUniform(UNIFORM::u_emmisive_factor, material->emissive_factor);
 			} else {
-				shader->setUniform("u_emmisive_factor", vec3(0.0f, 0.0f, 0.0f));
+				shader->setUniform(UNIFORM::u_emmisive_factor, vec3(0.0f, 0.0f, 0.0f));
 			}
 
 
@@ -197,11 +267,11 @@ namespace GTR {
 				occlusion_texture = Texture::getWhiteTexture(); //a 1x1 black texture
 			}
 
-			shader->setUniform("u_texture", albedo_texture, 0);
-			shader->setUniform("u_emmisive_tex", emmisive_texture, 1);
-			shader->setUniform("u_met_rough_tex", mr_texture, 2);
-			shader->setUniform("u_normal_tex", normal_texture, 3);
-			shader->setUniform("u_occlusion_tex", occlusion_texture, 4);
+			shader->setUniform(UNIFORM::u_texture, albedo_texture, 0);
+			shader->setUniform(UNIFORM::u_emmisive_tex, emmisive_texture, 1);
+			shader->setUniform(UNIFORM::u_met_rough_tex, mr_texture, 2);
+			shader->setUniform(UNIFORM::u_normal_tex, normal_texture, 3);
+			shader->setUniform(UNIFORM::u_occlusion_tex, occlusion_texture, 4);
 
 			return enabled_textures;
 		};
@@ -215,8 +285,10 @@ namespace GTR {
 				ImGui::Checkbox("Linearize shadomap visualization", &liniearize_shadowmap_vis);
 			}
 
+			ImGui::Text("Geometry submit (CPU): %.3f ms", submit_cpu_ms);
+
 			const char* rend_pipe[2] = { "FORWARD", "DEFERRED" };
-			const char* deferred_output_labels[DEFERRED_DEBUG_SIZE] = { "Final Result", "Color", "Normal", "Materials","Depth", "World pos.", "Emmisive", "Ambient occlusion", "Ambient occlusion blurred" };
+			const char* deferred_output_labels[DEFERRED_DEBUG_SIZE] = { "Final Result", "Color", "Normal", "Materials","Depth", "World pos.", "Emmisive", "Ambient occlusion", "Ambient occlusion upsampled" };
 			ImGui::Combo("Rendering pipeline", (int*)&current_pipeline, rend_pipe, IM_ARRAYSIZE(rend_pipe));
 
 			switch (current_pipeline) {
@@ -225,23 +297,40 @@ namespace GTR {
 				break;
 			case DEFERRED:
 				ImGui::Combo("Deferred debug", (int*)&deferred_output, deferred_output_labels, IM_ARRAYSIZE(deferred_output_labels));
+				ImGui::Checkbox("Packed GBuffer", &use_packed_gbuffer);
 				ImGui::Checkbox("Show Light volumes", &render_light_volumes);
 				ImGui::Checkbox("Use SSAO", &use_ssao);
 				if (use_ssao) {
-					ImGui::SliderFloat("AO radius", &ao_component.ao_radius, 0.0f, 40.0f);
+					ao_component.render_imgui();
 				}
 				break;
 			default:
 				break;
 			}
+			ImGui::Checkbox("Write compact HDRE caches", &HDRE::write_compact_cache);
 			tonemapping_component.imgui_config();
 			irradiance_component.render_imgui();
 			reflections_component.debug_imgui();
 			volumetric_component.render_imgui();
 			bloom_component.render_imgui();
+			postFX_component.render_imgui();
+			dynamic_resolution.render_imgui(vec2(Application::instance->window_width, Application::instance->window_height));
+			image_compare.render_imgui();
+			frame_graph.render_imgui();
+			ShaderVariants::render_imgui();
+			MESH_PARSER::render_imgui();
+			ANIMATION_CLIP::render_imgui();
+			ANIMATION_BATCH::render_imgui();
+			SKINNING::render_imgui();
+			MESH_LOD::render_imgui();
+			MESH_OPTIMIZER::render_imgui();
+			OCCLUSION::render_imgui();
 #endif
 		}
 	};
 
+	void getHDREFormat(HDRE* hdre, unsigned int* format, unsigned int* type, unsigned int* internal_format);
+	void uploadHDRELevel(Texture* texture, HDRE* hdre, const int level);
 	Texture* CubemapFromHDRE(const char* filename);
-};
\ No newline at end of file
+	Texture* CubemapFromHDREAsync(const char* filename);
+};
@@ -4,8 +4,13 @@
 #include "prefab.h"
 #include "extra/cJSON.h"
 #include "extra/hdre.h"
+#include "gltf_loader.h"
+#include "task.h"
+#include "animation.h"
+#include "animation_batch.h"
 
 GTR::Scene* GTR::Scene::instance = NULL;
+bool GTR::Scene::progressive_loading = false;
 
 GTR::Scene::Scene()
 {
@@ -22,6 +27,12 @@ void GTR::Scene::clear()
 	}
 	entities.resize(0);
 	decals.resize(0);
+	ANIMATION_BATCH::scene_batch.clear();
+
+	//the prefabs still loading will not be assigned
+	loading_assets.clear();
+	pending_assets = 0;
+	load_generation++;
 }
 
 
@@ -62,6 +73,12 @@ bool GTR::Scene::load(const char* filename)
 	// Cleanup of prefab list
 	prefab_storage.clear();
 
+	loading_assets.clear();
+	pending_assets = 0;
+	load_generation++;
+	load_start_time = getTime();
+	load_time = 0;
+
 	//entities
 	cJSON* entities_json = cJSON_GetObjectItemCaseSensitive(json, "entities");
 	cJSON* entity_json;
@@ -130,9 +147,118 @@ bool GTR::Scene::load(const char* filename)
 	//free memory
 	cJSON_Delete(json);
 
+	if (!progressive_loading)
+		waitForAssets();
+
 	return true;
 }
 
+void GTR::Scene::requestPrefab(PrefabEntity* entity, const std::string& filename)
+{
+	//already loaded by a previous scene
+	entity->prefab = GTR::Prefab::Find(filename.c_str());
+	if (entity->prefab)
+	{
+		entity->prefab->addRef();
+		return;
+	}
+
+	//several entities use the same file, it is read only once
+	for (int i = 0; i < loading_assets.size(); ++i)
+	{
+		if (loading_assets[i].filename == filename)
+		{
+			loading_assets[i].users.push_back(entity);
+			return;
+		}
+	}
+
+	sSceneAsset asset;
+	asset.filename = filename;
+	asset.users.push_back(entity);
+	loading_assets.push_back(asset);
+	pending_assets++;
+
+	//read and decode in a loading thread, the upload has to be in the main thread
+	Scene* scene = this;
+	int generation = load_generation;
+	int asset_index = loading_assets.size() - 1;
+	TaskManager::workers.addTask(new Task([scene, generation, asset_index, filename]() {
+		sGLTFData* gltf = readGLTF(filename.c_str());
+		TaskManager::foreground.addTask(new Task([scene, generation, asset_index, filename, gltf]() {
+			scene->onPrefabLoaded(generation, asset_index, filename, gltf);
+		}));
+	}));
+}
+
+void GTR::Scene::onPrefabLoaded(int generation, int asset_index, const std::string& filename, sGLTFData* gltf)
+{
+	Prefab* prefab = GTR::Prefab::Find(filename.c_str());
+	if (prefab)
+		freeGLTF(gltf);
+	else
+	{
+		prefab = buildGLTF(gltf);
+		if (prefab)
+		{
+			prefab->registerPrefab(filename);
+			prefab->updateBounding();
+		}
+		else
+			std::cout << "[ERROR]: Prefab not found" << std::endl;
+	}
+
+	//the scene was cleared while loading
+	if (generation != load_generation)
+		return;
+
+	sSceneAsset& asset = loading_assets[asset_index];
+	for (int i = 0; i < asset.users.size(); ++i)
+	{
+		asset.users[i]->prefab = prefab;
+		if (prefab)
+			prefab->addRef();
+	}
+
+	pending_assets--;
+	if (pending_assets == 0)
+	{
+		load_time = getTime() - load_start_time;
+		std::cout << " + Scene prefabs loaded in " << load_time << "ms" << std::endl;
+	}
+}
+
+void GTR::Scene::waitForAssets()
+{
+	while (pending_assets > 0)
+	{
+		//without loading threads the work is done here
+		if (!TaskManager::workers.getThreadCount())
+		{
+			TaskManager::workers.fetchTask();
+			TaskManager::foreground.fetchTask();
+			continue;
+		}
+		//sleeps until a loading thread queues its upload, the timeout is only a safety net
+		TaskManager::foreground.waitForTask(100);
+	}
+}
+
+void GTR::Scene::renderLoadingInMenu()
+{
+#ifndef SKIP_IMGUI
+	if (ImGui::TreeNode("Loading")) {
+		ImGui::Checkbox("Progressive loading", &progressive_loading);
+		ImGui::Text("Loading threads: %d", TaskManager::workers.getThreadCount());
+		if (pending_assets > 0)
+			ImGui::Text("Prefabs loading: %d / %d", pending_assets, (int)loading_assets.size());
+		else
+			ImGui::Text("Prefabs: %d loaded in %d ms", (int)loading_assets.size(), (int)load_time);
+		ImGui::TreePop();
+	}
+#endif
+}
+
 GTR::BaseEntity* GTR::Scene::createEntity(std::string type)
 {
 	if (type == "PREFAB") {
@@ -167,18 +293,46 @@ GTR::PrefabEntity::PrefabEntity()
 	prefab = NULL;
 }
 
+GTR::PrefabEntity::~PrefabEntity()
+{
+	if (prefab)
+		prefab->releaseRef();
+}
+
 void GTR::PrefabEntity::configure(cJSON* json)
 {
 	if (cJSON_GetObjectItem(json, "filename"))
 	{
 		filename = cJSON_GetObjectItem(json, "filename")->valuestring;
-		prefab = GTR::Prefab::Get( (std::string("data/") + filename).c_str());
+		scene->requestPrefab(this, std::string("data/") + filename);
 	}
 	if (cJSON_GetObjectItem(json, "pbr_type"))
 	{
 		int pbr_id = cJSON_GetObjectItem(json, "pbr_type")->valueint;
 		pbr_structure = (ePBR_Type)pbr_id;
 	}
+	if (cJSON_GetObjectItem(json, "animation"))
+	{
+		animation_filename = cJSON_GetObjectItem(json, "animation")->valuestring;
+		animation = Animation::Get((std::string("data/") + animation_filename).c_str());
+	}
+	if (cJSON_GetObjectItem(json, "animation_speed"))
+		animation_speed = (float)cJSON_GetObjectItem(json, "animation_speed")->valuedouble;
+	occluder = readJSONBool(json, "occluder", occluder);
+}
+
+int GTR::PrefabEntity::getAnimationInstance(Mesh* mesh)
+{
+	for (int i = 0; i < animation_instances.size(); ++i)
+		if (animation_instances[i].first == mesh)
+			return animation_instances[i].second;
+
+	//all the meshes of the entity play the animation at the same time
+	AnimationBatch& batch = ANIMATION_BATCH::scene_batch;
+	float time = animation_instances.size() ? batch.instances[animation_instances[0].second].time : 0.0f;
+	int instance = batch.add(animation, mesh, time, animation_speed);
+	animation_instances.push_back(std::make_pair(mesh, instance));
+	return instance;
 }
 
 void GTR::PrefabEntity::renderInMenu()
@@ -192,6 +346,14 @@ void GTR::PrefabEntity::renderInMenu()
 		prefab->root.renderInMenu();
 		ImGui::TreePop();
 	}
+	ImGui::Checkbox("Occluder", &occluder);
+	if (animation)
+	{
+		ImGui::Text("animation: %s (%d skinned meshes)", animation_filename.c_str(), (int)animation_instances.size());
+		if (ImGui::SliderFloat("Animation speed", &animation_speed, 0.0f, 4.0f))
+			for (int i = 0; i < animation_instances.size(); ++i)
+				ANIMATION_BATCH::scene_batch.instances[animation_instances[i].second].speed = animation_speed;
+	}
 #endif
 }
 
@@ -284,6 +446,6 @@ void GTR::DecalEntity::configure(cJSON* json) {
 	if (cJSON_GetObjectItem(json, "albedo")) {
 		texture_dir = cJSON_GetObjectItem(json, "albedo")->valuestring;
 
-		color_tex = Texture::Get((std::string("data/") + texture_dir).c_str());
+		color_tex = Texture::GetAsync((std::string("data/") + texture_dir).c_str());
 	}
 }
\ No newline at end of file
@@ -11,6 +11,9 @@
 
 //forward declaration
 class cJSON; 
+struct sGLTFData;
+class Mesh;
+class Animation;
 
 
 //our namespace
@@ -32,6 +35,7 @@ namespace GTR {
 
 	class Scene;
 	class Prefab;
+	class Node;
 	class DecalEntity;
 
 	//represents one element of the scene (could be lights, prefabs, cameras, etc)
@@ -56,10 +60,30 @@ namespace GTR {
 		std::string filename;
 		Prefab* prefab;
 		ePBR_Type pbr_structure = ROUGH_R_MET_G;
+
+		// Optional, the skinned meshes of the prefab are animated in ANIMATION_BATCH::scene_batch
+		std::string animation_filename;
+		Animation* animation = NULL;
+		float animation_speed = 1.0f;
+		std::vector<std::pair<Mesh*, int>> animation_instances; // The batch instance of each skinned mesh
+
+		std::unordered_map<const Node*, uint8_t> node_lods; // LOD of each node in the last frame of the main view
+
+		bool occluder = true; // Its meshes can hide others in the occlusion culling, "occluder": false for thin or see-through prefabs
 		
 		PrefabEntity();
+		virtual ~PrefabEntity();
 		virtual void renderInMenu();
 		virtual void configure(cJSON* json);
+
+		// Added to the batch the first time the mesh is visible
+		int getAnimationInstance(Mesh* mesh);
+	};
+
+	//a prefab file that is being loaded, shared by all the entities that use it
+	struct sSceneAsset {
+		std::string filename;
+		std::vector<PrefabEntity*> users;
 	};
 
 	//contains all entities of the scene
@@ -84,11 +108,24 @@ namespace GTR {
 			return (pref == prefab_storage.end()) ? NULL : (PrefabEntity*)pref->second;
 		}
 
+		//the prefabs are read in the loading threads and uploaded in the main thread
+		static bool progressive_loading; //render while the prefabs arrive, instead of waiting in load
+		std::vector<sSceneAsset> loading_assets;
+		int pending_assets = 0;
+		int load_generation = 0; //the results of a previous load are discarded
+		long load_start_time = 0;
+		long load_time = 0; //ms until the last prefab was ready
+
 		void clear();
 		void addEntity(BaseEntity* entity);
 
 		bool load(const char* filename);
 		BaseEntity* createEntity(std::string type);
+
+		void requestPrefab(PrefabEntity* entity, const std::string& filename);
+		void onPrefabLoaded(int generation, int asset_index, const std::string& filename, sGLTFData* gltf);
+		void waitForAssets();
+		void renderLoadingInMenu();
 	};
 
 	// CUSTOM CLASSES =================
@@ -188,6 +225,8 @@ namespace GTR {
 	public:
 		std::string texture_dir;
 		Texture* color_tex;
+
+		DecalEntity() { entity_type = DECALL; color_tex = NULL; }
 		
 		virtual void renderInMenu();
 		virtual void configure(cJSON* json);
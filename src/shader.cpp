@@ -8,9 +8,39 @@
 #include <locale>
 
 #include "texture.h"
+#include "mesh.h"
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#endif
+
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 std::string Shader::s_shader_atlas_filename;
 std::map<std::string, std::string> Shader::s_shaders_atlas;
+std::map<std::string, Shader::sAtlasProgram> Shader::s_atlas_programs;
+int Shader::s_atlas_version = 0;
+std::map<std::string, unsigned int> Shader::s_uniform_block_bindings;
+bool Shader::s_parallel_compile = false;
+bool Shader::s_use_binary_cache = false;
+std::string Shader::s_binary_cache_folder = "data/shader_cache";
+int Shader::s_binary_cache_hits = 0;
+int Shader::s_binary_cache_misses = 0;
+
+//names of the uniform handles, the index is the id
+static std::vector<std::string>& getUniformNames()
+{
+	static std::vector<std::string> names;
+	return names;
+}
+
+sUniformHandle::sUniformHandle(const char* varname)
+{
+	id = Shader::getUniformID(varname);
+}
 
 
 //typedef unsigned int GLhandle;
@@ -53,7 +83,7 @@ std::map<std::string, std::string> Shader::s_shaders_atlas;
 
 #endif
 
-std::map<std::string,Shader*> Shader::s_Shaders;
+AssetRegistry<Shader> Shader::s_Shaders("Shader", 1 << 12);
 bool Shader::s_ready = false;
 Shader* Shader::current = NULL;
 
@@ -78,6 +108,18 @@ void Shader::setFilenames(const std::string& vsf, const std::string& psf)
 	ps_filename = psf;
 }
 
+//the macros must go after the #version line, or the compiler rejects the shader
+static std::string addMacros(const std::string& code, const std::string& macros)
+{
+	size_t pos = code.find("#version");
+	if (pos == std::string::npos)
+		return macros + "\n" + code;
+	pos = code.find('\n', pos);
+	if (pos == std::string::npos)
+		return code + "\n" + macros + "\n";
+	return code.substr(0, pos + 1) + macros + "\n" + code.substr(pos + 1);
+}
+
 bool Shader::load(const std::string& vsf, const std::string& psf, const char* macros)
 {
 	assert(	compiled == false );
@@ -98,8 +140,8 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 	//printf("Fragment shader from memory:\n%s\n", psm.c_str());
 	if (macros)
 	{
-		vsm = macros + vsm;
-		psm = macros + psm;
+		vsm = addMacros(vsm, macros);
+		psm = addMacros(psm, macros);
 		this->macros = macros;
 	}
 
@@ -113,30 +155,26 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 
 Shader* Shader::Get(const char* vsf, const char* psf, const char* macros)
 {
-	std::string name;
-	
+	//the name is "vs,ps" + macros, only built when the shader is registered
+	uint64_t key = hashAssetName(vsf);
 	if (psf)
-		name = std::string(vsf) + "," + std::string(psf ? psf : "") + (macros ? macros : "");
-	else
-		name = vsf;
-	std::map<std::string,Shader*>::iterator it = s_Shaders.find(name);
-	if (it != s_Shaders.end())
-		return it->second;
-
-	if (!psf)
-		return NULL;
+		key = hashAssetName(macros ? macros : "", hashAssetName(psf, hashAssetName(",", key)));
+	Shader* sh = s_Shaders.find(key);
+	if (sh || !psf)
+		return sh;
 
-	Shader* sh = new Shader();
+	sh = new Shader();
 	if (!sh->load( vsf,psf, macros ))
 		return NULL;
-	s_Shaders[name] = sh;
+	s_Shaders.add(key, std::string(vsf) + "," + std::string(psf) + (macros ? macros : ""), sh);
 	return sh;
 }
 
 void Shader::ReloadAll()
 {
-	for( std::map<std::string,Shader*>::iterator it = s_Shaders.begin(); it!=s_Shaders.end();it++)
-		it->second->recompile();
+	s_Shaders.forEach([](const std::string& name, Shader* shader) {
+		shader->recompile();
+	});
 	if(!s_shader_atlas_filename.empty())
 		LoadAtlas(s_shader_atlas_filename.c_str());
 	std::cout << "Shaders recompiled" << std::endl;
@@ -213,6 +251,10 @@ bool Shader::LoadAtlas(const char* filename)
 
 	//compile shaders
 	std::string shaders = s_shaders_atlas[""];
+	s_atlas_version++;
+	std::vector<Shader*> pending;
+	std::vector<std::string> pending_names;
+	std::vector<bool> pending_new;
 
 	lines = tokenize(shaders, "\n");
 	for (int i = 0; i < lines.size(); ++i)
@@ -240,34 +282,82 @@ bool Shader::LoadAtlas(const char* filename)
 			continue;
 		}
 
-		vs_code = macros + "\n" + vs_code;
-		fs_code = macros + "\n" + fs_code;
+		sAtlasProgram& program = s_atlas_programs[ name ];
+		program.vs = vs_filename;
+		program.fs = fs_filename;
+		program.macros = macros;
+
+		vs_code = addMacros(vs_code, macros);
+		fs_code = addMacros(fs_code, macros);
 
-		Shader* shader = NULL;
-		auto it = s_Shaders.find( name );
-		if(it == s_Shaders.end())
+		Shader* shader = s_Shaders.find( name );
+		bool is_new = shader == NULL;
+		if(!shader)
 		{
 			shader = new Shader();
-			s_Shaders[ name ] = shader;
-		}
-		else
-			shader = it->second;
-	
-		if (!shader->compileFromMemory(vs_code,fs_code))
-		{
-			delete shader;
-			std::cout << " * Compilation error in shader at atlas: " << name << std::endl;
-            return false; //stop here
-			continue;
+			s_Shaders.add( name, shader );
 		}
 
+		//only kick off the compilation, the driver can work on all of them at the same time
+		shader->startCompileFromMemory(vs_code,fs_code);
 		shader->vs_filename = vs_filename;
 		shader->ps_filename = fs_filename;
 		shader->from_atlas = true;
-		std::cout << " + Shader from atlas: " << name << std::endl;
+		pending.push_back(shader);
+		pending_names.push_back(name);
+		pending_new.push_back(is_new);
 	}
 
-	return true;
+	FinishCompiles(pending);
+
+	bool all_compiled = true;
+	for (size_t i = 0; i < pending.size(); ++i)
+	{
+		if (pending[i]->compiled && !pending[i]->kept_previous)
+		{
+			std::cout << " + Shader from atlas: " << pending_names[i] << std::endl;
+			continue;
+		}
+		std::cout << " * Compilation error in shader at atlas: " << pending_names[i] << std::endl;
+		all_compiled = false;
+		//on a reload the shader keeps its previous program, the handles and the cached pointers stay valid
+		if (!pending_new[i])
+			continue;
+		s_Shaders.remove(pending_names[i]);
+		delete pending[i];
+	}
+
+	return all_compiled;
+}
+
+Shader* Shader::CompileFromAtlas(const char* name, const std::string& extra_macros, const bool wait)
+{
+	auto it = s_atlas_programs.find(name);
+	if (it == s_atlas_programs.end())
+	{
+		std::cout << " * Shader not found in atlas: " << name << std::endl;
+		return NULL;
+	}
+
+	const sAtlasProgram& program = it->second;
+	std::string macros = program.macros.size() ? program.macros + "\n" + extra_macros : extra_macros;
+	std::string vs_code = addMacros(s_shaders_atlas[program.vs], macros);
+	std::string fs_code = addMacros(s_shaders_atlas[program.fs], macros);
+
+	Shader* shader = new Shader();
+	shader->startCompileFromMemory(vs_code, fs_code);
+	if (wait && !shader->finishCompile())
+	{
+		delete shader;
+		std::cout << " * Compilation error in atlas variant: " << name << std::endl;
+		return NULL;
+	}
+
+	shader->vs_filename = program.vs;
+	shader->ps_filename = program.fs;
+	shader->macros = macros;
+	shader->from_atlas = true;
+	return shader;
 }
 
 bool Shader::compile()
@@ -297,6 +387,13 @@ bool Shader::hasInfoLog() const
 // ******************************************
 
 bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
+{
+	startCompileFromMemory(vsm, psm);
+	return finishCompile();
+}
+
+//compiles and links without asking for the result, so the driver does not have to wait
+void Shader::startCompileFromMemory(const std::string& vsm, const std::string& psm)
 {
 	if (glCreateProgram == 0)
 	{
@@ -304,48 +401,239 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 		exit(0);
 	}
 
-	if (program != 0)
+	//a working program is kept until the new one links, a hot reload with errors does not break the shader
+	if (previous_program != 0)
+		glDeleteProgram(previous_program);
+	previous_program = 0;
+	if (program != 0 && compiled)
+		previous_program = program;
+	else if (program != 0)
 		glDeleteProgram(program);
 	program = glCreateProgram();
 	assert (glGetError() == GL_NO_ERROR);
 
-	if (!createVertexShaderObject(vsm))
+	compiled = false;
+	kept_previous = false;
+	pending_link = true;
+	pending_vs_code = vsm;
+	pending_fs_code = psm;
+
+	binary_key = s_use_binary_cache ? getBinaryKey(vsm, psm) : 0;
+	from_binary = binary_key != 0 && loadProgramBinary();
+	if (from_binary)
 	{
-		printf("Vertex shader compilation failed\n");
-		return false;
+		s_binary_cache_hits++;
+		return;
 	}
+	if (binary_key)
+		s_binary_cache_misses++;
 
-	if (!createFragmentShaderObject(psm))
-	{
-		printf("Fragment shader compilation failed\n");
-		return false;
-	}
+	linkFromSource();
+}
 
+void Shader::linkFromSource()
+{
+	createVertexShaderObject(pending_vs_code);
+	createFragmentShaderObject(pending_fs_code);
+	if (binary_key)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(program);
 	assert (glGetError() == GL_NO_ERROR);
+}
+
+bool Shader::isCompileDone()
+{
+	if (!pending_link || !s_parallel_compile)
+		return true;
+	GLint done = 0;
+	glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+	return done != 0;
+}
+
+bool Shader::finishCompile()
+{
+	assert(pending_link && "No compilation started");
+	pending_link = false;
 
 	GLint linked=0;
     
 	glGetProgramiv(program,GL_LINK_STATUS,&linked);
 	assert(glGetError() == GL_NO_ERROR);
 
+	//the driver can reject a binary even with the same driver string, compile it again
+	if (!linked && from_binary)
+	{
+		std::cout << " * Shader binary rejected, compiling from source" << std::endl;
+		from_binary = false;
+		s_binary_cache_hits--;
+		s_binary_cache_misses++;
+		glDeleteProgram(program);
+		program = glCreateProgram();
+		linkFromSource();
+		glGetProgramiv(program,GL_LINK_STATUS,&linked);
+	}
+
 	if (!linked)
 	{
+		if (!checkShaderObject(vs, pending_vs_code))
+			printf("Vertex shader compilation failed\n");
+		if (!checkShaderObject(fs, pending_fs_code))
+			printf("Fragment shader compilation failed\n");
 		saveProgramInfoLog(program);
+		GLuint working_program = previous_program;
+		previous_program = 0;
 		release();
+		if (working_program)
+		{
+			std::cout << " * Keeping the previous version of the shader" << std::endl;
+			program = working_program;
+			compiled = true;
+			kept_previous = true;
+		}
 		return false;
 	}
 
+	if (previous_program)
+	{
+		glDeleteProgram(previous_program);
+		previous_program = 0;
+	}
+
+	if (!from_binary && binary_key)
+		saveProgramBinary();
+	pending_vs_code.clear();
+	pending_fs_code.clear();
+
 #ifdef _DEBUG
 	validate();
 #endif
 
 	compiled = true;
 	locations.clear(); //regenerate table
+	handle_locations.clear();
+
+	bindUniformBlocks();
 
 	return true;
 }
 
+//finishes the shaders in the order the driver completes them, when it can tell
+void Shader::FinishCompiles(std::vector<Shader*>& shaders)
+{
+	std::vector<Shader*> remaining = shaders;
+	while (remaining.size())
+	{
+		for (int i = remaining.size() - 1; i >= 0; --i)
+		{
+			if (!remaining[i]->isCompileDone())
+				continue;
+			remaining[i]->finishCompile();
+			remaining.erase(remaining.begin() + i);
+		}
+		if (remaining.size())
+			SDL_Delay(1);
+	}
+}
+
+//FNV-1a of the code (macros included) and the driver, a new driver invalidates the binaries
+uint64_t Shader::getBinaryKey(const std::string& vsm, const std::string& psm)
+{
+	static std::string driver;
+	if (driver.empty())
+		driver = std::string((const char*)glGetString(GL_VENDOR)) + (const char*)glGetString(GL_RENDERER) + (const char*)glGetString(GL_VERSION);
+
+	uint64_t hash = 14695981039346656037ull;
+	const std::string* parts[3] = { &vsm, &psm, &driver };
+	for (int i = 0; i < 3; ++i)
+	{
+		const std::string& str = *parts[i];
+		for (size_t j = 0; j < str.size(); ++j)
+		{
+			hash ^= (unsigned char)str[j];
+			hash *= 1099511628211ull;
+		}
+		hash ^= 0xFF; //separator
+		hash *= 1099511628211ull;
+	}
+	return hash ? hash : 1;
+}
+
+static std::string getBinaryFilename(const std::string& folder, uint64_t key)
+{
+	char name[32];
+	sprintf(name, "/%016llx.bin", (unsigned long long)key);
+	return folder + name;
+}
+
+//the file is the binary format followed by the binary
+bool Shader::loadProgramBinary()
+{
+	std::vector<unsigned char> buffer;
+	if (!readFileBin(getBinaryFilename(s_binary_cache_folder, binary_key), buffer) || buffer.size() <= sizeof(GLenum))
+		return false;
+
+	GLenum format = *(GLenum*)&buffer[0];
+	glProgramBinary(program, format, &buffer[sizeof(GLenum)], (GLsizei)(buffer.size() - sizeof(GLenum)));
+	return glGetError() == GL_NO_ERROR;
+}
+
+void Shader::saveProgramBinary()
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<unsigned char> buffer(sizeof(GLenum) + length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, NULL, &format, &buffer[sizeof(GLenum)]);
+	*(GLenum*)&buffer[0] = format;
+	if (glGetError() != GL_NO_ERROR)
+		return;
+
+#ifdef WIN32
+	_mkdir(s_binary_cache_folder.c_str());
+#else
+	mkdir(s_binary_cache_folder.c_str(), 0755);
+#endif
+	FILE* file = fopen(getBinaryFilename(s_binary_cache_folder, binary_key).c_str(), "wb");
+	if (!file)
+		return;
+	fwrite(&buffer[0], 1, buffer.size(), file);
+	fclose(file);
+}
+
+//draws a pixel with every shader, drivers finish some of the work the first time a program is used
+void Shader::WarmUp(const std::vector<Shader*>& extra_shaders)
+{
+	Mesh* quad = Mesh::getQuad();
+
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(0, 0, 1, 1);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glDisable(GL_DEPTH_TEST);
+
+	s_Shaders.forEach([quad](const std::string& name, Shader* shader) {
+		shader->warmUp(quad);
+	});
+	for (size_t i = 0; i < extra_shaders.size(); ++i)
+		extra_shaders[i]->warmUp(quad);
+
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_SCISSOR_TEST);
+}
+
+void Shader::warmUp(Mesh* quad)
+{
+	if (!compiled)
+		return;
+	enable();
+	quad->render(GL_TRIANGLES);
+	disable();
+}
+
 bool Shader::validate()
 {
 	glValidateProgram(program);
@@ -393,6 +681,18 @@ bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::st
 	glCompileShader(handle);
 	assert( glGetError() == GL_NO_ERROR );
 
+	//the compile status is not asked here, it would wait for the compilation
+	glAttachShader(program,handle);
+	assert( glGetError() == GL_NO_ERROR );
+
+	return true;
+}
+
+bool Shader::checkShaderObject(GLuint handle, const std::string& code)
+{
+	if (!handle)
+		return true;
+
 	GLint compile=0;
 	glGetShaderiv(handle,GL_COMPILE_STATUS,&compile);
 	assert( glGetError() == GL_NO_ERROR );
@@ -402,16 +702,13 @@ bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::st
 	{
 		saveShaderInfoLog(handle);
         std::cout << "Shader code:\n " << std::endl;
-		std::vector<std::string> lines = split( fullcode, '\n' );
+		std::vector<std::string> lines = split( code, '\n' );
 		for( size_t i = 0; i < lines.size(); ++i)
 			std::cout << i << "  " << lines[i] << std::endl;
 
 		return false;
 	}
 
-	glAttachShader(program,handle);
-	assert( glGetError() == GL_NO_ERROR );
-
 	return true;
 }
 
@@ -439,7 +736,14 @@ void Shader::release()
 		program = 0;
 	}
 
+	if (previous_program)
+	{
+		glDeleteProgram(previous_program);
+		previous_program = 0;
+	}
+
 	locations.clear();
+	handle_locations.clear();
 
 	compiled = false;
 }
@@ -531,12 +835,8 @@ GLint Shader::getLocation(const char* varname,loctable* table)
 	if(cur == locs->end()) //not found in the locations table
 	{
 		loc = glGetUniformLocation(program, varname);
-		if (loc == -1)
-		{
-			return -1;
-		}
 
-		//insert the new value
+		//insert the new value (also the missing ones, so they are not searched again)
 		locs->insert(loctable::value_type(varname,loc));
 	}
 	else //found in the table
@@ -560,17 +860,61 @@ int Shader::getAttribLocation(const char* varname)
 
 int Shader::getUniformLocation(const char* varname)
 {
-	int loc = getLocation(varname, &locations);
-	if (loc == -1)
+	return getLocation(varname, &locations);
+}
+
+int Shader::getUniformID(const char* varname)
+{
+	std::vector<std::string>& names = getUniformNames();
+	for (int i = 0; i < names.size(); ++i)
+		if (names[i] == varname)
+			return i;
+	names.push_back(varname);
+	return names.size() - 1;
+}
+
+GLint Shader::resolveLocation(int id)
+{
+	if (id >= handle_locations.size())
+		handle_locations.resize(getUniformNames().size(), UNRESOLVED_LOCATION);
+	handle_locations[id] = glGetUniformLocation(program, getUniformNames()[id].c_str());
+	return handle_locations[id];
+}
+
+void Shader::setUniform(const sUniformHandle& h, Texture* tex, int slot)
+{
+	assert(current == this);
+	tex->markUsed();
+	glActiveTexture(GL_TEXTURE0 + slot);
+	glBindTexture(tex->texture_type, tex->texture_id);
+	GLint loc = getLocation(h);
+	if (loc != -1)
+		glUniform1i(loc, slot);
+}
+
+void Shader::SetUniformBlockBinding(const char* block_name, unsigned int binding)
+{
+	s_uniform_block_bindings[block_name] = binding;
+	s_Shaders.forEach([](const std::string& name, Shader* shader) {
+		shader->bindUniformBlocks();
+	});
+}
+
+void Shader::bindUniformBlocks()
+{
+	if (!program)
+		return;
+	for (auto it = s_uniform_block_bindings.begin(); it != s_uniform_block_bindings.end(); ++it)
 	{
-		return loc;
+		GLuint index = glGetUniformBlockIndex(program, it->first.c_str());
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, index, it->second);
 	}
-	assert(glGetError() == GL_NO_ERROR);
-	return loc;
 }
 
 void Shader::setTexture(const char* varname, Texture* tex, int slot)
 {
+	tex->markUsed();
 	glActiveTexture(GL_TEXTURE0 + slot);
 	glBindTexture(tex->texture_type, tex->texture_id);
 	setUniform1(varname, slot);
@@ -593,7 +937,7 @@ void Shader::setUniform1(const char* varname, bool input1)
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1i(loc, input1);
-	assert(glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform1(const char* varname, int input1)
@@ -601,7 +945,7 @@ void Shader::setUniform1(const char* varname, int input1)
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform1i(loc, input1);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform2(const char* varname, int input1, int input2)
@@ -609,7 +953,7 @@ void Shader::setUniform2(const char* varname, int input1, int input2)
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform2i(loc, input1, input2);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform3(const char* varname, int input1, int input2, int input3)
@@ -617,7 +961,7 @@ void Shader::setUniform3(const char* varname, int input1, int input2, int input3
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform3i(loc, input1, input2, input3);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform4(const char* varname, const int input1, const int input2, const int input3, const int input4)
@@ -625,7 +969,7 @@ void Shader::setUniform4(const char* varname, const int input1, const int input2
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform4i(loc, input1, input2, input3, input4);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform1Array(const char* varname, const int* input, const int count)
@@ -633,7 +977,7 @@ void Shader::setUniform1Array(const char* varname, const int* input, const int c
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform1iv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform2Array(const char* varname, const int* input, const int count)
@@ -641,7 +985,7 @@ void Shader::setUniform2Array(const char* varname, const int* input, const int c
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform2iv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform3Array(const char* varname, const int* input, const int count)
@@ -649,7 +993,7 @@ void Shader::setUniform3Array(const char* varname, const int* input, const int c
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform3iv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform4Array(const char* varname, const int* input, const int count)
@@ -657,7 +1001,7 @@ void Shader::setUniform4Array(const char* varname, const int* input, const int c
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform4iv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform1(const char* varname, const float input1)
@@ -665,7 +1009,7 @@ void Shader::setUniform1(const char* varname, const float input1)
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform1f(loc, input1);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform2(const char* varname, const float input1, const float input2)
@@ -673,7 +1017,7 @@ void Shader::setUniform2(const char* varname, const float input1, const float in
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform2f(loc, input1, input2);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform3(const char* varname, const float input1, const float input2, const float input3)
@@ -681,7 +1025,7 @@ void Shader::setUniform3(const char* varname, const float input1, const float in
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform3f(loc, input1, input2, input3);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform4(const char* varname, const float input1, const float input2, const float input3, const float input4)
@@ -689,7 +1033,7 @@ void Shader::setUniform4(const char* varname, const float input1, const float in
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform4f(loc, input1, input2, input3, input4);
-	checkGLErrors();
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform1Array(const char* varname, const float* input, const int count)
@@ -697,7 +1041,7 @@ void Shader::setUniform1Array(const char* varname, const float* input, const int
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform1fv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform2Array(const char* varname, const float* input, const int count)
@@ -705,7 +1049,7 @@ void Shader::setUniform2Array(const char* varname, const float* input, const int
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform2fv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform3Array(const char* varname, const float* input, const int count)
@@ -713,7 +1057,7 @@ void Shader::setUniform3Array(const char* varname, const float* input, const int
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform3fv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setUniform4Array(const char* varname, const float* input, const int count)
@@ -721,7 +1065,7 @@ void Shader::setUniform4Array(const char* varname, const float* input, const int
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform4fv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setMatrix44(const char* varname, const float* m)
@@ -729,7 +1073,7 @@ void Shader::setMatrix44(const char* varname, const float* m)
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniformMatrix4fv(loc, 1, GL_FALSE, m);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setMatrix44( const char* varname, const Matrix44 &m )
@@ -737,7 +1081,7 @@ void Shader::setMatrix44( const char* varname, const Matrix44 &m )
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniformMatrix4fv(loc, 1, GL_FALSE, m.m);
-	assert (glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::setMatrix44Array( const char* varname, Matrix44* m_array, int num )
@@ -745,7 +1089,7 @@ void Shader::setMatrix44Array( const char* varname, Matrix44* m_array, int num )
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniformMatrix4fv(loc, num, GL_FALSE, (GLfloat*)m_array);
-	assert(glGetError() == GL_NO_ERROR);
+	CHECK_UNIFORM_ERROR();
 }
 
 void Shader::init()
@@ -755,6 +1099,26 @@ void Shader::init()
 	if(firsttime)
 	{
 
+		//the driver compiles in its own threads, and reports when each program is done
+		typedef void (APIENTRY * glMaxShaderCompilerThreads_func)(GLuint count);
+		glMaxShaderCompilerThreads_func max_compiler_threads = NULL;
+		if (SDL_GL_ExtensionSupported("GL_KHR_parallel_shader_compile"))
+			max_compiler_threads = (glMaxShaderCompilerThreads_func)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsKHR");
+		else if (SDL_GL_ExtensionSupported("GL_ARB_parallel_shader_compile"))
+			max_compiler_threads = (glMaxShaderCompilerThreads_func)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsARB");
+		if (max_compiler_threads)
+		{
+			max_compiler_threads(0xFFFFFFFF); //as many as the driver wants
+			s_parallel_compile = true;
+		}
+
+		GLint binary_formats = 0;
+		if (SDL_GL_ExtensionSupported("GL_ARB_get_program_binary"))
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binary_formats);
+		s_use_binary_cache = binary_formats > 0;
+
+		std::cout << " + Parallel shader compile: " << (s_parallel_compile ? "yes" : "no") << ", program binary cache: " << (s_use_binary_cache ? "yes" : "no") << std::endl;
+
 	#ifdef LOAD_EXTENSIONS_MANUALLY
 		IMPORT_GLEXT( glCreateProgramObject );
 		IMPORT_GLEXT( glLinkProgram );
@@ -795,9 +1159,9 @@ void Shader::init()
 
 Shader* Shader::getDefaultShader(std::string name)
 {
-	auto it = s_Shaders.find(name);
-	if (it != s_Shaders.end())
-		return it->second;
+	Shader* default_shader = s_Shaders.find(name);
+	if (default_shader)
+		return default_shader;
 
 	std::string vs = "";
 	std::string fs = "";
@@ -955,6 +1319,6 @@ Shader* Shader::getDefaultShader(std::string name)
 	sh->setUniform4("u_color", Vector4(1, 1, 1, 1));
 	sh->disable();
 
-	s_Shaders[name] = sh;
+	s_Shaders.add(name, sh);
 	return sh;
 }
@@ -10,6 +10,9 @@
 #include <map>
 #include "framework.h"
 #include <cassert>
+#include <vector>
+#include <cstdint>
+#include "asset_registry.h"
 
 #ifdef _DEBUG
 	#define CHECK_SHADER_VAR(a,b) if (a == -1) return
@@ -18,7 +21,22 @@
 	#define CHECK_SHADER_VAR(a,b) if (a == -1) return
 #endif
 
+//glGetError waits for the driver, so the setters only check it when debugging
+#ifdef _DEBUG
+	#define CHECK_UNIFORM_ERROR() assert(glGetError() == GL_NO_ERROR)
+#else
+	#define CHECK_UNIFORM_ERROR()
+#endif
+
 class Texture;
+class Mesh;
+
+//a uniform name resolved once to an id, every shader stores the location of each id in an array
+//declare them static: static const sUniformHandle u_model("u_model");
+struct sUniformHandle {
+	int id;
+	explicit sUniformHandle(const char* varname);
+};
 
 class Shader
 {
@@ -40,6 +58,10 @@ public:
 
 	//internal functions
 	virtual bool compileFromMemory(const std::string& vsm, const std::string& psm);
+	//compilation in two steps, so the driver can compile several programs at the same time
+	void startCompileFromMemory(const std::string& vsm, const std::string& psm);
+	bool isCompileDone(); //does not wait, always true without parallel compile
+	bool finishCompile();
 	virtual void release();
 	virtual void enable();
 	virtual void disable();
@@ -64,6 +86,18 @@ public:
 	//for textures you must specify an slot (a number from 0 to 16) where this texture is stored in the shader
 	void setUniform(const char* varname, Texture* texture, int slot) { assert(current == this); setTexture(varname, texture, slot); }
 
+	//upload using handles, no string lookup
+	void setUniform(const sUniformHandle& h, int input) { assert(current == this); GLint loc = getLocation(h); if (loc != -1) glUniform1i(loc, input); }
+	void setUniform(const sUniformHandle& h, float input) { assert(current == this); GLint loc = getLocation(h); if (loc != -1) glUniform1f(loc, input); }
+	void setUniform(const sUniformHandle& h, const Vector2& input) { assert(current == this); GLint loc = getLocation(h); if (loc != -1) glUniform2f(loc, input.x, input.y); }
+	void setUniform(const sUniformHandle& h, const Vector3& input) { assert(current == this); GLint loc = getLocation(h); if (loc != -1) glUniform3f(loc, input.x, input.y, input.z); }
+	void setUniform(const sUniformHandle& h, const Vector4& input) { assert(current == this); GLint loc = getLocation(h); if (loc != -1) glUniform4f(loc, input.x, input.y, input.z, input.w); }
+	void setUniform(const sUniformHandle& h, const Matrix44& input) { assert(current == this); GLint loc = getLocation(h); if (loc != -1) glUniformMatrix4fv(loc, 1, GL_FALSE, input.m); }
+	void setUniform(const sUniformHandle& h, Texture* texture, int slot);
+	void setUniform1Array(const sUniformHandle& h, const float* input, const int count) { GLint loc = getLocation(h); if (loc != -1) glUniform1fv(loc, count, input); }
+	void setUniform1Array(const sUniformHandle& h, const int* input, const int count) { GLint loc = getLocation(h); if (loc != -1) glUniform1iv(loc, count, input); }
+	void setUniform3Array(const sUniformHandle& h, const float* input, const int count) { GLint loc = getLocation(h); if (loc != -1) glUniform3fv(loc, count, input); }
+
 
 	virtual void setInt(const char* varname, const int& input) { setUniform1(varname, input); }
 	virtual void setFloat(const char* varname, const float& input) { setUniform1(varname, input); }
@@ -110,7 +144,7 @@ public:
 
 	static Shader* Get(const char* vsf, const char* psf = NULL, const char* macros = NULL);
 	static void ReloadAll();
-	static std::map<std::string,Shader*> s_Shaders;
+	static AssetRegistry<Shader> s_Shaders;
 
 	//this is a way to load a single file that contains all the shaders 
 	//to know more about the file format, it is based in this https://github.com/jagenjo/rendeer.js/tree/master/guides#the-shaders but with tiny differences
@@ -118,8 +152,45 @@ public:
 	static std::string s_shader_atlas_filename;
 	static std::map<std::string, std::string> s_shaders_atlas; //stores strings, no shaders
 
+	//the programs declared in the atlas, so they can be compiled again with extra macros
+	struct sAtlasProgram {
+		std::string vs;
+		std::string fs;
+		std::string macros;
+	};
+	static std::map<std::string, sAtlasProgram> s_atlas_programs;
+	static int s_atlas_version; //increased every time the atlas is loaded
+	//returns a new shader that is not registered in s_Shaders, NULL if it fails
+	//without wait, the compilation is only started and must be finished with FinishCompiles
+	static Shader* CompileFromAtlas(const char* name, const std::string& extra_macros, const bool wait = true);
+
+	//waits for all the started compilations, the ones that fail are left with compiled = false
+	static void FinishCompiles(std::vector<Shader*>& shaders);
+	static bool s_parallel_compile; //KHR_parallel_shader_compile
+
+	//linked programs are saved in the folder, and loaded instead of compiled in the next runs
+	static bool s_use_binary_cache;
+	static std::string s_binary_cache_folder;
+	static int s_binary_cache_hits;
+	static int s_binary_cache_misses;
+
+	//uses every program once, so the driver does not finish them during the first frames
+	static void WarmUp(const std::vector<Shader*>& extra_shaders);
+
 	static Shader* getDefaultShader(std::string name);
 
+	//uniform handles
+	static int getUniformID(const char* varname);
+	inline GLint getLocation(const sUniformHandle& handle) {
+		if (handle.id < (int)handle_locations.size() && handle_locations[handle.id] != UNRESOLVED_LOCATION)
+			return handle_locations[handle.id];
+		return resolveLocation(handle.id);
+	}
+
+	//uniform blocks, every shader that declares the block gets it in the binding point
+	static std::map<std::string, unsigned int> s_uniform_block_bindings;
+	static void SetUniformBlockBinding(const char* block_name, unsigned int binding);
+
 protected:
 
 	std::string info_log;
@@ -131,10 +202,26 @@ protected:
 	bool createVertexShaderObject(const std::string& shader);
 	bool createFragmentShaderObject(const std::string& shader);
 	bool createShaderObject(unsigned int type, GLuint& handle, const std::string& shader);
+	bool checkShaderObject(GLuint handle, const std::string& code);
+	void linkFromSource();
+	void warmUp(Mesh* quad);
+
+	bool pending_link = false;
+	std::string pending_vs_code; //kept until the link ends, to show the errors
+	std::string pending_fs_code;
+
+	bool from_binary = false;
+	uint64_t binary_key = 0;
+	GLuint previous_program = 0; //the working program while its new version compiles, it is restored if that fails
+	bool kept_previous = false; //the last compilation failed and the previous program is in use
+	static uint64_t getBinaryKey(const std::string& vsm, const std::string& psm);
+	bool loadProgramBinary();
+	void saveProgramBinary();
 	void saveShaderInfoLog(GLuint obj);
 	void saveProgramInfoLog(GLuint obj);
 
 	bool validate();
+	void bindUniformBlocks();
 
 	GLuint vs;
 	GLuint fs;
@@ -153,9 +240,15 @@ private:
 	};	
 	typedef std::map<const char*, int, ltstr> loctable;
 
+	static const GLint UNRESOLVED_LOCATION = -2;
+	std::vector<GLint> handle_locations; //location of each uniform id, -1 if the shader does not use it
+	GLint resolveLocation(int id);
+
 public:
 	GLint getLocation( const char* varname, loctable* table );
 	loctable locations;	
 };
 
+template<> inline AssetRegistry<Shader>& getAssetRegistry<Shader>() { return Shader::s_Shaders; }
+
 #endif
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include "shader_variants.h"
+
+std::unordered_map<uint64_t, Shader*> GTR::ShaderVariants::s_variants;
+int GTR::ShaderVariants::s_atlas_version = 0;
+int GTR::ShaderVariants::s_compile_count = 0;
+int GTR::ShaderVariants::s_lazy_compile_count = 0;
+float GTR::ShaderVariants::s_compile_ms = 0.0f;
+
+static std::string get_variant_macros(const uint64_t key) {
+	std::string macros;
+	for (int i = 0; i < GTR::FEATURE_COUNT; i++) {
+		if (key & (1ull << i)) {
+			macros += std::string("#define ") + GTR::FEATURE_DEFINES[i] + "\n";
+		}
+	}
+	return macros;
+}
+
+uint64_t GTR::get_material_features(const sDrawCall& draw_call) {
+	const Material* material = draw_call.material;
+	uint64_t features = 0;
+	if (material->normal_texture.texture) {
+		features |= FEATURE_NORMAL_MAP;
+	}
+	if (material->alpha_mode == MASK) {
+		features |= FEATURE_ALPHA_MASK;
+	}
+	if (draw_call.pbr_structure == ROUGH_G_MET_B) {
+		features |= FEATURE_ROUGH_G_MET_B;
+	}
+	if (draw_call.palette_offset != -1) {
+		features |= FEATURE_SKINNING;
+	}
+	return features;
+}
+
+Shader* GTR::ShaderVariants::Get(const eVariantShader base, const uint64_t features) {
+	// The shaders of the old atlas are still valid, but they do not have the changes
+	if (s_atlas_version != Shader::s_atlas_version) {
+		clear();
+		s_atlas_version = Shader::s_atlas_version;
+		precompile_all();
+	}
+
+	uint64_t key = get_key(base, features);
+	auto it = s_variants.find(key);
+	if (it != s_variants.end()) {
+		return it->second;
+	}
+
+	// Not precompiled, this stalls the frame
+	Uint64 start = SDL_GetPerformanceCounter();
+	Shader* shader = Shader::CompileFromAtlas(VARIANT_SHADERS[base].atlas_name, get_variant_macros(key));
+	s_compile_ms += (float)((SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+	s_compile_count++;
+	s_lazy_compile_count++;
+
+	// The failed variants are also stored as NULL, to not try to compile them every frame
+	s_variants[key] = shader;
+	return shader;
+}
+
+void GTR::ShaderVariants::precompile(const eVariantShader base, const uint64_t feature_mask) {
+	Uint64 start = SDL_GetPerformanceCounter();
+	std::vector<uint64_t> keys;
+	std::vector<Shader*> shaders;
+	add_variants_to_compile(base, feature_mask, &keys, &shaders);
+	finish_compiles(keys, shaders, start);
+}
+
+// All the variants are started before waiting for any of them, so the driver compiles them in parallel
+void GTR::ShaderVariants::precompile_all() {
+	s_atlas_version = Shader::s_atlas_version;
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	std::vector<uint64_t> keys;
+	std::vector<Shader*> shaders;
+	for (int i = 0; i < VARIANT_SHADER_COUNT; i++) {
+		add_variants_to_compile((eVariantShader)i, VARIANT_SHADERS[i].used_features, &keys, &shaders);
+	}
+	finish_compiles(keys, shaders, start);
+}
+
+void GTR::ShaderVariants::add_variants_to_compile(const eVariantShader base, const uint64_t feature_mask, std::vector<uint64_t>* keys, std::vector<Shader*>* shaders) {
+	uint64_t mask = feature_mask & VARIANT_SHADERS[base].used_features;
+	// Iterate all the subsets of the mask
+	uint64_t subset = 0;
+	do {
+		uint64_t key = get_key(base, subset);
+		if (is_valid_combination(base, subset) && s_variants.find(key) == s_variants.end()) {
+			keys->push_back(key);
+			shaders->push_back(Shader::CompileFromAtlas(VARIANT_SHADERS[base].atlas_name, get_variant_macros(key), false));
+		}
+		subset = (subset - mask) & mask;
+	} while (subset != 0);
+}
+
+bool GTR::ShaderVariants::is_valid_combination(const eVariantShader base, const uint64_t features) {
+	const uint64_t exclusive = features & VARIANT_SHADERS[base].exclusive_features;
+	// Clearing the lowest bit leaves nothing when there is one or none
+	return (exclusive & (exclusive - 1)) == 0;
+}
+
+void GTR::ShaderVariants::finish_compiles(const std::vector<uint64_t>& keys, std::vector<Shader*>& shaders, const Uint64 start) {
+	// CompileFromAtlas returns NULL when the shader is not in the atlas
+	std::vector<Shader*> started;
+	for (uint16_t i = 0; i < shaders.size(); i++) {
+		if (shaders[i]) {
+			started.push_back(shaders[i]);
+		}
+	}
+	Shader::FinishCompiles(started);
+
+	for (uint16_t i = 0; i < shaders.size(); i++) {
+		if (shaders[i] && !shaders[i]->compiled) {
+			std::cout << " * Compilation error in atlas variant: " << VARIANT_SHADERS[keys[i] >> 56].atlas_name << std::endl;
+			delete shaders[i];
+			shaders[i] = NULL;
+		}
+		s_variants[keys[i]] = shaders[i];
+	}
+
+	s_compile_ms += (float)((SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+	s_compile_count += shaders.size();
+}
+
+void GTR::ShaderVariants::get_all(std::vector<Shader*>* shaders) {
+	for (auto it = s_variants.begin(); it != s_variants.end(); ++it) {
+		if (it->second) {
+			shaders->push_back(it->second);
+		}
+	}
+}
+
+void GTR::ShaderVariants::clear() {
+	for (auto it = s_variants.begin(); it != s_variants.end(); ++it) {
+		delete it->second;
+	}
+	s_variants.clear();
+}
+
+void GTR::ShaderVariants::render_imgui() {
+#ifndef SKIP_IMGUI
+	if (ImGui::TreeNode("Shader variants")) {
+		int count_per_shader[VARIANT_SHADER_COUNT] = {};
+		for (auto it = s_variants.begin(); it != s_variants.end(); ++it) {
+			count_per_shader[it->first >> 56]++;
+		}
+
+		ImGui::Text("Live variants: %d", get_live_count());
+		ImGui::Text("Compiled: %d in %.1f ms", s_compile_count, s_compile_ms);
+		ImGui::Text("Compiled while rendering: %d", s_lazy_compile_count);
+		ImGui::Text("Binary cache: %d hits, %d misses", Shader::s_binary_cache_hits, Shader::s_binary_cache_misses);
+		for (int i = 0; i < VARIANT_SHADER_COUNT; i++) {
+			ImGui::Text("%s: %d", VARIANT_SHADERS[i].atlas_name, count_per_shader[i]);
+		}
+		if (ImGui::Button("Precompile all")) {
+			precompile_all();
+		}
+		ImGui::TreePop();
+	}
+#endif
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "includes.h"
+#include "shader.h"
+#include "scene.h"
+#include "draw_call.h"
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+// ================
+//  SHADER VARIANTS
+// ================
+// The material and renderer features are bits, and every set of bits is compiled
+// as its own permutation of an atlas shader, with a #define per feature. This way
+// the shaders do not branch on uniforms per pixel.
+// The variants are compiled the first time they are used, or before with precompile.
+
+namespace GTR {
+
+	enum eShaderFeatures : uint64_t {
+		FEATURE_NORMAL_MAP = 1 << 0,
+		FEATURE_ALPHA_MASK = 1 << 1,
+		FEATURE_ROUGH_G_MET_B = 1 << 2, // Else ROUGH_R_MET_G
+		FEATURE_IRRADIANCE = 1 << 3,
+		FEATURE_PACKED_GBUFFER = 1 << 4,
+		// Post pass
+		FEATURE_TONEMAP_UNCHARTED = 1 << 5,
+		FEATURE_TONEMAP_PERCEPTION = 1 << 6,
+		FEATURE_CHROM_ABERR = 1 << 7,
+		FEATURE_VIGNETTE = 1 << 8,
+		FEATURE_COLOR_LUT = 1 << 9,
+		FEATURE_FILM_GRAIN = 1 << 10,
+		// Per draw call
+		FEATURE_SKINNING = 1 << 11, // Instanced, with the palettes of SKINNING
+		FEATURE_TONEMAP_LINEAR = 1 << 12, // Only the exposure and the gamma
+		FEATURE_COUNT = 13
+	};
+
+	// Define of each feature bit
+	const char* const FEATURE_DEFINES[FEATURE_COUNT] = { "HAS_NORMAL_MAP", "ALPHA_MASK", "ROUGH_G_MET_B", "USE_IRRADIANCE", "PACKED_GBUFFER",
+		"TONEMAP_UNCHARTED", "TONEMAP_PERCEPTION", "CHROM_ABERR", "VIGNETTE", "COLOR_LUT", "FILM_GRAIN", "SKINNING", "TONEMAP_LINEAR" };
+
+	enum eVariantShader : uint8_t {
+		VARIANT_FORWARD_PBR = 0,
+		VARIANT_DEFERRED_GEOMETRY,
+		VARIANT_DEFERRED_PASS,
+		VARIANT_DEFERRED_LIGHTPASS,
+		VARIANT_DEFERRED_DECALS,
+		VARIANT_AO_PASS,
+		VARIANT_AO_UPSAMPLE,
+		VARIANT_POST_UBER,
+		VARIANT_SHADOW,
+		VARIANT_SHADER_COUNT
+	};
+
+	struct sVariantShaderDesc {
+		const char* atlas_name;
+		uint64_t used_features; // The other bits are ignored, so they do not create duplicated variants
+		uint64_t exclusive_features; // At most one of them is set, like the tonemappers
+	};
+
+	const sVariantShaderDesc VARIANT_SHADERS[VARIANT_SHADER_COUNT] = {
+		{ "forward_singlepass_pbr", FEATURE_NORMAL_MAP | FEATURE_ALPHA_MASK | FEATURE_IRRADIANCE | FEATURE_SKINNING, 0 },
+		{ "deferred_plane_opaque", FEATURE_NORMAL_MAP | FEATURE_ALPHA_MASK | FEATURE_ROUGH_G_MET_B | FEATURE_PACKED_GBUFFER | FEATURE_SKINNING, 0 },
+		{ "deferred_pass", FEATURE_IRRADIANCE | FEATURE_PACKED_GBUFFER, 0 },
+		{ "deferred_lightpass", FEATURE_PACKED_GBUFFER, 0 },
+		{ "deferred_decals", FEATURE_PACKED_GBUFFER, 0 },
+		{ "ao_pass", FEATURE_PACKED_GBUFFER, 0 },
+		{ "ao_upsample", FEATURE_PACKED_GBUFFER, 0 },
+		{ "post_uber", FEATURE_TONEMAP_UNCHARTED | FEATURE_TONEMAP_PERCEPTION | FEATURE_TONEMAP_LINEAR | FEATURE_CHROM_ABERR | FEATURE_VIGNETTE | FEATURE_COLOR_LUT | FEATURE_FILM_GRAIN, FEATURE_TONEMAP_UNCHARTED | FEATURE_TONEMAP_PERCEPTION | FEATURE_TONEMAP_LINEAR },
+		{ "shadow_flat", FEATURE_SKINNING, 0 }
+	};
+
+	// Features that depend on the material and the mesh of the draw call
+	uint64_t get_material_features(const sDrawCall& draw_call);
+
+	class ShaderVariants {
+	public:
+		// Key of the variant: the base shader on the top byte, the used features on the rest
+		static inline uint64_t get_key(const eVariantShader base, const uint64_t features) {
+			return ((uint64_t)base << 56) | (features & VARIANT_SHADERS[base].used_features);
+		}
+
+		static Shader* Get(const eVariantShader base, const uint64_t features);
+
+		// Compiles the valid combinations of the features in the mask, before they are needed
+		static void precompile(const eVariantShader base, const uint64_t feature_mask);
+		static void precompile_all();
+
+		static void clear();
+
+		static void get_all(std::vector<Shader*>* shaders);
+
+		// Stats
+		static inline int get_live_count() { return (int)s_variants.size(); }
+		static int s_compile_count;
+		static int s_lazy_compile_count; // Variants that were not precompiled, each one is a hitch
+		static float s_compile_ms;
+
+		static void render_imgui();
+
+	private:
+		// False for the combinations that no pass sets, like two tonemappers
+		static bool is_valid_combination(const eVariantShader base, const uint64_t features);
+
+		static void add_variants_to_compile(const eVariantShader base, const uint64_t feature_mask, std::vector<uint64_t>* keys, std::vector<Shader*>* shaders);
+		static void finish_compiles(const std::vector<uint64_t>& keys, std::vector<Shader*>& shaders, const Uint64 start);
+
+		static std::unordered_map<uint64_t, Shader*> s_variants;
+		static int s_atlas_version; // Atlas of the cached variants, they are compiled again if it is reloaded
+	};
+};
@@ -1,9 +1,14 @@
 #include "shadows.h"
+#include "shader_variants.h"
+#include "skinning.h"
 
 
 void GTR::ShadowRenderer::init() {
 	shadowmap = new FBO();
 	shadowmap->setDepthOnly(SHADOW_MAP_RES, SHADOW_MAP_RES);
+
+	static_assert(sizeof(sShadowBlock) % 16 == 0, "std140 blocks are padded to 16 bytes");
+	shadow_block.create("ShadowBlock", SHADOW_BLOCK_BINDING, sizeof(sShadowBlock));
 }
 void GTR::ShadowRenderer::clean() {
 	shadowmap->freeTextures();
@@ -11,14 +16,21 @@ void GTR::ShadowRenderer::clean() {
 
 void GTR::ShadowRenderer::render_light(sShadowDrawCall& draw_call, Matrix44 &vp_matrix) {
 	//define locals to simplify coding
-	Shader* shader = Shader::Get("shadow_flat");
+	Shader* shader = ShaderVariants::Get(VARIANT_SHADOW, 0);
 
 	shader->enable();
 
 	assert(glGetError() == GL_NO_ERROR);
 	glEnable(GL_CULL_FACE);
 
+	// The skinned objects are drawn after, an instanced draw per mesh and texture
+	std::vector<uint16_t> skinned;
 	for (uint16_t i = 0; i < draw_call.obj_cout; i++) {
+		if (draw_call.palette_offsets[i] != -1) {
+			skinned.push_back(i);
+			continue;
+		}
+
 		//upload uniforms
 		Texture* tex = draw_call.albedo_textures[i];
 		if (tex == NULL) {
@@ -30,13 +42,52 @@ void GTR::ShadowRenderer::render_light(sShadowDrawCall& draw_call, Matrix44 &vp_
 		shader->setUniform("u_model", draw_call.models[i]);
 
 		//do the draw call that renders the mesh into the screen
-		draw_call.meshes[i]->render(GL_TRIANGLES);
+		draw_call.meshes[i]->render(GL_TRIANGLES, -1, 0, draw_call.lods[i]);
 	}
+	shader->disable();
 
-	assert(glGetError() == GL_NO_ERROR);
+	// Same palettes as the camera passes, they are uploaded once per frame
+	if (skinned.size()) {
+		auto same_batch = [&draw_call](const uint16_t a, const uint16_t b) {
+			return draw_call.meshes[a] == draw_call.meshes[b] && draw_call.lods[a] == draw_call.lods[b] && draw_call.albedo_textures[a] == draw_call.albedo_textures[b] && draw_call.alpha_cutoffs[a] == draw_call.alpha_cutoffs[b];
+		};
+		std::sort(skinned.begin(), skinned.end(), [&draw_call](const uint16_t a, const uint16_t b) {
+			if (draw_call.meshes[a] != draw_call.meshes[b])
+				return draw_call.meshes[a] < draw_call.meshes[b];
+			if (draw_call.lods[a] != draw_call.lods[b])
+				return draw_call.lods[a] < draw_call.lods[b];
+			if (draw_call.albedo_textures[a] != draw_call.albedo_textures[b])
+				return draw_call.albedo_textures[a] < draw_call.albedo_textures[b];
+			return draw_call.alpha_cutoffs[a] < draw_call.alpha_cutoffs[b];
+		});
+
+		shader = ShaderVariants::Get(VARIANT_SHADOW, FEATURE_SKINNING);
+		shader->enable();
+		shader->setUniform("u_viewprojection", vp_matrix);
 
-	//disable shader
-	shader->disable();
+		SKINNING::sInstances instances;
+		for (uint16_t i = 0; i < skinned.size(); i++) {
+			const uint16_t obj = skinned[i];
+			instances.add(draw_call.models[obj], draw_call.palette_offsets[obj]);
+
+			bool batch_ends = !SKINNING::use_instancing || (i + 1 == skinned.size()) || !same_batch(obj, skinned[i + 1]);
+			if (!batch_ends) {
+				continue;
+			}
+
+			Texture* tex = draw_call.albedo_textures[obj];
+			if (tex == NULL) {
+				tex = Texture::getWhiteTexture();
+			}
+			shader->setUniform("u_texture", tex, 0);
+			shader->setUniform("u_alpha_cutoff", draw_call.alpha_cutoffs[obj]);
+			SKINNING::render(shader, draw_call.meshes[obj], instances, draw_call.lods[obj]);
+			instances.clear();
+		}
+		shader->disable();
+	}
+
+	assert(glGetError() == GL_NO_ERROR);
 
 	//set the render state as it was before to avoid problems with future renders
 	glDisable(GL_CULL_FACE);
@@ -112,4 +163,15 @@ void GTR::ShadowRenderer::render_scene_shadows(Camera *cam) {
 
 	// Re-enable color writing
 	glColorMask(true, true, true, true);
+
+	upload_shadow_block();
+}
+
+void GTR::ShadowRenderer::upload_shadow_block() {
+	sShadowBlock block;
+	memcpy(block.shadow_vp, light_view_projections, sizeof(light_view_projections));
+	block.shadow_bias = shadow_bias;
+	block.shadow_count = light_projection_count;
+
+	shadow_block.upload(&block);
 }
\ No newline at end of file
@@ -7,6 +7,9 @@
 #include "shader.h"
 #include "application.h"
 #include "frusturm_culling.h"
+#include "mesh_lod.h"
+#include "occlusion_culling.h"
+#include "uniform_buffer.h"
 // ================
 	//  SHADOW RENDERER
 	// ================
@@ -14,6 +17,14 @@
 #define SHADOW_MAP_RES 4048
 
 namespace GTR {
+	// Same layout as ShadowBlock in the shader atlas (std140)
+	struct sShadowBlock {
+		Matrix44 shadow_vp[MAX_LIGHT_NUM];
+		float shadow_bias;
+		int shadow_count;
+		float padding[2];
+	};
+
 	struct sShadowDrawCall {
 		LightEntity* light;
 
@@ -22,11 +33,15 @@ namespace GTR {
 		std::vector<Mesh*> meshes;
 		std::vector<Texture*> albedo_textures;
 		std::vector<float> alpha_cutoffs;
+		std::vector<int> palette_offsets; // -1 for the static meshes
+		std::vector<uint8_t> lods;
 
 		inline void clear() {
 			models.clear();
 			meshes.clear();
 			albedo_textures.clear();
+			palette_offsets.clear();
+			lods.clear();
 		}
 	};
 
@@ -47,6 +62,7 @@ namespace GTR {
 		int  light_projection_count = 0;
 
 		FBO* shadowmap;
+		UniformBuffer shadow_block;
 
 		float shadow_bias = 0.005f;
 
@@ -62,11 +78,12 @@ namespace GTR {
 
 		void render_scene_shadows(Camera* cam);
 
+		void upload_shadow_block();
+
+		// The matrices and the bias are in the ShadowBlock, uploaded once per frame
 		inline void bind_shadows(Shader* scene_shader) {
-			scene_shader->setUniform("u_shadow_map", get_shadowmap(), 8);
-			scene_shader->setMatrix44Array("u_shadow_vp", light_view_projections, MAX_LIGHT_NUM);
-			scene_shader->setUniform("u_shadow_count", light_projection_count);
-			scene_shader->setUniform("u_shadow_bias", shadow_bias);
+			static const sUniformHandle u_shadow_map("u_shadow_map");
+			scene_shader->setUniform(u_shadow_map, get_shadowmap(), 8);
 		}
 
 		inline Texture* get_shadowmap() const {
@@ -78,16 +95,24 @@ namespace GTR {
 			return light->light_id;
 		}
 
-		inline void add_instance_to_light(const uint16_t light, Mesh* inst_mesh, Texture *text, float alpha_cutoff, Matrix44& inst_model) {
+		inline void add_instance_to_light(const uint16_t light, Mesh* inst_mesh, Texture *text, float alpha_cutoff, Matrix44& inst_model, const int palette_offset = -1, const uint8_t lod = 0) {
 			sShadowDrawCall* draw_call = &draw_call_stack[light];
 
 			draw_call->models.push_back(inst_model);
 			draw_call->meshes.push_back(inst_mesh);
 			draw_call->albedo_textures.push_back(text);
 			draw_call->alpha_cutoffs.push_back(alpha_cutoff);
+			draw_call->palette_offsets.push_back(palette_offset);
+			draw_call->lods.push_back(lod);
 			draw_call->obj_cout++;
 		}
 
+		// The LOD uses the projected scale of the camera with the bias of the shadows
+		inline void add_draw_call_to_light(const uint16_t light, sDrawCall& inst) {
+			const int lod = MESH_LOD::select_lod(inst.mesh, inst.lod_scale, MESH_LOD::pass_bias[MESH_LOD::PASS_SHADOWS]);
+			add_instance_to_light(light, inst.mesh, inst.material->color_texture.texture, inst.material->alpha_cutoff, inst.model, inst.palette_offset, (uint8_t)lod);
+		}
+
 		void add_scene_data(CULLING::sSceneCulling* scene_data) {
 			// Add the lights to the shadowmap
 			draw_call_stack.resize(scene_data->_scene_non_directonal_lights.size() + scene_data->_scene_directional_lights.size());
@@ -116,11 +141,7 @@ namespace GTR {
 					LightEntity* curr_light = scene_data->_scene_non_directonal_lights[light_i];
 
 					if (curr_light->is_in_light_frustum(world_bounding)) {
-						add_instance_to_light(curr_light->shadow_id,
-							scene_data->_opaque_objects[i].mesh, 
-							scene_data->_opaque_objects[i].material->color_texture.texture,
-							scene_data->_opaque_objects[i].material->alpha_cutoff,
-							scene_data->_opaque_objects[i].model);
+						add_draw_call_to_light(curr_light->shadow_id, scene_data->_opaque_objects[i]);
 					}
 				}
 
@@ -128,11 +149,7 @@ namespace GTR {
 					LightEntity* curr_light = scene_data->_scene_directional_lights[light_i];
 
 					if (curr_light->is_in_light_frustum(world_bounding)) {
-						add_instance_to_light(curr_light->shadow_id,
-							scene_data->_opaque_objects[i].mesh,
-							scene_data->_opaque_objects[i].material->color_texture.texture,
-							scene_data->_opaque_objects[i].material->alpha_cutoff,
-							scene_data->_opaque_objects[i].model);
+						add_draw_call_to_light(curr_light->shadow_id, scene_data->_opaque_objects[i]);
 					}
 				}
 			}
@@ -144,11 +161,30 @@ namespace GTR {
 					LightEntity* curr_light = scene_data->_scene_non_directonal_lights[light_i];
 
 					if (curr_light->is_in_light_frustum(world_bounding)) {
-						add_instance_to_light(curr_light->shadow_id,
-							scene_data->_translucent_objects[i].mesh,
-							scene_data->_translucent_objects[i].material->color_texture.texture,
-							scene_data->_translucent_objects[i].material->alpha_cutoff,
-							scene_data->_translucent_objects[i].model);
+						add_draw_call_to_light(curr_light->shadow_id, scene_data->_translucent_objects[i]);
+					}
+				}
+
+				for (uint16_t light_i = 0; light_i < scene_data->_scene_directional_lights.size(); light_i++) {
+					LightEntity* curr_light = scene_data->_scene_directional_lights[light_i];
+
+					if (curr_light->is_in_light_frustum(world_bounding)) {
+						add_draw_call_to_light(curr_light->shadow_id, scene_data->_translucent_objects[i]);
+					}
+				}
+			}
+
+			// The objects hidden from the camera can still cast a visible shadow
+			if (OCCLUSION::cull_shadow_casters)
+				return;
+			for (uint32_t i = 0; i < scene_data->_occluded_objects.size(); i++) {
+				BoundingBox world_bounding = scene_data->_occluded_objects[i].aabb;
+
+				for (uint16_t light_i = 0; light_i < scene_data->_scene_non_directonal_lights.size(); light_i++) {
+					LightEntity* curr_light = scene_data->_scene_non_directonal_lights[light_i];
+
+					if (curr_light->is_in_light_frustum(world_bounding)) {
+						add_draw_call_to_light(curr_light->shadow_id, scene_data->_occluded_objects[i]);
 					}
 				}
 
@@ -156,11 +192,7 @@ namespace GTR {
 					LightEntity* curr_light = scene_data->_scene_directional_lights[light_i];
 
 					if (curr_light->is_in_light_frustum(world_bounding)) {
-						add_instance_to_light(curr_light->shadow_id,
-							scene_data->_translucent_objects[i].mesh,
-							scene_data->_translucent_objects[i].material->color_texture.texture,
-							scene_data->_translucent_objects[i].material->alpha_cutoff,
-							scene_data->_translucent_objects[i].model);
+						add_draw_call_to_light(curr_light->shadow_id, scene_data->_occluded_objects[i]);
 					}
 				}
 			}
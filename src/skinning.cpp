@@ -0,0 +1,118 @@
+#include "skinning.h"
+
+#include "animation_batch.h"
+#include "includes.h"
+#include "mesh.h"
+#include "shader.h"
+
+namespace SKINNING {
+
+	bool enabled = true;
+	bool use_instancing = true;
+	sStats stats;
+
+	static std::vector<Matrix44> frame_palettes;
+	static std::vector<int> instance_offsets; // Per instance of the scene batch, -1 if not in this frame
+	static bool is_dirty = false;
+	static int max_matrices = 0; // Of the texture buffer
+
+	static GLuint palette_buffer_id = 0;
+	static GLuint palette_texture_id = 0;
+
+	void begin_frame() {
+		frame_palettes.clear();
+		instance_offsets.assign(ANIMATION_BATCH::scene_batch.instances.size(), -1);
+		is_dirty = false;
+		stats = sStats();
+	}
+
+	int get_palette_offset(const int batch_instance) {
+		const AnimationBatch& batch = ANIMATION_BATCH::scene_batch;
+		if (batch_instance < 0 || batch_instance >= (int)batch.instances.size())
+			return -1;
+		if (batch_instance >= (int)instance_offsets.size())
+			instance_offsets.resize(batch.instances.size(), -1);
+
+		int& offset = instance_offsets[batch_instance];
+		if (offset != -1)
+			return offset;
+
+		if (!max_matrices) {
+			GLint max_texels = 0;
+			glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+			max_matrices = max_texels / 4;
+		}
+		const int size = batch.getPaletteSize(batch_instance);
+		if (!size || (int)frame_palettes.size() + size > max_matrices)
+			return -1;
+
+		offset = (int)frame_palettes.size();
+		const Matrix44* palette = batch.getPalette(batch_instance);
+		frame_palettes.insert(frame_palettes.end(), palette, palette + size);
+		is_dirty = true;
+		stats.instances++;
+		stats.matrices = (int)frame_palettes.size();
+		return offset;
+	}
+
+	void bind(Shader* shader) {
+		static const sUniformHandle u_bone_palettes("u_bone_palettes");
+
+		if (!palette_buffer_id) {
+			glGenBuffers(1, &palette_buffer_id);
+			glGenTextures(1, &palette_texture_id);
+		}
+
+		// A new store every time, the draws of the last upload can still be using the old one
+		if (is_dirty) {
+			const size_t bytes = frame_palettes.size() * sizeof(Matrix44);
+			glBindBuffer(GL_TEXTURE_BUFFER, palette_buffer_id);
+			glBufferData(GL_TEXTURE_BUFFER, bytes, frame_palettes.data(), GL_STREAM_DRAW);
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+			is_dirty = false;
+			stats.upload_bytes += bytes;
+			stats.uploads++;
+		}
+
+		glActiveTexture(GL_TEXTURE0 + SKINNING_PALETTE_SLOT);
+		glBindTexture(GL_TEXTURE_BUFFER, palette_texture_id);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, palette_buffer_id);
+		glActiveTexture(GL_TEXTURE0);
+		shader->setUniform(u_bone_palettes, SKINNING_PALETTE_SLOT);
+	}
+
+	void render(Shader* shader, const GTR::sDrawCall& draw_call) {
+		if (draw_call.palette_offset == -1) {
+			draw_call.mesh->render(GL_TRIANGLES, -1, 0, draw_call.lod);
+			return;
+		}
+
+		bind(shader);
+		draw_call.mesh->renderInstanced(GL_TRIANGLES, &draw_call.model, 1, &draw_call.palette_offset, draw_call.lod);
+		stats.skinned_draws++;
+		stats.draw_calls++;
+	}
+
+	void render(Shader* shader, Mesh* mesh, const sInstances& instances, const int lod) {
+		if (!instances.size())
+			return;
+
+		bind(shader);
+		mesh->renderInstanced(GL_TRIANGLES, instances.models.data(), instances.size(), instances.palette_offsets.data(), lod);
+		stats.skinned_draws += instances.size();
+		stats.draw_calls++;
+	}
+
+	void render_imgui() {
+#ifndef SKIP_IMGUI
+		if (ImGui::TreeNode("Skinning")) {
+			ImGui::Checkbox("Enabled", &enabled);
+			ImGui::Checkbox("Instancing", &use_instancing);
+			ImGui::Text("Palettes: %d (%d matrices, max %d)", stats.instances, stats.matrices, max_matrices);
+			ImGui::Text("Uploaded: %.1f KB in %d uploads", stats.upload_bytes / 1024.0f, stats.uploads);
+			ImGui::Text("Skinned draws: %d in %d draw calls", stats.skinned_draws, stats.draw_calls);
+			ImGui::TreePop();
+		}
+#endif
+	}
+};
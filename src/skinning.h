@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include "framework.h"
+#include "draw_call.h"
+
+class Shader;
+
+// ==========
+//  SKINNING
+// ==========
+// The palettes of the animated instances that are visible in a frame are copied in one
+// buffer, uploaded once to a texture buffer (4 RGBA32F texels per matrix) and read with
+// texelFetch by the SKINNING variants of the shaders. A draw call only keeps the offset of
+// its palette, so the skinned draws with the same mesh and material are a single instanced
+// draw, with the model and the palette offset per instance, and the shadows use the same upload.
+
+#define SKINNING_PALETTE_SLOT 11
+
+namespace SKINNING {
+
+	extern bool enabled;
+	extern bool use_instancing;
+
+	struct sStats {
+		int instances = 0; // Palettes in the buffer
+		int matrices = 0;
+		size_t upload_bytes = 0;
+		int uploads = 0;
+		int skinned_draws = 0; // Instances drawn, in all the passes
+		int draw_calls = 0; // Skinned draw calls, in all the passes
+	};
+	extern sStats stats;
+
+	// The models and palette offsets of an instanced draw
+	struct sInstances {
+		std::vector<Matrix44> models;
+		std::vector<int> palette_offsets;
+
+		inline void add(const Matrix44& model, const int palette_offset) {
+			models.push_back(model);
+			palette_offsets.push_back(palette_offset);
+		}
+		inline void clear() {
+			models.clear();
+			palette_offsets.clear();
+		}
+		inline int size() const { return (int)models.size(); }
+	};
+
+	// Forgets the palettes of the last frame, before the culling
+	void begin_frame();
+
+	// Copies the palette of an instance of ANIMATION_BATCH::scene_batch in the buffer of the frame,
+	// once per frame. Returns the offset in matrices, -1 if it does not fit
+	int get_palette_offset(const int batch_instance);
+
+	// Uploads the buffer if it changed since the last bind
+	void bind(Shader* shader);
+
+	// The mesh of the draw call, skinned if it has a palette. The models are a uniform for the static
+	// draws, and an instanced attribute for the skinned ones
+	void render(Shader* shader, const GTR::sDrawCall& draw_call);
+	void render(Shader* shader, Mesh* mesh, const sInstances& instances, const int lod = 0);
+
+	// Draw calls with the same mesh, LOD and material go in the same instanced draw
+	inline bool draw_call_batch_comp(const GTR::sDrawCall* a, const GTR::sDrawCall* b) {
+		if (a->mesh != b->mesh)
+			return a->mesh < b->mesh;
+		if (a->lod != b->lod)
+			return a->lod < b->lod;
+		if (a->material != b->material)
+			return a->material < b->material;
+		return a->pbr_structure < b->pbr_structure;
+	}
+	inline bool same_batch(const GTR::sDrawCall* a, const GTR::sDrawCall* b) {
+		return a->mesh == b->mesh && a->lod == b->lod && a->material == b->material && a->pbr_structure == b->pbr_structure;
+	}
+
+	void render_imgui();
+};
@@ -3,14 +3,18 @@
 #include <thread>         // std::thread
 #include <chrono>		  //ms
 #include <cassert>
+#include <atomic>
+#include <memory>
 
 TaskManager TaskManager::foreground;
 TaskManager TaskManager::background;
+TaskManager TaskManager::workers;
+//the static objects are constructed in the main thread, before main
+std::thread::id TaskManager::main_thread = std::this_thread::get_id();
 
 TaskManager::TaskManager()
 {
 	must_loop = false;
-	_thread = NULL;
 }
 
 void TaskManager::loop()
@@ -20,10 +24,12 @@ void TaskManager::loop()
 
 	while (must_loop)
 	{
-		if (pending_tasks.empty())
 		{
-			std::this_thread::sleep_for(10ms);
-			continue;
+			//woken by addTask, the timeout is to check must_loop
+			std::unique_lock<std::mutex> lock(tasks_mutex);
+			tasks_added.wait_for(lock, 10ms, [this] { return !pending_tasks.empty(); });
+			if (pending_tasks.empty())
+				continue;
 		}
 
 		fetchTask();
@@ -57,23 +63,76 @@ void TaskManager::fetchTask()
 	}
 }
 
+bool TaskManager::waitForTask(int max_ms)
+{
+	{
+		std::unique_lock<std::mutex> lock(tasks_mutex);
+		if (!tasks_added.wait_for(lock, std::chrono::milliseconds(max_ms), [this] { return !pending_tasks.empty(); }))
+			return false;
+	}
+	fetchTask();
+	return true;
+}
+
 void thread_loop_func(TaskManager* manager)
 {
 	manager->loop();
 	//join?
 }
 
-void TaskManager::startThread()
+void TaskManager::startThread(int count)
 {
-	assert(!_thread && "TaskManager already in a thread");
+	assert(_threads.empty() && "TaskManager already in a thread");
 	must_loop = true;
-	_thread = new std::thread(thread_loop_func, this);
+	//every thread fetches from the same list
+	for (int i = 0; i < count; ++i)
+		_threads.push_back(new std::thread(thread_loop_func, this));
 }
 
 void TaskManager::addTask(Task* task)
 {
 	//block pending_tasks
-	const std::lock_guard<std::mutex> lock(tasks_mutex);
-	pending_tasks.push_back(task);
-	//release pending_tasks automatically
+	{
+		const std::lock_guard<std::mutex> lock(tasks_mutex);
+		pending_tasks.push_back(task);
+		//release pending_tasks automatically
+	}
+	tasks_added.notify_one();
+}
+
+//shared with the tasks, that can start after parallelFor returned
+struct sParallelBatch {
+	std::atomic<int> next{ 0 };
+	std::atomic<int> done{ 0 };
+	int count = 0;
+	std::function<void(int)> func;
+
+	void run()
+	{
+		for (int i = next.fetch_add(1); i < count; i = next.fetch_add(1))
+		{
+			func(i);
+			done.fetch_add(1, std::memory_order_release);
+		}
+	}
+};
+
+void TaskManager::parallelFor(int count, const std::function<void(int)>& func)
+{
+	if (count <= 0)
+		return;
+
+	std::shared_ptr<sParallelBatch> batch = std::make_shared<sParallelBatch>();
+	batch->count = count;
+	batch->func = func;
+
+	int helpers = (int)_threads.size();
+	if (helpers > count - 1)
+		helpers = count - 1;
+	for (int i = 0; i < helpers; ++i)
+		addTask(new Task([batch]() { batch->run(); }));
+
+	batch->run();
+	while (batch->done.load(std::memory_order_acquire) < count)
+		std::this_thread::yield();
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <mutex>
 #include <thread>         // std::thread
 #include <functional>
+#include <condition_variable>
 
 //any task executed in BG should inherit from this one
 class Task {
@@ -20,15 +21,27 @@ class TaskManager {
 public:
 	std::list<Task*> pending_tasks;
 	std::mutex tasks_mutex;  // protects pending_tasks
+	std::condition_variable tasks_added; // wakes the threads waiting for tasks
 	bool must_loop;
-	std::thread* _thread;
+	std::vector<std::thread*> _threads;
+
+	static std::thread::id main_thread; //the one that owns the GL context and runs the foreground tasks
+	static bool isMainThread() { return std::this_thread::get_id() == main_thread; }
 
 	static TaskManager foreground;
 	static TaskManager background;
+	static TaskManager workers; //pool for the loading work that can run in parallel
 
 	TaskManager();
 	void addTask(Task* task);
 	void fetchTask();
+	//sleeps until a task is added or max_ms pass, then runs it. False if there was none
+	bool waitForTask(int max_ms);
 	void loop();
-	void startThread();
+	void startThread(int count = 1);
+	int getThreadCount() const { return (int)_threads.size(); }
+
+	//runs func(i) for i in [0, count) in the threads and in the caller, returns when all are done.
+	//the caller only runs this batch, so it is not blocked by a long task in the queue
+	void parallelFor(int count, const std::function<void(int)>& func);
 };
\ No newline at end of file
@@ -57,7 +57,7 @@ Vector4 Image::getPixelInterpolatedHigh(float x, float y, bool repeat) {
 };
 
 
-std::map<std::string, Texture*> Texture::sTexturesLoaded;
+AssetRegistry<Texture> Texture::sTexturesLoaded("Texture", 1 << 13);
 
 int Texture::default_mag_filter = GL_LINEAR;
 int Texture::default_min_filter = GL_LINEAR_MIPMAP_LINEAR;
@@ -93,6 +93,9 @@ Texture::Texture(Image* img)
 Texture::~Texture()
 {
 	clear();
+
+	if (filename.size())
+		sTexturesLoaded.remove(filename, this);
 }
 
 void Texture::clear()
@@ -106,24 +109,62 @@ void Texture::clear()
 	if(!loading) //when loading the texture of 1x1 is replaced with the new one
 		stdlog("Destroy texture: " + filename );
 	texture_id = 0;
+}
 
-	if (filename.size())
+size_t Texture::getVRAMBytes() const
+{
+	if (!texture_id)
+		return 0;
+
+	int bytes_per_pixel = 0;
+	switch (internal_format)
 	{
-		auto it = sTexturesLoaded.find(filename);
-		if (it != sTexturesLoaded.end())
-			sTexturesLoaded.erase(it);
+	case GL_RGBA32F: bytes_per_pixel = 16; break;
+	case GL_RGB32F: bytes_per_pixel = 12; break;
+	case GL_RGBA16F: bytes_per_pixel = 8; break;
+	case GL_RGB16F: bytes_per_pixel = 6; break;
+	default:
+		{
+			int channels = (format == GL_RGBA) ? 4 : (format == GL_RGB) ? 3 : (format == GL_RG) ? 2 : 1;
+			int type_size = (type == GL_FLOAT) ? 4 : (type == GL_HALF_FLOAT) ? 2 : 1;
+			bytes_per_pixel = channels * type_size;
+		}
 	}
+
+	size_t bytes = (size_t)width * (size_t)height * bytes_per_pixel;
+	if (texture_type == GL_TEXTURE_CUBE_MAP)
+		bytes *= 6;
+	else if (depth > 0)
+		bytes *= (size_t)depth;
+	//the mipmaps add a third
+	return mipmaps ? bytes + bytes / 3 : bytes;
+}
+
+//replaced by a 1x1 texture, it is loaded again in the loading threads when used
+void Texture::evictFromVRAM()
+{
+	if (!reloadable || loading || evicted)
+		return;
+	glDeleteTextures(1, &texture_id);
+	texture_id = 0;
+	create(1, 1);
+	evicted = true;
+}
+
+void Texture::restore()
+{
+	loading = true;
+	ASSET_MEMORY::reload_count++;
+	TaskManager::workers.addTask(new LoadTextureTask(filename.c_str()));
 }
 
 void Texture::Release()
 {
 	std::vector<Texture *> texs;
 
-	for (auto mp : sTexturesLoaded)
-	{
-		Texture *m = mp.second;
+	sTexturesLoaded.forEach([&texs](const std::string& name, Texture* m) {
 		texs.push_back(m);
-	}
+	});
 
 	for (Texture *m : texs)
 	{
@@ -167,7 +208,6 @@ void Texture::create(unsigned int width, unsigned int height, unsigned int forma
 	upload(format, type, mipmaps, data, internal_format);
 }
 
-/*
 void Texture::create3D(unsigned int width, unsigned int height, unsigned int depth, unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format)
 {
 	assert(width && height && depth && "texture must have a size");
@@ -193,7 +233,6 @@ void Texture::create3D(unsigned int width, unsigned int height, unsigned int dep
 
 	upload3D(format, type, mipmaps, data, internal_format);
 }
-*/
 
 void Texture::createCubemap(unsigned int width, unsigned int height, Uint8** data, unsigned int format, unsigned int type, bool mipmaps, unsigned int internal_format)
 {
@@ -221,10 +260,7 @@ void Texture::createCubemap(unsigned int width, unsigned int height, Uint8** dat
 Texture* Texture::Find(const char* filename)
 {
 	assert(filename);
-	auto it = sTexturesLoaded.find(filename);
-	if (it != sTexturesLoaded.end())
-		return it->second;
-	return NULL;
+	return sTexturesLoaded.find(filename);
 }
 
 Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
@@ -240,27 +276,38 @@ Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
 		delete texture;
 		return NULL;
 	}
+	//the reload uses the default options
+	texture->reloadable = mipmaps && wrap;
 
 	return texture;
 }
 
 Texture* Texture::GetAsync(const char* filename, bool mipmaps, bool wrap)
 {
+	//the find and the register are one step, so two threads do not create the same texture
+	static std::mutex async_mutex;
+	const std::lock_guard<std::mutex> lock(async_mutex);
+
 	//check if exists
 	Texture* texture = Find(filename);
 	if (texture)
 		return texture;
 
-	//create temp texture
+	//create temp texture, the flags are set before it is published
 	Texture* temp = new Texture();
-	temp->create(1, 1);
+	temp->loading = true;
+	temp->reloadable = true;
+	//the GL calls only in the main thread, the create is queued before the upload of the image
+	if (TaskManager::isMainThread())
+		temp->create(1, 1);
+	else
+		TaskManager::foreground.addTask(new Task([temp]() { if (temp->loading) temp->create(1, 1); }));
 	//register
 	temp->setName(filename);
-	temp->loading = true;
 
-	//add action to BG Thread 
+	//add action to the loading threads, several images are decoded at the same time
 	LoadTextureTask* task = new LoadTextureTask(filename);
-	TaskManager::background.addTask(task);
+	TaskManager::workers.addTask(task);
 
 	return temp;
 }
@@ -344,7 +391,6 @@ void Texture::upload( unsigned int format, unsigned int type, bool mipmaps, Uint
 	assert(checkGLErrors() && "Error uploading texture");
 }
 
-/*
 void Texture::upload3D(unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format) {
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_3D && "Texture type does not match.");
@@ -365,7 +411,6 @@ void Texture::upload3D(unsigned int format, unsigned int type, bool mipmaps, Uin
 	glBindTexture(this->texture_type, 0);
 	assert(checkGLErrors() && "Error uploading texture");
 }
-*/
 
 void Texture::uploadCubemap(unsigned int format, unsigned int t, bool mips, Uint8** data, unsigned int intFormat, int level) {
 	
@@ -1050,8 +1095,8 @@ void UploadTextureTask::onExecute()
 	Texture* texture = NULL;
 
 	//in case somehow it got loaded while I was loading it in the background
-	auto it = Texture::sTexturesLoaded.find(filename);
-	if (it == Texture::sTexturesLoaded.end())
+	texture = Texture::Find(filename.c_str());
+	if (!texture)
 	{
 		/*
 		//create texture
@@ -1063,11 +1108,10 @@ void UploadTextureTask::onExecute()
 		return;
 	}
 
-	texture = it->second;
-
 	//upload to GPU
 	texture->loadFromImage(image);
 	texture->loading = false;
+	texture->evicted = false;
 
 	//delete image
 	delete image;
@@ -7,6 +7,8 @@
 #include "includes.h"
 #include "framework.h"
 #include "task.h"
+#include "asset_registry.h"
+#include "asset_memory.h"
 #include <map>
 #include <set>
 #include <string>
@@ -111,7 +113,7 @@ public:
 	//a general struct to store all the information about a TGA file
 
 	//textures manager
-	static std::map<std::string, Texture*> sTexturesLoaded;
+	static AssetRegistry<Texture> sTexturesLoaded;
 
 	GLuint texture_id; // GL id to identify the texture in opengl, every texture must have its own id
 	float width;
@@ -132,6 +134,21 @@ public:
 	//original data info
 	Image image;
 
+	//memory management, see asset_memory.h
+	int ref_count = 0; //materials in use with this texture
+	uint32_t last_used_frame = ASSET_MEMORY::frame;
+	bool evicted = false; //replaced by a 1x1 texture until it is loaded again
+	bool reloadable = false; //loaded from a file with the default options, so it can be evicted
+
+	size_t getVRAMBytes() const;
+	void evictFromVRAM();
+	void restore();
+	inline void markUsed() {
+		last_used_frame = ASSET_MEMORY::frame;
+		if (evicted && !loading)
+			restore();
+	}
+
 	Texture();
 	Texture(unsigned int width, unsigned int height, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
 	Texture(Image* img);
@@ -143,13 +160,13 @@ public:
 	void clear();
 
 	void create(unsigned int width, unsigned int height, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
-	//void create3D(unsigned int width, unsigned int height, unsigned int depth, unsigned int format = GL_RED, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
+	void create3D(unsigned int width, unsigned int height, unsigned int depth, unsigned int format = GL_RED, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
 	void createCubemap(unsigned int width, unsigned int height, Uint8** data = NULL, unsigned int format = GL_RGBA, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, unsigned int internal_format = 0);
 
 	void upload(Image* img);
 	void upload(FloatImage* img);
 	void upload(unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
-	//void upload3D(unsigned int format = GL_RED, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
+	void upload3D(unsigned int format = GL_RED, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
 	void uploadCubemap(unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8** data = NULL, unsigned int internal_format = 0, int level = 0);
 	void uploadAsArray(unsigned int texture_size, bool mipmaps = true);
 
@@ -170,9 +187,10 @@ public:
 	static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true);
 	static Texture* GetAsync(const char* filename, bool mipmaps = true, bool wrap = true);
 	static Texture* Find(const char* filename);
+	static Texture* Find(uint64_t name_hash) { return sTexturesLoaded.find(name_hash); }
 	void setName(const char* name) {
 		filename = name;
-		sTexturesLoaded[filename] = this;
+		sTexturesLoaded.add(filename, this);
 	}
 
 	void generateMipmaps();
@@ -211,5 +229,6 @@ public:
 	void onExecute();
 };
 
+template<> inline AssetRegistry<Texture>& getAssetRegistry<Texture>() { return Texture::sTexturesLoaded; }
 
 #endif
\ No newline at end of file
@@ -1,117 +1,154 @@
 #include "tonemapping.h"
 #include "texture.h"
 #include <ctime>
+#include <cmath>
 namespace GTR {
 
-	const char* mapping_shader[2] = { "perception_tonemapper", "uncharted_tonemapper" };
-
+	// NOTE: luminance_fbo is transient, given by the renderer's frame graph
 	void Tonemapping_Component::init() {
-		fbo = new FBO();
-		compute_fbo = new FBO();
-		ilumination_fbo = new FBO();
-
-		fbo->create(Application::instance->window_width, Application::instance->window_height,
-			1,
-			GL_RGBA,
-			GL_FLOAT,
-			true);
-
-		ilumination_fbo->create(Application::instance->window_width, Application::instance->window_height,
-			1,
-			GL_RGBA,
-			GL_FLOAT,
-			true);
-
-		compute_fbo->create(1, 1, // 1 by 1 texture 
-			2, // 2 textures for the swapchain
-			GL_RGBA, // 2 channels 
-			GL_FLOAT, // of 32 bits
-			false); // without a depth texture
-
-		compute_fbo->bind();
-		compute_fbo->enableSingleBuffer(0);
-		glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-		compute_fbo->enableSingleBuffer(1);
-		glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-		compute_fbo->unbind();
-	}
-
-	 Texture* Tonemapping_Component::pass(Texture* prev_pass) {
-		 if (current_mapper == NO_MAPPER)
-			 return prev_pass;
-
-		glDisable(GL_DEPTH_TEST);
-		
-		// First, compute the luma of the scene
-		ilumination_fbo->bind();
-		ilumination_fbo->enableSingleBuffer(0);
-		Mesh* quad = Mesh::getQuad();
-		Shader* shader = Shader::Get("compute_lum");
-		shader->enable();
-		shader->setUniform("u_albedo_tex", prev_pass, 0);
-		quad->render(GL_TRIANGLES);
-		shader->disable();
-		ilumination_fbo->unbind();
-
-		// Compute the average and the maximun luminace, while storing it on the
-		// luminance swapchain
-		get_avg_max_lum_of_texture(ilumination_fbo->color_textures[0]);
-
-		fbo->bind();
-		fbo->enableSingleBuffer(0);
-
-		shader = Shader::Get(mapping_shader[current_mapper]);
-		shader->enable();
-		shader->setUniform("u_albedo_tex", prev_pass, 0);
-		shader->setUniform("u_max_avg_lum_tex", compute_fbo->color_textures[compute_fbo_swapchain], 1);
-		shader->setUniform("u_max_avg_lum_prev_tex", compute_fbo->color_textures[!compute_fbo_swapchain], 2);
-		quad->render(GL_TRIANGLES);
-
-		shader->disable();
-		fbo->unbind();
-
-		// Update the swapchain index
-		compute_fbo_swapchain = !compute_fbo_swapchain;
-
-		glEnable(GL_DEPTH_TEST);
-		first_frame = true;
-
-		return fbo->color_textures[0];
+		glGenBuffers(LUM_READBACK_FRAMES, readback_pbos);
+		for (int i = 0; i < LUM_READBACK_FRAMES; i++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_pbos[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, LUM_TARGET_SIZE * LUM_TARGET_SIZE * sizeof(float), NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 	}
 
-	 Texture* Tonemapping_Component::get_avg_max_lum_of_texture(Texture* text) {
-		 compute_fbo->bind();
-
-		 text->generateMipmaps();
-
-		 compute_fbo->enableAllBuffers();
-
-		 Mesh* quad = Mesh::getQuad();
-
-		 Shader* shader = Shader::Get("compute_max_and_avg_lum");
-
-		 int numLevels = (log2(max(text->width, text->height)));
-
-		 shader->enable();
-		 shader->setUniform("u_write_to_swap", (float)compute_fbo_swapchain);
-		 shader->setUniform("u_tex", text, 0);
-		 shader->setUniform("u_text_size", vec2(text->width, text->height));
-		 shader->setUniform("u_lowest_mip_level", numLevels);
-		 shader->setUniform("u_is_first_frame", (int)first_frame);
+	 void Tonemapping_Component::update_exposure(Texture* hdr_tex) {
+		 // The log luminance of the scene, downsampled
+		 if (use_auto_exposure) {
+			 glDisable(GL_DEPTH_TEST);
+			 luminance_fbo->bind();
+			 static const Handle<Shader> sh_compute_lum("compute_lum");
+			 Shader* shader = sh_compute_lum.get();
+			 shader->enable();
+			 shader->setUniform("u_albedo_tex", hdr_tex, 0);
+			 shader->setUniform("u_min_log_lum", min_log_lum);
+			 Mesh::getQuad()->render(GL_TRIANGLES);
+			 shader->disable();
+
+			 read_luminance();
+			 luminance_fbo->unbind();
+			 glEnable(GL_DEPTH_TEST);
+		 }
+		 adapt_exposure();
+	 }
 
-		 quad->render(GL_TRIANGLES);
-		 shader->disable();
+	 void Tonemapping_Component::set_uniforms(Shader* shader) const {
+		 shader->setUniform("u_exposure", get_exposure());
+		 shader->setUniform("u_max_lum", max_lum * get_exposure());
+	 }
 
-		 compute_fbo->unbind();
+	 // Queues the readback of this frame, and processes the oldest one if the GPU is done with it
+	 void Tonemapping_Component::read_luminance() {
+		 glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_pbos[readback_index]);
+		 glReadPixels(0, 0, LUM_TARGET_SIZE, LUM_TARGET_SIZE, GL_RED, GL_FLOAT, 0);
+		 if (readback_fences[readback_index]) {
+			 glDeleteSync(readback_fences[readback_index]);
+		 }
+		 readback_fences[readback_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		 readback_index = (readback_index + 1) % LUM_READBACK_FRAMES;
+
+		 GLsync& oldest_fence = readback_fences[readback_index];
+		 if (oldest_fence) {
+			 GLenum status = glClientWaitSync(oldest_fence, 0, 0);
+			 if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+				 glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_pbos[readback_index]);
+				 const float* data = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, LUM_TARGET_SIZE * LUM_TARGET_SIZE * sizeof(float), GL_MAP_READ_BIT);
+				 if (data) {
+					 compute_histogram(data, LUM_TARGET_SIZE * LUM_TARGET_SIZE);
+					 glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+				 }
+				 glDeleteSync(oldest_fence);
+				 oldest_fence = 0;
+			 }
+		 }
+		 glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	 }
 
+	 void Tonemapping_Component::compute_histogram(const float* log_lum, const int count) {
+		 const float range = max_log_lum - min_log_lum;
+		 for (int i = 0; i < LUM_HISTOGRAM_BINS; i++) {
+			 histogram[i] = 0.0f;
+		 }
+		 for (int i = 0; i < count; i++) {
+			 int bin = (int)((log_lum[i] - min_log_lum) / range * LUM_HISTOGRAM_BINS);
+			 bin = (bin < 0) ? 0 : ((bin >= LUM_HISTOGRAM_BINS) ? LUM_HISTOGRAM_BINS - 1 : bin);
+			 histogram[bin] += 1.0f;
+		 }
+
+		 // Average of the bins between the percentiles, and the max at its percentile
+		 const float bin_size = range / LUM_HISTOGRAM_BINS;
+		 const float low_count = low_percentile * count, high_count = high_percentile * count, max_count = max_percentile * count;
+		 float accumulated = 0.0f, log_sum = 0.0f, weight_sum = 0.0f;
+		 float max_log = min_log_lum;
+		 for (int i = 0; i < LUM_HISTOGRAM_BINS; i++) {
+			 float bin_start = accumulated;
+			 accumulated += histogram[i];
+
+			 // Part of the bin that is inside the percentiles
+			 float inside = fmin(accumulated, high_count) - fmax(bin_start, low_count);
+			 if (inside > 0.0f) {
+				 log_sum += (min_log_lum + (i + 0.5f) * bin_size) * inside;
+				 weight_sum += inside;
+			 }
+			 if (bin_start < max_count) {
+				 max_log = min_log_lum + (i + 1) * bin_size;
+			 }
+		 }
+
+		 if (weight_sum > 0.0f) {
+			 target_avg_lum = exp2f(log_sum / weight_sum);
+			 target_max_lum = exp2f(max_log);
+		 }
+
+		 // The first histogram is taken as is
+		 if (!has_histogram) {
+			 avg_lum = target_avg_lum;
+			 max_lum = target_max_lum;
+			 has_histogram = true;
+		 }
+	 }
 
-		 return compute_fbo->color_textures[compute_fbo_swapchain];
+	 // Exponential adaptation, framerate independent
+	 void Tonemapping_Component::adapt_exposure() {
+		 Uint64 now = SDL_GetPerformanceCounter();
+		 float dt = (last_counter == 0) ? 0.0f : (float)((now - last_counter) / (double)SDL_GetPerformanceFrequency());
+		 last_counter = now;
+		 // Long pauses (loading, breakpoints) are not a reason to jump
+		 dt = fmin(dt, 0.1f);
+
+		 float speed = (target_avg_lum > avg_lum) ? adaptation_speed_up : adaptation_speed_down;
+		 float factor = 1.0f - expf(-dt * speed);
+		 avg_lum += (target_avg_lum - avg_lum) * factor;
+		 max_lum += (target_max_lum - max_lum) * factor;
 	 }
 
+	 float Tonemapping_Component::get_exposure() const {
+		 if (!use_auto_exposure) {
+			 return manual_exposure;
+		 }
+		 return manual_exposure * key_value / fmax(avg_lum, 0.0001f);
+	 }
 
 	 void Tonemapping_Component::imgui_config() {
+#ifndef SKIP_IMGUI
 		 const char* tonemapping_labels[3] = { "PERCEPTUAL", "UNCHARTED", "NONE" };
 
 		 ImGui::Combo("Tonemapping Mode", (int*)&current_mapper, tonemapping_labels, IM_ARRAYSIZE(tonemapping_labels));
+
+		 ImGui::Checkbox("Auto exposure", &use_auto_exposure);
+		 ImGui::SliderFloat("Exposure compensation", &manual_exposure, 0.1f, 8.0f);
+		 if (use_auto_exposure) {
+			 ImGui::SliderFloat("Key value", &key_value, 0.05f, 0.5f);
+			 ImGui::SliderFloat("Low percentile", &low_percentile, 0.0f, high_percentile);
+			 ImGui::SliderFloat("High percentile", &high_percentile, low_percentile, 1.0f);
+			 ImGui::SliderFloat("Adaptation speed up", &adaptation_speed_up, 0.1f, 10.0f);
+			 ImGui::SliderFloat("Adaptation speed down", &adaptation_speed_down, 0.1f, 10.0f);
+			 ImGui::PlotHistogram("Log luminance", histogram, LUM_HISTOGRAM_BINS, 0, NULL, 0.0f, FLT_MAX, ImVec2(0, 60));
+			 ImGui::Text("Avg lum: %.3f (target %.3f), max lum: %.3f", avg_lum, target_avg_lum, max_lum);
+			 ImGui::Text("Exposure: %.3f", get_exposure());
+		 }
+#endif
 	 }
 };
\ No newline at end of file
@@ -4,7 +4,20 @@
 #include "fbo.h"
 #include "shader.h"
 #include "application.h"
+#include "shader_variants.h"
 
+// ================
+//  TONEMAPPING & AUTO EXPOSURE
+// ================
+// The log luminance of the frame is rendered to a small target and read back
+// to the CPU a few frames later, without waiting for the GPU. Its histogram
+// gives the average (of the middle percentiles) and the max luminance, and the
+// exposure adapts to them over time.
+// The tonemapping itself is done by the fused post pass, see sPostFX_Component.
+
+#define LUM_TARGET_SIZE 64
+#define LUM_HISTOGRAM_BINS 64
+#define LUM_READBACK_FRAMES 3
 
 namespace GTR {
 
@@ -16,19 +29,55 @@ namespace GTR {
 
 	struct Tonemapping_Component {
 
-		FBO* fbo = NULL;
-		FBO* compute_fbo = NULL;
-		FBO* ilumination_fbo = NULL;
+		// Transient, set by the frame graph
+		FBO* luminance_fbo = NULL; // LUM_TARGET_SIZE^2 of log2 luminance
+
+		// Ring of readbacks, the oldest is read when its fence is signaled
+		GLuint readback_pbos[LUM_READBACK_FRAMES] = {};
+		GLsync readback_fences[LUM_READBACK_FRAMES] = {};
+		int readback_index = 0;
+
+		// Histogram of the last read luminance, in log2 space
+		float min_log_lum = -10.0f;
+		float max_log_lum = 8.0f;
+		float histogram[LUM_HISTOGRAM_BINS] = {};
+		// The average ignores the darkest and brightest pixels
+		float low_percentile = 0.5f;
+		float high_percentile = 0.95f;
+		float max_percentile = 0.98f;
 
-		bool compute_fbo_swapchain;
+		// Temporal adaptation, towards the target of the histogram
+		float target_avg_lum = 0.18f;
+		float target_max_lum = 1.0f;
+		float avg_lum = 0.18f;
+		float max_lum = 1.0f;
+		float adaptation_speed_up = 3.0f; // Going to a brighter scene
+		float adaptation_speed_down = 1.0f;
+		bool has_histogram = false;
+		Uint64 last_counter = 0;
 
-		bool first_frame = false;
+		bool use_auto_exposure = true;
+		float key_value = 0.18f; // Middle gray
+		float manual_exposure = 1.0f;
 
 		eTonemappers current_mapper = UNCHARTED_MAPPER;
 
 		void init();
-		Texture* pass(Texture* prev_pass);
-		Texture* get_avg_max_lum_of_texture(Texture* text);
+		// Measures the luminance of the frame, and adapts the exposure
+		void update_exposure(Texture* hdr_tex);
+
+		void read_luminance();
+		void compute_histogram(const float* log_lum, const int count);
+		void adapt_exposure();
+		float get_exposure() const;
+
+		// Variant bits and uniforms of the tonemapper, for the post pass
+		inline uint64_t get_features() const {
+			if (current_mapper == PERCEPTION_MAPPER)
+				return FEATURE_TONEMAP_PERCEPTION;
+			return (current_mapper == UNCHARTED_MAPPER) ? FEATURE_TONEMAP_UNCHARTED : FEATURE_TONEMAP_LINEAR;
+		}
+		void set_uniforms(Shader* shader) const;
 
 		void imgui_config();
 	};
@@ -0,0 +1,43 @@
+#include "uniform_buffer.h"
+#include "shader.h"
+#include <cassert>
+
+UniformBuffer::UniformBuffer()
+{
+	ubo_id = 0;
+	binding = 0;
+	size = 0;
+}
+
+UniformBuffer::~UniformBuffer()
+{
+	if (ubo_id)
+		glDeleteBuffers(1, &ubo_id);
+}
+
+void UniformBuffer::create(const char* block_name, unsigned int binding, unsigned int size)
+{
+	assert(size % 16 == 0 && "std140 blocks are padded to 16 bytes");
+	this->binding = binding;
+	this->size = size;
+
+	if (ubo_id == 0)
+		glGenBuffers(1, &ubo_id);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo_id);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	//the binding point always has this buffer, the shaders only read from it
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo_id);
+	Shader::SetUniformBlockBinding(block_name, binding);
+}
+
+void UniformBuffer::upload(const void* data)
+{
+	assert(ubo_id && "Must create the buffer before uploading data.");
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo_id);
+	//orphan the old storage, so the draws of the last frame that read it do not stall the upload
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
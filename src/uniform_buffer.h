@@ -0,0 +1,30 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include "includes.h"
+
+//UniformBufferObject
+//a std140 uniform block shared by all the shaders, uploaded once per frame instead of per draw call
+
+//binding points of the blocks
+enum eUniformBlockBinding {
+	SHADOW_BLOCK_BINDING = 0,
+	GI_BLOCK_BINDING = 1,
+	AO_KERNEL_BLOCK_BINDING = 2
+};
+
+class UniformBuffer {
+public:
+	GLuint ubo_id;
+	unsigned int binding;
+	unsigned int size;
+
+	UniformBuffer();
+	~UniformBuffer();
+
+	//block_name must match the block in the shaders, size the std140 size of the block
+	void create(const char* block_name, unsigned int binding, unsigned int size);
+	void upload(const void* data);
+};
+
+#endif
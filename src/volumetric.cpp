@@ -4,32 +4,17 @@
 #include "camera.h"
 #include "fbo.h"
 
-
-void GTR::sVolumetric_Component::init(const vec2 &screen_size) {
-	vol_fbo = new FBO();
-	comp_FBO = new FBO();
-
-	vol_fbo->create(screen_size.x / 3.0f, screen_size.y / 3.0f, 1, GL_RGBA, GL_FLOAT, false);
-	comp_FBO->create(screen_size.x, screen_size.y, 1, GL_RGBA, GL_FLOAT, false);
+// Radical inverse, for the jitter of the froxel positions
+inline float halton(uint32_t index, const uint32_t base) {
+	float result = 0.0f, fraction = 1.0f / base;
+	for (; index > 0; index /= base, fraction /= base) {
+		result += fraction * (index % base);
+	}
+	return result;
 }
 
-Texture* GTR::sVolumetric_Component::render(const Camera* cam,
-										const vec2& screen_size,
-										const CULLING::sSceneCulling* scene_data,
-										ShadowRenderer* shadow_manager,
-										Texture* color_tex,
-										Texture* depth_Tex) {
-	if (!enable_volumetric)
-		return color_tex;
-
-	// TODO: detect screen size change
-	
-	Shader* shader = Shader::Get("volumetric");
-	Mesh* quad = Mesh::getQuad();
-
-	mat4 in_view_proj = cam->viewprojection_matrix;
-
-	// Get light data
+// The lights of the culled scene, shared by both modes
+inline void upload_volumetric_lights(Shader* shader, const GTR::CULLING::sSceneCulling* scene_data) {
 	vec3  light_positions[MAX_LIGHT_NUM];
 	vec3  light_color[MAX_LIGHT_NUM];
 	float light_max_distance[MAX_LIGHT_NUM];
@@ -43,7 +28,7 @@ Texture* GTR::sVolumetric_Component::render(const Camera* cam,
 	uint16_t light_count = 0;
 
 	for (; light_count < scene_data->_scene_directional_lights.size(); light_count++) {
-		LightEntity* light_ent = scene_data->_scene_directional_lights[light_count];
+		GTR::LightEntity* light_ent = scene_data->_scene_directional_lights[light_count];
 
 		light_id[light_count] = light_ent->light_type;
 		light_positions[light_count] = light_ent->get_translation();
@@ -54,7 +39,7 @@ Texture* GTR::sVolumetric_Component::render(const Camera* cam,
 		light_direction[light_count] = light_ent->get_model().frontVector() * -1.0f;
 	}
 	for (int i = 0; i < scene_data->_scene_non_directonal_lights.size(); light_count++, i++) {
-		LightEntity* light_ent = scene_data->_scene_non_directonal_lights[i];
+		GTR::LightEntity* light_ent = scene_data->_scene_non_directonal_lights[i];
 
 		light_id[light_count] = light_ent->light_type;
 		light_positions[light_count] = light_ent->get_translation();
@@ -67,12 +52,6 @@ Texture* GTR::sVolumetric_Component::render(const Camera* cam,
 		light_cone_decay[light_count] = light_ent->cone_exp_decay;
 	}
 
-	vol_fbo->bind();
-	vol_fbo->enableSingleBuffer(0);
-	glClearColor(0.1, 0.1, 0.1, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	shader->enable();
 	shader->setUniform3Array("u_light_pos", (float*)light_positions, light_count);
 	shader->setUniform3Array("u_light_color", (float*)light_color, light_count);
 	shader->setUniform1Array("u_light_shadow_id", (int*)light_shadow_id, light_count);
@@ -83,6 +62,42 @@ Texture* GTR::sVolumetric_Component::render(const Camera* cam,
 	shader->setUniform1Array("u_light_cone_decay", (float*) light_cone_decay, light_count);
 	shader->setUniform1Array("u_light_type", (int*)light_id, light_count);
 	shader->setUniform("u_num_lights", light_count);
+}
+
+Texture* GTR::sVolumetric_Component::render(const Camera* cam,
+										const vec2& screen_size,
+										const CULLING::sSceneCulling* scene_data,
+										ShadowRenderer* shadow_manager,
+										Texture* color_tex,
+										Texture* depth_Tex) {
+	if (!enable_volumetric) {
+		history_valid = false;
+		return color_tex;
+	}
+
+	if (mode == VOLUMETRIC_FROXELS) {
+		return froxels(cam, scene_data, shadow_manager, color_tex, depth_Tex);
+	}
+	history_valid = false;
+	return ray_march(cam, scene_data, shadow_manager, color_tex, depth_Tex);
+}
+
+Texture* GTR::sVolumetric_Component::ray_march(const Camera* cam,
+										const CULLING::sSceneCulling* scene_data,
+										ShadowRenderer* shadow_manager,
+										Texture* color_tex,
+										Texture* depth_Tex) {
+	static const Handle<Shader> sh_volumetric("volumetric");
+	Shader* shader = sh_volumetric.get();
+	Mesh* quad = Mesh::getQuad();
+
+	vol_fbo->bind();
+	vol_fbo->enableSingleBuffer(0);
+	glClearColor(0.1, 0.1, 0.1, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	shader->enable();
+	upload_volumetric_lights(shader, scene_data);
 
 	shadow_manager->bind_shadows(shader);
 
@@ -104,7 +119,8 @@ Texture* GTR::sVolumetric_Component::render(const Camera* cam,
 	glClearColor(0.1, 0.1, 0.1, 1.0);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	shader = Shader::Get("comp_volumetric");
+	static const Handle<Shader> sh_comp_volumetric("comp_volumetric");
+	shader = sh_comp_volumetric.get();
 
 	shader->enable();
 	shader->setUniform("u_volumetric", vol_fbo->color_textures[0], 1);
@@ -118,16 +134,174 @@ Texture* GTR::sVolumetric_Component::render(const Camera* cam,
 	return comp_FBO->color_textures[0];
 }
 
+Texture* GTR::sVolumetric_Component::froxels(const Camera* cam,
+										const CULLING::sSceneCulling* scene_data,
+										ShadowRenderer* shadow_manager,
+										Texture* color_tex,
+										Texture* depth_Tex) {
+	create_volumes();
+
+	Mesh* quad = Mesh::getQuad();
+	const vec3 grid_size = vec3(FROXEL_GRID_X, FROXEL_GRID_Y, FROXEL_GRID_Z);
+	const vec2 volume_near_far = vec2(cam->near_plane, max_ray_len);
+
+	Matrix44 inv_viewprojection = cam->viewprojection_matrix;
+	inv_viewprojection.inverse();
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+
+	// Injection: the scattering of every light, at a jittered position inside each froxel
+	Texture* history = scattering_volumes[history_index];
+	history_index = (history_index + 1) % 2;
+	Texture* scattering = scattering_volumes[history_index];
+
+	const uint32_t jitter_index = (frame % 16) + 1;
+	static const Handle<Shader> sh_froxel_inject("froxel_inject");
+	Shader* shader = sh_froxel_inject.get();
+	shader->enable();
+	upload_volumetric_lights(shader, scene_data);
+	shadow_manager->bind_shadows(shader);
+	shader->setUniform("u_grid_size", grid_size);
+	shader->setUniform("u_volume_near_far", volume_near_far);
+	shader->setUniform("u_jitter", vec3(halton(jitter_index, 2), halton(jitter_index, 3), halton(jitter_index, 5)));
+	shader->setUniform("u_inv_viewprojection", inv_viewprojection);
+	shader->setUniform("u_camera_position", cam->eye);
+	shader->setUniform("u_density", air_density * 0.0001f);
+	shader->setUniform("u_scattering_intensity", scattering_intensity);
+	shader->setUniform("u_history_tex", history, 0);
+	shader->setUniform("u_prev_viewprojection", prev_viewprojection);
+	shader->setUniform("u_prev_camera_position", prev_eye);
+	// Without history, the current frame is taken as is
+	shader->setUniform("u_blend", history_valid ? temporal_blend : 1.0f);
+	render_to_volume(scattering, shader);
+	shader->disable();
+
+	// Integration, front to back
+	static const Handle<Shader> sh_froxel_integrate("froxel_integrate");
+	shader = sh_froxel_integrate.get();
+	shader->enable();
+	shader->setUniform("u_scattering_tex", scattering, 0);
+	shader->setUniform("u_grid_size", grid_size);
+	shader->setUniform("u_volume_near_far", volume_near_far);
+	integrate_volume(shader);
+	shader->disable();
+
+	// Composite, one lookup per pixel
+	comp_FBO->bind();
+	comp_FBO->enableSingleBuffer(0);
+
+	static const Handle<Shader> sh_froxel_apply("froxel_apply");
+	shader = sh_froxel_apply.get();
+	shader->enable();
+	shader->setUniform("u_color", color_tex, 0);
+	shader->setUniform("u_depth_tex", depth_Tex, 1);
+	shader->setUniform("u_integrated_tex", integrated_volume, 2);
+	shader->setUniform("u_grid_size", grid_size);
+	shader->setUniform("u_volume_near_far", volume_near_far);
+	shader->setUniform("u_inv_viewprojection", inv_viewprojection);
+	shader->setUniform("u_camera_position", cam->eye);
+	quad->render(GL_TRIANGLES);
+	shader->disable();
+
+	comp_FBO->unbind();
+	glEnable(GL_DEPTH_TEST);
+
+	prev_viewprojection = cam->viewprojection_matrix;
+	prev_eye = cam->eye;
+	history_valid = true;
+	frame++;
+
+	return comp_FBO->color_textures[0];
+}
+
+void GTR::sVolumetric_Component::create_volumes() {
+	if (integrated_volume) {
+		return;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		scattering_volumes[i] = new Texture();
+		scattering_volumes[i]->create3D(FROXEL_GRID_X, FROXEL_GRID_Y, FROXEL_GRID_Z, GL_RGBA, GL_HALF_FLOAT, false, NULL, GL_RGBA16F);
+	}
+	integrated_volume = new Texture();
+	integrated_volume->create3D(FROXEL_GRID_X, FROXEL_GRID_Y, FROXEL_GRID_Z, GL_RGBA, GL_HALF_FLOAT, false, NULL, GL_RGBA16F);
+	for (int i = 0; i < 2; i++) {
+		integration_carry[i] = new Texture();
+		integration_carry[i]->create(FROXEL_GRID_X, FROXEL_GRID_Y, GL_RGBA, GL_FLOAT, false, NULL, GL_RGBA32F);
+	}
+
+	glGenFramebuffers(1, &volume_fbo);
+	history_valid = false;
+}
+
+// Draws a quad on each slice, the shader gets the slice index
+void GTR::sVolumetric_Component::render_to_volume(Texture* volume, Shader* shader) {
+	Mesh* quad = Mesh::getQuad();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, volume_fbo);
+	glPushAttrib(GL_VIEWPORT_BIT);
+	glViewport(0, 0, FROXEL_GRID_X, FROXEL_GRID_Y);
+	const GLenum draw_buffer = GL_COLOR_ATTACHMENT0;
+	glDrawBuffers(1, &draw_buffer);
+
+	for (int slice = 0; slice < FROXEL_GRID_Z; slice++) {
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, volume->texture_id, 0, slice);
+		shader->setUniform("u_slice", slice);
+		quad->render(GL_TRIANGLES);
+	}
+
+	glPopAttrib();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// One pass front to back: each slice adds its step to the integration of the previous one.
+// The volume can not be read while a layer of it is attached, so the running result
+// is also written to a 2D carry texture, read by the next slice
+void GTR::sVolumetric_Component::integrate_volume(Shader* shader) {
+	Mesh* quad = Mesh::getQuad();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, volume_fbo);
+	glPushAttrib(GL_VIEWPORT_BIT);
+	glViewport(0, 0, FROXEL_GRID_X, FROXEL_GRID_Y);
+	const GLenum draw_buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, draw_buffers);
+
+	for (int slice = 0; slice < FROXEL_GRID_Z; slice++) {
+		Texture* previous = integration_carry[slice % 2];
+		Texture* current = integration_carry[(slice + 1) % 2];
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, integrated_volume->texture_id, 0, slice);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, current->texture_id, 0);
+		shader->setUniform("u_previous_tex", previous, 1);
+		shader->setUniform("u_slice", slice);
+		quad->render(GL_TRIANGLES);
+	}
+
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+	glPopAttrib();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
 void GTR::sVolumetric_Component::render_imgui() {
+#ifndef SKIP_IMGUI
 	if (ImGui::TreeNode("Volumetric light")) {
+		const char* mode_labels[2] = { "Ray march", "Froxels" };
 
 		ImGui::Checkbox("Enable Volumetric light", &enable_volumetric);
+		ImGui::Combo("Volumetric mode", &mode, mode_labels, IM_ARRAYSIZE(mode_labels));
 		ImGui::SliderFloat("Max ray len", &max_ray_len, 100.0f, 2000.0f);
 		ImGui::SliderFloat("Air density", &air_density, 0.1f, 1.0f);
-		ImGui::SliderInt("Sample count", &sample_size, 50, 1000);
 
-		ImGui::SliderInt("Compositing Blur", &comp_blur_size, 1, 20);
+		if (mode == VOLUMETRIC_RAY_MARCH) {
+			ImGui::SliderInt("Sample count", &sample_size, 50, 1000);
+			ImGui::SliderInt("Compositing Blur", &comp_blur_size, 1, 20);
+		} else {
+			ImGui::SliderFloat("Scattering intensity", &scattering_intensity, 0.0f, 50.0f);
+			ImGui::SliderFloat("Froxel history blend", &temporal_blend, 0.01f, 1.0f);
+			ImGui::Text("Grid: %d x %d x %d", FROXEL_GRID_X, FROXEL_GRID_Y, FROXEL_GRID_Z);
+		}
 
 		ImGui::TreePop();
 	}
+#endif
 }
\ No newline at end of file
@@ -4,21 +4,55 @@
 #include "shadows.h"
 #include "frusturm_culling.h"
 
+// ================
+//  VOLUMETRIC LIGHT
+// ================
+// Two modes: a ray march per pixel, or a froxel volume (frustum aligned voxels).
+// In the froxel mode the lights are injected once per froxel, with a jittered
+// position that is blended with the reprojected history, and then integrated
+// front to back, so the composite is a single 3D texture lookup per pixel.
+
+// The froxel grid, the slices are exponentially distributed up to max_ray_len
+#define FROXEL_GRID_X 160
+#define FROXEL_GRID_Y 90
+#define FROXEL_GRID_Z 64
+
 namespace GTR {
 
+	enum eVolumetricMode : int {
+		VOLUMETRIC_RAY_MARCH = 0,
+		VOLUMETRIC_FROXELS
+	};
+
 	struct sVolumetric_Component {
-		FBO* vol_fbo = NULL;
+		// Transient, set by the frame graph (1/3 and full resolution)
+		FBO* vol_fbo = NULL; // Only used by the ray march
 		FBO* comp_FBO = NULL;
 
+		int mode = VOLUMETRIC_FROXELS;
+
 		int sample_size = 100;
 		float max_ray_len = 800.0f;
 		float air_density = 0.1f;
 
 		int comp_blur_size = 4;
 
-		bool enable_volumetric = false;
+		// Froxels
+		float scattering_intensity = 10.0f;
+		float temporal_blend = 0.05f; // Weight of the current frame
+		// Scattering and extinction, the history is the other one
+		Texture* scattering_volumes[2] = { NULL, NULL };
+		int history_index = 0;
+		bool history_valid = false;
+		// Accumulated scattering and transmittance from the camera
+		Texture* integrated_volume = NULL;
+		Texture* integration_carry[2] = { NULL, NULL }; // Integrated up to the previous slice, ping-pong
+		GLuint volume_fbo = 0;
+		Matrix44 prev_viewprojection;
+		vec3 prev_eye;
+		uint32_t frame = 0;
 
-		void init(const vec2 &screen_size);
+		bool enable_volumetric = false;
 
 		void render_imgui();
 
@@ -29,5 +63,12 @@ namespace GTR {
 					Texture* color_tex,
 					Texture *depth_Tex);
 
+	private:
+		Texture* ray_march(const Camera* cam, const CULLING::sSceneCulling* scene_data, ShadowRenderer* shadow_manager, Texture* color_tex, Texture* depth_Tex);
+		Texture* froxels(const Camera* cam, const CULLING::sSceneCulling* scene_data, ShadowRenderer* shadow_manager, Texture* color_tex, Texture* depth_Tex);
+
+		void create_volumes();
+		void render_to_volume(Texture* volume, Shader* shader);
+		void integrate_volume(Shader* shader);
 	};
 };
\ No newline at end of file
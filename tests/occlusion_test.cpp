@@ -0,0 +1,170 @@
+// Tests of the software occlusion culling, without a window or a GL context.
+// Build and run them with: make test
+
+#include "../src/occlusion_culling.h"
+
+#include <cstdio>
+
+using namespace OCCLUSION;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	if (!(condition)) { printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #condition); failures++; }
+
+#define BUFFER_SIZE 64
+
+// Camera at the origin looking to -Z, 90 degrees so the half width of the view is the distance
+static Matrix44 get_viewprojection() {
+	Vector3 eye(0.0f, 0.0f, 0.0f), center(0.0f, 0.0f, -1.0f), up(0.0f, 1.0f, 0.0f);
+	Matrix44 view, projection;
+	view.lookAt(eye, center, up);
+	projection.perspective(90.0f, 1.0f, 0.1f, 100.0f);
+	return view * projection;
+}
+
+static Vector4 to_clip(const Matrix44& viewprojection, const float x, const float y, const float z) {
+	return viewprojection * Vector4(x, y, z, 1.0f);
+}
+
+// A square facing the camera, [-size, size] in x and y
+static void add_quad(const Matrix44& viewprojection, const float size, const float z, std::vector<sScreenVertex>& triangles) {
+	const Vector4 a = to_clip(viewprojection, -size, -size, z);
+	const Vector4 b = to_clip(viewprojection, size, -size, z);
+	const Vector4 c = to_clip(viewprojection, size, size, z);
+	const Vector4 d = to_clip(viewprojection, -size, size, z);
+	clip_triangle(a, b, c, BUFFER_SIZE, BUFFER_SIZE, triangles);
+	clip_triangle(a, d, c, BUFFER_SIZE, BUFFER_SIZE, triangles); // Clockwise on purpose
+}
+
+static void rasterize(DepthBuffer& buffer, const std::vector<sScreenVertex>& triangles) {
+	buffer.resize(BUFFER_SIZE, BUFFER_SIZE);
+	buffer.clear(0, BUFFER_SIZE);
+	buffer.rasterize(triangles.data(), triangles.size() / 3, 0, BUFFER_SIZE);
+	buffer.buildHiZ(0, BUFFER_SIZE / OCCLUSION_TILE_SIZE);
+}
+
+static bool is_box_occluded(const DepthBuffer& buffer, const Matrix44& viewprojection, const BoundingBox& box) {
+	float rect[4], nearest;
+	if (!project_box(box, viewprojection, BUFFER_SIZE, BUFFER_SIZE, rect, &nearest))
+		return false;
+	return buffer.isOccluded(rect[0], rect[1], rect[2], rect[3], nearest);
+}
+
+static bool is_counter_clockwise(const sScreenVertex* v) {
+	return (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y) > 0.0f;
+}
+
+static void test_clip_triangle() {
+	const Matrix44 viewprojection = get_viewprojection();
+	std::vector<sScreenVertex> triangles;
+
+	// In front of the near plane
+	clip_triangle(to_clip(viewprojection, -1, -1, -5), to_clip(viewprojection, 1, -1, -5), to_clip(viewprojection, 0, 1, -5), BUFFER_SIZE, BUFFER_SIZE, triangles);
+	CHECK(triangles.size() == 3);
+	CHECK(is_counter_clockwise(&triangles[0]));
+	CHECK(triangles[0].z > 0.19f && triangles[0].z < 0.21f); // 1/w, w is the distance
+
+	// Clockwise, it is flipped
+	triangles.clear();
+	clip_triangle(to_clip(viewprojection, -1, -1, -5), to_clip(viewprojection, 0, 1, -5), to_clip(viewprojection, 1, -1, -5), BUFFER_SIZE, BUFFER_SIZE, triangles);
+	CHECK(triangles.size() == 3);
+	CHECK(is_counter_clockwise(&triangles[0]));
+
+	// Behind the camera
+	triangles.clear();
+	clip_triangle(to_clip(viewprojection, -1, -1, 5), to_clip(viewprojection, 1, -1, 5), to_clip(viewprojection, 0, 1, 5), BUFFER_SIZE, BUFFER_SIZE, triangles);
+	CHECK(triangles.empty());
+
+	// One vertex behind the near plane, the rest is a quad
+	triangles.clear();
+	clip_triangle(to_clip(viewprojection, -1, -1, -5), to_clip(viewprojection, 1, -1, -5), to_clip(viewprojection, 0, -1, 5), BUFFER_SIZE, BUFFER_SIZE, triangles);
+	CHECK(triangles.size() == 6);
+
+	// Two vertices behind the near plane, the rest is a triangle
+	triangles.clear();
+	clip_triangle(to_clip(viewprojection, -1, -1, -5), to_clip(viewprojection, 1, -1, 5), to_clip(viewprojection, 0, -1, 5), BUFFER_SIZE, BUFFER_SIZE, triangles);
+	CHECK(triangles.size() == 3);
+
+	// The clipped vertices are on the near plane, never at an infinite or negative 1/w
+	for (const sScreenVertex& v : triangles)
+		CHECK(v.z > 0.0f && v.z <= 1.0f / 0.1f + 0.01f);
+	for (size_t i = 0; i < triangles.size(); i += 3)
+		CHECK(is_counter_clockwise(&triangles[i]));
+}
+
+static void test_culling() {
+	const Matrix44 viewprojection = get_viewprojection();
+	DepthBuffer buffer;
+	std::vector<sScreenVertex> triangles;
+
+	// At 10 units, the quad covers the middle half of the screen
+	add_quad(viewprojection, 5.0f, -10.0f, triangles);
+	CHECK(triangles.size() == 6);
+	rasterize(buffer, triangles);
+
+	// Behind the occluder
+	CHECK(is_box_occluded(buffer, viewprojection, BoundingBox(Vector3(0, 0, -20), Vector3(1, 1, 1))));
+	// In front of it
+	CHECK(!is_box_occluded(buffer, viewprojection, BoundingBox(Vector3(0, 0, -5), Vector3(1, 1, 1))));
+	// Crossing it
+	CHECK(!is_box_occluded(buffer, viewprojection, BoundingBox(Vector3(0, 0, -10), Vector3(1, 1, 1))));
+	// Behind, but bigger than it on the screen
+	CHECK(!is_box_occluded(buffer, viewprojection, BoundingBox(Vector3(0, 0, -20), Vector3(15, 1, 1))));
+	// Behind, partly out of the screen and partly where there is no occluder
+	float rect[4], nearest;
+	const BoundingBox off_screen(Vector3(20, 0, -20), Vector3(2, 1, 1));
+	CHECK(project_box(off_screen, viewprojection, BUFFER_SIZE, BUFFER_SIZE, rect, &nearest) && rect[2] > BUFFER_SIZE);
+	CHECK(!is_box_occluded(buffer, viewprojection, off_screen));
+	// Crossing the near plane
+	CHECK(!project_box(BoundingBox(Vector3(0, 0, 0), Vector3(1, 1, 1)), viewprojection, BUFFER_SIZE, BUFFER_SIZE, rect, &nearest));
+	CHECK(!is_box_occluded(buffer, viewprojection, BoundingBox(Vector3(0, 0, 0), Vector3(1, 1, 1))));
+
+	// An occluder bigger than the screen hides what is behind it, also partly off the screen
+	triangles.clear();
+	add_quad(viewprojection, 50.0f, -10.0f, triangles);
+	rasterize(buffer, triangles);
+	CHECK(is_box_occluded(buffer, viewprojection, off_screen));
+
+	// An occluder that crosses the near plane, a floor from under the camera to the back
+	triangles.clear();
+	const Vector4 a = to_clip(viewprojection, -50, -1, 1), b = to_clip(viewprojection, 50, -1, 1);
+	const Vector4 c = to_clip(viewprojection, 50, -1, -90), d = to_clip(viewprojection, -50, -1, -90);
+	clip_triangle(a, b, c, BUFFER_SIZE, BUFFER_SIZE, triangles);
+	clip_triangle(a, c, d, BUFFER_SIZE, BUFFER_SIZE, triangles);
+	rasterize(buffer, triangles);
+	CHECK(is_box_occluded(buffer, viewprojection, BoundingBox(Vector3(0, -3, -20), Vector3(1, 1, 1)))); // Under the floor
+	CHECK(!is_box_occluded(buffer, viewprojection, BoundingBox(Vector3(0, 1, -20), Vector3(1, 1, 1)))); // Over it
+}
+
+// The rows rasterized in bands, as the worker threads do, give the same buffer
+static void test_bands() {
+	const Matrix44 viewprojection = get_viewprojection();
+	std::vector<sScreenVertex> triangles;
+	add_quad(viewprojection, 5.0f, -10.0f, triangles);
+
+	DepthBuffer full, banded;
+	rasterize(full, triangles);
+	banded.resize(BUFFER_SIZE, BUFFER_SIZE);
+	const int band = BUFFER_SIZE / 2;
+	for (int min_y = 0; min_y < BUFFER_SIZE; min_y += band) {
+		banded.clear(min_y, min_y + band);
+		banded.rasterize(triangles.data(), triangles.size() / 3, min_y, min_y + band);
+		banded.buildHiZ(min_y / OCCLUSION_TILE_SIZE, (min_y + band) / OCCLUSION_TILE_SIZE);
+	}
+	CHECK(full.depth == banded.depth);
+	CHECK(full.hiz == banded.hiz);
+}
+
+int main() {
+	test_clip_triangle();
+	test_culling();
+	test_bands();
+
+	if (failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All the occlusion tests passed\n");
+	return 0;
+}
@@ -0,0 +1,93 @@
+// Tests of the bounding box of the skinned meshes, that the frustum and the occlusion culling use.
+// Build and run them with: make test
+
+#include "../src/occlusion_culling.h"
+
+#include <cstdio>
+
+using namespace OCCLUSION;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	if (!(condition)) { printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #condition); failures++; }
+
+#define BUFFER_SIZE 64
+
+static bool contains(const BoundingBox& box, const Vector3& point) {
+	const Vector3 d = point - box.center;
+	return fabsf(d.x) <= box.halfsize.x + 0.001f && fabsf(d.y) <= box.halfsize.y + 0.001f && fabsf(d.z) <= box.halfsize.z + 0.001f;
+}
+
+static bool is_same(const BoundingBox& a, const BoundingBox& b) {
+	return a.center.distance(b.center) < 0.001f && a.halfsize.distance(b.halfsize) < 0.001f;
+}
+
+// A character of 2 units in its bind pose, the second bone raises the arm 3 units over the head
+static const BoundingBox bind_box(Vector3(0, 1, 0), Vector3(0.5f, 1, 0.5f));
+
+static void get_pose(Matrix44* palette) {
+	palette[0].setIdentity();
+	palette[1].setTranslation(0, 3, 0);
+}
+
+static void test_pose_bounding() {
+	Matrix44 model;
+	model.setTranslation(10, 0, -5);
+	const BoundingBox bind_world = transformBoundingBox(model, bind_box);
+
+	// The rest pose keeps the box
+	Matrix44 rest[2];
+	CHECK(is_same(transformBoundingBox(rest, 2, model, bind_box), bind_world));
+
+	// The raised arm goes out of the bind pose box, the box of the pose has it
+	Matrix44 pose[2];
+	get_pose(pose);
+	const BoundingBox pose_world = transformBoundingBox(pose, 2, model, bind_box);
+	const Vector3 hand(10.5f, 5.0f, -5.0f);
+	CHECK(!contains(bind_world, hand));
+	CHECK(contains(pose_world, hand));
+	CHECK(contains(pose_world, bind_world.center - bind_world.halfsize));
+	CHECK(contains(pose_world, bind_world.center + bind_world.halfsize));
+}
+
+// An occluder that hides the body but not the raised arm
+static void test_pose_occlusion() {
+	Vector3 eye(0, 1, 10), center(0, 1, 0), up(0, 1, 0);
+	Matrix44 view, projection;
+	view.lookAt(eye, center, up);
+	projection.perspective(90.0f, 1.0f, 0.1f, 100.0f);
+	const Matrix44 viewprojection = view * projection;
+
+	// A wall from the floor to 3 units, in front of the character
+	std::vector<sScreenVertex> triangles;
+	const Vector4 a = viewprojection * Vector4(-4, -1, 5, 1), b = viewprojection * Vector4(4, -1, 5, 1);
+	const Vector4 c = viewprojection * Vector4(4, 3, 5, 1), d = viewprojection * Vector4(-4, 3, 5, 1);
+	clip_triangle(a, b, c, BUFFER_SIZE, BUFFER_SIZE, triangles);
+	clip_triangle(a, c, d, BUFFER_SIZE, BUFFER_SIZE, triangles);
+	DepthBuffer buffer;
+	buffer.resize(BUFFER_SIZE, BUFFER_SIZE);
+	buffer.clear(0, BUFFER_SIZE);
+	buffer.rasterize(triangles.data(), triangles.size() / 3, 0, BUFFER_SIZE);
+	buffer.buildHiZ(0, BUFFER_SIZE / OCCLUSION_TILE_SIZE);
+
+	Matrix44 model, pose[2];
+	get_pose(pose);
+	float rect[4], nearest;
+	const BoundingBox bind_world = transformBoundingBox(model, bind_box);
+	CHECK(project_box(bind_world, viewprojection, BUFFER_SIZE, BUFFER_SIZE, rect, &nearest) && buffer.isOccluded(rect[0], rect[1], rect[2], rect[3], nearest));
+	const BoundingBox pose_world = transformBoundingBox(pose, 2, model, bind_box);
+	CHECK(project_box(pose_world, viewprojection, BUFFER_SIZE, BUFFER_SIZE, rect, &nearest) && !buffer.isOccluded(rect[0], rect[1], rect[2], rect[3], nearest));
+}
+
+int main() {
+	test_pose_bounding();
+	test_pose_occlusion();
+
+	if (failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All the skinning tests passed\n");
+	return 0;
+}